@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define MAX_HOGS	16
+
+/*
+ *	Measure how long it takes, with CPU-bound processes running, from the key
+ *	press that completes a line to this process reading it.
+ *
+ *	Usage: echolat [hogs] [lines]
+ */
+int main(int argc, char *argv[]) {
+	char buf[128];
+	pid_t hogs[MAX_HOGS];
+	int nhogs = 2, lines = 5, i, ret, count = 0;
+	unsigned int max = 0, total = 0;
+	struct tty_latency lat;
+
+	if (argc > 1) {
+		nhogs = atoi(argv[1]);
+		if (nhogs > MAX_HOGS) {
+			nhogs = MAX_HOGS;
+		}
+	}
+	if (argc > 2) {
+		lines = atoi(argv[2]);
+	}
+	for (i = 0; i < nhogs; i++) {
+		hogs[i] = fork();
+		if (hogs[i] == 0) {
+			while (1);
+		}
+	}
+	printf("%d CPU hogs running, time slice %d ms\n", nhogs, sched_slice(0));
+
+	ioctl(0, TTY_IOCTL_LATENCY, (int)&lat);
+	for (i = 0; i < lines; i++) {
+		printf("type a line: ");
+		fflush(stdout);
+		ret = read(0, buf, sizeof(buf));
+		if (ret <= 0) {
+			break;
+		}
+		if (ioctl(0, TTY_IOCTL_LATENCY, (int)&lat) == 0 && lat.count) {
+			printf("latency %u cycles\n", lat.last);
+			if (lat.last > max) {
+				max = lat.last;
+			}
+			total += lat.last / 1000;
+			count++;
+		}
+	}
+	if (count) {
+		printf("%d lines: average %u, max %u cycles\n", count,
+			   total / count * 1000, max);
+	}
+
+	for (i = 0; i < nhogs; i++) {
+		kill(hogs[i], SIGKILL);
+		waitpid(hogs[i], &ret, 0);
+	}
+	return 0;
+}
@@ -6,6 +6,19 @@
 #ifndef SYS_IOCTL_C
 #define SYS_IOCTL_C
 
+#define TTY_IOCTL_LATENCY	0x5401	///< tty: get, then reset, `struct tty_latency`
+
+/**
+ *	Time from the key press that completes a line to the moment the process
+ *	waiting for it gets to read it, in TSC cycles
+ */
+struct tty_latency {
+	unsigned int last;			///< Latency of the last line read
+	unsigned int max;			///< Highest latency
+	unsigned int count;			///< Lines read after a wakeup
+	unsigned long long total;	///< Sum of the latencies
+};
+
 /**
  *	Control device
  *
@@ -0,0 +1,68 @@
+/**
+ *	@file sys/mman.h
+ *
+ *	Memory mapping of files and anonymous memory
+ */
+#ifndef SYS_MMAN_H
+#define SYS_MMAN_H
+
+#include "types.h"
+
+#define PROT_NONE	0x0	///< Pages may not be accessed
+#define PROT_READ	0x1	///< Pages may be read
+#define PROT_WRITE	0x2	///< Pages may be written
+#define PROT_EXEC	0x4	///< Pages may be executed
+
+#define MAP_SHARED		0x01	///< Changes are shared and written back to the file
+#define MAP_PRIVATE		0x02	///< Changes are private to the process
+#define MAP_FIXED		0x10	///< Place the mapping exactly at `addr`
+#define MAP_ANONYMOUS	0x20	///< Mapping is not backed by a file, pages read as zero
+#define MAP_ANON		MAP_ANONYMOUS
+
+#define MAP_FAILED	((void *) -1)	///< Return value of `mmap` on failure
+
+#define MS_ASYNC		1	///< Schedule the write back (performed synchronously)
+#define MS_INVALIDATE	2	///< Invalidate other mappings of the file
+#define MS_SYNC			4	///< Write back modified pages before returning
+
+/**
+ *	Map files or anonymous memory into the address space
+ *
+ *	Pages are populated lazily on first access. File pages are read from the
+ *	file at that point; modified pages of shared mappings are written back on
+ *	`msync`, `munmap` and process exit.
+ *
+ *	@param addr: hint for the address of the mapping, or the exact address
+ *				 with `MAP_FIXED`
+ *	@param length: size of the mapping in bytes
+ *	@param prot: allowed accesses, see `PROT_*`
+ *	@param flags: exactly one of `MAP_SHARED` and `MAP_PRIVATE`, optionally
+ *				  combined with `MAP_FIXED` and `MAP_ANONYMOUS`
+ *	@param fd: the file to map, ignored for `MAP_ANONYMOUS`
+ *	@param offset: offset in the file of the start of the mapping, must be a
+ *				   multiple of 4KB
+ *	@return the address of the mapping, or `MAP_FAILED` on failure (set errno)
+ */
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+
+/**
+ *	Remove mappings in a range of addresses
+ *
+ *	@param addr: start of the range, must be 4KB aligned
+ *	@param length: size of the range in bytes
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int munmap(void *addr, size_t length);
+
+/**
+ *	Write modified pages of shared file mappings back to their files
+ *
+ *	@param addr: start of the range, must be 4KB aligned
+ *	@param length: size of the range in bytes
+ *	@param flags: one of `MS_ASYNC` and `MS_SYNC`, optionally with
+ *				  `MS_INVALIDATE`
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int msync(void *addr, size_t length, int flags);
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ *	@file sys/resource.h
+ *
+ *	Scheduling priority of processes
+ */
+#ifndef SYS_RESOURCE_H
+#define SYS_RESOURCE_H
+
+#include "types.h"
+
+#define PRIO_PROCESS	0	///< `which` of a single process, `who` is its pid
+
+/**
+ *	Get the nice value of a process
+ *
+ *	@param which: must be `PRIO_PROCESS`
+ *	@param who: the pid, 0 for the calling process
+ *	@return the nice value, from -20 to 19, or -1 on failure (set errno).
+ *			Clear errno before the call to tell a failure from a nice value
+ *			of -1.
+ */
+int getpriority(int which, id_t who);
+
+/**
+ *	Set the nice value of a process
+ *
+ *	Lower values give a higher priority. Only root may lower the value.
+ *
+ *	@param which: must be `PRIO_PROCESS`
+ *	@param who: the pid, 0 for the calling process
+ *	@param prio: the nice value, clamped to -20 to 19
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int setpriority(int which, id_t who, int prio);
+
+/**
+ *	Get or set the scheduler time slice
+ *
+ *	Tasks at the highest priority level run for one slice before being
+ *	preempted, lower levels get longer slices.
+ *
+ *	@param ms: the new slice in ms, at most 1000, or 0 to only get it. Only
+ *			   root may change it.
+ *	@return the slice in ms, or -1 on failure (set errno)
+ */
+int sched_slice(int ms);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ *	@file sys/swap.h
+ *
+ *	System call to enable swapping
+ */
+#ifndef SYS_SWAP_H
+#define SYS_SWAP_H
+
+#include "types.h"
+
+/**
+ *	Enable swapping of anonymous pages to an area of a block device
+ *
+ *	The area must not overlap any file system on the device. Swapping cannot
+ *	be turned off again.
+ *
+ *	@param path: the path to the device, e.g. /dev/hda
+ *	@param offset: start of the swap area on the device, must be a multiple
+ *				   of 4KB
+ *	@param length: size of the swap area in bytes
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int swapon(const char *path, off_t offset, size_t length);
+
+#endif
@@ -0,0 +1,28 @@
+/**
+ *	@file sys/time.h
+ *
+ *	Time of day
+ */
+#ifndef SYS_TIME_H
+#define SYS_TIME_H
+
+#include "types.h"
+
+/**
+ *	Time in seconds and microseconds
+ */
+struct timeval {
+	time_t tv_sec;			///< Seconds
+	suseconds_t tv_usec;	///< Microseconds, from 0 to 999999
+};
+
+/**
+ *	Get the wall-clock time
+ *
+ *	@param tv: receives the time since the Epoch
+ *	@param tz: ignored, time zones are not supported
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int gettimeofday(struct timeval *tv, void *tz);
+
+#endif
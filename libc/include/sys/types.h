@@ -17,8 +17,8 @@ typedef unsigned long blksize_t;
 /// Used for system times in clock ticks or CLOCKS_PER_SEC (see <time.h>).
 typedef unsigned long clock_t;
 
-// /// Used for clock ID type in the clock and timer functions.
-// TODO clockid_t;
+/// Used for clock ID type in the clock and timer functions.
+typedef int clockid_t;
 
 // /// Used for timer ID returned by timer_create().
 // TODO timer_t
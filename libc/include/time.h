@@ -0,0 +1,53 @@
+/**
+ *	@file time.h
+ *
+ *	Clocks and sleeping
+ */
+#ifndef TIME_H
+#define TIME_H
+
+#include "sys/types.h"
+
+#define CLOCK_REALTIME	0	///< Wall-clock time, since the Epoch
+#define CLOCK_MONOTONIC	1	///< Time since boot, never goes back
+
+/**
+ *	Time in seconds and nanoseconds
+ */
+struct timespec {
+	time_t tv_sec;	///< Seconds
+	long tv_nsec;	///< Nanoseconds, from 0 to 999999999
+};
+
+/**
+ *	Read a clock
+ *
+ *	The monotonic clock has a resolution of a few nanoseconds when the CPU
+ *	has a time stamp counter, so it can time short sections of code.
+ *
+ *	@param clock_id: `CLOCK_REALTIME` or `CLOCK_MONOTONIC`
+ *	@param tp: receives the time
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+
+/**
+ *	Suspend the calling process
+ *
+ *	@param req: time to sleep. The kernel rounds it up to its timer
+ *				resolution, about 1ms.
+ *	@param rem: if not NULL, receives the time left when a signal interrupts
+ *				the sleep
+ *	@return 0 on success, or -1 on failure (set errno, EINTR if interrupted)
+ */
+int nanosleep(const struct timespec *req, struct timespec *rem);
+
+/**
+ *	Get the time
+ *
+ *	@param tloc: if not NULL, also receives the time
+ *	@return the seconds since the Epoch, or -1 on failure (set errno)
+ */
+time_t time(time_t *tloc);
+
+#endif
@@ -224,4 +224,29 @@ int mkdir(const char *path, mode_t mode);
  */
 int rmdir(const char *path);
 
+/**
+ *	Change the nice value of the calling process
+ *
+ *	@param inc: added to the nice value. Only root may pass a negative value.
+ *	@return the new nice value, or -1 on failure (set errno)
+ */
+int nice(int inc);
+
+/**
+ *	Suspend the calling process
+ *
+ *	@param usec: microseconds to sleep, at most 2000000000. The kernel rounds
+ *				 it up to its timer resolution, about 1ms.
+ *	@return 0 on success, or -1 on failure (set errno)
+ */
+int usleep(useconds_t usec);
+
+/**
+ *	Suspend the calling process
+ *
+ *	@param seconds: seconds to sleep
+ *	@return 0, or the seconds left if the sleep failed
+ */
+unsigned int sleep(unsigned int seconds);
+
 #endif
@@ -8,6 +8,11 @@
 #include "../include/signal.h"
 #include "../include/sys/wait.h"
 #include "../include/sys/mount.h"
+#include "../include/sys/mman.h"
+#include "../include/sys/swap.h"
+#include "../include/sys/resource.h"
+#include "../include/sys/time.h"
+#include "../include/time.h"
 
 int do_syscall(int num, int b, int c, int d);
 
@@ -215,6 +220,161 @@ void* sbrk(int increment) {
 	return (void*)do_syscall(SYSCALL_SBRK, increment, 0, 0);
 }
 
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	int ret;
+	struct sys_mmap_args args;
+	args.addr = addr;
+	args.length = length;
+	args.prot = prot;
+	args.flags = flags;
+	args.fd = fd;
+	args.offset = offset;
+	ret = do_syscall(SYSCALL_MMAP, (int)(&args), 0, 0);
+	if (ret < 0 && ret > -4096) {
+		errno = -ret;
+		return MAP_FAILED;
+	}
+	return (void *)ret;
+}
+
+int munmap(void *addr, size_t length) {
+	int ret;
+	ret = do_syscall(SYSCALL_MUNMAP, (int)addr, (int)length, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int msync(void *addr, size_t length, int flags) {
+	int ret;
+	ret = do_syscall(SYSCALL_MSYNC, (int)addr, (int)length, flags);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int swapon(const char *path, off_t offset, size_t length) {
+	int ret;
+	ret = do_syscall(SYSCALL_SWAPON, (int)path, (int)offset, (int)length);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int getpriority(int which, id_t who) {
+	int ret;
+	ret = do_syscall(SYSCALL_GETPRIORITY, which, (int)who, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	// The kernel returns 20 - nice, which is never negative
+	return 20 - ret;
+}
+
+int setpriority(int which, id_t who, int prio) {
+	int ret;
+	ret = do_syscall(SYSCALL_SETPRIORITY, which, (int)who, prio);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int nice(int inc) {
+	int prio;
+	errno = 0;
+	prio = getpriority(PRIO_PROCESS, 0);
+	if (prio == -1 && errno) {
+		return -1;
+	}
+	if (setpriority(PRIO_PROCESS, 0, prio + inc) != 0) {
+		return -1;
+	}
+	return getpriority(PRIO_PROCESS, 0);
+}
+
+int sched_slice(int ms) {
+	int ret;
+	ret = do_syscall(SYSCALL_SCHED_SLICE, ms, 0, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int usleep(useconds_t usec) {
+	int ret;
+	if (usec < 0 || usec > 2000000000) {
+		errno = EINVAL;
+		return -1;
+	}
+	ret = do_syscall(SYSCALL_USLEEP, (int)usec, 0, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+unsigned int sleep(unsigned int seconds) {
+	for (; seconds > 0; seconds--) {
+		if (usleep(1000000) != 0) {
+			break;
+		}
+	}
+	return seconds;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+	int ret;
+	ret = do_syscall(SYSCALL_NANOSLEEP, (int)req, (int)rem, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp) {
+	int ret;
+	ret = do_syscall(SYSCALL_CLOCK_GETTIME, clock_id, (int)tp, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+int gettimeofday(struct timeval *tv, void *tz) {
+	int ret;
+	ret = do_syscall(SYSCALL_GETTIMEOFDAY, (int)tv, (int)tz, 0);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+time_t time(time_t *tloc) {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+		return -1;
+	}
+	if (tloc) {
+		*tloc = ts.tv_sec;
+	}
+	return ts.tv_sec;
+}
+
 #define LIBC_MAX_OPEN_DIR	64
 
 static DIR libc_dir_list[LIBC_MAX_OPEN_DIR];
@@ -64,10 +64,33 @@
 #define SYSCALL_GETGID		53
 #define SYSCALL_SETGID		54
 
+#define SYSCALL_MMAP		55
+#define SYSCALL_MUNMAP		56
+#define SYSCALL_MSYNC		57
+#define SYSCALL_SWAPON		58
+
+#define SYSCALL_GETPRIORITY	59
+#define SYSCALL_SETPRIORITY	60
+#define SYSCALL_SCHED_SLICE	61
+
+#define SYSCALL_USLEEP		62
+#define SYSCALL_NANOSLEEP	63
+#define SYSCALL_CLOCK_GETTIME	64
+#define SYSCALL_GETTIMEOFDAY	65
+
 struct sys_mount_opts {
 	const char *source;
 	unsigned long mountflags;
 	const char *opts;
 } __attribute__((__packed__));
 
+struct sys_mmap_args {
+	void *addr;
+	unsigned long length;
+	int prot;
+	int flags;
+	int fd;
+	unsigned long offset;
+} __attribute__((__packed__));
+
 #endif
@@ -3,6 +3,8 @@
  */
 
 #include "ata.h"
+#include "../timer.h"
+#include "../proc/workqueue.h"
 
 #define STAT_ERR_BIT	0x01	///< status bit err
 #define STAT_DRQ_BIT	0x08	///< status bit drq
@@ -22,7 +24,12 @@
 #define CMD_SLAVE_ID		0xA0	///< slave identify command
 #define CMD_ID				0xEC	///< identify command
 
+#define ATA_POLL_LIMIT		0x100000			///< status reads before a busy drive is given up
+#define ATA_FLUSH_TIMEOUT	TIMER_MS(30000)		///< ticks a background cache flush may take
+
 static ata_data_t driver_info;		///< local struct to store driver data
+static work_t ata_flush_work;		///< write cache flush, data is the device
+static int ata_flushing = 0;		///< a cache flush command may be running
 
 
 /**
@@ -119,6 +126,54 @@ int ata_poll_stat(ata_data_t* dev){
 	return 0;
 }
 
+/**
+ *	Flush the write cache of the drive, on the system work queue
+ *
+ *	Sleeps a timer tick at a time while the drive is busy, rather than
+ *	polling it.
+ *
+ *	@param work: the work item, data is the device
+ */
+static void ata_flush(work_t* work){
+	ata_data_t* dev = (ata_data_t*)work->data;
+	int32_t reg_offset = dev->io_base_reg;
+	uint32_t ticks = 0;
+
+	outb(CMD_CACHE_FLUSH, reg_offset + STATUS_CMD_OFF);
+	ata_flushing = 1;
+	io_delay(dev);
+	// a new command waits for the flush and clears the flag
+	while(ata_flushing && (inb(reg_offset + STATUS_CMD_OFF) & STAT_BSY_BIT)){
+		if(++ticks > ATA_FLUSH_TIMEOUT)
+			break;
+		timer_sleep(1);
+	}
+	ata_flushing = 0;
+}
+
+/**
+ *	Wait for a background cache flush before sending a command
+ *
+ *	@param dev: driver data
+ *	@return 0 once the drive is idle, -1 if the flush failed or never ended
+ */
+static int ata_flush_wait(ata_data_t* dev){
+	int i;
+	uint8_t status;
+
+	if(!ata_flushing)
+		return 0;
+	ata_flushing = 0;
+	for(i = 0; i < ATA_POLL_LIMIT; i++){
+		status = inb(dev->io_base_reg + STATUS_CMD_OFF);
+		if(status & STAT_DF_BIT || status & STAT_ERR_BIT)
+			return -1;
+		if(!(status & STAT_BSY_BIT))
+			return 0;
+	}
+	return -1;
+}
+
 /**
  *	28 bit read
  *
@@ -220,8 +275,7 @@ int ata_write_28(uint32_t lba, uint8_t* buf, ata_data_t* dev){
 		buf += 2;
 	}
 
-	// cache flush
-	outb(CMD_CACHE_FLUSH, reg_offset + STATUS_CMD_OFF);
+	// the write cache is flushed by ata_flush once the whole request is done
 	// check status byte for error
 	uint8_t status = inb(reg_offset + STATUS_CMD_OFF);
 	if(status & STAT_DF_BIT || status & STAT_ERR_BIT)
@@ -250,6 +304,8 @@ int ata_read_st(int32_t sectorcount, uint8_t* buf, int32_t lba, ata_data_t* dev)
 	// TODO: verify partition size & sector len
 	//uint8_t sec_len = inb(reg_offset + SEC_COUNT_OFF);
 
+	if(-1 == ata_flush_wait(dev))
+		return -1;
 	uint8_t	status = inb(reg_offset + STATUS_CMD_OFF);
 	if(status | STAT_BSY_BIT || status & STAT_DRQ_BIT){
 		soft_reset(dev);
@@ -310,6 +366,8 @@ int ata_write_st(int32_t sectorcount, uint8_t* buf, int32_t lba, ata_data_t* dev
 	// TODO: verify partition size & sector len
 	//uint8_t sec_len = inb(reg_offset + SEC_COUNT_OFF);
 
+	if(-1 == ata_flush_wait(dev))
+		return -1;
 	uint8_t	status = inb(reg_offset + STATUS_CMD_OFF);
 	if(status | STAT_BSY_BIT || status & STAT_DRQ_BIT){
 		soft_reset(dev);
@@ -335,12 +393,21 @@ int ata_write_st(int32_t sectorcount, uint8_t* buf, int32_t lba, ata_data_t* dev
 	}*/
 	// calls single sector write
 	for( ; i < sectorcount; i++){
-		if(0 != ata_write_28((int32_t)(abs_lba + i), (uint8_t*)buf, dev))
-			return -1;
+		if(0 != ata_write_28((int32_t)(abs_lba + i), (uint8_t*)buf, dev)){
+			write_count = -1;
+			break;
+		}
 		buf += 512;
 		write_count += 512;
 	}
 
+	// flush the sectors written in the background, once per request
+	if(write_count > 0){
+		ata_flush_work.func = &ata_flush;
+		ata_flush_work.data = (uint32_t)dev;
+		schedule_work(&ata_flush_work);
+	}
+
 	return write_count;
 }
 
@@ -4,6 +4,7 @@
 #include "../proc/task.h"
 #include "../proc/signal.h"
 #include "../proc/scheduler.h"
+#include "../proc/fpu.h"
 
 void idt_int_bp_handler() {
 	printf("Breakpoint\n");
@@ -13,10 +14,24 @@ void idt_int_of_handler() {
 	printf("Overflow\n");
 }
 
+void idt_int_nm_handler() {
+	switch (fpu_restore()) {
+		case 0:
+			// The faulting instruction runs again with the task's state
+			return;
+		case -ENOMEM:
+			syscall_kill(task_current_pid(), SIGKILL, 0);
+			break;
+		default:
+			syscall_kill(task_current_pid(), SIGFPE, 0);
+	}
+	scheduler_event();
+}
+
 void idt_int_pf_handler(int eip, int err, int addr) {
 	// Check copy-on-write
 	int ret;
-	ret = task_pf_copy_on_write(addr);
+	ret = task_pf_copy_on_write(addr, err & 2);
 	switch(ret) {
 		case 0:
 			// Success!
@@ -214,6 +214,13 @@ void idt_int_bp_handler();
  */
 void idt_int_of_handler();
 
+/**
+ *	Device Not Available handler
+ *
+ *	Gives the FPU to the current task, which is killed if that fails
+ */
+void idt_int_nm_handler();
+
 /**
  *	Page fault handler
  *
@@ -1,32 +1,60 @@
 #include "page_table.h"
 #include "../proc/signal.h"
+#include "../k_mem/kmalloc.h"
 
-#define ALLOCATABLE_4MB_START_INDEX	7	///< new pages will allocate from here
+#define USER_PAGE_DIR_START_INDEX	32	///< page directory entries below are kernel only
 
 #define PAGE_4MB 	0x400000
 
 #define PAGE_4KB 	0x1000
 
-#define MANYOUSHU_PAGE_START_ADDR	0xC00000
+#define PAGE_KERNEL_RESERVED	0x800000	///< 0-8MB: kernel image and boot stack
 
 #define GET_DIR_INDEX(x) (x / PAGE_4MB)
 
 #define GET_TAB_INDEX(x) ((x / PAGE_4KB) & (0x3FF))
 
-#define GET_MEM_MAP_INDEX(x) (x / PAGE_4MB)
-
-#define GET_MANYOU_INDEX(x) ((x / PAGE_4KB) & (0x3FF))
+#define GET_FRAME_INDEX(x) (((uint32_t)(x)) / PAGE_4KB)
 
 //128MB
 #define USER_PAGE_TABLE_VIR_ADDR	0x8000000
 
-static page_4MB_descriptor_t page_phys_mem_map[MAX_DYNAMIC_4MB_PAGE];
+#define PAGE_KERNEL_FRAMES	(PAGE_KERNEL_RESERVED / PAGE_4KB)
+
+#define PAGE_FRAME_NONE		(-1)	///< end of a buddy free list
+
+#define PAGE_CR4_PGE	0x80	///< CR4 flag, global pages survive CR3 reloads
+
+#define PAGE_FRAME_TABLE_VIRT	0xC00000	///< virtual address of the frame descriptor table
+
+#define PAGE_MAX_MEM_REGIONS	32	///< usable regions kept from the boot memory map
+
+/**
+ *	A usable physical memory region reported by the boot loader
+ */
+typedef struct s_page_mem_region{
+	uint32_t	start;	///< first byte, 4KB aligned
+	uint32_t	end;	///< byte after the last one, 4KB aligned
+} page_mem_region_t;
+
+static page_mem_region_t page_mem_regions[PAGE_MAX_MEM_REGIONS];
+
+static int page_mem_region_num = 0;
+
+static page_frame_t *page_frames;	// one descriptor per physical frame
+
+static int32_t page_frame_num = 0;	// number of descriptors in `page_frames`
+
+static uint32_t page_frame_table_base;	// physical address of `page_frames`
 
-static page_4KB_descriptor_t manyoushu_mem_table[4][1024];
+static uint32_t page_frame_table_size;
 
-static int page_4KB_allocation_index = 0;
+static page_table_t page_frame_table_pt[PAGE_PHYS_MEM_LIMIT / PAGE_4KB *
+										sizeof(page_frame_t) / PAGE_4MB];
 
-static int page_4MB_allocation_index = ALLOCATABLE_4MB_START_INDEX;
+static int32_t page_free_area[PAGE_BUDDY_ORDERS];	// heads of buddy free lists
+
+static page_alloc_stats_t page_stats;
 
 static page_directory_t page_directory;
 
@@ -34,89 +62,261 @@ static page_table_t ece391_init_page_table;
 
 static page_table_t manyoushu_page_table;
 
-int get_phys_mem_reference_count(int physical_addr){
-	// align to 4MB
-	int mem_index = GET_MEM_MAP_INDEX(physical_addr);
+static page_directory_t *page_dir_cur = &page_directory;	// directory loaded in CR3
 
-	if ((mem_index == 0) || (mem_index >= MAX_DYNAMIC_4MB_PAGE))
-		return -EINVAL;
+static page_directory_t *page_dir_list[PAGE_DIR_MAX];	// process directories
+
+static kmem_cache_t *page_table_cache;	// page tables and process directories
+
+static uint8_t page_zero[PAGE_4KB] __attribute__((aligned(PAGE_4KB)));	// shared zero frame
+
+static page_reclaim_t page_reclaimers[PAGE_RECLAIM_MAX];	// memory pressure hooks
+
+/**
+ *	Get the descriptor of a physical frame
+ *
+ *	@return the descriptor, or NULL if the address is not managed
+ */
+static inline page_frame_t *page_frame_of(uint32_t physical_addr){
+	uint32_t idx = GET_FRAME_INDEX(physical_addr);
+	if (idx >= (uint32_t)page_frame_num){
+		return NULL;
+	}
+	return page_frames + idx;
+}
+
+/**
+ *	Push a free block onto the free list of its order
+ */
+static void page_buddy_list_add(int32_t idx, int order){
+	page_frame_t *frame = page_frames + idx;
+
+	frame->flags |= PAGE_DES_FREE;
+	frame->order = order;
+	frame->count = 0;
+	frame->prev = PAGE_FRAME_NONE;
+	frame->next = page_free_area[order];
+	if (frame->next != PAGE_FRAME_NONE){
+		page_frames[frame->next].prev = idx;
+	}
+	page_free_area[order] = idx;
+	page_stats.nr_free[order]++;
+	page_stats.free_frames += (1 << order);
+}
+
+/**
+ *	Remove a free block from the free list of its order
+ */
+static void page_buddy_list_del(int32_t idx){
+	page_frame_t *frame = page_frames + idx;
 
-	if (mem_index >= 3 && mem_index <= 6){
-		// manyoushu page
-		int mem_table_index = GET_MANYOU_INDEX(physical_addr);
-		return manyoushu_mem_table[mem_index-3][mem_table_index].count;
+	if (frame->prev != PAGE_FRAME_NONE){
+		page_frames[frame->prev].next = frame->next;
 	}else{
-		return page_phys_mem_map[mem_index].count;
+		page_free_area[frame->order] = frame->next;
 	}
+	if (frame->next != PAGE_FRAME_NONE){
+		page_frames[frame->next].prev = frame->prev;
+	}
+	frame->flags &= ~PAGE_DES_FREE;
+	page_stats.nr_free[frame->order]--;
+	page_stats.free_frames -= (1 << frame->order);
 }
 
-int _page_alloc_get_4MB(){
-	int sanity_count = 0;
-	// find next free 4MB page
-	while (page_phys_mem_map[page_4MB_allocation_index].count > 0){
-		// increment index
-		++page_4MB_allocation_index;
-		// wrap around
-		if (page_4MB_allocation_index > MAX_DYNAMIC_4MB_PAGE){
-			page_4MB_allocation_index = ALLOCATABLE_4MB_START_INDEX;
+/**
+ *	Take a block of 2^order frames from the buddy allocator
+ *
+ *	@return index of the first frame, or -ENOMEM
+ */
+static int32_t page_buddy_alloc(int order){
+	int cur;
+	int32_t idx;
+
+	// smallest order with a free block
+	for (cur = order; cur < PAGE_BUDDY_ORDERS; cur++){
+		if (page_free_area[cur] != PAGE_FRAME_NONE){
+			break;
 		}
-		// don't go to a dead loop
-		++sanity_count;
-		if (sanity_count > (MAX_DYNAMIC_4MB_PAGE - ALLOCATABLE_4MB_START_INDEX)){
-			// nah, the physical memory is full
-			return -ENOMEM;
+	}
+	if (cur >= PAGE_BUDDY_ORDERS){
+		page_stats.fail_count[order]++;
+		return -ENOMEM;
+	}
+
+	idx = page_free_area[cur];
+	page_buddy_list_del(idx);
+	// split down, returning upper halves to the free lists
+	while (cur > order){
+		cur--;
+		page_buddy_list_add(idx + (1 << cur), cur);
+		page_stats.split_count++;
+	}
+
+	page_frames[idx].order = order;
+	page_frames[idx].count = 1;
+	page_stats.alloc_count[order]++;
+	return idx;
+}
+
+/**
+ *	Return a block to the buddy allocator, merging it with free buddies
+ */
+static void page_buddy_free(int32_t idx, int order){
+	int32_t buddy;
+
+	page_stats.free_count[order]++;
+	while (order < PAGE_BUDDY_ORDERS - 1){
+		buddy = idx ^ (1 << order);
+		if (buddy >= page_frame_num ||
+			!(page_frames[buddy].flags & PAGE_DES_FREE) ||
+			page_frames[buddy].order != order){
+			break;
 		}
+		page_buddy_list_del(buddy);
+		idx &= ~(1 << order);
+		order++;
+		page_stats.merge_count++;
 	}
-	// found a good one, mark as used
-	page_phys_mem_map[page_4MB_allocation_index].count++;
-	return page_4MB_allocation_index * PAGE_4MB;
+	page_buddy_list_add(idx, order);
 }
 
-// should be only used for C00000 - 1000000 memory space
-int _page_alloc_get_4KB(){
-	int sanity_count = 0;
-	while (manyoushu_mem_table[page_4KB_allocation_index/1024][page_4KB_allocation_index%1024].count>0){
-		// increment index
-		++page_4KB_allocation_index;
-		// wrap around
-		if (page_4KB_allocation_index >= 4096){
-			page_4KB_allocation_index = 0;
+/**
+ *	Hand a range of frames to the buddy allocator
+ *
+ *	The range is added from the top down, so that the free lists hand out
+ *	low addresses first.
+ *
+ *	@param start: index of the first frame
+ *	@param end: index after the last frame
+ */
+static void page_buddy_add_range(int32_t start, int32_t end){
+	int order;
+
+	while (end > start){
+		// largest naturally aligned block ending at `end`
+		order = PAGE_BUDDY_ORDERS - 1;
+		while (((end - (1 << order)) & ((1 << order) - 1)) ||
+			   end - (1 << order) < start){
+			order--;
+		}
+		end -= (1 << order);
+		page_stats.total_frames += (1 << order);
+		page_buddy_free(end, order);
+		page_stats.free_count[order]--;	// not an actual release
+	}
+}
+
+int get_phys_mem_reference_count(int physical_addr){
+	page_frame_t *frame = page_frame_of(physical_addr);
+
+	if (!frame || (frame->flags & PAGE_DES_KERNEL))
+		return -EINVAL;
+
+	return frame->count;
+}
+
+void page_alloc_count_shared(uint32_t *frames, uint32_t *saved){
+	page_frame_t *frame;
+	int32_t idx = 0;
+
+	*frames = 0;
+	*saved = 0;
+	while (idx < page_frame_num){
+		frame = page_frames + idx;
+		if (!(frame->flags & PAGE_DES_RAM) || (frame->flags & PAGE_DES_KERNEL)){
+			idx++;
+			continue;
 		}
-		// don't go to a dead loop
-		++sanity_count;
-		if (sanity_count >= 4096){
-			// nah, the 4KB pages are all out
-			return -ENOMEM;
+		// block heads carry the order and count of the whole block
+		if (!(frame->flags & PAGE_DES_FREE) && frame->count > 1){
+			*frames += 1 << frame->order;
+			*saved += (frame->count - 1) << frame->order;
 		}
+		idx += 1 << frame->order;
 	}
-	// found a good one, mark as used
-	manyoushu_mem_table[page_4KB_allocation_index/1024][page_4KB_allocation_index%1024].count ++;
+}
 
-	return MANYOUSHU_PAGE_START_ADDR + page_4KB_allocation_index * PAGE_4KB;
+/**
+ *	Ask the reclaim hooks for frames
+ *
+ *	@return the number of frames released
+ */
+static int page_alloc_reclaim(int frames){
+	int i, freed = 0;
+
+	for (i = 0; i < PAGE_RECLAIM_MAX && page_reclaimers[i]; i++){
+		freed += page_reclaimers[i](frames - freed);
+		if (freed >= frames){
+			break;
+		}
+	}
+	return freed;
 }
 
-int _page_alloc_add_refer_4MB(int addr){
+int page_alloc_order(int order){
+	int32_t idx;
+
+	if (order < 0 || order >= PAGE_BUDDY_ORDERS){
+		return -EINVAL;
+	}
+	idx = page_buddy_alloc(order);
+	// released frames may not coalesce into a large block, keep asking
+	while (idx < 0 && page_alloc_reclaim(1 << order) > 0){
+		idx = page_buddy_alloc(order);
+	}
+	if (idx < 0){
+		return idx;
+	}
+	return idx * PAGE_4KB;
+}
+
+int page_alloc_register_reclaim(page_reclaim_t reclaim){
+	int i;
+
+	for (i = 0; i < PAGE_RECLAIM_MAX; i++){
+		if (!page_reclaimers[i] || page_reclaimers[i] == reclaim){
+			page_reclaimers[i] = reclaim;
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+int _page_alloc_get_4MB(){
+	return page_alloc_order(PAGE_BUDDY_ORDERS - 1);
+}
+
+int _page_alloc_get_4KB(){
+	return page_alloc_order(0);
+}
+
+/**
+ *	Add a reference to an allocated block
+ */
+static int page_alloc_add_refer(int addr){
+	page_frame_t *frame = page_frame_of(addr);
+
 	// check if the physical address is really allocated
-	if (page_phys_mem_map[GET_DIR_INDEX(addr)].count<=0){
-		// not valid
+	if (!frame || (frame->flags & (PAGE_DES_KERNEL | PAGE_DES_FREE)) ||
+		!(frame->flags & PAGE_DES_RAM) || frame->count <= 0){
 		return -EINVAL;
 	}
-	// add reference count
-	page_phys_mem_map[GET_DIR_INDEX(addr)].count ++;
+	frame->count++;
 	return 0;
 }
 
-int _page_alloc_add_refer_4KB(int addr){
-	// check if the physical address is in the manyoushu 4MB
-/*	if (GET_MEM_MAP_INDEX(addr)!=GET_MEM_MAP_INDEX(MANYOUSHU_PAGE_START_ADDR)){
+int _page_alloc_add_refer_4MB(int addr){
+	if (addr % PAGE_4MB){
 		return -EINVAL;
-	}*/
-	// check if the physical address is really allocated
-	if (manyoushu_mem_table[GET_DIR_INDEX(addr)-3][GET_TAB_INDEX(addr)].count<=0){
+	}
+	return page_alloc_add_refer(addr);
+}
+
+int _page_alloc_add_refer_4KB(int addr){
+	if (addr % PAGE_4KB){
 		return -EINVAL;
 	}
-	manyoushu_mem_table[GET_DIR_INDEX(addr)-3][GET_TAB_INDEX(addr)].count++;
-	return 0;
+	return page_alloc_add_refer(addr);
 }
 
 int page_alloc_4MB(int* physical_addr){
@@ -159,45 +359,187 @@ int page_alloc_4KB(int* physical_addr){
 	}
 }
 
-int page_alloc_free_4MB(int physical_addr){
-	// never free a kernel page or a manyoushu page
-	if (physical_addr < (MANYOUSHU_PAGE_START_ADDR + PAGE_4MB)){
+/**
+ *	Drop a reference to an allocated block, releasing it on the last one
+ */
+static int page_alloc_free(int physical_addr){
+	page_frame_t *frame = page_frame_of(physical_addr);
+
+	// never free a kernel page, and check if the block is really in use
+	if (!frame || (frame->flags & (PAGE_DES_KERNEL | PAGE_DES_FREE)) ||
+		!(frame->flags & PAGE_DES_RAM) || frame->count <= 0){
 		return -EINVAL;
 	}
-	// check if the physical page is really in use
-	if (page_phys_mem_map[GET_DIR_INDEX(physical_addr)].count<=0){
+	// then decrease the use count
+	frame->count--;
+	if (frame->count == 0){
+		page_buddy_free(frame - page_frames, frame->order);
+	}
+	return 0;
+}
+
+/**
+ *	Turn an allocated block into independent 4KB frames
+ *
+ *	Every frame inherits the reference count of the block, so that the frames
+ *	can later be shared and released one by one.
+ */
+static int page_alloc_split(int physical_addr){
+	page_frame_t *frame = page_frame_of(physical_addr);
+	int i, n;
+
+	if (!frame || (frame->flags & (PAGE_DES_KERNEL | PAGE_DES_FREE)) ||
+		!(frame->flags & PAGE_DES_RAM) || frame->count <= 0){
 		return -EINVAL;
 	}
-	// then decrease the use count
-	page_phys_mem_map[GET_DIR_INDEX(physical_addr)].count--;
+	n = 1 << frame->order;
+	page_stats.alloc_count[frame->order]--;
+	page_stats.alloc_count[0] += n;
+	for (i = 0; i < n; ++i){
+		frame[i].order = 0;
+		frame[i].count = frame->count;
+	}
 	return 0;
 }
 
-int page_alloc_free_4KB(int physical_addr){
-	// the physical address should be in the manyoushu page
-	if ((physical_addr < MANYOUSHU_PAGE_START_ADDR)||
-		(physical_addr > (MANYOUSHU_PAGE_START_ADDR + PAGE_4MB))){
+int page_alloc_free_4MB(int physical_addr){
+	if (physical_addr % PAGE_4MB){
 		return -EINVAL;
 	}
-	// check if the physical 4KB page is really in use
-	if (manyoushu_mem_table[GET_DIR_INDEX(physical_addr)-3][GET_TAB_INDEX(physical_addr)].count<=0){
+	return page_alloc_free(physical_addr);
+}
+
+int page_alloc_free_4KB(int physical_addr){
+	if (physical_addr % PAGE_4KB){
 		return -EINVAL;
 	}
-	// then decrease the use count;
-	manyoushu_mem_table[GET_DIR_INDEX(physical_addr)-3][GET_TAB_INDEX(physical_addr)].count --;
-	return 0;
+	return page_alloc_free(physical_addr);
+}
+
+void page_alloc_get_stats(page_alloc_stats_t *stats){
+	if (stats){
+		memcpy(stats, &page_stats, sizeof(page_alloc_stats_t));
+	}
+}
+
+void page_alloc_print_stats(){
+	int i, largest = -1;
+
+	printf("frames: %d total, %d free\n", page_stats.total_frames,
+		   page_stats.free_frames);
+	printf("order  free  alloc  freed  fail\n");
+	for (i = 0; i < PAGE_BUDDY_ORDERS; i++){
+		printf("%d  %d  %d  %d  %d\n", i, page_stats.nr_free[i],
+			   page_stats.alloc_count[i], page_stats.free_count[i],
+			   page_stats.fail_count[i]);
+		if (page_stats.nr_free[i]){
+			largest = i;
+		}
+	}
+	printf("splits: %d, merges: %d, largest free order: %d\n",
+		   page_stats.split_count, page_stats.merge_count, largest);
+}
+
+
+/**
+ *	Collect usable regions from the boot loader's memory map
+ *
+ *	Regions are clipped to `PAGE_PHYS_MEM_LIMIT` and shrunk to 4KB boundaries.
+ *	If no memory map is available, `mem_upper` is used instead.
+ */
+static void page_mem_regions_init(multiboot_info_t *mbi){
+	memory_map_t *mmap;
+	uint32_t start, end;
+
+	page_mem_region_num = 0;
+	if (mbi && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)){
+		for (mmap = (memory_map_t *)mbi->mmap_addr;
+			 (uint32_t)mmap < mbi->mmap_addr + mbi->mmap_length &&
+			 page_mem_region_num < PAGE_MAX_MEM_REGIONS;
+			 mmap = (memory_map_t *)((uint32_t)mmap + mmap->size + sizeof(mmap->size))){
+			if (mmap->type != MULTIBOOT_MEMORY_AVAILABLE || mmap->base_addr_high ||
+				mmap->base_addr_low >= PAGE_PHYS_MEM_LIMIT){
+				continue;
+			}
+			start = mmap->base_addr_low;
+			if (mmap->length_high ||
+				mmap->length_low >= PAGE_PHYS_MEM_LIMIT - start){
+				end = PAGE_PHYS_MEM_LIMIT;
+			}else{
+				end = start + mmap->length_low;
+			}
+			start = (start + PAGE_4KB - 1) & ~(PAGE_4KB - 1);
+			end &= ~(PAGE_4KB - 1);
+			if (start < end){
+				page_mem_regions[page_mem_region_num].start = start;
+				page_mem_regions[page_mem_region_num].end = end;
+				page_mem_region_num++;
+			}
+		}
+	}else if (mbi && (mbi->flags & MULTIBOOT_INFO_MEMORY)){
+		// upper memory starts at 1MB, mem_upper is in KB
+		end = 0x100000 + mbi->mem_upper * 1024;
+		if (mbi->mem_upper >= (PAGE_PHYS_MEM_LIMIT - 0x100000) / 1024){
+			end = PAGE_PHYS_MEM_LIMIT;
+		}
+		page_mem_regions[0].start = 0x100000;
+		page_mem_regions[0].end = end & ~(PAGE_4KB - 1);
+		page_mem_region_num = 1;
+	}
+}
+
+/**
+ *	Get the end of memory used by the boot loader's modules
+ *
+ *	@return physical address after the last module, at least the end of the
+ *			kernel reserved area
+ */
+static uint32_t page_boot_reserved_end(multiboot_info_t *mbi){
+	module_t *mod;
+	uint32_t i, end = PAGE_KERNEL_RESERVED;
+
+	if (mbi && (mbi->flags & MULTIBOOT_INFO_MODS)){
+		mod = (module_t *)mbi->mods_addr;
+		for (i = 0; i < mbi->mods_count; i++, mod++){
+			if (mod->mod_end > end){
+				end = mod->mod_end;
+			}
+		}
+	}
+	return (end + PAGE_4KB - 1) & ~(PAGE_4KB - 1);
 }
 
+/**
+ *	Map the frame descriptor table at `PAGE_FRAME_TABLE_VIRT`
+ */
+static void page_frame_table_map(){
+	uint32_t off;
+	int i;
+
+	for (i = 0; (uint32_t)i * PAGE_4MB < page_frame_table_size; i++){
+		memset(page_frame_table_pt + i, 0, sizeof(page_table_t));
+		page_dir_add_4KB_entry(PAGE_FRAME_TABLE_VIRT + i * PAGE_4MB,
+							   page_frame_table_pt + i, PAGE_DIR_ENT_PRESENT |
+							   PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_SUPERVISOR |
+							   PAGE_DIR_ENT_GLOBAL);
+	}
+	for (off = 0; off < page_frame_table_size; off += PAGE_4KB){
+		page_frame_table_pt[off / PAGE_4MB].page_table_entry[GET_TAB_INDEX(off)] =
+			(page_frame_table_base + off) | PAGE_TAB_ENT_PRESENT |
+			PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_SUPERVISOR | PAGE_TAB_ENT_GLOBAL;
+	}
+}
 
-void page_ece391_init(){
+void page_ece391_init(multiboot_info_t *mbi){
 	// clear the page directory
 	memset(&page_directory, 0, 4096);
 
 	// clear the page table of 0-4MB
 	memset(&ece391_init_page_table, 0, 4096);
 
-	// work around
-	page_phys_mem_map_init();
+	// build the frame allocator from the memory map while paging is off
+	page_phys_mem_map_init(mbi);
+	page_frame_table_map();
 
 	// create 4KB page for 0-4MB
 	page_dir_add_4KB_entry(0x0, (void*)(&ece391_init_page_table), PAGE_DIR_ENT_PRESENT |
@@ -207,10 +549,7 @@ void page_ece391_init(){
 	page_dir_add_4MB_entry(0x400000, 0x400000, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
 							PAGE_DIR_ENT_SUPERVISOR | PAGE_DIR_ENT_4MB |
 							PAGE_DIR_ENT_GLOBAL);
-	// create 4MB page for 8-12MB (program kernel stacks)
-	page_dir_add_4MB_entry(0x800000, 0x800000, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
-							PAGE_DIR_ENT_SUPERVISOR | PAGE_DIR_ENT_4MB |
-							PAGE_DIR_ENT_GLOBAL);
+	// NOTE: 8-12MB holds the kernel stacks, mapped by the tasks
 	// NOTE: creating page table dir for video memory now in tty
 
 	// create 4KB page table for Manyoushu
@@ -219,188 +558,554 @@ void page_ece391_init(){
 			| PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER);
 
 	page_turn_on((int)(&page_directory));
+	memset(page_zero, 0, PAGE_4KB);
 
 	// paging is turned on, but we still have other things to do
+	page_frames = (page_frame_t *)PAGE_FRAME_TABLE_VIRT;
 	page_kernel_mem_map_init();
-	// Initialize global memory blocks
-	memset((char *)0x800000, -1, 4<<20);
 
 	signal_init();
 }
 
-void page_phys_mem_map_init(){
-	int i,j;
-	// initiate physical memory page descriptors
-	for (i=0;i<MAX_DYNAMIC_4MB_PAGE;++i){
-		page_phys_mem_map[i].flags = 0;
-		page_phys_mem_map[i].count = 0;
-		page_phys_mem_map[i].pages = NULL;
+void page_phys_mem_map_init(multiboot_info_t *mbi){
+	int i;
+	int32_t frame, run, end;
+	uint32_t reserved_end, start;
+
+	page_mem_regions_init(mbi);
+
+	// size the descriptor table after the highest usable address
+	page_frame_num = PAGE_KERNEL_FRAMES;
+	for (i = 0; i < page_mem_region_num; ++i){
+		if ((int32_t)GET_FRAME_INDEX(page_mem_regions[i].end) > page_frame_num){
+			page_frame_num = GET_FRAME_INDEX(page_mem_regions[i].end);
+		}
 	}
-	// initiate memory map for manyoushu
-	for (i=0;i<1024;++i){
-		for (j=0; j<4; ++j){
-			manyoushu_mem_table[j][i].flags = 0;
-			manyoushu_mem_table[j][i].count = 0;
+	page_frame_table_size = page_frame_num * sizeof(page_frame_t);
+	page_frame_table_size = (page_frame_table_size + PAGE_4KB - 1) & ~(PAGE_4KB - 1);
+
+	// carve the table out of the first region that can hold it
+	reserved_end = page_boot_reserved_end(mbi);
+	page_frame_table_base = 0;
+	for (i = 0; i < page_mem_region_num; ++i){
+		start = page_mem_regions[i].start;
+		if (start < reserved_end){
+			start = reserved_end;
 		}
+		if (start < page_mem_regions[i].end &&
+			page_mem_regions[i].end - start >= page_frame_table_size){
+			page_frame_table_base = start;
+			break;
+		}
+	}
+	if (!page_frame_table_base){
+		printf("[CRITICAL] NOT ENOUGH MEMORY FOR THE FRAME TABLE!\n");
+		while(1);
+	}
+
+	// initiate physical memory frame descriptors, paging is still off so the
+	// table can be accessed by its physical address
+	page_frames = (page_frame_t *)page_frame_table_base;
+	memset(page_frames, 0, page_frame_table_size);
+	memset(&page_stats, 0, sizeof(page_stats));
+	for (i = 0; i < PAGE_BUDDY_ORDERS; ++i){
+		page_free_area[i] = PAGE_FRAME_NONE;
+	}
+	// 0-8MB is taken by the kernel image, followed by
+	// boot modules and the descriptor table itself
+	for (frame = 0; frame < (int32_t)GET_FRAME_INDEX(reserved_end) &&
+		 frame < page_frame_num; ++frame){
+		page_frames[frame].count = 1;
+		page_frames[frame].flags |= PAGE_DES_RESERVE;
+	}
+	for (frame = GET_FRAME_INDEX(page_frame_table_base);
+		 frame < (int32_t)GET_FRAME_INDEX(page_frame_table_base + page_frame_table_size);
+		 ++frame){
+		page_frames[frame].count = 1;
+		page_frames[frame].flags |= PAGE_DES_RESERVE | PAGE_DES_KERNEL;
 	}
-	page_phys_mem_map[0].count = 1;
-	page_phys_mem_map[1].count = 1;
-	page_phys_mem_map[2].count = 1;
-	page_phys_mem_map[3].count = 1;
-	page_phys_mem_map[3].pages = manyoushu_mem_table[0];
-	page_phys_mem_map[4].count = 1;
-	page_phys_mem_map[4].pages = manyoushu_mem_table[1];
-	page_phys_mem_map[5].count = 1;
-	page_phys_mem_map[5].pages = manyoushu_mem_table[2];
-	page_phys_mem_map[6].count = 1;
-	page_phys_mem_map[6].pages = manyoushu_mem_table[3];
 
+	// hand every other usable frame to the buddy allocator, skipping frames
+	// that are reserved or reported twice by overlapping regions
+	for (i = 0; i < page_mem_region_num; ++i){
+		end = GET_FRAME_INDEX(page_mem_regions[i].end);
+		frame = GET_FRAME_INDEX(page_mem_regions[i].start);
+		while (frame < end){
+			for (run = frame; run < end &&
+				 !(page_frames[run].flags & (PAGE_DES_RESERVE | PAGE_DES_RAM)); ++run){
+				page_frames[run].flags |= PAGE_DES_RAM;
+			}
+			if (run > frame){
+				page_buddy_add_range(frame, run);
+			}
+			frame = run + 1;
+		}
+	}
 
-	//manyoushu_mem_table[0xb8].count = 1; 	//WTF AM I THINKING
+	printf("Physical memory: %d MB usable, %d MB max address\n",
+		   page_stats.total_frames / 256, page_frame_num / 256);
 }
 
 void page_kernel_mem_map_init(){
-	// first 3 4MB pages are reserved for kernel usage
-	page_phys_mem_map[0].flags |= PAGE_DES_KERNEL;
-	page_phys_mem_map[1].flags |= PAGE_DES_KERNEL;
-	page_phys_mem_map[2].flags |= PAGE_DES_KERNEL;
+	int i;
+	// first 2 4MB pages are reserved for kernel usage
+	for (i = 0; i < PAGE_KERNEL_FRAMES && i < page_frame_num; ++i){
+		page_frames[i].flags |= PAGE_DES_KERNEL;
+	}
+}
 
-	// C00000 - 1000000 addresses for 4KB Manyoushu
-	page_phys_mem_map[3].flags |= PAGE_DES_RESERVE;
-	page_phys_mem_map[4].flags |= PAGE_DES_RESERVE;
-	page_phys_mem_map[5].flags |= PAGE_DES_RESERVE;
-	page_phys_mem_map[6].flags |= PAGE_DES_RESERVE;
+/**
+ *	Get the physical address of a page table or directory
+ *
+ *	Static tables live in the identity-mapped kernel image, dynamic ones are
+ *	taken from the kernel memory pool.
+ */
+static uint32_t page_table_phys(void *table){
+	if ((uint32_t)table < PAGE_KERNEL_RESERVED){
+		return (uint32_t)table;
+	}
+	return kmem_virt_to_phys(table);
 }
 
-// this function should only be called during initialization
-int page_dir_add_4KB_entry(uint32_t virtual_addr, void* new_page_table, int flags){
-	// check invalid parameter
-	if (!new_page_table){
-		return -EINVAL;
+/**
+ *	Get the kernel virtual address of a page table from a directory entry
+ *
+ *	@return the page table, or NULL if the entry does not refer to one
+ */
+static page_table_t *page_dir_get_table(page_directory_t *pd, int page_dir_index){
+	page_directory_entry_t ent = pd->page_directory_entry[page_dir_index];
+	uint32_t addr;
+
+	if (!(ent & PAGE_DIR_ENT_PRESENT) || (ent & PAGE_DIR_ENT_4MB)){
+		return NULL;
 	}
-	// check inconsistent flags
-	if (flags & PAGE_DIR_ENT_4MB){
-		return -EINVAL;
+	addr = ent & 0xFFFFF000;
+	if (addr < PAGE_KERNEL_RESERVED){
+		return (page_table_t *)addr;
 	}
+	return (page_table_t *)kmem_phys_to_virt(addr);
+}
+
+/**
+ *	Write a page directory entry
+ *
+ *	Kernel entries are shared by every address space, so they are written to
+ *	the master directory and to every process directory alike.
+ */
+static void page_dir_set_entry(page_directory_t *pd, int page_dir_index,
+							   page_directory_entry_t ent){
+	int i;
+
+	if (page_dir_index >= USER_PAGE_DIR_START_INDEX){
+		pd->page_directory_entry[page_dir_index] = ent;
+		return;
+	}
+	page_directory.page_directory_entry[page_dir_index] = ent;
+	for (i = 0; i < PAGE_DIR_MAX; ++i){
+		if (page_dir_list[i]){
+			page_dir_list[i]->page_directory_entry[page_dir_index] = ent;
+		}
+	}
+}
+
+/**
+ *	Get the page table covering a user address, allocating it if needed
+ *
+ *	@return the page table, or NULL if the address is covered by a 4MB page
+ *			or no memory is left
+ */
+static page_table_t *page_dir_make_table(page_directory_t *pd, uint32_t virtual_addr){
 	int page_dir_index = GET_DIR_INDEX(virtual_addr);
+	page_table_t *table;
 
-	// if this page dir entry already exists
-	if (page_directory.page_directory_entry[page_dir_index] & (PAGE_DIR_ENT_PRESENT)){
-		return -EEXIST;
+	if (pd->page_directory_entry[page_dir_index] & PAGE_DIR_ENT_PRESENT){
+		return page_dir_get_table(pd, page_dir_index);
+	}
+	if (page_dir_index < USER_PAGE_DIR_START_INDEX){
+		return NULL;
 	}
+	table = kmem_cache_alloc(page_table_cache);
+	if (!table){
+		return NULL;
+	}
+	memset(table, 0, sizeof(page_table_t));
+	pd->page_directory_entry[page_dir_index] = page_table_phys(table) |
+		PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER;
+	return table;
+}
 
-	// if the page table addr is not aligned to 4KB boundary
-	if (((int)new_page_table) % PAGE_4KB){
-		return -EINVAL;
+page_directory_t *page_dir_create(){
+	page_directory_t *pd;
+	page_table_t *table;
+	int i;
+
+	if (!page_table_cache){
+		page_table_cache = kmem_cache_create("page_table", sizeof(page_table_t));
+		if (!page_table_cache){
+			return NULL;
+		}
+	}
+	for (i = 0; i < PAGE_DIR_MAX; ++i){
+		if (!page_dir_list[i]){
+			break;
+		}
+	}
+	if (i >= PAGE_DIR_MAX){
+		errno = EAGAIN;
+		return NULL;
 	}
 
-	flags |= PAGE_DIR_ENT_PRESENT; // sanity force present flags
+	pd = kmem_cache_alloc(page_table_cache);
+	if (!pd){
+		return NULL;
+	}
+	// share the kernel part of the master directory, start with no user pages
+	memcpy(pd->page_directory_entry, page_directory.page_directory_entry,
+		   USER_PAGE_DIR_START_INDEX * sizeof(page_directory_entry_t));
+	memset(pd->page_directory_entry + USER_PAGE_DIR_START_INDEX, 0,
+		   (1024 - USER_PAGE_DIR_START_INDEX) * sizeof(page_directory_entry_t));
+
+	// the global user page is visible to every process
+	table = page_dir_make_table(pd, USER_PAGE_TABLE_VIR_ADDR);
+	if (!table){
+		kmem_cache_free(page_table_cache, pd);
+		return NULL;
+	}
+	table->page_table_entry[0] = manyoushu_page_table.page_table_entry[0];
 
-	// add the entry in page directory
-	page_directory.page_directory_entry[page_dir_index] = ((int)(new_page_table)& 0xFFFFF000) | flags;
+	page_dir_list[i] = pd;
+	return pd;
+}
 
-	return 0;
+void page_dir_clear_user(page_directory_t *pd, uint32_t keep){
+	page_table_t *table;
+	int i;
+
+	for (i = USER_PAGE_DIR_START_INDEX; i < 1024; ++i){
+		if (keep && i == (int)GET_DIR_INDEX(keep)){
+			continue;
+		}
+		table = page_dir_get_table(pd, i);
+		if (i == GET_DIR_INDEX(USER_PAGE_TABLE_VIR_ADDR) && table){
+			// keep the global user page
+			memset(table->page_table_entry + 1, 0,
+				   1023 * sizeof(page_table_entry_t));
+			continue;
+		}
+		if (table){
+			kmem_cache_free(page_table_cache, table);
+		}
+		pd->page_directory_entry[i] = 0;
+	}
+	if (pd == page_dir_cur){
+		page_flush_tlb();
+	}
 }
 
-int page_dir_add_4MB_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
+void page_dir_destroy(page_directory_t *pd){
+	page_table_t *table;
+	int i;
+
+	if (!pd || pd == &page_directory){
+		return;
+	}
+	if (pd == page_dir_cur){
+		page_dir_switch(NULL);
+	}
+	for (i = 0; i < PAGE_DIR_MAX; ++i){
+		if (page_dir_list[i] == pd){
+			page_dir_list[i] = NULL;
+		}
+	}
+	for (i = USER_PAGE_DIR_START_INDEX; i < 1024; ++i){
+		table = page_dir_get_table(pd, i);
+		if (table){
+			kmem_cache_free(page_table_cache, table);
+		}
+	}
+	kmem_cache_free(page_table_cache, pd);
+}
+
+void page_dir_switch(page_directory_t *pd){
+	if (!pd){
+		pd = &page_directory;
+	}
+	if (pd == page_dir_cur){
+		return;
+	}
+	page_dir_cur = pd;
+	asm volatile ("movl %0, %%cr3" : : "r"(page_table_phys(pd)) : "memory");
+}
+
+page_directory_t *page_dir_current(){
+	return page_dir_cur;
+}
+
+int page_dir_map_4MB(page_directory_t *pd, uint32_t virtual_addr, uint32_t real_addr, int flags){
+	page_frame_t *frame;
+	int page_dir_index;
+
 	// check inconsistent flag
 	if (!(flags & PAGE_DIR_ENT_4MB)){
 		return -EINVAL;
 	}
 	// auto fit to nearest 4MB
-	int page_dir_index;
 	page_dir_index = GET_DIR_INDEX(virtual_addr);
 
 	// if this dir entry already exists
-	if (page_directory.page_directory_entry[page_dir_index] & (PAGE_DIR_ENT_PRESENT)){
+	if (pd->page_directory_entry[page_dir_index] & (PAGE_DIR_ENT_PRESENT)){
 		return -EEXIST;
 	}
 
-	virtual_addr = page_dir_index * PAGE_4MB;
 	real_addr = (real_addr / PAGE_4MB) *PAGE_4MB;
 
 	flags |= PAGE_DIR_ENT_PRESENT; // sanity force present flags
 
 	// if want to map to a kernel address, hmmmmmm
-	if (page_phys_mem_map[GET_MEM_MAP_INDEX(real_addr)].flags & (PAGE_DES_KERNEL)){
+	frame = page_frame_of(real_addr);
+	if (!frame){
+		return -EINVAL;
+	}
+	if (frame->flags & (PAGE_DES_KERNEL)){
 		return -EACCES;
 	}
 
 	// if want to map to a physical memory that hasn't been allocated
-	if (page_phys_mem_map[GET_MEM_MAP_INDEX(real_addr)].count <= 0){
+	if (frame->count <= 0){
 		return -EINVAL;
 	}
 
 	// add the entry in page directory
-	page_directory.page_directory_entry[page_dir_index] = (real_addr) | flags;
+	page_dir_set_entry(pd, page_dir_index, (real_addr) | flags);
 
 	return 0;
 }
 
-int page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
-	// auto fit to nearest 4KB
+int page_dir_map_4KB(page_directory_t *pd, uint32_t virtual_addr, uint32_t real_addr, int flags){
+	page_frame_t *frame;
+	page_table_t *table;
 	int page_tab_index = GET_TAB_INDEX(virtual_addr);
 
-	// find the page table the virtual address belongs to
-	int page_dir_entry_index = GET_DIR_INDEX(virtual_addr);
-
 	real_addr = (real_addr / PAGE_4KB) * PAGE_4KB;
 
-	// check that page table is valid and in use
-	if (!(page_directory.page_directory_entry[page_dir_entry_index] & (PAGE_DIR_ENT_PRESENT))){
-		return -EINVAL;
+	table = page_dir_make_table(pd, virtual_addr);
+	if (!table){
+		return (pd->page_directory_entry[GET_DIR_INDEX(virtual_addr)] &
+				PAGE_DIR_ENT_PRESENT) ? -EEXIST : -ENOMEM;
 	}
-	// get the address of the page table
-	page_table_t* dest_page_table = (page_table_t*)(page_directory.page_directory_entry[page_dir_entry_index] & 0xFFFFF000);
 
 	// check if already exists
-	if (dest_page_table->page_table_entry[page_tab_index] & (PAGE_TAB_ENT_PRESENT)){
+	if (table->page_table_entry[page_tab_index] & (PAGE_TAB_ENT_PRESENT)){
 		return -EEXIST;
 	}
 
-/*	// if want to map to a kernel address, hmmmmmm
-	if (page_phys_mem_map[GET_MEM_MAP_INDEX(real_addr)].flags & (PAGE_DES_KERNEL)){
-		return -EACCES;
-	}*/
+	// if want to map to a physical memory that hasn't been allocated
+	frame = page_frame_of(real_addr);
+	if (!frame || frame->count <= 0){
+		return -EINVAL;
+	}
 
-	// NOTE SPECIAL WORKAROUND
-	if (page_tab_index == 0){
-		dest_page_table->page_table_entry[page_tab_index] = (real_addr) | flags;
+	flags |= PAGE_TAB_ENT_PRESENT;	// enforce preset bit
+
+	table->page_table_entry[page_tab_index] = (real_addr) | flags;
+
+	return 0;
+}
+
+int page_dir_unmap(page_directory_t *pd, uint32_t virtual_addr){
+	page_table_t *table;
+	int page_dir_index = GET_DIR_INDEX(virtual_addr);
+
+	// cannot unmap kernel pages
+	if (page_dir_index < USER_PAGE_DIR_START_INDEX){
+		return -EINVAL;
+	}
+	if (!(pd->page_directory_entry[page_dir_index] & PAGE_DIR_ENT_PRESENT)){
+		return -EINVAL;
+	}
+	if (pd->page_directory_entry[page_dir_index] & PAGE_DIR_ENT_4MB){
+		pd->page_directory_entry[page_dir_index] = 0;
 		return 0;
 	}
+	table = page_dir_get_table(pd, page_dir_index);
+	if (!table || !(table->page_table_entry[GET_TAB_INDEX(virtual_addr)] & PAGE_TAB_ENT_PRESENT)){
+		return -EINVAL;
+	}
+	table->page_table_entry[GET_TAB_INDEX(virtual_addr)] = 0;
+	return 0;
+}
 
-	// if want to map to a physical memory that hasn't been allocated
-	if (page_phys_mem_map[GET_MEM_MAP_INDEX(real_addr)].count<=0){
+page_table_entry_t *page_dir_get_pte(page_directory_t *pd, uint32_t virtual_addr){
+	page_table_t *table = page_dir_get_table(pd, GET_DIR_INDEX(virtual_addr));
+
+	if (!table){
+		return NULL;
+	}
+	return table->page_table_entry + GET_TAB_INDEX(virtual_addr);
+}
+
+page_table_entry_t *page_dir_make_pte(page_directory_t *pd, uint32_t virtual_addr){
+	page_table_t *table = page_dir_make_table(pd, virtual_addr);
+
+	if (!table){
+		return NULL;
+	}
+	return table->page_table_entry + GET_TAB_INDEX(virtual_addr);
+}
+
+int page_dir_split_4MB(page_directory_t *pd, uint32_t virtual_addr){
+	int page_dir_index = GET_DIR_INDEX(virtual_addr);
+	page_directory_entry_t ent = pd->page_directory_entry[page_dir_index];
+	page_table_t *table;
+	uint32_t real_addr;
+	int i, ret;
+
+	if (page_dir_index < USER_PAGE_DIR_START_INDEX ||
+		(ent & (PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_4MB)) !=
+		(PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_4MB)){
 		return -EINVAL;
 	}
-	if (GET_MEM_MAP_INDEX(real_addr) > 0){
-		if (page_phys_mem_map[GET_MEM_MAP_INDEX(real_addr)].pages[GET_MANYOU_INDEX(real_addr)].count <= 0){
-			return -EINVAL;
-		}
+	real_addr = ent & ~(PAGE_4MB - 1);
+	// a block shared as a whole cannot be split by one of its users
+	if (get_phys_mem_reference_count(real_addr) != 1){
+		return -EBUSY;
 	}
 
-	flags |= PAGE_TAB_ENT_PRESENT;	// enforce preset bit
+	table = kmem_cache_alloc(page_table_cache);
+	if (!table){
+		return -ENOMEM;
+	}
+	ret = page_alloc_split(real_addr);
+	if (ret){
+		kmem_cache_free(page_table_cache, table);
+		return ret;
+	}
+	// 4MB and 4KB entries share the low flag bits
+	ent &= PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER;
+	for (i = 0; i < 1024; ++i){
+		table->page_table_entry[i] = (real_addr + i * PAGE_4KB) | ent;
+	}
+	pd->page_directory_entry[page_dir_index] = page_table_phys(table) |
+		PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER;
+	return 0;
+}
 
-	dest_page_table->page_table_entry[page_tab_index] = (real_addr) | flags;
+int page_dir_move(page_directory_t *pd, uint32_t from, uint32_t to){
+	int src = GET_DIR_INDEX(from);
+	int dst = GET_DIR_INDEX(to);
+	page_table_t *table;
 
+	// the global user page table never moves
+	if (src < USER_PAGE_DIR_START_INDEX || dst < USER_PAGE_DIR_START_INDEX ||
+		src == GET_DIR_INDEX(USER_PAGE_TABLE_VIR_ADDR) ||
+		dst == GET_DIR_INDEX(USER_PAGE_TABLE_VIR_ADDR) || src == dst){
+		return -EINVAL;
+	}
+	if (!(pd->page_directory_entry[src] & PAGE_DIR_ENT_PRESENT)){
+		return -EINVAL;
+	}
+	table = page_dir_get_table(pd, dst);
+	if (table){
+		kmem_cache_free(page_table_cache, table);
+	}
+	pd->page_directory_entry[dst] = pd->page_directory_entry[src];
+	pd->page_directory_entry[src] = 0;
+	if (pd == page_dir_cur){
+		page_flush_tlb();
+	}
 	return 0;
 }
 
-int _page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
+uint32_t page_zero_frame(){
+	return (uint32_t)page_zero;
+}
+
+int page_dir_unmap_table(page_directory_t *pd, uint32_t virtual_addr){
+	int page_dir_index = GET_DIR_INDEX(virtual_addr);
+	page_table_t *table;
+
+	// the global user page table is never released
+	if (page_dir_index < USER_PAGE_DIR_START_INDEX ||
+		page_dir_index == GET_DIR_INDEX(USER_PAGE_TABLE_VIR_ADDR)){
+		return -EINVAL;
+	}
+	table = page_dir_get_table(pd, page_dir_index);
+	if (!table){
+		return -EINVAL;
+	}
+	pd->page_directory_entry[page_dir_index] = 0;
+	kmem_cache_free(page_table_cache, table);
+	return 0;
+}
+
+// this function should only be called during initialization
+int page_dir_add_4KB_entry(uint32_t virtual_addr, void* new_page_table, int flags){
+	// check invalid parameter
+	if (!new_page_table){
+		return -EINVAL;
+	}
+	// check inconsistent flags
+	if (flags & PAGE_DIR_ENT_4MB){
+		return -EINVAL;
+	}
+	int page_dir_index = GET_DIR_INDEX(virtual_addr);
+
+	// if this page dir entry already exists
+	if (page_dir_cur->page_directory_entry[page_dir_index] & (PAGE_DIR_ENT_PRESENT)){
+		return -EEXIST;
+	}
+
+	// if the page table addr is not aligned to 4KB boundary
+	if (((int)new_page_table) % PAGE_4KB){
+		return -EINVAL;
+	}
+
+	flags |= PAGE_DIR_ENT_PRESENT; // sanity force present flags
+
+	// add the entry in page directory
+	page_dir_set_entry(page_dir_cur, page_dir_index,
+					   (page_table_phys(new_page_table) & 0xFFFFF000) | flags);
+
+	return 0;
+}
+
+int page_dir_add_4MB_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
+	return page_dir_map_4MB(page_dir_cur, virtual_addr, real_addr, flags);
+}
+
+int page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
+	page_table_t *dest_page_table;
 	// auto fit to nearest 4KB
 	int page_tab_index = GET_TAB_INDEX(virtual_addr);
 
-	// find the page table the virtual address belongs to
-	int page_dir_entry_index = GET_DIR_INDEX(virtual_addr);
+	// NOTE SPECIAL WORKAROUND
+	if (page_tab_index == 0){
+		dest_page_table = page_dir_make_table(page_dir_cur, virtual_addr);
+		if (!dest_page_table){
+			return -EINVAL;
+		}
+		if (dest_page_table->page_table_entry[page_tab_index] & (PAGE_TAB_ENT_PRESENT)){
+			return -EEXIST;
+		}
+		real_addr = (real_addr / PAGE_4KB) * PAGE_4KB;
+		dest_page_table->page_table_entry[page_tab_index] = (real_addr) | flags;
+		return 0;
+	}
+
+	return page_dir_map_4KB(page_dir_cur, virtual_addr, real_addr, flags);
+}
+
+int _page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
+	// auto fit to nearest 4KB
+	int page_tab_index = GET_TAB_INDEX(virtual_addr);
 
 	real_addr = (real_addr / PAGE_4KB) * PAGE_4KB;
 
-	// check that page table is valid and in use
-	if (!(page_directory.page_directory_entry[page_dir_entry_index] & (PAGE_DIR_ENT_PRESENT))){
+	// get the page table the virtual address belongs to
+	page_table_t* dest_page_table = page_dir_make_table(page_dir_cur, virtual_addr);
+	if (!dest_page_table){
 		return -EINVAL;
 	}
-	// get the address of the page table
-	page_table_t* dest_page_table = (page_table_t*)(page_directory.page_directory_entry[page_dir_entry_index] & 0xFFFFF000);
 
 	// check if already exists
 	if (dest_page_table->page_table_entry[page_tab_index] & (PAGE_TAB_ENT_PRESENT)){
@@ -415,60 +1120,119 @@ int _page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags){
 }
 
 int page_dir_delete_entry(uint32_t virtual_addr){
-	// cannot delete dir entries before allocatable ones
-	if (GET_DIR_INDEX(virtual_addr) < ALLOCATABLE_4MB_START_INDEX){
+	// cannot delete kernel dir entries
+	if (GET_DIR_INDEX(virtual_addr) < USER_PAGE_DIR_START_INDEX){
 		return -EINVAL;
 	}
 
-	// if the page dir is not present
-	if (page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] & PAGE_DIR_ENT_PRESENT){
-		page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] -= PAGE_DIR_ENT_PRESENT;
-		return 0;
+	// if the page dir is not present, or refers to a page table
+	if ((page_dir_cur->page_directory_entry[GET_DIR_INDEX(virtual_addr)] &
+		 (PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_4MB)) ==
+		(PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_4MB)){
+		return page_dir_unmap(page_dir_cur, virtual_addr);
 	}else{
 		return -EINVAL;
 	}
 }
 
 int page_tab_delete_entry(uint32_t virtual_addr){
-	// cannot delete page table entries other than manyoushu
-	if (GET_DIR_INDEX(virtual_addr) != 32){
+	// cannot delete kernel page table entries
+	if (GET_DIR_INDEX(virtual_addr) < USER_PAGE_DIR_START_INDEX){
 		return -EINVAL;
 	}
+	return _page_tab_delete_entry(virtual_addr);
+}
 
+int _page_tab_delete_entry(uint32_t virtual_addr){
 	// check valid page dir entry just for ... redundancy
-	if (!(page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] & PAGE_DIR_ENT_PRESENT)){
+	page_table_t* dest_page_table = page_dir_get_table(page_dir_cur, GET_DIR_INDEX(virtual_addr));
+	if (!dest_page_table){
 		return -EINVAL;
 	}
 
-	page_table_t* dest_page_table = (page_table_t*)(page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] & (0xFFFFF000));
 	// if the page table entry is not present
 	if (dest_page_table->page_table_entry[GET_TAB_INDEX(virtual_addr)] & PAGE_TAB_ENT_PRESENT){
-		dest_page_table->page_table_entry[GET_TAB_INDEX(virtual_addr)] -= PAGE_TAB_ENT_PRESENT;
+		dest_page_table->page_table_entry[GET_TAB_INDEX(virtual_addr)] = 0;
 		return 0;
 	}else{
 		return -EINVAL;
 	}
 }
 
-int _page_tab_delete_entry(uint32_t virtual_addr){
-	// check valid page dir entry just for ... redundancy
-	if (!(page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] & PAGE_DIR_ENT_PRESENT)){
-		return -EINVAL;
+void page_flush_tlb(){
+	__asm__ volatile ("movl	%%cr3, %%eax\n\t"
+					  "movl	%%eax, %%cr3\n\t" : : : "eax", "memory");
+}
+
+void page_flush_tlb_global(){
+	uint32_t cr4;
+
+	// clearing PGE drops global entries too, interrupts must not see it off
+	asm volatile ("pushfl\n\t"
+				  "cli\n\t"
+				  "movl	%%cr4, %0\n\t"
+				  "andl	%1, %0\n\t"
+				  "movl	%0, %%cr4\n\t"
+				  "orl	%2, %0\n\t"
+				  "movl	%0, %%cr4\n\t"
+				  "popfl"
+				  : "=&r"(cr4) : "i"(~PAGE_CR4_PGE), "i"(PAGE_CR4_PGE) : "memory", "cc");
+}
+
+void page_flush_tlb_page(uint32_t virtual_addr){
+	asm volatile ("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+}
+
+void page_flush_tlb_range(uint32_t start, uint32_t end){
+	start &= ~(PAGE_4KB - 1);
+	if (end <= start){
+		return;
 	}
+	if ((end - start) / PAGE_4KB > PAGE_FLUSH_MAX){
+		if (GET_DIR_INDEX(start) < USER_PAGE_DIR_START_INDEX){
+			page_flush_tlb_global();
+		}else{
+			page_flush_tlb();
+		}
+		return;
+	}
+	for (; start < end; start += PAGE_4KB){
+		page_flush_tlb_page(start);
+	}
+}
 
-	page_table_t* dest_page_table = (page_table_t*)(page_directory.page_directory_entry[GET_DIR_INDEX(virtual_addr)] & (0xFFFFF000));
-	// if the page table entry is not present
-	if (dest_page_table->page_table_entry[GET_TAB_INDEX(virtual_addr)] & PAGE_TAB_ENT_PRESENT){
-		dest_page_table->page_table_entry[GET_TAB_INDEX(virtual_addr)] -= PAGE_TAB_ENT_PRESENT;
-		return 0;
-	}else{
-		return -EINVAL;
+void page_flush_init(page_flush_t *batch){
+	batch->count = 0;
+	batch->global = 0;
+}
+
+void page_flush_add(page_flush_t *batch, uint32_t virtual_addr){
+	if (GET_DIR_INDEX(virtual_addr) < USER_PAGE_DIR_START_INDEX){
+		batch->global = 1;
+	}
+	if (batch->count < PAGE_FLUSH_MAX){
+		batch->addrs[batch->count] = virtual_addr;
+	}
+	if (batch->count <= PAGE_FLUSH_MAX){
+		batch->count++;
 	}
 }
 
-void page_flush_tlb(){
-	__asm__("movl	%cr3, %eax\n\t"
-			"movl	%eax, %cr3\n\t");
+void page_flush_finish(page_flush_t *batch){
+	int i;
+
+	if (batch->count > PAGE_FLUSH_MAX){
+		if (batch->global){
+			page_flush_tlb_global();
+		}else{
+			page_flush_tlb();
+		}
+	}else{
+		for (i = 0; i < batch->count; i++){
+			page_flush_tlb_page(batch->addrs[i]);
+		}
+	}
+	page_flush_init(batch);
 }
 
 
@@ -8,16 +8,32 @@
 
 #include "../lib.h"
 #include "../errno.h"
+#include "../multiboot.h"
 
-#define MAX_DYNAMIC_4MB_PAGE 63 ///< Maximum of 4MB pages
+#define PAGE_BUDDY_ORDERS	11	///< Buddy orders, 4KB (order 0) ... 4MB (order 10)
+#define PAGE_PHYS_MEM_LIMIT	0x80000000	///< Physical addresses must fit in a positive int
+#define PAGE_MAX_4MB_BLOCKS	((int)(PAGE_PHYS_MEM_LIMIT >> 22))	///< Upper bound of 4MB blocks
+#define PAGE_DIR_MAX		128	///< Maximum number of process page directories
+#define PAGE_RECLAIM_MAX	4	///< Maximum number of registered reclaim hooks
+#define PAGE_FLUSH_MAX		32	///< Pages invalidated one by one before a full TLB flush is cheaper
+
+/**
+ *	Reclaim hook, called when the buddy allocator runs out of memory
+ *
+ *	@param frames: number of 4KB frames the allocator is looking for
+ *	@return the number of frames released to the allocator
+ */
+typedef int (*page_reclaim_t)(int frames);
 
 /**
  * 	Initialize page, initialize physical memory map, and turn on paging
  *
- *	@note initialize video memory & 4-8MB kernel space, reserve 8-CMB for usage,
- * 			and also C-10 MB for 4KB Manyoushu
+ *	@param mbi: multiboot information, used for the physical memory map
+ *	@note initialize video memory & 4-8MB kernel space, and hand the rest of
+ * 			physical memory to the buddy allocator
+ *	@note must be called while the boot information is still identity mapped
  */
-void page_ece391_init();
+void page_ece391_init(multiboot_info_t *mbi);
 
 /**
  * 	Add flags to kernel memory descriptors
@@ -25,9 +41,15 @@ void page_ece391_init();
 void page_kernel_mem_map_init();
 
 /**
- *	Initialize memory descriptors for kernel memory
+ *	Initialize physical frame descriptors and the buddy allocator
+ *
+ *	The descriptor table is sized after the highest usable address in the
+ *	boot memory map, and carved from the first usable region above the
+ *	kernel and boot modules.
+ *
+ *	@param mbi: multiboot information
  */
-void page_phys_mem_map_init();
+void page_phys_mem_map_init(multiboot_info_t *mbi);
 
 /**
  * 	Exposed function for getting memory reference count of
@@ -36,6 +58,16 @@ void page_phys_mem_map_init();
  */
 int get_phys_mem_reference_count(int physical_addr);
 
+/**
+ *	Count the frames referenced more than once, e.g. shared copy-on-write
+ *
+ *	@param frames: filled with the number of shared 4KB frames
+ *	@param saved: filled with the number of 4KB frames that the extra
+ *				  references would need if every reference had its own copy
+ *	@note walks the whole frame table
+ */
+void page_alloc_count_shared(uint32_t *frames, uint32_t *saved);
+
 /**
  *	Turn on paging in the processor
  *
@@ -58,7 +90,7 @@ extern void page_turn_on(int page_directory);
 int page_dir_add_4KB_entry(uint32_t virtual_addr, void* new_page_table, int flags);
 
 /**
- *	Add a 4MB page table to the page directory
+ *	Add a 4MB page to the current page directory
  *
  *	@param virtual_addr: start address of the 4MB space that the page
  *						directory entry is referring to
@@ -70,7 +102,7 @@ int page_dir_add_4KB_entry(uint32_t virtual_addr, void* new_page_table, int flag
 int page_dir_add_4MB_entry(uint32_t virtual_addr, uint32_t real_addr, int flags);
 
 /**
- *	Add a 4KB page entry in the page table
+ *	Add a 4KB page entry in the current page directory
  *
  *	@param virtual_addr: start address of the 4KB space that the page
  *						 table entry is referring to
@@ -94,7 +126,7 @@ int page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags);
 int _page_tab_add_entry(uint32_t virtual_addr, uint32_t real_addr, int flags);
 
 /**
- *	Free a 4MB in the page directory
+ *	Free a 4MB page in the current page directory
  *
  *	@param virtual_addr: virtual address to be freed
  *	@return: 0 on success, negative value for errors
@@ -112,7 +144,7 @@ int page_dir_delete_entry(uint32_t virtual_addr);
 int _page_tab_delete_entry(uint32_t virtual_addr);
 
 /**
- *	Free a 4KB page entry to the page table
+ *	Free a 4KB page entry in the current page directory
  *
  *	@param virtual_addr: virtual address to be freed
  *	@return: 0 on success, negative value for errors
@@ -130,6 +162,86 @@ int page_tab_delete_entry(uint32_t virtual_addr);
  */
 void page_flush_tlb();
 
+/**
+ *	Flush the whole TLB, global kernel pages included
+ *
+ *	@note only needed when many kernel mappings change at once
+ */
+void page_flush_tlb_global();
+
+/**
+ *	Invalidate the TLB entry of a single page
+ *
+ *	@param virtual_addr: address inside the page, for a 4MB page any address
+ *						 inside it drops the whole entry
+ */
+void page_flush_tlb_page(uint32_t virtual_addr);
+
+/**
+ *	Invalidate the TLB entries of a range of pages
+ *
+ *	Up to `PAGE_FLUSH_MAX` pages are invalidated one by one, larger ranges
+ *	flush the whole TLB instead.
+ *
+ *	@param start: first address of the range
+ *	@param end: end of the range
+ */
+void page_flush_tlb_range(uint32_t start, uint32_t end);
+
+/**
+ *	Pages whose mappings changed, invalidated together by `page_flush_finish`
+ */
+typedef struct s_page_flush{
+	uint32_t	addrs[PAGE_FLUSH_MAX];	///< Pages to invalidate
+	int			count;		///< Pages added, more than `PAGE_FLUSH_MAX` flushes everything
+	int			global;		///< Nonzero if a kernel page was added
+} page_flush_t;
+
+/**
+ *	Start an empty batch of TLB invalidations
+ *
+ *	@param batch: the batch
+ */
+void page_flush_init(page_flush_t *batch);
+
+/**
+ *	Add a page to a batch of TLB invalidations
+ *
+ *	@param batch: the batch
+ *	@param virtual_addr: address inside the page
+ */
+void page_flush_add(page_flush_t *batch, uint32_t virtual_addr);
+
+/**
+ *	Invalidate the pages of a batch and empty it
+ *
+ *	@param batch: the batch
+ */
+void page_flush_finish(page_flush_t *batch);
+
+/**
+ *
+ *	allocate a block of 2^order physically contiguous 4KB frames
+ *
+ *	@param order: order of the block, 0 (4KB) to `PAGE_BUDDY_ORDERS`-1 (4MB)
+ *	@return physical address of the block, or the negative of an errno
+ *
+ *	@note the block starts with a reference count of 1, and is released by
+ *		  `page_alloc_free_4KB` on its physical address
+ */
+int page_alloc_order(int order);
+
+/**
+ *	Register a hook that gives frames back under memory pressure
+ *
+ *	When an allocation fails, `page_alloc_order` calls the hooks in
+ *	registration order and retries for as long as they release frames.
+ *
+ *	@param reclaim: the hook
+ *	@return 0 on success, or -ENOSPC if too many hooks are registered
+ */
+int page_alloc_register_reclaim(page_reclaim_t reclaim);
+
 /**
  *
  *	private function to find a usable 4MB page
@@ -212,7 +324,8 @@ int page_alloc_free_4MB(int physical_addr);
  *
  *	@return 0 for success, negative value for error
  *
- *	@note actually decrease the use count of that memory
+ *	@note actually decrease the use count of that memory. The whole block
+ *		  headed by the frame is released when the count drops to zero.
  */
 int page_alloc_free_4KB(int physical_addr);
 
@@ -236,27 +349,192 @@ typedef struct s_page_table{
 
 
 /**
- *	4MB physical memory descriptor
+ *	4KB physical frame descriptor
+ *
+ *	Only the first frame of an allocated or free block carries its order and
+ *	reference count.
  */
-typedef struct s_page_4MB_descriptor{
-	uint32_t				flags;	///< private flags for physical memory administration
-	int 					count;	///< use count or reference count
-	struct s_page_4KB_descriptor* 	pages; ///<  The pages
-} page_4MB_descriptor_t;
+typedef struct s_page_frame{
+	uint16_t	flags;		///< private flags for physical memory administration
+	uint16_t	order;		///< order of the block headed by this frame
+	int 		count;		///< use count or reference count
+	int32_t		prev;		///< previous free block of the same order
+	int32_t		next;		///< next free block of the same order
+} page_frame_t;
 
 /**
- *	4KB physical memory descriptor
+ *	Physical frame allocator counters
  */
-typedef struct s_page_4KB_descriptor{
-	uint32_t 	flags;		///< private flags for physical memory administration
-	int 		count;		///< use count or reference count
-} page_4KB_descriptor_t;
+typedef struct s_page_alloc_stats{
+	uint32_t	total_frames;	///< Frames managed by the buddy allocator
+	uint32_t	free_frames;	///< Frames currently free
+	uint32_t	nr_free[PAGE_BUDDY_ORDERS];		///< Free blocks of each order
+	uint32_t	alloc_count[PAGE_BUDDY_ORDERS];	///< Allocations of each order
+	uint32_t	free_count[PAGE_BUDDY_ORDERS];	///< Releases of each order
+	uint32_t	fail_count[PAGE_BUDDY_ORDERS];	///< Failed allocations of each order
+	uint32_t	split_count;	///< Blocks split to serve a smaller order
+	uint32_t	merge_count;	///< Buddies merged on release
+} page_alloc_stats_t;
+
+/**
+ *	Get a snapshot of the physical frame allocator counters
+ *
+ *	@param stats: buffer to fill
+ */
+void page_alloc_get_stats(page_alloc_stats_t *stats);
+
+/**
+ *	Print the physical frame allocator counters and free lists
+ */
+void page_alloc_print_stats();
+
+/**
+ *	Create a page directory for a process
+ *
+ *	The kernel part of the address space is shared with every other
+ *	directory, the user part is empty except for the global user page.
+ *
+ *	@return the directory, or NULL on failure with errno set
+ */
+page_directory_t *page_dir_create();
+
+/**
+ *	Release a process page directory and all of its page tables
+ *
+ *	@param pd: the directory. The master directory is loaded first if `pd`
+ *			   is the current one.
+ *	@note the mapped physical memory is not released
+ */
+void page_dir_destroy(page_directory_t *pd);
+
+/**
+ *	Remove every user mapping from a page directory, except the global user page
+ *
+ *	@param pd: the directory
+ *	@param keep: address inside a 4MB region whose mapping is kept, or 0
+ */
+void page_dir_clear_user(page_directory_t *pd, uint32_t keep);
+
+/**
+ *	Load a page directory into CR3
+ *
+ *	@param pd: the directory, or NULL for the master kernel directory
+ */
+void page_dir_switch(page_directory_t *pd);
+
+/**
+ *	Get the page directory currently loaded in CR3
+ *
+ *	@return the directory
+ */
+page_directory_t *page_dir_current();
+
+/**
+ *	Map a 4MB page in a page directory
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: virtual address, aligned down to 4MB
+ *	@param real_addr: allocated physical memory, aligned down to 4MB
+ *	@param flags: flags of the page directory entry, must include `PAGE_DIR_ENT_4MB`
+ *	@return: 0 on success, negative value for errors
+ *	@note Will be rejected if the entry already exists
+ */
+int page_dir_map_4MB(page_directory_t *pd, uint32_t virtual_addr, uint32_t real_addr, int flags);
+
+/**
+ *	Map a 4KB page in a page directory, creating the page table if needed
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: virtual address, aligned down to 4KB
+ *	@param real_addr: allocated physical memory, aligned down to 4KB
+ *	@param flags: flags of the page table entry
+ *	@return: 0 on success, negative value for errors
+ *	@note Will be rejected if the entry already exists
+ */
+int page_dir_map_4KB(page_directory_t *pd, uint32_t virtual_addr, uint32_t real_addr, int flags);
+
+/**
+ *	Unmap the user page containing a virtual address in a page directory
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: the virtual address
+ *	@return: 0 on success, negative value for errors
+ */
+int page_dir_unmap(page_directory_t *pd, uint32_t virtual_addr);
+
+/**
+ *	Get the page table entry mapping a virtual address
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: the virtual address
+ *	@return pointer to the entry, or NULL if the address is not covered by
+ *			a page table
+ */
+page_table_entry_t *page_dir_get_pte(page_directory_t *pd, uint32_t virtual_addr);
+
+/**
+ *	Get the page table entry mapping a user address, creating the page table
+ *	if needed
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: the virtual address
+ *	@return pointer to the entry, or NULL if the address is covered by a 4MB
+ *			page or no memory is left
+ */
+page_table_entry_t *page_dir_make_pte(page_directory_t *pd, uint32_t virtual_addr);
+
+/**
+ *	Replace a 4MB user mapping by a page table of 4KB pages
+ *
+ *	The frames of the 4MB block become independent 4KB frames, which can be
+ *	shared and released one by one with `page_alloc_4KB` and
+ *	`page_alloc_free_4KB`.
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: address inside the 4MB page
+ *	@return: 0 on success, -EBUSY if the block is shared, or another
+ *			 negative value for errors
+ */
+int page_dir_split_4MB(page_directory_t *pd, uint32_t virtual_addr);
+
+/**
+ *	Move the mapping of a 4MB user region to another 4MB region
+ *
+ *	@param pd: the directory
+ *	@param from: address inside the region currently mapped
+ *	@param to: address inside the destination region. A page table there is
+ *			   released, but not the memory it maps.
+ *	@return: 0 on success, negative value for errors
+ */
+int page_dir_move(page_directory_t *pd, uint32_t from, uint32_t to);
+
+/**
+ *	Get the shared zero frame
+ *
+ *	The frame is part of the kernel image. It is not reference counted, and
+ *	must only be mapped read-only in user space.
+ *
+ *	@return physical address of the frame
+ */
+uint32_t page_zero_frame();
+
+/**
+ *	Release the page table covering a user address
+ *
+ *	@param pd: the directory
+ *	@param virtual_addr: address inside the 4MB space of the page table
+ *	@return: 0 on success, negative value for errors
+ *	@note the mapped physical memory is not released
+ */
+int page_dir_unmap_table(page_directory_t *pd, uint32_t virtual_addr);
 
 /*
  *	flags for physical memory map
  */
 #define PAGE_DES_KERNEL		0x02	///< dadada
 #define	PAGE_DES_RESERVE	0x04	///< dadada
+#define PAGE_DES_FREE		0x08	///< frame heads a block on a buddy free list
+#define PAGE_DES_RAM		0x10	///< frame is usable RAM managed by the buddy allocator
 /*
  *	4KB page directory entry
  *
@@ -318,6 +596,13 @@ typedef struct s_page_4KB_descriptor{
 #define	PAGE_TAB_ENT_USER				0x04	///<flag, as name suggested
 #define PAGE_TAB_ENT_SUPERVISOR			0x00	///<flag, as name suggested
 
+#define PAGE_TAB_ENT_ACCESSED			0x20	///<flag, set by the processor on access
+#define PAGE_TAB_ENT_DIRTY				0x40	///<flag, set by the processor on write
+
 #define PAGE_TAB_ENT_GLOBAL				0x100	///<flag, as name suggested
 
+#define PAGE_TAB_ENT_COW				0x200	///<available bit, page is copy-on-write
+#define PAGE_TAB_ENT_ZRAM				0x400	///<available bit, swapped page is held compressed in memory
+#define PAGE_TAB_ENT_SWAP				0x800	///<available bit, not present page is in swap
+
 #endif
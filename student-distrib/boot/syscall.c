@@ -6,6 +6,11 @@
 #include "../fs/vfs.h"
 #include "../proc/task.h"
 #include "../proc/signal.h"
+#include "../proc/mman.h"
+#include "../proc/swap.h"
+#include "../proc/scheduler.h"
+#include "../timer.h"
+#include "../clock.h"
 
 #include "../../libc/src/syscalls.h" // Definitions from libc
 #include "../terminal_driver/terminal_out_driver.h"
@@ -86,6 +91,12 @@ void syscall_register_all() {
 	syscall_register(SYSCALL_BRK, syscall_brk);
 	syscall_register(SYSCALL_SBRK, syscall_sbrk);
 
+	// Memory mappings
+	syscall_register(SYSCALL_MMAP, syscall_mmap);
+	syscall_register(SYSCALL_MUNMAP, syscall_munmap);
+	syscall_register(SYSCALL_MSYNC, syscall_msync);
+	syscall_register(SYSCALL_SWAPON, syscall_swapon);
+
 	// Signals
 	syscall_register(SYSCALL_KILL, syscall_kill);
 	syscall_register(SYSCALL_SIGACTION, syscall_sigaction);
@@ -112,5 +123,16 @@ void syscall_register_all() {
 	syscall_register(SYSCALL_SETGID, syscall_setgid);
 	syscall_register(SYSCALL_GETUID, syscall_getuid);
 	syscall_register(SYSCALL_GETGID, syscall_getgid);
+
+	// Scheduling
+	syscall_register(SYSCALL_GETPRIORITY, syscall_getpriority);
+	syscall_register(SYSCALL_SETPRIORITY, syscall_setpriority);
+	syscall_register(SYSCALL_SCHED_SLICE, syscall_sched_slice);
+
+	// Timers
+	syscall_register(SYSCALL_USLEEP, syscall_usleep);
+	syscall_register(SYSCALL_NANOSLEEP, syscall_nanosleep);
+	syscall_register(SYSCALL_CLOCK_GETTIME, syscall_clock_gettime);
+	syscall_register(SYSCALL_GETTIMEOFDAY, syscall_gettimeofday);
 	
 }
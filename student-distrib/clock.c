@@ -0,0 +1,235 @@
+#include "clock.h"
+
+#include "pit.h"
+#include "rtc.h"
+#include "timer.h"
+#include "lib.h"
+#include "errno.h"
+#include "proc/signal.h"
+#include "proc/scheduler.h"
+#include "fs/fs_devfs.h"
+#include "k_mem/kmalloc.h"
+#include "../libc/include/time.h"
+#include "../libc/include/sys/time.h"
+
+#define CLOCK_NS_PER_SEC	1000000000
+#define CLOCK_NS_PER_2TICKS	(2000000000 / TIMER_HZ)	// exact for TIMER_HZ 1024
+#define CLOCK_SLEEP_CHUNK	(TIMER_MAX_DELAY / TIMER_HZ - 1)	// longest sleep, in s
+
+static uint32_t clock_khz = 0;	// TSC frequency, 0 if not used
+static uint32_t clock_mult = 0;	// ns = cycles * clock_mult >> CLOCK_SHIFT
+static uint64_t clock_base;		// TSC at boot
+static uint32_t clock_epoch;	// seconds since the Epoch at boot
+static file_operations_t clock_uptime_fop;
+
+/**
+ *	Divide a 64-bit number by a 32-bit one
+ *
+ *	Two `divl` instead of a call to libgcc's `__udivdi3`, which every clock
+ *	read would otherwise make to split nanoseconds into seconds.
+ *
+ *	@param n: the dividend, replaced by the quotient
+ *	@return the remainder
+ */
+static uint32_t clock_div64(uint64_t *n, uint32_t base) {
+	uint32_t hi = *n >> 32, lo = *n, q_hi, q_lo, r;
+
+	q_hi = hi / base;
+	r = hi % base;
+	asm ("divl %4" : "=a" (q_lo), "=d" (r) : "a" (lo), "d" (r), "rm" (base));
+	*n = ((uint64_t)q_hi << 32) | q_lo;
+	return r;
+}
+
+/**
+ *	Measure the TSC against a PIT one-shot count
+ */
+static void clock_calibrate() {
+	uint32_t eax = 1, ebx, ecx, edx, counts, cycles;
+	uint64_t start, end, window_ns, n;
+
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	if (!(edx & CLOCK_CPUID_TSC)) {
+		printf("CLOCK: no TSC, the clocks count timer ticks\n");
+		return;
+	}
+	pit_oneshot(PIT_COUNT_MAX);
+	start = clock_tsc();
+	while ((counts = pit_elapsed()) < PIT_FREQ / 1000 * CLOCK_CALIBRATE_MS);
+	end = clock_tsc();
+
+	cycles = end - start;
+	window_ns = (uint64_t)counts * CLOCK_NS_PER_SEC;
+	clock_div64(&window_ns, PIT_FREQ);
+	n = (uint64_t)cycles * 1000000;
+	clock_div64(&n, (uint32_t)window_ns);
+	clock_khz = n;
+	n = window_ns << CLOCK_SHIFT;
+	clock_div64(&n, cycles);
+	clock_mult = n;
+}
+
+void clock_init() {
+	clock_calibrate();
+	clock_base = clock_tsc();
+	clock_epoch = rtc_cmos_time();
+}
+
+uint32_t clock_tsc_khz() {
+	return clock_khz;
+}
+
+uint64_t clock_monotonic_ns() {
+	uint64_t cycles;
+
+	if (!clock_mult) {
+		return (uint64_t)timer_now() * CLOCK_NS_PER_2TICKS >> 1;
+	}
+	cycles = clock_tsc() - clock_base;
+	// 64 by 32 bits product, in two halves so that it does not overflow
+	return (((cycles >> 32) * clock_mult) << (32 - CLOCK_SHIFT)) +
+		   (((cycles & 0xFFFFFFFF) * clock_mult) >> CLOCK_SHIFT);
+}
+
+/**
+ *	Split the monotonic clock in seconds and nanoseconds
+ */
+static void clock_monotonic(uint32_t *sec, uint32_t *nsec) {
+	uint64_t ns = clock_monotonic_ns();
+
+	*nsec = clock_div64(&ns, CLOCK_NS_PER_SEC);
+	*sec = ns;
+}
+
+int syscall_clock_gettime(int clock_id, int tpp, int c) {
+	struct timespec *tp = (struct timespec *)tpp;
+	uint32_t sec, nsec;
+
+	if (clock_id != CLOCK_MONOTONIC && clock_id != CLOCK_REALTIME) {
+		return -EINVAL;
+	}
+	if (!tp) {
+		return -EFAULT;
+	}
+	clock_monotonic(&sec, &nsec);
+	if (clock_id == CLOCK_REALTIME) {
+		sec += clock_epoch;
+	}
+	tp->tv_sec = sec;
+	tp->tv_nsec = nsec;
+	return 0;
+}
+
+int syscall_gettimeofday(int tvp, int tzp, int c) {
+	struct timeval *tv = (struct timeval *)tvp;
+	uint32_t sec, nsec;
+
+	if (!tv) {
+		return -EFAULT;
+	}
+	clock_monotonic(&sec, &nsec);
+	tv->tv_sec = sec + clock_epoch;
+	tv->tv_usec = nsec / 1000;
+	return 0;
+}
+
+int syscall_nanosleep(int reqp, int remp, int c) {
+	struct timespec *req = (struct timespec *)reqp;
+	struct timespec *rem = (struct timespec *)remp;
+	uint32_t sec, ticks, chunk, left;
+
+	if (!req) {
+		return -EFAULT;
+	}
+	if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= CLOCK_NS_PER_SEC) {
+		return -EINVAL;
+	}
+	if (!req->tv_sec && !req->tv_nsec) {
+		return 0;
+	}
+	sec = req->tv_sec;
+	// Round up to ticks, plus one as the current tick is partly over
+	ticks = (2 * (uint32_t)req->tv_nsec + CLOCK_NS_PER_2TICKS - 1) /
+			CLOCK_NS_PER_2TICKS + 1;
+	do {
+		// Longer sleeps than the timers allow are done in several steps
+		chunk = (sec > CLOCK_SLEEP_CHUNK) ? CLOCK_SLEEP_CHUNK : sec;
+		sec -= chunk;
+		left = timer_sleep(ticks + chunk * TIMER_HZ);
+		if (left) {
+			if (rem) {
+				rem->tv_sec = sec + left / TIMER_HZ;
+				rem->tv_nsec = (left % TIMER_HZ) * CLOCK_NS_PER_2TICKS / 2;
+			}
+			signal_syscall_return(-EINTR);
+		}
+		ticks = 0;
+	} while (sec > 0);
+	return 0;
+}
+
+/**
+ *	Append a time in ns to a report as seconds with two decimals
+ */
+static void clock_uptime_put(clock_uptime_t *u, uint64_t ns) {
+	int8_t num[12];
+	uint32_t cs;
+
+	// Hundredths of a second
+	clock_div64(&ns, CLOCK_NS_PER_SEC / 100);
+	cs = clock_div64(&ns, 100);
+	itoa((uint32_t)ns, num, 10);
+	strcpy((int8_t *)u->buf + u->len, num);
+	u->len += strlen(num);
+	u->buf[u->len++] = '.';
+	u->buf[u->len++] = '0' + cs / 10;
+	u->buf[u->len++] = '0' + cs % 10;
+}
+
+int clock_driver_register() {
+	clock_uptime_fop.open = &clock_uptime_open;
+	clock_uptime_fop.release = &clock_uptime_release;
+	clock_uptime_fop.read = &clock_uptime_read;
+	clock_uptime_fop.write = NULL;
+	clock_uptime_fop.readdir = NULL;
+	return devfs_register_driver("uptime", &clock_uptime_fop);
+}
+
+int clock_uptime_open(inode_t *inode, file_t *file) {
+	clock_uptime_t *u;
+
+	u = kmalloc(sizeof(clock_uptime_t));
+	if (!u) {
+		return -ENOMEM;
+	}
+	u->len = 0;
+	clock_uptime_put(u, clock_monotonic_ns());
+	u->buf[u->len++] = ' ';
+	clock_uptime_put(u, scheduler_idle_ns());
+	u->buf[u->len++] = '\n';
+	file->private_data = (int)u;
+	return 0;
+}
+
+int clock_uptime_release(inode_t *inode, file_t *file) {
+	kfree((void *)file->private_data);
+	file->private_data = 0;
+	return 0;
+}
+
+ssize_t clock_uptime_read(file_t *file, uint8_t *buf, size_t count, off_t *offset) {
+	clock_uptime_t *u = (clock_uptime_t *)file->private_data;
+
+	if (!u) {
+		return -EBADF;
+	}
+	if (*offset >= u->len) {
+		return 0;
+	}
+	if (count > u->len - *offset) {
+		count = u->len - *offset;
+	}
+	memcpy(buf, u->buf + *offset, count);
+	*offset += count;
+	return count;
+}
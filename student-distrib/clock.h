@@ -0,0 +1,130 @@
+/**
+ *	@file clock.h
+ *
+ *	System clocks
+ *
+ *	The monotonic clock counts the nanoseconds since boot with the time stamp
+ *	counter, whose rate is measured against the PIT by `clock_init`. Without
+ *	a TSC, it falls back to the timer ticks (timer.h). The realtime clock
+ *	adds the wall-clock time read from the CMOS clock at boot.
+ *
+ *	/dev/uptime reads as the seconds since boot and the seconds spent in the
+ *	idle task, with two decimals, as /proc/uptime does on Linux.
+ */
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+#include "fs/vfs.h"
+
+#define CLOCK_CALIBRATE_MS	50		///< Length of the TSC calibration
+#define CLOCK_SHIFT			22		///< Fixed point of the cycles to ns factor
+#define CLOCK_CPUID_TSC		(1 << 4)	///< CPUID.1:EDX, time stamp counter
+#define CLOCK_UPTIME_SIZE	32		///< Size of the report of an open /dev/uptime
+
+/**
+ *	Report of an open /dev/uptime file
+ */
+typedef struct s_clock_uptime {
+	uint32_t len;					///< Length of the report
+	char buf[CLOCK_UPTIME_SIZE];	///< Report text
+} clock_uptime_t;
+
+/**
+ *	Read the time stamp counter
+ *
+ *	@return the cycles since the CPU was reset
+ */
+static inline uint64_t clock_tsc() {
+	uint32_t lo, hi;
+
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ *	Calibrate the TSC and read the wall-clock time
+ *
+ *	@note must run before `timer_init`, it uses the PIT
+ */
+void clock_init();
+
+/**
+ *	Rate of the TSC
+ *
+ *	@return the frequency in kHz, or 0 if the TSC is not used
+ */
+uint32_t clock_tsc_khz();
+
+/**
+ *	Time since boot
+ *
+ *	@return the nanoseconds elapsed since `clock_init`
+ */
+uint64_t clock_monotonic_ns();
+
+/**
+ *	clock_gettime system call
+ *
+ *	@param clock_id: `CLOCK_MONOTONIC` or `CLOCK_REALTIME`
+ *	@param tpp: the `struct timespec` to fill
+ *	@return 0, -EINVAL for an unknown clock, or -EFAULT
+ */
+int syscall_clock_gettime(int clock_id, int tpp, int c);
+
+/**
+ *	gettimeofday system call
+ *
+ *	@param tvp: the `struct timeval` to fill with the realtime clock
+ *	@param tzp: ignored
+ *	@return 0, or -EFAULT
+ */
+int syscall_gettimeofday(int tvp, int tzp, int c);
+
+/**
+ *	nanosleep system call
+ *
+ *	@param reqp: the `struct timespec` to sleep for
+ *	@param remp: if not NULL, receives the time left when interrupted
+ *	@return 0, -EINVAL, -EFAULT, or -EINTR if interrupted by a signal
+ *	@note sleeps at least the requested time, rounded up to timer ticks
+ */
+int syscall_nanosleep(int reqp, int remp, int c);
+
+/**
+ *	Register the uptime driver in devfs
+ *
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int clock_driver_register();
+
+/**
+ *	Take a snapshot of the uptime and idle time for a newly opened file
+ *
+ *	@param inode: the device i-node
+ *	@param file: the file
+ *	@return 0 on success, or -ENOMEM
+ */
+int clock_uptime_open(inode_t *inode, file_t *file);
+
+/**
+ *	Release the snapshot of a file
+ *
+ *	@param inode: the device i-node
+ *	@param file: the file
+ *	@return 0
+ */
+int clock_uptime_release(inode_t *inode, file_t *file);
+
+/**
+ *	Read the report
+ *
+ *	@param file: the file
+ *	@param buf: buffer to fill
+ *	@param count: size of `buf`
+ *	@param offset: position in the report, advanced by the bytes read
+ *	@return the number of bytes read, 0 at the end of the report
+ */
+ssize_t clock_uptime_read(file_t *file, uint8_t *buf, size_t count, off_t *offset);
+
+#endif
@@ -4,6 +4,7 @@
 #include "../lib.h"
 #include "../proc/task.h"
 #include "file_lookup.h"
+#include "page_cache.h"
 
 #include "../../libc/src/syscalls.h" // Definitions from libc
 
@@ -221,6 +222,7 @@ int syscall_umount(int targetaddr, int b, int c) {
 				// There are open files
 				return -EBUSY;
 			}
+			page_cache_invalidate_sb(fstab_mnt[i].sb);
 			fstab_mnt[i].sb->fstype->kill_sb(fstab_mnt[i].sb);
 			fstab_mnt[i].mountpoint[0] = '\0';
 			return 0;
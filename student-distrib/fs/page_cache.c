@@ -0,0 +1,225 @@
+#include "page_cache.h"
+
+#include "../lib.h"
+#include "../errno.h"
+#include "../k_mem/kmalloc.h"
+
+static kmem_cache_t *page_cache_page_cache;	// page_cache_page_t objects
+static kmem_cache_t *page_cache_inode_cache;	// page_cache_inode_t objects
+
+static page_cache_inode_t *page_cache_files = NULL;	// files with cached pages
+
+static page_cache_page_t *page_cache_lru_head = NULL;	// most recently used
+static page_cache_page_t *page_cache_lru_tail = NULL;	// least recently used
+
+static uint32_t page_cache_nr_pages = 0;	// pages held by the cache
+
+/**
+ *	Link a page at the head of the LRU list
+ */
+static void page_cache_lru_add(page_cache_page_t *page) {
+	page->lru_prev = NULL;
+	page->lru_next = page_cache_lru_head;
+	if (page_cache_lru_head) {
+		page_cache_lru_head->lru_prev = page;
+	} else {
+		page_cache_lru_tail = page;
+	}
+	page_cache_lru_head = page;
+}
+
+/**
+ *	Remove a page from the LRU list
+ */
+static void page_cache_lru_del(page_cache_page_t *page) {
+	if (page->lru_prev) {
+		page->lru_prev->lru_next = page->lru_next;
+	} else {
+		page_cache_lru_head = page->lru_next;
+	}
+	if (page->lru_next) {
+		page->lru_next->lru_prev = page->lru_prev;
+	} else {
+		page_cache_lru_tail = page->lru_prev;
+	}
+	page->lru_prev = page->lru_next = NULL;
+}
+
+/**
+ *	Find the cache entry of a file
+ *
+ *	@param create: allocate the entry if the file has none
+ *	@return the entry, or NULL if not found or out of memory
+ */
+static page_cache_inode_t *page_cache_file(inode_t *inode, int create) {
+	page_cache_inode_t *file;
+
+	for (file = page_cache_files; file; file = file->next) {
+		if (file->sb == inode->sb && file->ino == inode->ino) {
+			return file;
+		}
+	}
+	if (!create || !page_cache_inode_cache) {
+		return NULL;
+	}
+	file = kmem_cache_alloc(page_cache_inode_cache);
+	if (!file) {
+		return NULL;
+	}
+	file->sb = inode->sb;
+	file->ino = inode->ino;
+	file->size = inode->size;
+	file->mtime = inode->mtime;
+	file->pages = NULL;
+	file->next = page_cache_files;
+	page_cache_files = file;
+	return file;
+}
+
+/**
+ *	Drop a file and all its pages from the cache
+ */
+static void page_cache_file_drop(page_cache_inode_t *file) {
+	page_cache_inode_t **link;
+	page_cache_page_t *page;
+
+	while ((page = file->pages)) {
+		file->pages = page->next;
+		page_cache_lru_del(page);
+		page_alloc_free_4KB(page->paddr);
+		kmem_cache_free(page_cache_page_cache, page);
+		page_cache_nr_pages--;
+	}
+	for (link = &page_cache_files; *link; link = &(*link)->next) {
+		if (*link == file) {
+			*link = file->next;
+			break;
+		}
+	}
+	kmem_cache_free(page_cache_inode_cache, file);
+}
+
+void page_cache_init() {
+	if (!page_cache_page_cache) {
+		page_cache_page_cache = kmem_cache_create("page_cache",
+								sizeof(page_cache_page_t));
+		page_cache_inode_cache = kmem_cache_create("page_cache_inode",
+								sizeof(page_cache_inode_t));
+	}
+	page_alloc_register_reclaim(&page_cache_reclaim);
+}
+
+uint32_t page_cache_find(inode_t *inode, uint32_t offset, uint32_t start, uint32_t end) {
+	page_cache_inode_t *file;
+	page_cache_page_t *page;
+
+	file = page_cache_file(inode, 0);
+	if (!file) {
+		return 0;
+	}
+	if (file->size != inode->size || file->mtime != inode->mtime) {
+		// File changed since its pages were cached
+		page_cache_file_drop(file);
+		return 0;
+	}
+	for (page = file->pages; page; page = page->next) {
+		if (page->offset == offset && page->start == start && page->end == end) {
+			if (page_alloc_4KB((int *)&(page->paddr)) != 0) {
+				return 0;
+			}
+			page_cache_lru_del(page);
+			page_cache_lru_add(page);
+			return page->paddr;
+		}
+	}
+	return 0;
+}
+
+int page_cache_add(inode_t *inode, uint32_t offset, uint32_t start, uint32_t end,
+				   uint32_t paddr) {
+	page_cache_inode_t *file;
+	page_cache_page_t *page;
+	int ret;
+
+	if (!page_cache_page_cache || (offset & 0xFFF) || start > end || end > (4<<10)) {
+		return -EINVAL;
+	}
+	// Allocate first, the allocation may reclaim pages and drop files
+	page = kmem_cache_alloc(page_cache_page_cache);
+	if (!page) {
+		return -ENOMEM;
+	}
+	file = page_cache_file(inode, 1);
+	if (!file) {
+		kmem_cache_free(page_cache_page_cache, page);
+		return -ENOMEM;
+	}
+	ret = page_alloc_4KB((int *)&paddr);
+	if (ret != 0) {
+		kmem_cache_free(page_cache_page_cache, page);
+		if (!file->pages) {
+			page_cache_file_drop(file);
+		}
+		return ret;
+	}
+	page->offset = offset;
+	page->start = start;
+	page->end = end;
+	page->paddr = paddr;
+	page->owner = file;
+	page->next = file->pages;
+	file->pages = page;
+	page_cache_lru_add(page);
+	page_cache_nr_pages++;
+	return 0;
+}
+
+void page_cache_invalidate(inode_t *inode) {
+	page_cache_inode_t *file;
+
+	file = page_cache_file(inode, 0);
+	if (file) {
+		page_cache_file_drop(file);
+	}
+}
+
+void page_cache_invalidate_sb(super_block_t *sb) {
+	page_cache_inode_t *file, *next;
+
+	for (file = page_cache_files; file; file = next) {
+		next = file->next;
+		if (file->sb == sb) {
+			page_cache_file_drop(file);
+		}
+	}
+}
+
+int page_cache_reclaim(int frames) {
+	page_cache_page_t *page, *prev, **link;
+	page_cache_inode_t *file;
+	int freed = 0;
+
+	for (page = page_cache_lru_tail; page && freed < frames; page = prev) {
+		prev = page->lru_prev;
+		if (get_phys_mem_reference_count(page->paddr) != 1) {
+			// Still mapped by a process
+			continue;
+		}
+		file = page->owner;
+		for (link = &file->pages; *link != page; link = &(*link)->next);
+		*link = page->next;
+		page_cache_lru_del(page);
+		page_alloc_free_4KB(page->paddr);
+		kmem_cache_free(page_cache_page_cache, page);
+		page_cache_nr_pages--;
+		freed++;
+		if (!file->pages) {
+			page_cache_file_drop(file);
+		}
+	}
+	return freed;
+}
+
+uint32_t page_cache_pages() {
+	return page_cache_nr_pages;
+}
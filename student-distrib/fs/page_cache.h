@@ -0,0 +1,113 @@
+/**
+ *	@file fs/page_cache.h
+ *
+ *	Page cache for read-only executable segments
+ *
+ *	Frames holding the non-writable PT_LOAD segments of an executable are kept
+ *	per i-node, so that later execs of the same file map them read-only and
+ *	shared instead of reading the file again. The cache holds one reference on
+ *	each frame, which keeps the pages around after the last process using
+ *	them exits. Pages no process maps any more are evicted, least recently
+ *	used first, when the frame allocator runs out of memory.
+ */
+#ifndef FS_PAGE_CACHE_H
+#define FS_PAGE_CACHE_H
+
+#include "vfs.h"
+
+struct s_page_cache_inode;
+
+/**
+ *	A cached 4KB page of a file
+ *
+ *	Bytes of the page outside [start, end) are zero, so that pages cut from
+ *	segments with different bounds are never confused.
+ */
+typedef struct s_page_cache_page {
+	uint32_t offset;	///< File offset of the page, 4KB aligned
+	uint16_t start;		///< First byte of the page holding file data
+	uint16_t end;		///< End of the file data in the page
+	uint32_t paddr;		///< Physical address of the frame
+	struct s_page_cache_inode *owner;	///< File the page belongs to
+	struct s_page_cache_page *next;		///< Next page of the same file
+	struct s_page_cache_page *lru_prev;	///< More recently used page
+	struct s_page_cache_page *lru_next;	///< Less recently used page
+} page_cache_page_t;
+
+/**
+ *	Cached pages of a file
+ */
+typedef struct s_page_cache_inode {
+	super_block_t *sb;	///< File system of the file
+	ino_t ino;			///< I-number of the file
+	off_t size;			///< Size of the file when its pages were cached
+	time_t mtime;		///< Modification date when its pages were cached
+	page_cache_page_t *pages;			///< Cached pages
+	struct s_page_cache_inode *next;	///< Next file in the cache
+} page_cache_inode_t;
+
+/**
+ *	Initialize the page cache and register it with the frame allocator
+ */
+void page_cache_init();
+
+/**
+ *	Look up a cached page of a file
+ *
+ *	@param inode: i-node of the file
+ *	@param offset: file offset of the page, 4KB aligned
+ *	@param start: first byte of the page holding file data
+ *	@param end: end of the file data in the page
+ *	@return the physical address of the frame with a reference added for the
+ *			caller, or 0 if the page is not cached
+ */
+uint32_t page_cache_find(inode_t *inode, uint32_t offset, uint32_t start, uint32_t end);
+
+/**
+ *	Add a page of a file to the cache
+ *
+ *	The cache takes its own reference on the frame. The frame must not be
+ *	written after it has been added.
+ *
+ *	@param inode: i-node of the file
+ *	@param offset: file offset of the page, 4KB aligned
+ *	@param start: first byte of the page holding file data
+ *	@param end: end of the file data in the page
+ *	@param paddr: physical address of the frame holding the page
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int page_cache_add(inode_t *inode, uint32_t offset, uint32_t start, uint32_t end,
+				   uint32_t paddr);
+
+/**
+ *	Drop all cached pages of a file
+ *
+ *	Frames still mapped by processes are released when they are unmapped.
+ *
+ *	@param inode: i-node of the file
+ */
+void page_cache_invalidate(inode_t *inode);
+
+/**
+ *	Drop all cached pages of a file system
+ *
+ *	@param sb: super block of the file system
+ */
+void page_cache_invalidate_sb(super_block_t *sb);
+
+/**
+ *	Evict cached pages that no process maps
+ *
+ *	@param frames: number of frames wanted
+ *	@return the number of frames released
+ */
+int page_cache_reclaim(int frames);
+
+/**
+ *	Get the number of pages held by the cache
+ *
+ *	@return the number of cached 4KB pages
+ */
+uint32_t page_cache_pages();
+
+#endif
@@ -4,6 +4,7 @@
 #include "../errno.h"
 
 #include "file_lookup.h"
+#include "page_cache.h"
 #include "../proc/task.h"
 
 #include "../../libc/src/syscalls.h" // Definitions from libc
@@ -234,6 +235,10 @@ int syscall_write(int fd, int bufaddr, int count) {
 	if (!file->f_op->write) {
 		return -ENOSYS;
 	}
+	if (file->inode->file_type == FTYPE_REGULAR) {
+		// Cached executable pages would go stale
+		page_cache_invalidate(file->inode);
+	}
 	// TODO: no permission check
 	return (*file->f_op->write)(file, (uint8_t *) bufaddr, count, &(file->pos));
 }
@@ -701,6 +706,10 @@ int syscall_unlink(int pathp, int b, int c) {
 	}
 
 	inode_from->link_count--;
+	if (inode_from->link_count <= 0) {
+		// The i-number may be reused by a new file
+		page_cache_invalidate(inode_from);
+	}
 
 	// Success
 	(*inode_to->sb->s_op->write_inode)(inode_to);
@@ -860,6 +869,7 @@ int syscall_truncate(int fd, int length, int c) {
 	if (!file->inode->i_op->truncate) {
 		return -ENOSYS;
 	}
+	page_cache_invalidate(file->inode);
 	orig_length = file->inode->size;
 	file->inode->size = length;
 	ret = (*file->inode->i_op->truncate)(file->inode);
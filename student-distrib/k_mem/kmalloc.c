@@ -1,82 +1,516 @@
 #include "kmalloc.h"
 
-static struct memory_list mem_info[SLAB_NUM];
-static struct memory_list *free_list;
-static struct memory_list *alloc_list;
-
 static char status = 0;								// indicate if memory pool is initialized
 static int 	start_addr;
 static int 	cur_addr = 0;							// indicate virtual addr for next allocated starting page addr
+static uint32_t kmem_chunk_phys[KMEM_POOL / (4 * MEGA_BYTE)];	// physical address of each mapped 4MB chunk
+
+static page_table_t kmem_run_tables[KMEM_RUN_SIZE / (4 * MEGA_BYTE)];	// page run mappings
+static uint32_t kmem_run_map[KMEM_RUN_PAGES / 32];	// bitmap of used pages in the run region
+static uint16_t kmem_run_len[KMEM_RUN_PAGES];	// length of the run starting at each page
+
+static kmem_block_t *kmem_heap_free[KMEM_TLSF_FL_COUNT][KMEM_TLSF_SL_COUNT];	// free lists
+static uint32_t kmem_heap_fl_map = 0;					// non-empty first level classes
+static uint32_t kmem_heap_sl_map[KMEM_TLSF_FL_COUNT];	// non-empty second level classes
+static uint32_t kmem_heap_chunks = 0;					// bitmap of pool chunks in the heap
+
+static kmalloc_stats_t kmalloc_counters;
+
+static kmem_cache_t *kmalloc_caches[KMALLOC_NUM_CLASSES];	// 16 B ... 2 KB
+static const char *kmalloc_cache_names[KMALLOC_NUM_CLASSES] = {
+	"kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+/**
+ *	Get the size class serving an allocation
+ *
+ *	@return index into `kmalloc_caches`, or -1 if the size is too large
+ */
+static int kmalloc_size_class(size_t size) {
+	int class = 0;
+	size_t class_size = KMALLOC_MIN_SIZE;
+
+	if (size > KMALLOC_MAX_SIZE) {
+		return -1;
+	}
+	while (class_size < size) {
+		class_size <<= 1;
+		class++;
+	}
+	return class;
+}
+
+/**
+ *	Index of the least significant set bit of a nonzero word
+ */
+static inline int kmem_ffs(uint32_t word) {
+	int bit;
+	asm ("bsfl %1, %0" : "=r" (bit) : "rm" (word) : "cc");
+	return bit;
+}
+
+/**
+ *	Index of the most significant set bit of a nonzero word
+ */
+static inline int kmem_fls(uint32_t word) {
+	int bit;
+	asm ("bsrl %1, %0" : "=r" (bit) : "rm" (word) : "cc");
+	return bit;
+}
+
+static inline uint32_t kmem_block_size(kmem_block_t *block) {
+	return block->size & ~KMEM_BLOCK_FLAGS;
+}
+
+static inline kmem_block_t *kmem_block_next(kmem_block_t *block) {
+	return (kmem_block_t *)((uint32_t)block + KMEM_BLOCK_HEADER + kmem_block_size(block));
+}
+
+static inline void *kmem_block_payload(kmem_block_t *block) {
+	return (void *)((uint32_t)block + KMEM_BLOCK_HEADER);
+}
+
+/**
+ *	Get the free list class of a block size
+ */
+static void kmem_heap_class(uint32_t size, int *fl, int *sl) {
+	if (size < KMEM_TLSF_SMALL) {
+		*fl = 0;
+		*sl = size / (KMEM_TLSF_SMALL / KMEM_TLSF_SL_COUNT);
+	} else {
+		*fl = kmem_fls(size);
+		*sl = (size >> (*fl - KMEM_TLSF_SL_LOG2)) ^ KMEM_TLSF_SL_COUNT;
+		*fl -= KMEM_TLSF_FL_SHIFT - 1;
+	}
+}
+
+/**
+ *	Link a free block into the list of its class
+ */
+static void kmem_heap_insert(kmem_block_t *block) {
+	int fl, sl;
+
+	kmem_heap_class(kmem_block_size(block), &fl, &sl);
+	block->prev_free = NULL;
+	block->next_free = kmem_heap_free[fl][sl];
+	if (block->next_free) {
+		block->next_free->prev_free = block;
+	}
+	kmem_heap_free[fl][sl] = block;
+	kmem_heap_fl_map |= 1 << fl;
+	kmem_heap_sl_map[fl] |= 1 << sl;
+	kmalloc_counters.free_bytes += kmem_block_size(block);
+	kmalloc_counters.free_blocks++;
+}
+
+/**
+ *	Unlink a free block from the list of its class
+ */
+static void kmem_heap_remove(kmem_block_t *block) {
+	int fl, sl;
+
+	kmem_heap_class(kmem_block_size(block), &fl, &sl);
+	if (block->prev_free) {
+		block->prev_free->next_free = block->next_free;
+	} else {
+		kmem_heap_free[fl][sl] = block->next_free;
+		if (!block->next_free) {
+			kmem_heap_sl_map[fl] &= ~(1 << sl);
+			if (!kmem_heap_sl_map[fl]) {
+				kmem_heap_fl_map &= ~(1 << fl);
+			}
+		}
+	}
+	if (block->next_free) {
+		block->next_free->prev_free = block->prev_free;
+	}
+	kmalloc_counters.free_bytes -= kmem_block_size(block);
+	kmalloc_counters.free_blocks--;
+}
+
+/**
+ *	Find a free block of at least `size` bytes
+ *
+ *	The size is rounded up to the next class boundary, so that any block of
+ *	the class found is large enough.
+ *
+ *	@return the block, still linked, or NULL if none is large enough
+ */
+static kmem_block_t *kmem_heap_find(uint32_t size) {
+	uint32_t map;
+	int fl, sl;
+
+	if (size >= KMEM_TLSF_SMALL) {
+		size += (1 << (kmem_fls(size) - KMEM_TLSF_SL_LOG2)) - 1;
+	}
+	kmem_heap_class(size, &fl, &sl);
+	if (fl >= KMEM_TLSF_FL_COUNT) {
+		return NULL;
+	}
+	map = kmem_heap_sl_map[fl] & (~0U << sl);
+	if (!map) {
+		if (fl + 1 >= KMEM_TLSF_FL_COUNT) {
+			return NULL;
+		}
+		map = kmem_heap_fl_map & (~0U << (fl + 1));
+		if (!map) {
+			return NULL;
+		}
+		fl = kmem_ffs(map);
+		map = kmem_heap_sl_map[fl];
+	}
+	return kmem_heap_free[fl][kmem_ffs(map)];
+}
+
+/**
+ *	Hand a 4MB chunk of the pool to the general heap
+ *
+ *	The chunk becomes one free block, followed by a used sentinel header that
+ *	stops merging at the end of the chunk.
+ */
+static void kmem_heap_add_chunk(uint32_t chunk) {
+	kmem_block_t *block, *last;
+
+	block = (kmem_block_t *)(chunk + KMEM_ALIGN - KMEM_BLOCK_HEADER);
+	last = (kmem_block_t *)(chunk + 4 * MEGA_BYTE - KMEM_BLOCK_HEADER);
+	block->prev_phys = NULL;
+	block->size = ((uint32_t)last - (uint32_t)kmem_block_payload(block)) | KMEM_BLOCK_FREE;
+	last->prev_phys = block;
+	last->size = KMEM_BLOCK_LAST;
+	kmem_heap_chunks |= 1 << ((chunk - start_addr) / (4 * MEGA_BYTE));
+	kmalloc_counters.heap_size += 4 * MEGA_BYTE;
+	kmem_heap_insert(block);
+}
+
+/**
+ *	Allocate from the general heap, growing it by a chunk if needed
+ *
+ *	@return pointer to the memory, or NULL on failure with errno set
+ */
+static void *kmem_heap_alloc(size_t size) {
+	kmem_block_t *block, *rest;
+	uint32_t chunk;
+
+	if (size > 4 * MEGA_BYTE - 2 * KMEM_ALIGN) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = ((size + KMEM_BLOCK_HEADER + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1)) - KMEM_BLOCK_HEADER;
+	if (size < KMEM_BLOCK_MIN) {
+		size = KMEM_BLOCK_MIN;
+	}
+	block = kmem_heap_find(size);
+	if (!block) {
+		chunk = (uint32_t)get_free_page();
+		if (!chunk) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		kmem_heap_add_chunk(chunk);
+		block = kmem_heap_find(size);
+		if (!block) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	kmem_heap_remove(block);
+
+	// Split off the tail if it can hold a block of its own
+	if (kmem_block_size(block) >= size + KMEM_BLOCK_HEADER + KMEM_BLOCK_MIN) {
+		rest = (kmem_block_t *)((uint32_t)kmem_block_payload(block) + size);
+		rest->prev_phys = block;
+		rest->size = (kmem_block_size(block) - size - KMEM_BLOCK_HEADER) | KMEM_BLOCK_FREE;
+		kmem_block_next(rest)->prev_phys = rest;
+		block->size = size;
+		kmem_heap_insert(rest);
+	}
+	block->size &= ~KMEM_BLOCK_FREE;
+
+	kmalloc_counters.alloc_count++;
+	kmalloc_counters.used_bytes += kmem_block_size(block) + KMEM_BLOCK_HEADER;
+	if (kmalloc_counters.used_bytes > kmalloc_counters.used_peak) {
+		kmalloc_counters.used_peak = kmalloc_counters.used_bytes;
+	}
+	return kmem_block_payload(block);
+}
+
+/**
+ *	Release a block of the general heap, merging it with free neighbours
+ *
+ *	@return 0 on success, or -EINVAL if `ptr` is not an allocated block
+ */
+static int kmem_heap_free_block(void *ptr) {
+	kmem_block_t *block, *neighbour;
+	uint32_t off = (uint32_t)ptr - start_addr;
+
+	if ((uint32_t)ptr < (uint32_t)start_addr || off >= KMEM_POOL ||
+		!(kmem_heap_chunks & (1 << (off / (4 * MEGA_BYTE)))) || ((uint32_t)ptr % KMEM_ALIGN)) {
+		return -EINVAL;
+	}
+	block = (kmem_block_t *)((uint32_t)ptr - KMEM_BLOCK_HEADER);
+	if (block->size & (KMEM_BLOCK_FREE | KMEM_BLOCK_LAST)) {
+		return -EINVAL;
+	}
+	kmalloc_counters.free_count++;
+	kmalloc_counters.used_bytes -= kmem_block_size(block) + KMEM_BLOCK_HEADER;
+
+	neighbour = block->prev_phys;
+	if (neighbour && (neighbour->size & KMEM_BLOCK_FREE)) {
+		kmem_heap_remove(neighbour);
+		neighbour->size += KMEM_BLOCK_HEADER + kmem_block_size(block);
+		block = neighbour;
+	}
+	neighbour = kmem_block_next(block);
+	if (neighbour->size & KMEM_BLOCK_FREE) {
+		kmem_heap_remove(neighbour);
+		block->size += KMEM_BLOCK_HEADER + kmem_block_size(neighbour);
+	}
+	block->size |= KMEM_BLOCK_FREE;
+	kmem_block_next(block)->prev_phys = block;
+	kmem_heap_insert(block);
+	return 0;
+}
+
+/**
+ *	Get the page table entry of a page in the run region
+ */
+static inline page_table_entry_t *kmem_run_pte(int page) {
+	return kmem_run_tables[page / 1024].page_table_entry + page % 1024;
+}
+
+/**
+ *	Find `pages` consecutive free pages in the run region, first fit
+ *
+ *	@return index of the first page, or -1 if the region is too fragmented
+ */
+static int kmem_run_find(int pages) {
+	int i, start = 0;
+
+	for (i = 0; i < KMEM_RUN_PAGES; i++) {
+		if (i % 32 == 0 && kmem_run_map[i / 32] == 0xFFFFFFFF) {
+			// Skip full words
+			i += 31;
+			start = i + 1;
+			continue;
+		}
+		if (kmem_run_map[i / 32] & (1 << (i % 32))) {
+			start = i + 1;
+		} else if (i - start + 1 == pages) {
+			return start;
+		}
+	}
+	return -1;
+}
+
+/**
+ *	Unmap pages of the run region and release their frames, if mapped
+ */
+static void kmem_run_unmap(int first, int pages) {
+	page_table_entry_t *pte;
+	int i;
+
+	for (i = first; i < first + pages; i++) {
+		pte = kmem_run_pte(i);
+		if (*pte & PAGE_TAB_ENT_PRESENT) {
+			page_alloc_free_4KB(*pte & ~0xFFF);
+			kmalloc_counters.run_pages--;
+		}
+		*pte = 0;
+		kmem_run_map[i / 32] &= ~(1 << (i % 32));
+	}
+	page_flush_tlb_range(KMEM_RUN_BASE + first * KMEM_SLAB_PAGE,
+						 KMEM_RUN_BASE + (first + pages) * KMEM_SLAB_PAGE);
+}
+
+/**
+ *	Allocate a run of pages, each backed by its own frame
+ *
+ *	@return pointer to the memory, or NULL on failure with errno set
+ */
+static void *kmem_run_alloc(size_t size) {
+	int pages, first, i, frame;
+
+	pages = ceiling_division(size, KMEM_SLAB_PAGE);
+	if (size > KMEM_RUN_SIZE || (first = kmem_run_find(pages)) < 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	// Reserve the run first, reclaim may map frames while we allocate
+	for (i = first; i < first + pages; i++) {
+		kmem_run_map[i / 32] |= 1 << (i % 32);
+	}
+	for (i = 0; i < pages; i++) {
+		frame = 0;
+		if (page_alloc_4KB(&frame) != 0) {
+			kmem_run_unmap(first, pages);
+			errno = ENOMEM;
+			return NULL;
+		}
+		*kmem_run_pte(first + i) = frame | PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR |
+								   PAGE_TAB_ENT_SUPERVISOR | PAGE_TAB_ENT_GLOBAL;
+		kmalloc_counters.run_pages++;
+	}
+	kmem_run_len[first] = pages;
+	if (kmalloc_counters.run_pages > kmalloc_counters.run_pages_peak) {
+		kmalloc_counters.run_pages_peak = kmalloc_counters.run_pages;
+	}
+	return (void *)(KMEM_RUN_BASE + first * KMEM_SLAB_PAGE);
+}
+
+/**
+ *	Release a run of pages
+ *
+ *	@return 0 on success, or -EINVAL if `ptr` does not start a run
+ */
+static int kmem_run_free(void *ptr) {
+	uint32_t off = (uint32_t)ptr - KMEM_RUN_BASE;
+	int first = off / KMEM_SLAB_PAGE;
+
+	if (off % KMEM_SLAB_PAGE || !kmem_run_len[first]) {
+		return -EINVAL;
+	}
+	kmem_run_unmap(first, kmem_run_len[first]);
+	kmem_run_len[first] = 0;
+	return 0;
+}
+
+void *kmem_map_frame(uint32_t paddr) {
+	int page;
+
+	page = kmem_run_find(1);
+	if (page < 0) {
+		return NULL;
+	}
+	kmem_run_map[page / 32] |= 1 << (page % 32);
+	*kmem_run_pte(page) = (paddr & ~0xFFF) | PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR |
+						  PAGE_TAB_ENT_SUPERVISOR | PAGE_TAB_ENT_GLOBAL;
+	return (void *)(KMEM_RUN_BASE + page * KMEM_SLAB_PAGE);
+}
+
+void kmem_unmap_frame(void *ptr) {
+	int page = ((uint32_t)ptr - KMEM_RUN_BASE) / KMEM_SLAB_PAGE;
+
+	if ((uint32_t)ptr < KMEM_RUN_BASE || page >= KMEM_RUN_PAGES || kmem_run_len[page]) {
+		return;
+	}
+	*kmem_run_pte(page) = 0;
+	kmem_run_map[page / 32] &= ~(1 << (page % 32));
+	page_flush_tlb_page((uint32_t)ptr);
+}
+
+void kmalloc_stats(kmalloc_stats_t *stats) {
+	kmem_block_t *block;
+	uint32_t largest = 0;
+	int fl, sl;
+
+	if (!stats) {
+		return;
+	}
+	// Only the highest non-empty class can hold the largest block
+	if (kmem_heap_fl_map) {
+		fl = kmem_fls(kmem_heap_fl_map);
+		sl = kmem_fls(kmem_heap_sl_map[fl]);
+		for (block = kmem_heap_free[fl][sl]; block; block = block->next_free) {
+			if (kmem_block_size(block) > largest) {
+				largest = kmem_block_size(block);
+			}
+		}
+	}
+	memcpy(stats, &kmalloc_counters, sizeof(kmalloc_stats_t));
+	stats->largest_free = largest;
+	stats->fragmentation = stats->free_bytes ?
+						   100 - largest * 100 / stats->free_bytes : 0;
+}
 
 void kmalloc_init() {
 
 	int i; 			// iterator
 	int addr = 0;	// request addr from page;
 
-	for (i = 1; i < SLAB_NUM; i++) {
-		mem_info[i].status = 0;
-		mem_info[i].size = 0;
-		mem_info[i].prev = NULL;
-		mem_info[i].info = NULL;
-		mem_info[i].next = NULL;
+	if (status) {
+		return;
 	}
 
-	// REQUESTE 3 4MB PAGES
+	// REQUEST THE FIRST 4MB PAGE FOR THE GENERAL HEAP, THE REST OF THE
+	// POOL IS HANDED TO THE SLAB CACHES AND THE HEAP ON DEMAND
 	page_alloc_4MB(&addr);
-	start_addr = addr;
-	cur_addr = addr + (4 * MEGA_BYTE);
-	page_dir_add_4MB_entry(addr, addr, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
+	start_addr = KMEM_VIRT_BASE;
+	cur_addr = start_addr + KMEM_HEAP_POOL;
+	kmem_chunk_phys[0] = addr;
+	page_dir_add_4MB_entry(start_addr, addr, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
 						PAGE_DIR_ENT_SUPERVISOR | PAGE_DIR_ENT_4MB |
 						PAGE_DIR_ENT_GLOBAL);
 
 	status = 1;
-	get_free_page();
-	get_free_page();
-/*
-	memory_pool[0].status = 0;
-	memory_pool[0].start_addr = start_addr;
-	memory_pool[0].size = SLAB_NUM;
-*/
-	((malloc_info_t*)start_addr)->start_addr = start_addr;
-	((malloc_info_t*)start_addr)->size = SLAB_NUM;
-	((malloc_info_t*)start_addr)->status = 0;
-
-	free_list = &(mem_info[0]);
-	free_list->status = 1;
-	free_list->size = SLAB_NUM;
-	free_list->prev = NULL;
-	free_list->info = ((malloc_info_t*)start_addr);
-	((malloc_info_t*)start_addr)->link = free_list;
-	free_list->next = NULL;
-
-	alloc_list = NULL;
-	// alloc_list->status = 1;
-	// alloc_list->size = 0;
-	// alloc_list->prev = NULL;
-	// alloc_list->info = NULL;
-	// alloc_list->next = NULL;
+	kmem_heap_add_chunk(start_addr);
 
-	status = 1;
+	// Page tables of the run region, shared by every address space
+	for (i = 0; i < KMEM_RUN_SIZE / (4 * MEGA_BYTE); i++) {
+		page_dir_add_4KB_entry(KMEM_RUN_BASE + i * (4 * MEGA_BYTE), kmem_run_tables + i,
+							   PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
+							   PAGE_DIR_ENT_SUPERVISOR);
+	}
+
+	// Size class caches
+	kmem_cache_init(start_addr);
+	for (i = 0; i < KMALLOC_NUM_CLASSES; i++) {
+		kmalloc_caches[i] = kmem_cache_create(kmalloc_cache_names[i],
+											  KMALLOC_MIN_SIZE << i);
+	}
 }
 
-int get_free_page() {
+void *get_free_page() {
+	int chunk;
 
 	if (status == 0) {
-		return -ENOBUFS;
+		return NULL;
 	}
 
-	if (cur_addr - start_addr >= (12 * MEGA_BYTE)) {
-		return -ENOBUFS;
+	if (cur_addr - start_addr >= KMEM_POOL) {
+		return NULL;
 	}
 
 	int addr = 0;
-	page_alloc_4MB(&addr);
+	if (page_alloc_4MB(&addr) != 0) {
+		return NULL;
+	}
 	page_dir_add_4MB_entry(cur_addr, addr, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
 					PAGE_DIR_ENT_SUPERVISOR | PAGE_DIR_ENT_4MB |
 					PAGE_DIR_ENT_GLOBAL);
+	chunk = cur_addr;
+	kmem_chunk_phys[(chunk - start_addr) / (4 * MEGA_BYTE)] = addr;
 	cur_addr += (4 * MEGA_BYTE);
 
-	return 0;
+	return (void *)chunk;
+}
+
+uint32_t kmem_virt_to_phys(void *ptr) {
+	uint32_t off = (uint32_t)ptr - start_addr;
+
+	if ((uint32_t)ptr >= KMEM_RUN_BASE && (uint32_t)ptr - KMEM_RUN_BASE < KMEM_RUN_SIZE) {
+		off = (uint32_t)ptr - KMEM_RUN_BASE;
+		if (!(*kmem_run_pte(off / KMEM_SLAB_PAGE) & PAGE_TAB_ENT_PRESENT)) {
+			return 0;
+		}
+		return (*kmem_run_pte(off / KMEM_SLAB_PAGE) & ~0xFFF) + off % KMEM_SLAB_PAGE;
+	}
+
+	if ((uint32_t)ptr < (uint32_t)start_addr || off >= (uint32_t)(cur_addr - start_addr)) {
+		return 0;
+	}
+	return kmem_chunk_phys[off / (4 * MEGA_BYTE)] + off % (4 * MEGA_BYTE);
+}
+
+void *kmem_phys_to_virt(uint32_t addr) {
+	int i;
+
+	for (i = 0; i < (cur_addr - start_addr) / (4 * MEGA_BYTE); i++) {
+		if (addr >= kmem_chunk_phys[i] && addr - kmem_chunk_phys[i] < 4 * MEGA_BYTE) {
+			return (void *)(start_addr + i * (4 * MEGA_BYTE) + addr - kmem_chunk_phys[i]);
+		}
+	}
+	return NULL;
 }
 
 int ceiling_division(int x, int y) {
@@ -86,148 +520,52 @@ int ceiling_division(int x, int y) {
 		return x/y;
 }
 void* kmalloc(size_t size) {
+	int i;
+	void *obj;
 
 	if (status == 0) {
 		kmalloc_init();
 	}
 
-	int num_slab;
-	int addr;
-	int i;
-
-	memory_list_t *temp, *temp2;
-	temp = free_list;
-
-	num_slab = ceiling_division((size + INFO_SIZE),SLAB_SIZE);
-
-	while(temp != NULL) {
-		if (temp->size >= num_slab)
-			break;
-		temp = temp->next;
-	}
-
-	if (temp->size - num_slab == 0) {
-
-		addr = temp->info->start_addr;
-
-		if (temp->prev != NULL)
-			temp->prev->next = temp->next;
-		if (temp->next != NULL)
-			temp->next->prev = temp->prev;
-
-		temp2 = alloc_list;
-
-		while (temp2->next != NULL) {
-			temp2 = temp2->next;
-		}
-
-		temp2->next = temp;
-		temp->prev = temp2;
-		temp->next = NULL;
-		temp->info->status = 1;
-
-		if (temp == free_list) {
-			free_list = NULL;
-		}
-
-	} else {
-		addr = temp->info->start_addr;
-		// temp for allocated memory, find new place for free slabs
-		malloc_info_t *new_info;
-		new_info = (malloc_info_t*)(addr + (num_slab*SLAB_SIZE));
-		for (i = 1; i < SLAB_NUM; i++) {
-			if (mem_info[i].status == 0) {
-				temp2 = &(mem_info[i]);
-				temp2->status = 1;
-				goto buf_found;
-			}
+	// Small requests are served by the size class caches
+	i = kmalloc_size_class(size);
+	if (i >= 0 && kmalloc_caches[i]) {
+		obj = kmem_cache_alloc(kmalloc_caches[i]);
+		if (obj) {
+			return obj;
 		}
-		// Out of memory
-		errno = ENOMEM;
-		return NULL;
-	buf_found:
-		temp2->size = temp->size - num_slab;
-		temp2->prev = temp->prev;
-		temp2->info = new_info;
-		temp2->info->start_addr = temp->info->start_addr + num_slab*SLAB_SIZE;
-		temp2->info->size = temp2->size;
-		temp2->info->status = 1;
-		temp2->info->link = temp2;
-		temp2->next = temp->next;
-
-		if (temp->prev != NULL)
-			temp->prev->next = temp2;
-		if (temp->next != NULL)
-			temp->next->prev = temp2;
-
-		temp->size = num_slab;
-		temp->info->start_addr = addr;
-		temp->info->size = num_slab;
-		temp->info->status = 1;
-
-		if (temp == free_list) {
-			free_list = temp2;
-		}
-
-		temp2 = alloc_list;
-		if (temp2 != NULL) {
-			while (temp2->next != NULL) {
-				temp2 = temp2->next;
-			}
-
-			temp2->next = temp;
-			temp->prev = temp2;
-			temp->next = NULL;
-		} else {
-			alloc_list = temp;
-			temp->prev = NULL;
-			temp->next = NULL;
+		// Out of slab pages, fall back to the heap
+	} else if (size > KMEM_SLAB_PAGE) {
+		obj = kmem_run_alloc(size);
+		if (!obj) {
+			kmalloc_counters.fail_count++;
 		}
+		return obj;
 	}
 
-	return (void*)(addr+INFO_SIZE);
+	obj = kmem_heap_alloc(size);
+	if (!obj) {
+		kmalloc_counters.fail_count++;
+	}
+	return obj;
 }
 
 int kfree(void* ptr) {
+	kmem_cache_t *cache;
 
-	if (((malloc_info_t*)(ptr - INFO_SIZE))->status != 1)
+	if (!ptr)
 		return -EINVAL;
 
-	malloc_info_t *info = (malloc_info_t*)(ptr - INFO_SIZE);
-	int offset = info->size * SLAB_SIZE;
-	memory_list_t *link = info->link;
-	memory_list_t *temp = free_list;
-	if (temp != NULL) {
-		while(temp->next != NULL) {
-			if (temp->info->start_addr + offset == info->start_addr)
-				break;
-			temp = temp->next;
-		}
+	if ((uint32_t)ptr >= KMEM_RUN_BASE && (uint32_t)ptr - KMEM_RUN_BASE < KMEM_RUN_SIZE)
+		return kmem_run_free(ptr);
 
-		if (temp->next != NULL) {
-			//TODO
-			temp->size += link->size;
-			temp->info->size = temp->size;
-			memset((char *) info->start_addr,0, info->size*SLAB_SIZE);
-
-		} else if (temp->info->start_addr + offset == info->start_addr){
-			info->status = 0;
-			temp->next = link;
-			link->prev = temp;
-			link->next = NULL;
-		} else {
-			temp->size += link->size;
-			temp->info->size = temp->size;
-			memset((char *) info->start_addr,0, info->size*SLAB_SIZE);
-		}
-	} else {
-		info->status = 0;
-		free_list = link;
-		link->prev = NULL;
-		link->next = NULL;
+	cache = kmem_cache_of(ptr);
+	if (cache) {
+		kmem_cache_free(cache, ptr);
+		return 0;
 	}
 
-	return 0;
+	return kmem_heap_free_block(ptr);
 }
 
 void* malloc(size_t size){
@@ -243,5 +581,5 @@ void* calloc(size_t count, size_t size){
 }
 
 void free(void* ptr){
-	free(ptr);
+	kfree(ptr);
 }
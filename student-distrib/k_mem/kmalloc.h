@@ -8,36 +8,149 @@
 #define KMALLOC_H_
 
 #include "../boot/page_table.h"
+#include "slab.h"
 
 #define MEGA_BYTE 	0x00100000
-#define SLAB_SIZE 	0x00000200 				///< SLAB_SIZE = 512 bytes
-#define KMEM_POOL 	0x00C00000				///< memory pool size = 12MB
-#define SLAB_NUM	(KMEM_POOL/SLAB_SIZE)	///< total number of slabs in memory pool = 8192
-#define INFO_SIZE 	sizeof(malloc_info_t)
-
-typedef struct malloc_info{
-	int start_addr;	///< the starting address of space
-	int size;		///< number of slabs;
-	char status; 	///< 0 for free, 1 for allocated
-	struct memory_list *link;
-} malloc_info_t;
-
-typedef struct memory_list {
-	char status;	///< 0 for not used;
-	int size;
-	struct memory_list *prev;		///< addr to the previous linked memory
-	struct malloc_info *info;		///< malloc info
-	struct memory_list *next;		///< pointer to the next item, NULL for last item
-} memory_list_t;
+#define KMEM_POOL 	0x02400000				///< maximum memory pool size = 36MB
+#define KMEM_VIRT_BASE	0x01C00000			///< virtual address of the memory pool = 28MB
+#define KMEM_RUN_BASE	0x04000000			///< virtual address of the page run region = 64MB
+#define KMEM_RUN_SIZE	0x04000000			///< size of the page run region, up to the user space = 64MB
+#define KMEM_RUN_PAGES	(KMEM_RUN_SIZE / KMEM_SLAB_PAGE)	///< pages in the page run region
+#define KMEM_HEAP_POOL	0x00400000			///< part of the pool first given to the general heap = 4MB
 
+#define KMEM_ALIGN			16	///< Alignment and granularity of general heap blocks
+#define KMEM_BLOCK_HEADER	8	///< Bytes of a block header before its payload
+#define KMEM_BLOCK_MIN		24	///< Smallest payload, large enough for the free list links
+#define KMEM_BLOCK_FREE		0x1	///< Flag in `kmem_block_t.size`: the block is free
+#define KMEM_BLOCK_LAST		0x2	///< Flag in `kmem_block_t.size`: sentinel ending a chunk
+#define KMEM_BLOCK_FLAGS	0x3	///< Flag bits in `kmem_block_t.size`
+
+#define KMEM_TLSF_SL_LOG2	4	///< log2 of the number of second level classes
+#define KMEM_TLSF_SL_COUNT	(1 << KMEM_TLSF_SL_LOG2)	///< Second level classes per first level
+#define KMEM_TLSF_FL_SHIFT	8	///< log2 of `KMEM_TLSF_SMALL`
+#define KMEM_TLSF_SMALL		(1 << KMEM_TLSF_FL_SHIFT)	///< Sizes below are classed linearly
+#define KMEM_TLSF_FL_COUNT	16	///< First level classes, enough for 4MB blocks
+
+/**
+ *	Header (boundary tag) of a block of the general heap
+ *
+ *	The general heap is a two-level segregated fit allocator: free blocks are
+ *	kept in lists indexed by a first level (power of two) and a second level
+ *	(linear subdivision) class of their size, with a bitmap of non-empty lists
+ *	for each level, so that finding a block and merging freed blocks with
+ *	their physical neighbours are both O(1). Header and payload together
+ *	always span a multiple of `KMEM_ALIGN` bytes, which keeps every payload
+ *	aligned.
+ */
+typedef struct s_kmem_block {
+	struct s_kmem_block *prev_phys;	///< Physically previous block, NULL for the first one
+	uint32_t size;					///< Payload size, with `KMEM_BLOCK_*` flags in the low bits
+	struct s_kmem_block *next_free;	///< Next free block of the same class, only when free
+	struct s_kmem_block *prev_free;	///< Previous free block of the same class, only when free
+} kmem_block_t;
+
+/**
+ *	kmalloc counters
+ */
+typedef struct s_kmalloc_stats {
+	uint32_t heap_size;		///< Bytes in the chunks of the general heap
+	uint32_t used_bytes;	///< Bytes allocated from the general heap, headers included
+	uint32_t used_peak;		///< High-water mark of `used_bytes`
+	uint32_t free_bytes;	///< Bytes in free blocks of the general heap
+	uint32_t free_blocks;	///< Number of free blocks of the general heap
+	uint32_t largest_free;	///< Largest free block of the general heap
+	uint32_t fragmentation;	///< Percentage of free bytes outside the largest free block
+	uint32_t alloc_count;	///< Allocations served by the general heap
+	uint32_t free_count;	///< Releases to the general heap
+	uint32_t fail_count;	///< kmalloc calls that failed
+	uint32_t run_pages;		///< Pages mapped by page runs
+	uint32_t run_pages_peak;	///< High-water mark of `run_pages`
+} kmalloc_stats_t;
+
+#define KMALLOC_MIN_SIZE	16		///< Smallest kmalloc size class
+#define KMALLOC_MAX_SIZE	2048	///< Largest kmalloc size class served by caches
+#define KMALLOC_NUM_CLASSES	8		///< Number of size classes, 16 B ... 2 KB
+
+/**
+ *	Map the first chunk of the kernel memory pool and create the size class caches
+ *
+ *	@note calling it again has no effect
+ */
 void kmalloc_init();
 
-int get_free_page();
+/**
+ *	Map another 4MB page at the end of the kernel memory pool
+ *
+ *	The pool grows on demand from the physical frame allocator, up to
+ *	`KMEM_POOL` bytes.
+ *
+ *	@return virtual address of the new 4MB page, or NULL if the pool is full
+ *			or no 4MB block is free
+ */
+void *get_free_page();
+
+/**
+ *	Get the physical address of kernel pool memory
+ *
+ *	@param ptr: pointer into the kernel memory pool or into a page run
+ *	@return the physical address, or 0 if `ptr` is not mapped
+ */
+uint32_t kmem_virt_to_phys(void *ptr);
+
+/**
+ *	Get the virtual address of kernel pool memory
+ *
+ *	@param addr: physical address inside a mapped chunk of the pool
+ *	@return the virtual address, or NULL if `addr` is not in the pool
+ */
+void *kmem_phys_to_virt(uint32_t addr);
 
 int ceiling_division(int x, int y);
 
+/**
+ *	Allocate kernel memory
+ *
+ *	Requests up to `KMALLOC_MAX_SIZE` bytes are served from power-of-two size
+ *	class caches, requests larger than a page are served as runs of 4KB
+ *	frames mapped in the page run region, and the rest from the general heap.
+ *
+ *	@param size: number of bytes
+ *	@return pointer to the memory, or NULL on failure with errno set
+ */
 void* kmalloc(size_t size);
 
+/**
+ *	Map a physical frame into the kernel address space
+ *
+ *	The frame is mapped in a free page of the page run region, and its
+ *	reference count is left untouched. Nothing is allocated, so this can be
+ *	used by reclaim hooks.
+ *
+ *	@param paddr: physical address of the frame
+ *	@return the virtual address of the frame, or NULL if the region is full
+ */
+void *kmem_map_frame(uint32_t paddr);
+
+/**
+ *	Remove a mapping made by `kmem_map_frame`
+ *
+ *	@param ptr: the address returned by `kmem_map_frame`
+ */
+void kmem_unmap_frame(void *ptr);
+
+/**
+ *	Get a snapshot of the kmalloc counters
+ *
+ *	@param stats: buffer to fill
+ */
+void kmalloc_stats(kmalloc_stats_t *stats);
+
+/**
+ *	Release memory allocated by `kmalloc` or `kmem_cache_alloc`
+ *
+ *	@param ptr: the memory
+ *	@return 0 on success, or the negative of an errno on failure
+ */
 int kfree(void* ptr);
 
 void* malloc(size_t size);
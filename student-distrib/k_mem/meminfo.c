@@ -0,0 +1,188 @@
+#include "meminfo.h"
+
+#include "../lib.h"
+#include "../errno.h"
+#include "kmalloc.h"
+#include "../fs/fs_devfs.h"
+#include "../fs/page_cache.h"
+#include "../proc/task.h"
+#include "../proc/swap.h"
+#include "../proc/zram.h"
+
+static file_operations_t meminfo_fop;
+
+/**
+ *	Append a string to the report, truncating it when the buffer is full
+ */
+static void meminfo_puts(meminfo_file_t *m, const char *s) {
+	while (*s && m->len < MEMINFO_BUF_SIZE) {
+		m->buf[m->len++] = *s++;
+	}
+}
+
+/**
+ *	Append a number to the report, right-aligned in `width` columns
+ */
+static void meminfo_putu(meminfo_file_t *m, uint32_t value, int width) {
+	int8_t num[12];
+	int len;
+
+	itoa(value, num, 10);
+	for (len = strlen(num); len < width; len++) {
+		meminfo_puts(m, " ");
+	}
+	meminfo_puts(m, (char *)num);
+}
+
+/**
+ *	Append a `Name: value unit` line to the report
+ */
+static void meminfo_line(meminfo_file_t *m, const char *name, uint32_t value,
+						 const char *unit) {
+	int len = strlen((int8_t *)name);
+
+	meminfo_puts(m, name);
+	meminfo_puts(m, ":");
+	for (len++; len < MEMINFO_NAME_WIDTH; len++) {
+		meminfo_puts(m, " ");
+	}
+	meminfo_putu(m, value, 8);
+	meminfo_puts(m, unit);
+	meminfo_puts(m, "\n");
+}
+
+/**
+ *	Write the report of the current memory usage
+ */
+static void meminfo_fill(meminfo_file_t *m) {
+	page_alloc_stats_t frames;
+	kmalloc_stats_t heap;
+	kmem_cache_t *cache;
+	swap_stats_t swap;
+	zram_stats_t zram;
+	uint32_t shared, saved, copied = 0, resident;
+	int i;
+
+	page_alloc_get_stats(&frames);
+	page_alloc_count_shared(&shared, &saved);
+	kmalloc_stats(&heap);
+	swap_get_stats(&swap);
+	zram_get_stats(&zram);
+	for (i = 0; i < TASK_MAX_PROC; i++) {
+		if (task_list[i].status != TASK_ST_NA) {
+			copied += task_list[i].cow_copied;
+		}
+	}
+
+	m->len = 0;
+	meminfo_line(m, "MemTotal", frames.total_frames * 4, " kB");
+	meminfo_line(m, "MemFree", frames.free_frames * 4, " kB");
+	meminfo_line(m, "Frames4MBUsed", frames.alloc_count[PAGE_BUDDY_ORDERS - 1] -
+				 frames.free_count[PAGE_BUDDY_ORDERS - 1], "");
+	meminfo_line(m, "Frames4MBFree", frames.nr_free[PAGE_BUDDY_ORDERS - 1], "");
+	meminfo_line(m, "Frames4KBUsed", frames.alloc_count[0] - frames.free_count[0], "");
+	meminfo_line(m, "Frames4KBFree", frames.nr_free[0], "");
+	meminfo_line(m, "CowShared", shared * 4, " kB");
+	meminfo_line(m, "CowSaved", saved * 4, " kB");
+	meminfo_line(m, "CowCopied", copied * 4, " kB");
+	meminfo_line(m, "PageCache", page_cache_pages() * 4, " kB");
+	meminfo_line(m, "HeapSize", heap.heap_size / 1024, " kB");
+	meminfo_line(m, "HeapUsed", heap.used_bytes / 1024, " kB");
+	meminfo_line(m, "HeapPeak", heap.used_peak / 1024, " kB");
+	meminfo_line(m, "HeapFree", heap.free_bytes / 1024, " kB");
+	meminfo_line(m, "HeapLargestFree", heap.largest_free / 1024, " kB");
+	meminfo_line(m, "HeapFragmentation", heap.fragmentation, " %");
+	meminfo_line(m, "HeapFailures", heap.fail_count, "");
+	meminfo_line(m, "PageRuns", heap.run_pages * 4, " kB");
+	meminfo_line(m, "PageRunsPeak", heap.run_pages_peak * 4, " kB");
+	meminfo_line(m, "SwapTotal", swap.slots * 4, " kB");
+	meminfo_line(m, "SwapFree", (swap.slots - swap.used) * 4, " kB");
+	meminfo_line(m, "SwapOut", swap.pages_out, " pages");
+	meminfo_line(m, "SwapIn", swap.pages_in, " pages");
+	meminfo_line(m, "SwapScanned", swap.scanned, "");
+	meminfo_line(m, "SwapErrors", swap.io_errors, "");
+	meminfo_line(m, "SwapFaultTime", swap.pages_in ?
+				 swap.disk_fault_time / swap.pages_in : 0, " kcycles");
+	meminfo_line(m, "ZramPages", zram.pages, "");
+	meminfo_line(m, "ZramZeroPages", zram.zero_pages, "");
+	meminfo_line(m, "ZramCompressed", zram.compr_bytes / 1024, " kB");
+	// original size over compressed size, pages of zeros left out
+	meminfo_line(m, "ZramRatio", zram.compr_bytes >= 100 ?
+				 (zram.pages - zram.zero_pages) * 4096 / (zram.compr_bytes / 100) : 0, " %");
+	meminfo_line(m, "ZramRejected", zram.rejected, "");
+	meminfo_line(m, "ZramOut", swap.zram_out, " pages");
+	meminfo_line(m, "ZramIn", swap.zram_in, " pages");
+	meminfo_line(m, "ZramFaultTime", swap.zram_in ?
+				 swap.zram_fault_time / swap.zram_in : 0, " kcycles");
+
+	meminfo_puts(m, "\ncache             objsize  active   slabs\n");
+	for (cache = kmem_cache_list(); cache; cache = cache->next) {
+		meminfo_puts(m, cache->name);
+		for (i = strlen((int8_t *)cache->name); i < MEMINFO_NAME_WIDTH; i++) {
+			meminfo_puts(m, " ");
+		}
+		meminfo_putu(m, cache->obj_size, 7);
+		meminfo_putu(m, cache->nr_active, 8);
+		meminfo_putu(m, cache->nr_slabs, 8);
+		meminfo_puts(m, "\n");
+	}
+
+	meminfo_puts(m, "\n  pid  resident    shared  cow_copied\n");
+	for (i = 0; i < TASK_MAX_PROC; i++) {
+		if (task_list[i].status == TASK_ST_NA || !task_list[i].pages) {
+			continue;
+		}
+		resident = task_resident_pages(task_list + i, &shared);
+		meminfo_putu(m, task_list[i].pid, 5);
+		meminfo_putu(m, resident * 4, 7);
+		meminfo_puts(m, " kB");
+		meminfo_putu(m, shared * 4, 7);
+		meminfo_puts(m, " kB");
+		meminfo_putu(m, task_list[i].cow_copied * 4, 9);
+		meminfo_puts(m, " kB\n");
+	}
+}
+
+int meminfo_driver_register() {
+	meminfo_fop.open = &meminfo_open;
+	meminfo_fop.release = &meminfo_release;
+	meminfo_fop.read = &meminfo_read;
+	meminfo_fop.write = NULL;
+	meminfo_fop.readdir = NULL;
+	return devfs_register_driver("meminfo", &meminfo_fop);
+}
+
+int meminfo_open(inode_t *inode, file_t *file) {
+	meminfo_file_t *m;
+
+	m = kmalloc(sizeof(meminfo_file_t));
+	if (!m) {
+		return -ENOMEM;
+	}
+	meminfo_fill(m);
+	file->private_data = (int)m;
+	return 0;
+}
+
+int meminfo_release(inode_t *inode, file_t *file) {
+	kfree((void *)file->private_data);
+	file->private_data = 0;
+	return 0;
+}
+
+ssize_t meminfo_read(file_t *file, uint8_t *buf, size_t count, off_t *offset) {
+	meminfo_file_t *m = (meminfo_file_t *)file->private_data;
+
+	if (!m) {
+		return -EBADF;
+	}
+	if (*offset >= m->len) {
+		return 0;
+	}
+	if (count > m->len - *offset) {
+		count = m->len - *offset;
+	}
+	memcpy(buf, m->buf + *offset, count);
+	*offset += count;
+	return count;
+}
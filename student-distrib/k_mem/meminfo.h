@@ -0,0 +1,63 @@
+/**
+ *	@file k_mem/meminfo.h
+ *
+ *	Memory usage report, readable from /dev/meminfo
+ *
+ *	A snapshot of the physical frame allocator, copy-on-write sharing, the
+ *	page cache, kmalloc, the slab caches and the resident pages of every
+ *	process is taken when the file is opened, and read back as text.
+ */
+#ifndef K_MEM_MEMINFO_H
+#define K_MEM_MEMINFO_H
+
+#include "../types.h"
+#include "../fs/vfs.h"
+
+#define MEMINFO_BUF_SIZE	8192	///< Size of the report buffer of an open file
+#define MEMINFO_NAME_WIDTH	18		///< Column of the values in the report
+
+/**
+ *	Report of an open /dev/meminfo file
+ */
+typedef struct s_meminfo_file {
+	uint32_t len;				///< Length of the report
+	char buf[MEMINFO_BUF_SIZE];	///< Report text
+} meminfo_file_t;
+
+/**
+ *	Register the meminfo driver in devfs
+ *
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int meminfo_driver_register();
+
+/**
+ *	Take a snapshot of the memory usage for a newly opened file
+ *
+ *	@param inode: the device i-node
+ *	@param file: the file
+ *	@return 0 on success, or -ENOMEM
+ */
+int meminfo_open(inode_t *inode, file_t *file);
+
+/**
+ *	Release the snapshot of a file
+ *
+ *	@param inode: the device i-node
+ *	@param file: the file
+ *	@return 0
+ */
+int meminfo_release(inode_t *inode, file_t *file);
+
+/**
+ *	Read the report
+ *
+ *	@param file: the file
+ *	@param buf: buffer to fill
+ *	@param count: size of `buf`
+ *	@param offset: position in the report, advanced by the bytes read
+ *	@return the number of bytes read, 0 at the end of the report
+ */
+ssize_t meminfo_read(file_t *file, uint8_t *buf, size_t count, off_t *offset);
+
+#endif
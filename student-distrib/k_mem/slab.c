@@ -0,0 +1,219 @@
+#include "slab.h"
+
+#include "kmalloc.h"
+#include "../lib.h"
+#include "../errno.h"
+
+#define KMEM_SLAB_PAGES	(KMEM_POOL / KMEM_SLAB_PAGE)	///< Pages in the pool
+
+static kmem_slab_t slab_pages[KMEM_SLAB_PAGES];	// one descriptor per pool page
+static kmem_slab_t *slab_free_pages = NULL;		// unused pool pages
+static uint32_t slab_pool_base = 0;
+
+static kmem_cache_t cache_cache;				// cache of kmem_cache_t
+static kmem_cache_t *cache_list = NULL;
+
+/**
+ *	Get the virtual address of the page described by a slab descriptor
+ */
+static inline uint8_t *slab_page_addr(kmem_slab_t *slab) {
+	return (uint8_t *)(slab_pool_base + (slab - slab_pages) * KMEM_SLAB_PAGE);
+}
+
+/**
+ *	Get the slab descriptor of the page containing a pointer
+ *
+ *	@return the descriptor, or NULL if the pointer is outside the pool
+ */
+static inline kmem_slab_t *slab_of(void *ptr) {
+	uint32_t off = (uint32_t)ptr - slab_pool_base;
+	if ((uint32_t)ptr < slab_pool_base || off >= KMEM_POOL) {
+		return NULL;
+	}
+	return slab_pages + off / KMEM_SLAB_PAGE;
+}
+
+/**
+ *	Take an unused page from the pool, mapping a new 4MB chunk if needed
+ *
+ *	@return the descriptor of the page, or NULL if the pool is exhausted
+ */
+static kmem_slab_t *slab_page_get() {
+	kmem_slab_t *slab;
+	uint32_t chunk;
+	int i;
+
+	if (!slab_free_pages) {
+		chunk = (uint32_t)get_free_page();
+		if (!chunk) {
+			return NULL;
+		}
+		// Push pages in reverse so that the lowest address is used first
+		slab = slab_of((void *)chunk);
+		for (i = (4 * MEGA_BYTE) / KMEM_SLAB_PAGE - 1; i >= 0; i--) {
+			slab[i].cache = NULL;
+			slab[i].next = slab_free_pages;
+			slab_free_pages = slab + i;
+		}
+	}
+	slab = slab_free_pages;
+	slab_free_pages = slab->next;
+	return slab;
+}
+
+/**
+ *	Return an empty slab page to the pool
+ */
+static void slab_page_put(kmem_slab_t *slab) {
+	slab->cache = NULL;
+	slab->free = NULL;
+	slab->prev = NULL;
+	slab->next = slab_free_pages;
+	slab_free_pages = slab;
+}
+
+/**
+ *	Link a slab at the head of its cache's partial list
+ */
+static inline void slab_link(kmem_cache_t *cache, kmem_slab_t *slab) {
+	slab->prev = NULL;
+	slab->next = cache->partial;
+	if (cache->partial) {
+		cache->partial->prev = slab;
+	}
+	cache->partial = slab;
+}
+
+/**
+ *	Remove a slab from its cache's partial list
+ */
+static inline void slab_unlink(kmem_cache_t *cache, kmem_slab_t *slab) {
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		cache->partial = slab->next;
+	}
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->prev = slab->next = NULL;
+}
+
+/**
+ *	Set up the static fields of a cache
+ */
+static void cache_setup(kmem_cache_t *cache, const char *name, size_t size) {
+	strncpy(cache->name, name, KMEM_CACHE_NAME_LEN - 1);
+	cache->name[KMEM_CACHE_NAME_LEN - 1] = '\0';
+	// Objects hold the free list link while unused, keep them dword aligned
+	if (size < sizeof(void *)) {
+		size = sizeof(void *);
+	}
+	cache->obj_size = (size + 3) & ~3;
+	cache->objs_per_slab = KMEM_SLAB_PAGE / cache->obj_size;
+	cache->partial = NULL;
+	cache->nr_slabs = 0;
+	cache->nr_active = 0;
+	cache->next = cache_list;
+	cache_list = cache;
+}
+
+void kmem_cache_init(uint32_t pool_base) {
+	int i;
+
+	slab_pool_base = pool_base;
+	slab_free_pages = NULL;
+	for (i = 0; i < KMEM_SLAB_PAGES; i++) {
+		slab_pages[i].cache = NULL;
+	}
+	cache_list = NULL;
+	cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t));
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size) {
+	kmem_cache_t *cache;
+
+	if (!name || size == 0 || size > KMEM_SLAB_PAGE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cache = kmem_cache_alloc(&cache_cache);
+	if (!cache) {
+		return NULL;
+	}
+	cache_setup(cache, name, size);
+	return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+	kmem_slab_t *slab;
+	uint8_t *page;
+	void **obj;
+	uint32_t i;
+
+	slab = cache->partial;
+	if (!slab) {
+		// Grow the cache by one slab
+		slab = slab_page_get();
+		if (!slab) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		page = slab_page_addr(slab);
+		slab->cache = cache;
+		slab->inuse = 0;
+		slab->free = NULL;
+		for (i = cache->objs_per_slab; i > 0; i--) {
+			obj = (void **)(page + (i - 1) * cache->obj_size);
+			*obj = slab->free;
+			slab->free = obj;
+		}
+		slab_link(cache, slab);
+		cache->nr_slabs++;
+	}
+
+	obj = slab->free;
+	slab->free = *obj;
+	slab->inuse++;
+	if (!slab->free) {
+		// Slab is full, take it off the partial list
+		slab_unlink(cache, slab);
+	}
+	cache->nr_active++;
+	return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+	kmem_slab_t *slab;
+
+	slab = slab_of(obj);
+	if (!obj || !slab || slab->cache != cache) {
+		return;
+	}
+
+	if (!slab->free) {
+		// Slab was full, it has a free object now
+		slab_link(cache, slab);
+	}
+	*(void **)obj = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	cache->nr_active--;
+
+	if (slab->inuse == 0 && (cache->partial != slab || slab->next)) {
+		// Keep at most one empty slab around for the next allocation
+		slab_unlink(cache, slab);
+		slab_page_put(slab);
+		cache->nr_slabs--;
+	}
+}
+
+kmem_cache_t *kmem_cache_of(void *ptr) {
+	kmem_slab_t *slab = slab_of(ptr);
+	return slab ? slab->cache : NULL;
+}
+
+kmem_cache_t *kmem_cache_list() {
+	return cache_list;
+}
@@ -0,0 +1,93 @@
+/**
+ *	@file k_mem/slab.h
+ *
+ *	Object caches (slab allocator) for fixed-size kernel objects
+ *
+ *	Every cache hands out objects of a single size. Objects are carved from
+ *	4KB slab pages taken out of the kernel memory pool, and the bookkeeping
+ *	for each slab page lives in a descriptor table indexed by page number, so
+ *	that both allocation and release are O(1).
+ */
+#ifndef K_MEM_SLAB_H
+#define K_MEM_SLAB_H
+
+#include "../types.h"
+
+#define KMEM_SLAB_PAGE		0x1000	///< Size of a slab page
+#define KMEM_CACHE_NAME_LEN	16		///< Maximum length of a cache name
+
+struct s_kmem_cache;
+
+/**
+ *	Descriptor of a 4KB page in the kernel memory pool
+ */
+typedef struct s_kmem_slab {
+	struct s_kmem_cache *cache;	///< Owning cache, NULL if not used as a slab
+	void *free;					///< Singly-linked list of free objects
+	uint32_t inuse;				///< Number of allocated objects
+	struct s_kmem_slab *prev;	///< Previous slab in the partial list
+	struct s_kmem_slab *next;	///< Next slab in the partial/free page list
+} kmem_slab_t;
+
+/**
+ *	Cache of objects of a single size
+ */
+typedef struct s_kmem_cache {
+	char name[KMEM_CACHE_NAME_LEN];	///< Name of the cache, for statistics
+	uint32_t obj_size;				///< Size of each object
+	uint32_t objs_per_slab;			///< Number of objects in one slab page
+	kmem_slab_t *partial;			///< Slabs with at least one free object
+	uint32_t nr_slabs;				///< Number of slab pages owned
+	uint32_t nr_active;				///< Number of allocated objects
+	struct s_kmem_cache *next;		///< Next cache in the global cache list
+} kmem_cache_t;
+
+/**
+ *	Initialize the slab allocator
+ *
+ *	@param pool_base: virtual address of the start of the kernel memory pool.
+ *					  All slab pages must come from this pool.
+ */
+void kmem_cache_init(uint32_t pool_base);
+
+/**
+ *	Create a new object cache
+ *
+ *	@param name: name of the cache
+ *	@param size: size of each object, at most `KMEM_SLAB_PAGE`
+ *	@return the new cache, or NULL on failure with errno set
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size);
+
+/**
+ *	Allocate an object from a cache
+ *
+ *	@param cache: the cache
+ *	@return pointer to the object, or NULL on failure with errno set
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ *	Release an object back to its cache
+ *
+ *	@param cache: the cache the object was allocated from
+ *	@param obj: the object
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ *	Find the cache owning a pointer
+ *
+ *	@param ptr: the pointer
+ *	@return the owning cache, or NULL if `ptr` is not in a slab page
+ */
+kmem_cache_t *kmem_cache_of(void *ptr);
+
+/**
+ *	Get the first cache of the global cache list, for statistics
+ *
+ *	@return the first cache, the others follow through `next`
+ */
+kmem_cache_t *kmem_cache_list();
+
+#endif
@@ -8,7 +8,8 @@
 #include "i8259.h"
 #include "keyboard.h"
 #include "rtc.h"
-#include "pit.h"
+#include "timer.h"
+#include "clock.h"
 #include "debug.h"
 #include "terminal_driver/terminal_out_driver.h"
 #include "terminal_driver/tty.h"
@@ -17,12 +18,18 @@
 #include "fsdriver/mp3fs_driver.h"
 #include "boot/idt.h"
 #include "boot/page_table.h"
+#include "k_mem/kmalloc.h"
+#include "k_mem/meminfo.h"
 
 #include "proc/signal.h"
 #include "proc/scheduler.h"
 #include "proc/task.h"
 #include "fs/vfs.h"
 #include "fs/fs_devfs.h"
+#include "fs/page_cache.h"
+#include "proc/swap.h"
+#include "proc/fpu.h"
+#include "proc/workqueue.h"
 #include "libc.h"
 
 #include "atadriver/ata.h"
@@ -159,12 +166,19 @@ void entry(unsigned long magic, unsigned long addr) {
 		ltr(KERNEL_TSS);
 	}
 
+	/* Pick memcpy/memset variants for this CPU */
+	mem_init();
+
 	/* Construct IDT */
 	idt_construct(idt);
 	lidt(idt_desc_ptr);
 
 	/* Initialize Paging */
-	page_ece391_init();
+	page_ece391_init(mbi);
+	kmalloc_init();
+	page_cache_init();
+	swap_init();
+	fpu_init();
 
 	// init tty
 	tty_init();
@@ -177,7 +191,8 @@ void entry(unsigned long magic, unsigned long addr) {
 	 * PIC, any other initialization stuff... */
 	keyboard_init();
 	rtc_init();
-	pit_init();
+	clock_init();
+	timer_init();
 
 	signal_init();
 
@@ -191,6 +206,8 @@ void entry(unsigned long magic, unsigned long addr) {
 	sti();
 	// Create kernel process identity
 	task_create_kernel_pid();
+	// Start the kernel threads
+	workqueue_init();
 	// install device driver fs
 	devfs_installfs();
 	if (!mp3fs_load_addr || mp3fs_installfs(mp3fs_load_addr)){
@@ -209,6 +226,8 @@ void entry(unsigned long magic, unsigned long addr) {
 	keyboard_driver_register();
 	terminal_out_driver_register();
 	tty_driver_register();
+	meminfo_driver_register();
+	clock_driver_register();
 
 	ata_driver_register();
 	ext4_ece391_init();
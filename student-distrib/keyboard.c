@@ -7,6 +7,7 @@
 #include "lib.h"
 #include "proc/task.h"
 #include "proc/signal.h"
+#include "proc/wait_queue.h"
 
 #define PRESSED     1			///< key state pressed
 #define UNPRESSED   0			///< key state unpressed
@@ -330,8 +331,8 @@ uint8_t kbdalt[128] =
   0,  /* All other keys are undefined */
 };
 
-/// PID that is awaiting input
-pid_t keyboard_pid_waiting;
+/// Processes awaiting input
+static wait_queue_t keyboard_wait;
 
 /**
  *	Helper function to append a char keyboard buffer
@@ -441,7 +442,7 @@ void regular_key(uint8_t scancode){
 		}*/
 		scanchar += TERMINAL_OFFSET;
 		if (scanchar < MAX_STDOUT)
-			tty_switch(scanchar);
+			tty_request_switch(scanchar);
 		return;
 	}
 	else if(ctrl_status == PRESSED){
@@ -480,10 +481,7 @@ void regular_key(uint8_t scancode){
 			// write enter control sequence to terminal driver
 			terminal_out_write_(&scanchar, 1);
 			// Signal if there are process awaiting
-			if (keyboard_pid_waiting) {
-				syscall_kill(keyboard_pid_waiting, SIGIO, 0);
-				keyboard_pid_waiting = 0;
-			}
+			wake_up(&keyboard_wait);
 		}
 		break;
 
@@ -611,20 +609,8 @@ int keyboard_driver_register(){
 }
 
 ssize_t keyboard_read(file_t* file, uint8_t *buf, size_t count, off_t *offset){
-	task_sigact_t sa;
-	sigset_t ss;
-	
-	if (prev_enter < 0){
-		// No enter in buffer, set process to sleep until SIGIO
-		keyboard_pid_waiting = task_current_pid();
-		sa.handler = SIG_IGN;
-		sigemptyset(&(sa.mask));
-		sa.flags = SA_RESTART;
-		syscall_sigaction(SIGIO, (int)&sa, 0);
-		sigemptyset(&ss);
-		syscall_sigsuspend((int) &ss, NULL, 0);
-		return 0; // Should not hit
-	}
+	// No enter in buffer, sleep until there is one
+	wait_event(&keyboard_wait, prev_enter >= 0);
 
 	if (prev_enter < (int) count) {
 		// If the flushable part of internal buffer is smaller than the external
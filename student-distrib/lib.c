@@ -15,6 +15,12 @@ static char* video_mem = (char *)VIDEO;
 
 static uint8_t tty_start = 0;
 
+/* Non-temporal stores are used for memcpy/memset of at least MEM_NT_MIN bytes */
+#define MEM_NT_MIN      (4 << 10)
+#define CPUID_SSE2      (1 << 26)
+
+static int mem_nt = 0;
+
 void _set_tty_start_(){
     tty_start = 1;
 }
@@ -292,6 +298,27 @@ uint32_t strlen(const int8_t* s) {
     return len;
 }
 
+/* void mem_init(void);
+ * Inputs: none
+ * Return Value: none
+ * Function: select the memcpy/memset variants for this CPU. SSE2 CPUs get
+ *           MOVNTI stores for large blocks, which bypass the caches and only
+ *           use general registers, so the FPU state of tasks is never touched */
+void mem_init(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+
+    asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    mem_nt = (edx & CPUID_SSE2) != 0;
+}
+
+/* int32_t mem_nt_enabled(void);
+ * Inputs: none
+ * Return Value: 1 if large blocks use non-temporal stores, 0 otherwise
+ * Function: report the choice made by mem_init */
+int32_t mem_nt_enabled(void) {
+    return mem_nt;
+}
+
 /* void* memset(void* s, int32_t c, uint32_t n);
  * Inputs:    void* s = pointer to memory
  *          int32_t c = value to set memory to
@@ -299,18 +326,33 @@ uint32_t strlen(const int8_t* s) {
  * Return Value: new string
  * Function: set n consecutive bytes of pointer s to value c */
 void* memset(void* s, int32_t c, uint32_t n) {
+    if (mem_nt && n >= MEM_NT_MIN) {
+        return memset_nt(s, c, n);
+    }
+    return memset_stos(s, c, n);
+}
+
+/* void* memset_stos(void* s, int32_t c, uint32_t n);
+ * Inputs:    void* s = pointer to memory
+ *          int32_t c = value to set memory to
+ *         uint32_t n = number of bytes to set
+ * Return Value: new string
+ * Function: memset through the caches with rep stosl */
+void* memset_stos(void* s, int32_t c, uint32_t n) {
+    void* d = s;
+
     c &= 0xFF;
     asm volatile ("                 \n\
-            .memset_top:            \n\
+            .memset_top%=:          \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memset_done    \n\
+            jz      .memset_done%=  \n\
             testl   $0x3, %%edi     \n\
-            jz      .memset_aligned \n\
+            jz      .memset_aligned%= \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memset_top     \n\
-            .memset_aligned:        \n\
+            jmp     .memset_top%=   \n\
+            .memset_aligned%=:      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -318,22 +360,69 @@ void* memset(void* s, int32_t c, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     stosl           \n\
-            .memset_bottom:         \n\
+            .memset_bottom%=:       \n\
             testl   %%edx, %%edx    \n\
-            jz      .memset_done    \n\
+            jz      .memset_done%=  \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memset_bottom  \n\
-            .memset_done:           \n\
+            jmp     .memset_bottom%= \n\
+            .memset_done%=:         \n\
             "
-            :
-            : "a"(c << 24 | c << 16 | c << 8 | c), "D"(s), "c"(n)
+            : "+D"(d), "+c"(n)
+            : "a"(c << 24 | c << 16 | c << 8 | c)
             : "edx", "memory", "cc"
     );
     return s;
 }
 
+/* void* memset_nt(void* s, int32_t c, uint32_t n);
+ * Inputs:    void* s = pointer to memory
+ *          int32_t c = value to set memory to
+ *         uint32_t n = number of bytes to set
+ * Return Value: new string
+ * Function: memset with non-temporal stores, 32 bytes per iteration.
+ *           Requires SSE2 */
+void* memset_nt(void* s, int32_t c, uint32_t n) {
+    uint8_t* d = (uint8_t*)s;
+    uint32_t head, blocks, v;
+
+    c &= 0xFF;
+    v = c << 24 | c << 16 | c << 8 | c;
+    head = (-(uint32_t)d) & 0x3;
+    if (head > n) {
+        head = n;
+    }
+    memset_stos(d, c, head);
+    d += head;
+    n -= head;
+    blocks = n >> 5;
+    asm volatile ("                     \n\
+            testl   %%ecx, %%ecx        \n\
+            jz      2f                  \n\
+            1:                          \n\
+            movnti  %%eax, (%%edi)      \n\
+            movnti  %%eax, 4(%%edi)     \n\
+            movnti  %%eax, 8(%%edi)     \n\
+            movnti  %%eax, 12(%%edi)    \n\
+            movnti  %%eax, 16(%%edi)    \n\
+            movnti  %%eax, 20(%%edi)    \n\
+            movnti  %%eax, 24(%%edi)    \n\
+            movnti  %%eax, 28(%%edi)    \n\
+            addl    $32, %%edi          \n\
+            decl    %%ecx               \n\
+            jnz     1b                  \n\
+            sfence                      \n\
+            2:                          \n\
+            "
+            : "+D"(d), "+c"(blocks)
+            : "a"(v)
+            : "memory", "cc"
+    );
+    memset_stos(d, c, n & 31);
+    return s;
+}
+
 /* void* memset_word(void* s, int32_t c, uint32_t n);
  * Description: Optimized memset_word
  * Inputs:    void* s = pointer to memory
@@ -382,19 +471,90 @@ void* memset_dword(void* s, int32_t c, uint32_t n) {
  * Return Value: pointer to dest
  * Function: copy n bytes of src to dest */
 void* memcpy(void* dest, const void* src, uint32_t n) {
+    if (mem_nt && n >= MEM_NT_MIN) {
+        return memcpy_nt(dest, src, n);
+    }
+    return memcpy_movs(dest, src, n);
+}
+
+/* void* memcpy_nt(void* dest, const void* src, uint32_t n);
+ * Inputs:      void* dest = destination of copy
+ *         const void* src = source of copy
+ *              uint32_t n = number of byets to copy
+ * Return Value: pointer to dest
+ * Function: copy with non-temporal stores, 32 bytes per iteration. The
+ *           destination is not pulled into the caches. Requires SSE2 */
+void* memcpy_nt(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint32_t head, blocks;
+
+    head = (-(uint32_t)d) & 0x3;
+    if (head > n) {
+        head = n;
+    }
+    memcpy_movs(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    blocks = n >> 5;
+    asm volatile ("                     \n\
+            testl   %%ecx, %%ecx        \n\
+            jz      2f                  \n\
+            1:                          \n\
+            movl    (%%esi), %%eax      \n\
+            movl    4(%%esi), %%edx     \n\
+            movnti  %%eax, (%%edi)      \n\
+            movnti  %%edx, 4(%%edi)     \n\
+            movl    8(%%esi), %%eax     \n\
+            movl    12(%%esi), %%edx    \n\
+            movnti  %%eax, 8(%%edi)     \n\
+            movnti  %%edx, 12(%%edi)    \n\
+            movl    16(%%esi), %%eax    \n\
+            movl    20(%%esi), %%edx    \n\
+            movnti  %%eax, 16(%%edi)    \n\
+            movnti  %%edx, 20(%%edi)    \n\
+            movl    24(%%esi), %%eax    \n\
+            movl    28(%%esi), %%edx    \n\
+            movnti  %%eax, 24(%%edi)    \n\
+            movnti  %%edx, 28(%%edi)    \n\
+            addl    $32, %%esi          \n\
+            addl    $32, %%edi          \n\
+            decl    %%ecx               \n\
+            jnz     1b                  \n\
+            sfence                      \n\
+            2:                          \n\
+            "
+            : "+S"(s), "+D"(d), "+c"(blocks)
+            :
+            : "eax", "edx", "memory", "cc"
+    );
+    memcpy_movs(d, s, n & 31);
+    return dest;
+}
+
+/* void* memcpy_movs(void* dest, const void* src, uint32_t n);
+ * Inputs:      void* dest = destination of copy
+ *         const void* src = source of copy
+ *              uint32_t n = number of byets to copy
+ * Return Value: pointer to dest
+ * Function: copy through the caches with rep movsl */
+void* memcpy_movs(void* dest, const void* src, uint32_t n) {
+    void* d = dest;
+
     asm volatile ("                 \n\
-            .memcpy_top:            \n\
+            .memcpy_top%=:          \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memcpy_done    \n\
+            jz      .memcpy_done%=  \n\
             testl   $0x3, %%edi     \n\
-            jz      .memcpy_aligned \n\
+            jz      .memcpy_aligned%= \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memcpy_top     \n\
-            .memcpy_aligned:        \n\
+            jmp     .memcpy_top%=   \n\
+            .memcpy_aligned%=:      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -402,27 +562,38 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     movsl           \n\
-            .memcpy_bottom:         \n\
+            .memcpy_bottom%=:       \n\
             testl   %%edx, %%edx    \n\
-            jz      .memcpy_done    \n\
+            jz      .memcpy_done%=  \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memcpy_bottom  \n\
-            .memcpy_done:           \n\
+            jmp     .memcpy_bottom%= \n\
+            .memcpy_done%=:         \n\
             "
+            : "+S"(src), "+D"(d), "+c"(n)
             :
-            : "S"(src), "D"(dest), "c"(n)
             : "eax", "edx", "memory", "cc"
     );
     return dest;
 }
 
+/* int32_t memcmp(const void* s1, const void* s2, uint32_t n);
+ * Inputs: const void* s1 = first block
+ *         const void* s2 = second block
+ *             uint32_t n = number of bytes to compare
+ * Return Value: difference of the first differing bytes, or 0
+ * Function: compare dwords until one differs, then find the byte */
 int32_t memcmp(const void* s1, const void* s2, uint32_t n){
-    uint32_t i;
-    for (i=0;i<n;++i){
+    uint32_t i = 0;
+    while (n - i >= 4 &&
+           *(const uint32_t*)((const int8_t*)s1 + i) ==
+           *(const uint32_t*)((const int8_t*)s2 + i)) {
+        i += 4;
+    }
+    for (;i<n;++i){
         if (((int8_t*)s1)[i] != ((int8_t*)s2)[i]){
             return ((int8_t*)s1)[i] - ((int8_t*)s2)[i];
         }
@@ -436,22 +607,32 @@ int32_t memcmp(const void* s1, const void* s2, uint32_t n){
  *         const void* src = source of move
  *              uint32_t n = number of byets to move
  * Return Value: pointer to dest
- * Function: move n bytes of src to dest */
+ * Function: move n bytes of src to dest. Copies forward with memcpy unless
+ *           dest overlaps the end of src, backward by dwords otherwise */
 void* memmove(void* dest, const void* src, uint32_t n) {
+    void* d = dest;
+
+    if ((uint32_t)dest <= (uint32_t)src || (uint32_t)dest - (uint32_t)src >= n) {
+        return memcpy(dest, src, n);
+    }
     asm volatile ("                             \n\
             movw    %%ds, %%dx                  \n\
             movw    %%dx, %%es                  \n\
-            cld                                 \n\
-            cmp     %%edi, %%esi                \n\
-            jae     .memmove_go                 \n\
             leal    -1(%%esi, %%ecx), %%esi     \n\
             leal    -1(%%edi, %%ecx), %%edi     \n\
+            movl    %%ecx, %%edx                \n\
+            andl    $0x3, %%ecx                 \n\
+            shrl    $2, %%edx                   \n\
             std                                 \n\
-            .memmove_go:                        \n\
             rep     movsb                       \n\
+            subl    $3, %%esi                   \n\
+            subl    $3, %%edi                   \n\
+            movl    %%edx, %%ecx                \n\
+            rep     movsl                       \n\
+            cld                                 \n\
             "
+            : "+D"(d), "+S"(src), "+c"(n)
             :
-            : "D"(dest), "S"(src), "c"(n)
             : "edx", "memory", "cc"
     );
     return dest;
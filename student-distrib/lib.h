@@ -16,10 +16,16 @@ int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
 void clear(void);
 
+void mem_init(void);
+int32_t mem_nt_enabled(void);
 void* memset(void* s, int32_t c, uint32_t n);
+void* memset_stos(void* s, int32_t c, uint32_t n);
+void* memset_nt(void* s, int32_t c, uint32_t n);
 void* memset_word(void* s, int32_t c, uint32_t n);
 void* memset_dword(void* s, int32_t c, uint32_t n);
 void* memcpy(void* dest, const void* src, uint32_t n);
+void* memcpy_movs(void* dest, const void* src, uint32_t n);
+void* memcpy_nt(void* dest, const void* src, uint32_t n);
 int32_t memcmp(const void* s1, const void* s2, uint32_t n);
 void* memmove(void* dest, const void* src, uint32_t n);
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n);
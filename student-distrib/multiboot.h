@@ -10,6 +10,14 @@
 #define MULTIBOOT_HEADER_MAGIC          0x1BADB002
 #define MULTIBOOT_BOOTLOADER_MAGIC      0x2BADB002
 
+/* Flags in multiboot_info_t */
+#define MULTIBOOT_INFO_MEMORY           0x00000001
+#define MULTIBOOT_INFO_MODS             0x00000008
+#define MULTIBOOT_INFO_MEM_MAP          0x00000040
+
+/* Type of a usable memory_map_t region */
+#define MULTIBOOT_MEMORY_AVAILABLE      1
+
 #ifndef ASM
 
 /* Types */
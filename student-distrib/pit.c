@@ -3,7 +3,7 @@
 #include "boot/idt.h"
 #include "lib.h"
 #include "i8259.h"
-#include "proc/scheduler.h"
+#include "timer.h"
 
 #define PIT_IRQNUM		0	///< IRQ number the PIT is connected to
 
@@ -12,17 +12,19 @@
 #define PIT_DATAPORT2	0x42	///< Data port for counter 2
 #define PIT_CMDPORT		0x43	///< Command port
 
-int counter;
+#define PIT_CMD_RATE		0x36	///< Counter 0, lobyte/hibyte, rate generator
+#define PIT_CMD_ONESHOT		0x30	///< Counter 0, lobyte/hibyte, interrupt on terminal count
+#define PIT_CMD_READBACK	0xC2	///< Latch count and status of counter 0
+#define PIT_STATUS_OUT		0x80	///< Status flag, output is high (count reached 0)
+
+static uint32_t pit_count;	// count programmed by the last `pit_oneshot`
 
 void pit_handler() {
 	send_eoi(PIT_IRQNUM);
-	if (scheduler_on_flag) {
-		scheduler_event();
-	}
+	timer_interrupt();
 }
 
 void pit_init() {
-	pit_setrate(512);
 	idt_addEventListener(PIT_IRQNUM, pit_handler);
 }
 
@@ -30,10 +32,41 @@ void pit_setrate(int rate)
 {
 	// Calculate divisor relative to default rate
 	// Default rate is 1.193182 MHz
-	rate = 1193182 / rate;
+	rate = PIT_FREQ / rate;
 	
 	// Set registers
-	outb(0x36, PIT_CMDPORT); // Use counter 0 as rate generator
+	outb(PIT_CMD_RATE, PIT_CMDPORT); // Use counter 0 as rate generator
 	outb(rate & 0xff, PIT_DATAPORT0); // LOBYTE
 	outb(rate >> 8, PIT_DATAPORT0); // HIBYTE
 }
+
+uint32_t pit_oneshot(uint32_t count) {
+	if (count > PIT_COUNT_MAX) {
+		count = PIT_COUNT_MAX;
+	} else if (count < PIT_COUNT_MIN) {
+		count = PIT_COUNT_MIN;
+	}
+	outb(PIT_CMD_ONESHOT, PIT_CMDPORT);
+	outb(count & 0xff, PIT_DATAPORT0);
+	outb(count >> 8, PIT_DATAPORT0);
+	pit_count = count;
+	return count;
+}
+
+uint32_t pit_elapsed() {
+	uint32_t status, cur;
+
+	outb(PIT_CMD_READBACK, PIT_CMDPORT);
+	status = inb(PIT_DATAPORT0);
+	cur = inb(PIT_DATAPORT0);
+	cur |= inb(PIT_DATAPORT0) << 8;
+	if (status & PIT_STATUS_OUT) {
+		// Reached 0, the counter wrapped around and kept counting down
+		return pit_count + ((0x10000 - cur) & 0xFFFF);
+	}
+	if (cur > pit_count) {
+		// Count not loaded yet
+		return 0;
+	}
+	return pit_count - cur;
+}
@@ -2,10 +2,20 @@
  *	@file pit.h
  *
  *	Programmable Interrupt Timer chip driver
+ *
+ *	Counter 0 runs in one-shot mode: it raises a single interrupt once the
+ *	programmed number of input clock cycles has elapsed, and is programmed
+ *	again by the timer subsystem (timer.h) for the next expiring timer.
  */
 #ifndef PIT_H
 #define PIT_H
 
+#include "types.h"
+
+#define PIT_FREQ		1193182	///< Input clock of the counters, in Hz
+#define PIT_COUNT_MAX	0xFFFF	///< Longest one-shot count
+#define PIT_COUNT_MIN	16		///< Shortest one-shot count
+
 /**
  *	Set PIT to generate periodic interrupt
  *
@@ -13,6 +23,24 @@
  */
 void pit_setrate(int rate);
 
+/**
+ *	Program counter 0 to interrupt once after a number of input clock cycles
+ *
+ *	@param count: cycles of `PIT_FREQ`, clamped to
+ *				  [`PIT_COUNT_MIN`, `PIT_COUNT_MAX`]
+ *	@return the count actually programmed
+ */
+uint32_t pit_oneshot(uint32_t count);
+
+/**
+ *	Read how many input clock cycles elapsed since the last `pit_oneshot`
+ *
+ *	Also counts the cycles elapsed after the interrupt, if it already fired.
+ *
+ *	@return the elapsed cycles
+ */
+uint32_t pit_elapsed();
+
 /**
  *	Initialize PIT
  */
@@ -4,6 +4,7 @@
 #include "task.h"
 #include "../../libc/include/sys/stat.h"
 #include "../k_mem/kmalloc.h"
+#include "../fs/page_cache.h"
 
 int elf_load_pheader(int fd, int offset, elf_pheader_t *ph) {
 	int ret;
@@ -60,15 +61,83 @@ int elf_sanity(int fd) {
 	return 0;
 }
 
+/**
+ *	Map a read-only segment through the page cache
+ *
+ *	Pages already cached for the file are mapped shared, the others are read
+ *	from the file into new frames that are then added to the cache. Pages
+ *	past the file data map the zero page.
+ *
+ *	@param idx: index of the next free entry in the pages of `proc`, advanced
+ *				by the number of pages mapped
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+static int elf_load_shared(int fd, inode_t *inode, elf_pheader_t *ph, task_t *proc, int *idx) {
+	task_ptentry_t *ptent;
+	uint32_t addr, fend, foff, lo, hi;
+	int ret;
+
+	fend = ph->vaddr + (ph->memsz < ph->filesz ? ph->memsz : ph->filesz);
+	for (addr = ph->vaddr & ~0xFFF; addr < ph->vaddr + ph->memsz; addr += (4<<10)) {
+		if (*idx == proc->page_limit) {
+			// No more pages may be allocated for this process
+			return -ENOMEM;
+		}
+		ptent = proc->pages + *idx;
+		ptent->vaddr = addr;
+		ptent->pt_flags = PAGE_DIR_ENT_USER | PAGE_DIR_ENT_PRESENT;
+		ptent->priv_flags = 0;
+		if (addr >= fend) {
+			ptent->paddr = page_zero_frame();
+		} else {
+			// Part of the page holding file data, the rest is zero
+			lo = (addr < ph->vaddr) ? ph->vaddr - addr : 0;
+			hi = (fend - addr < (4<<10)) ? fend - addr : (4<<10);
+			foff = ph->offset + addr - ph->vaddr;
+			ptent->paddr = page_cache_find(inode, foff, lo, hi);
+			if (!ptent->paddr) {
+				ret = page_alloc_4KB((int *)&(ptent->paddr));
+				if (ret != 0) {
+					return ret;
+				}
+				// Fill the frame through the temporary slot
+				page_dir_map_4KB(proc->pd, 0x08040000, ptent->paddr,
+								 PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR);
+				page_flush_tlb_page(0x08040000);
+				memset((char *)0x08040000, 0, 4<<10);
+				ret = syscall_lseek(fd, foff + lo, SEEK_SET);
+				if (ret >= 0) {
+					ret = syscall_read(fd, 0x08040000 + lo, hi - lo);
+				}
+				page_dir_unmap(proc->pd, 0x08040000);
+				if (ret != (int)(hi - lo)) {
+					page_alloc_free_4KB(ptent->paddr);
+					return (ret < 0) ? ret : -EIO;
+				}
+				// Not being cached only costs a later re-read
+				page_cache_add(inode, foff, lo, hi, ptent->paddr);
+			}
+		}
+		ret = page_tab_add_entry(ptent->vaddr, ptent->paddr, ptent->pt_flags);
+		if (ret != 0) {
+			printf("Mapping failed. %d\n", ret);
+		}
+		(*idx)++;
+	}
+	return 0;
+}
+
 int elf_load(int fd)  {
 	elf_eheader_t eh;
 	elf_pheader_t ph;
 	task_t *proc;
 	int i, j, ret, idx = 0, idx0;
-	uint32_t addr, align_off, brk = 0;
+	uint32_t addr, align_off, bss, brk = 0;
 	task_ptentry_t *ptent;
+	page_flush_t flush;
 	// stat_t file_stat;
 	proc = task_list + task_current_pid();
+	page_flush_init(&flush);
 
 	ret = syscall_read(fd, (int)&eh, sizeof(eh));
 	if (ret < 0) {
@@ -113,7 +182,7 @@ int elf_load(int fd)  {
 	}
 	proc->page_limit += 16; // For stacks and heaps
 	
-	ptent = kmalloc(proc->page_limit * sizeof(task_ptentry_t));
+	ptent = task_pages_alloc(&proc->page_limit);
 	if (!ptent) {
 		return -ENOMEM;
 	}
@@ -148,7 +217,21 @@ int elf_load(int fd)  {
 			// Bad alignment
 			return -ENOEXEC;
 		}
+		if (ph.vaddr + ph.memsz > brk) {
+			brk = ph.vaddr + ph.memsz;
+		}
+		if (ph.align == (4<<10) && !(ph.flags & 2)) {
+			// Read-only text is shared with other processes running the file
+			ret = elf_load_shared(fd, proc->files[fd]->inode, &ph, proc, &idx);
+			if (ret != 0) {
+				return ret;
+			}
+			continue;
+		}
 		idx0 = idx;
+		// 4KB pages past the file data of a writable segment share the zero page
+		bss = ph.vaddr + (ph.memsz < ph.filesz ? ph.memsz : ph.filesz);
+		bss = (ph.align == (4<<10) && (ph.flags & 2)) ? (bss + 0xFFF) & ~0xFFF : ~0U;
 		for (addr = ph.vaddr - align_off;
 			 addr < ph.vaddr+ph.memsz;
 			 addr += ph.align) {
@@ -160,6 +243,19 @@ int elf_load(int fd)  {
 			// Flags are the same for page directories and page tables
 			ptent->pt_flags = PAGE_DIR_ENT_USER;
 			ptent->paddr = 0;
+			if (addr >= bss) {
+				// Copy-on-write zero page, a frame is allocated on first write
+				ptent->paddr = page_zero_frame();
+				ptent->vaddr = addr;
+				ptent->pt_flags |= PAGE_DIR_ENT_PRESENT;
+				ptent->priv_flags = TASK_PTENT_CPONWR;
+				ret = page_tab_add_entry(ptent->vaddr, ptent->paddr, ptent->pt_flags);
+				if (ret != 0) {
+					printf("Mapping failed. %d\n", ret);
+				}
+				idx++;
+				continue;
+			}
 			if (ph.align == (4<<10)) {
 				// Allocate 4KB pages
 				ret = page_alloc_4KB((int *)&(ptent->paddr));
@@ -189,7 +285,7 @@ int elf_load(int fd)  {
 			}
 			idx++;
 		}
-		page_flush_tlb();
+		page_flush_tlb_range(ph.vaddr - align_off, ph.vaddr + ph.memsz);
 		ret = syscall_lseek(fd, ph.offset, SEEK_SET);
 		if (ret < 0) {
 			return ret;
@@ -211,8 +307,9 @@ int elf_load(int fd)  {
 				return ret;
 			}
 			if (ph.memsz > ph.filesz) {
-				// fill the rest with zeros
-				memset((uint8_t *)(ph.vaddr+ph.filesz), 0, ph.memsz-ph.filesz);
+				// fill the rest with zeros, up to the zero pages
+				memset((uint8_t *)(ph.vaddr+ph.filesz), 0,
+					   (ph.vaddr+ph.memsz < bss ? ph.vaddr+ph.memsz : bss) - (ph.vaddr+ph.filesz));
 			}
 		}
 		if (ret != 0) {
@@ -223,6 +320,7 @@ int elf_load(int fd)  {
 			for (j = idx0 ; j < idx; j++) {
 				ptent = proc->pages + j;
 				ptent->pt_flags &= ~PAGE_DIR_ENT_RDWR;
+				page_flush_add(&flush, ptent->vaddr);
 				if (ptent->pt_flags & PAGE_DIR_ENT_4MB) {
 					// Reload 4MB page table entry
 					ret = page_dir_delete_entry(ptent->vaddr);
@@ -246,11 +344,8 @@ int elf_load(int fd)  {
 				}
 			}
 		}
-		if (ph.vaddr + ph.memsz > brk) {
-			brk = ph.vaddr + ph.memsz;
-		}
 	}
-	page_flush_tlb();
+	page_flush_finish(&flush);
 	proc->heap.start = proc->heap.prog_break = (brk & ~((4<<20)-1)) + (4<<20);
 	return 0;
 }
@@ -0,0 +1,144 @@
+#include "fpu.h"
+
+#include "task.h"
+#include "../lib.h"
+#include "../errno.h"
+#include "../k_mem/kmalloc.h"
+
+static int fpu_enabled = 0;			// lazy switching is on
+static struct s_task *fpu_owner = NULL;	// task whose state is in the registers
+static fpu_state_t fpu_default;		// state of a task before its first FPU use
+static kmem_cache_t *fpu_cache;		// fpu_state_t objects
+
+/**
+ *	Set CR0.TS, the next FPU instruction faults
+ */
+static inline void fpu_stts() {
+	uint32_t cr0;
+
+	asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+	asm volatile ("movl %0, %%cr0" : : "r" (cr0 | FPU_CR0_TS));
+}
+
+/**
+ *	Clear CR0.TS
+ */
+static inline void fpu_clts() {
+	asm volatile ("clts");
+}
+
+static inline void fpu_fxsave(fpu_state_t *state) {
+	asm volatile ("fxsave (%0)" : : "r" (state) : "memory");
+}
+
+static inline void fpu_fxrstor(fpu_state_t *state) {
+	asm volatile ("fxrstor (%0)" : : "r" (state) : "memory");
+}
+
+void fpu_init() {
+	uint32_t eax = 1, ebx, ecx, edx, cr;
+	uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+
+	asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	if (!(edx & FPU_CPUID_FXSR)) {
+		printf("FPU: no FXSAVE support, FPU state is not switched\n");
+		return;
+	}
+	fpu_cache = kmem_cache_create("task_fpu", sizeof(fpu_state_t));
+	if (!fpu_cache) {
+		return;
+	}
+	asm volatile ("movl %%cr0, %0" : "=r" (cr));
+	cr = (cr & ~(FPU_CR0_EM | FPU_CR0_TS)) | FPU_CR0_MP | FPU_CR0_NE;
+	asm volatile ("movl %0, %%cr0" : : "r" (cr));
+	asm volatile ("movl %%cr4, %0" : "=r" (cr));
+	cr |= FPU_CR4_OSFXSR | FPU_CR4_OSXMMEXCPT;
+	asm volatile ("movl %0, %%cr4" : : "r" (cr));
+
+	asm volatile ("fninit");
+	asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+	fpu_fxsave(&fpu_default);
+	fpu_stts();
+	fpu_enabled = 1;
+}
+
+void fpu_switch(task_t *to) {
+	if (!fpu_enabled) {
+		return;
+	}
+	if (to == fpu_owner) {
+		fpu_clts();
+	} else {
+		fpu_stts();
+	}
+}
+
+int fpu_restore() {
+	task_t *proc = task_list + task_current_pid();
+
+	if (!fpu_enabled) {
+		return -ENODEV;
+	}
+	if (!proc->fpu) {
+		proc->fpu = kmem_cache_alloc(fpu_cache);
+		if (!proc->fpu) {
+			return -ENOMEM;
+		}
+		memcpy(proc->fpu, &fpu_default, sizeof(fpu_state_t));
+	}
+	fpu_clts();
+	if (fpu_owner == proc) {
+		return 0;
+	}
+	if (fpu_owner) {
+		fpu_fxsave(fpu_owner->fpu);
+	}
+	fpu_fxrstor(proc->fpu);
+	fpu_owner = proc;
+	return 0;
+}
+
+int fpu_fork(task_t *parent, task_t *child) {
+	child->fpu = NULL;
+	if (!parent->fpu) {
+		return 0;
+	}
+	child->fpu = kmem_cache_alloc(fpu_cache);
+	if (!child->fpu) {
+		return -ENOMEM;
+	}
+	if (fpu_owner == parent) {
+		// The parent is running, its registers are live
+		fpu_clts();
+		fpu_fxsave(parent->fpu);
+	}
+	memcpy(child->fpu, parent->fpu, sizeof(fpu_state_t));
+	return 0;
+}
+
+void fpu_release(task_t *proc) {
+	if (fpu_owner == proc) {
+		fpu_owner = NULL;
+		fpu_stts();
+	}
+	if (proc->fpu) {
+		kmem_cache_free(fpu_cache, proc->fpu);
+		proc->fpu = NULL;
+	}
+}
+
+int fpu_signal_save(task_t *proc, fpu_state_t *buf) {
+	if (!proc->fpu) {
+		return 0;
+	}
+	if (fpu_owner == proc) {
+		fpu_clts();
+		fpu_fxsave(proc->fpu);
+		// The handler reloads the clean state on its first FPU instruction
+		fpu_owner = NULL;
+		fpu_stts();
+	}
+	memcpy(buf, proc->fpu, sizeof(fpu_state_t));
+	memcpy(proc->fpu, &fpu_default, sizeof(fpu_state_t));
+	return 1;
+}
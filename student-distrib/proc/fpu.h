@@ -0,0 +1,91 @@
+/**
+ *	@file proc/fpu.h
+ *
+ *	Lazy switching of the x87 FPU and SSE registers between tasks
+ *
+ *	The FPU/SSE registers hold the state of at most one task at a time, the
+ *	owner. Switching to any other task sets CR0.TS, so that its first FPU or
+ *	SSE instruction raises a Device Not Available fault (#NM). The handler
+ *	saves the registers of the previous owner with FXSAVE and loads those of
+ *	the current task with FXRSTOR. Tasks that never use the FPU never pay for
+ *	a save or a restore, and get no state allocated.
+ *
+ *	The kernel itself is built without FPU and SSE instructions.
+ */
+#ifndef PROC_FPU_H
+#define PROC_FPU_H
+
+#include "../types.h"
+
+#define FPU_STATE_SIZE		512		///< Size of an FXSAVE image
+#define FPU_MXCSR_DEFAULT	0x1F80	///< All SIMD exceptions masked, round to nearest
+
+#define FPU_CR0_MP		0x02	///< CR0 flag, WAIT honours TS
+#define FPU_CR0_EM		0x04	///< CR0 flag, emulate the FPU
+#define FPU_CR0_TS		0x08	///< CR0 flag, task switched
+#define FPU_CR0_NE		0x20	///< CR0 flag, report x87 errors with #MF
+#define FPU_CR4_OSFXSR		0x200	///< CR4 flag, enable FXSAVE/FXRSTOR and SSE
+#define FPU_CR4_OSXMMEXCPT	0x400	///< CR4 flag, report SIMD errors with #XM
+
+#define FPU_CPUID_FXSR	(1 << 24)	///< CPUID.1:EDX, FXSAVE/FXRSTOR supported
+
+struct s_task;
+
+/**
+ *	An FXSAVE image of the FPU/SSE registers
+ */
+typedef struct s_fpu_state {
+	uint8_t data[FPU_STATE_SIZE];	///< Layout defined by FXSAVE
+} __attribute__((aligned(16))) fpu_state_t;
+
+/**
+ *	Enable the FPU and SSE, and build the initial register state of tasks
+ *
+ *	@note without FXSAVE support, tasks keep sharing the registers
+ */
+void fpu_init();
+
+/**
+ *	Prepare the FPU for a task about to run
+ *
+ *	@param to: the task
+ */
+void fpu_switch(struct s_task *to);
+
+/**
+ *	Give the FPU to the current task after a Device Not Available fault
+ *
+ *	@return 0 on success, -ENOMEM if no state could be allocated, or -ENODEV
+ *			if the fault was not caused by lazy switching
+ */
+int fpu_restore();
+
+/**
+ *	Copy the FPU/SSE state of a process into a forked child
+ *
+ *	@param parent: the forking process
+ *	@param child: the new process, a copy of the parent's `task_t`
+ *	@return 0 on success, or -ENOMEM
+ */
+int fpu_fork(struct s_task *parent, struct s_task *child);
+
+/**
+ *	Drop the FPU/SSE state of a task, e.g. on exit and exec
+ *
+ *	@param proc: the task
+ */
+void fpu_release(struct s_task *proc);
+
+/**
+ *	Save the FPU/SSE state of a task for a signal handler, and reset it
+ *
+ *	The handler starts with a clean state, the saved one is loaded back with
+ *	FXRSTOR when it returns.
+ *
+ *	@param proc: the task
+ *	@param buf: where to write the image, 16 bytes aligned
+ *	@return 1 if the state was saved, 0 if the task has not used the FPU
+ */
+int fpu_signal_save(struct s_task *proc, fpu_state_t *buf);
+
+#endif
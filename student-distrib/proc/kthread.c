@@ -0,0 +1,64 @@
+#include "kthread.h"
+
+#include "scheduler.h"
+#include "../lib.h"
+#include "../errno.h"
+
+/**
+ *	First function of every kernel thread, on top of its kernel stack
+ */
+static void kthread_start() {
+	task_t *proc = task_list + task_current_pid();
+
+	(*proc->kthread_func)(proc->kthread_data);
+	kthread_exit();
+}
+
+int kthread_create(void (*func)(uint32_t data), uint32_t data, int nice) {
+	task_t *proc;
+	uint32_t *frame;
+	int pid, esp;
+
+	pid = task_alloc_pid();
+	if (pid < 0) {
+		return pid;
+	}
+	esp = task_kstack_alloc(pid);
+	if (esp < 0) {
+		return esp;
+	}
+	proc = task_list + pid;
+	memset(proc, 0, sizeof(task_t));
+	proc->pid = pid;
+	// No parent waits for it
+	proc->parent = -1;
+	proc->ks_esp = esp;
+	proc->kthread_func = func;
+	proc->kthread_data = data;
+	// The kernel address space, `pd` NULL selects the kernel page directory
+	proc->pd = NULL;
+	proc->nice = nice;
+
+	// The frame `scheduler_resume` pops: edi, esi, ebx, ebp, then the entry
+	// point and a return address it never uses
+	frame = (uint32_t *)esp - 6;
+	memset(frame, 0, 6 * sizeof(uint32_t));
+	frame[4] = (uint32_t)&kthread_start;
+	proc->kctx_esp = (uint32_t)frame;
+
+	proc->status = TASK_ST_RUNNING;
+	scheduler_update(proc);
+	return pid;
+}
+
+void kthread_yield() {
+	task_t *proc = task_list + task_current_pid();
+
+	// Still runnable, it is picked again after the others of its level
+	scheduler_block(&proc->kctx_esp);
+}
+
+void kthread_exit() {
+	task_release(task_list + task_current_pid());
+	scheduler_event();
+}
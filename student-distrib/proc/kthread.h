@@ -0,0 +1,57 @@
+/**
+ *	@file proc/kthread.h
+ *
+ *	Kernel threads
+ *
+ *	A kernel thread is a task running a kernel function in ring 0, on a
+ *	kernel stack of its own and in the kernel address space. It is picked
+ *	from the run queues like a process, but has no user registers to return
+ *	to: `scheduler_switch` always resumes it from the kernel context saved by
+ *	`scheduler_block`, the first time from one built by `kthread_create`.
+ *
+ *	Like the rest of the kernel, kernel threads run with interrupts disabled.
+ *	They give up the processor when they sleep on a wait queue, call
+ *	`kthread_yield`, or return, never in the middle of their work. Signals
+ *	cannot be sent to them.
+ */
+#ifndef PROC_KTHREAD_H
+#define PROC_KTHREAD_H
+
+#include "task.h"
+
+/**
+ *	Start a kernel thread
+ *
+ *	@param func: the function to run, the thread exits when it returns
+ *	@param data: argument of `func`
+ *	@param nice: nice value of the thread, from `SCHEDULER_NICE_MIN` to
+ *				 `SCHEDULER_NICE_MAX`
+ *	@return the pid of the thread, -EAGAIN if no pid is free, or -ENOMEM
+ */
+int kthread_create(void (*func)(uint32_t data), uint32_t data, int nice);
+
+/**
+ *	Let the other runnable tasks of the same priority run
+ *
+ *	@note only from a kernel thread
+ */
+void kthread_yield();
+
+/**
+ *	End the current kernel thread
+ *
+ *	@note does not return
+ */
+void kthread_exit();
+
+/**
+ *	Check whether a task is a kernel thread
+ *
+ *	@param proc: the task
+ *	@return 1 for a kernel thread, 0 for a process
+ */
+static inline int kthread_is(task_t *proc) {
+	return proc->kthread_func != NULL;
+}
+
+#endif
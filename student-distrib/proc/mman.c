@@ -0,0 +1,452 @@
+#include "mman.h"
+
+#include "task.h"
+#include "../lib.h"
+#include "../errno.h"
+#include "../k_mem/kmalloc.h"
+#include "../fs/page_cache.h"
+
+#include "../../libc/src/syscalls.h" // Definitions from libc
+#include "../../libc/include/sys/mman.h"
+
+static kmem_cache_t *task_mmap_cache;	// task_mmap_t objects
+
+task_mmap_t *task_mmap_find(task_t *proc, uint32_t addr) {
+	task_mmap_t *map;
+
+	for (map = proc->mmaps; map && map->start <= addr; map = map->next) {
+		if (addr < map->end) {
+			return map;
+		}
+	}
+	return NULL;
+}
+
+int task_mmap_shared(task_t *proc, uint32_t addr) {
+	task_mmap_t *map = task_mmap_find(proc, addr);
+	return map && (map->flags & MAP_SHARED);
+}
+
+/**
+ *	Release a mapping descriptor and its reference to the file
+ */
+static void task_mmap_put(task_mmap_t *map) {
+	if (map->file) {
+		vfs_close_file(map->file);
+	}
+	kmem_cache_free(task_mmap_cache, map);
+}
+
+/**
+ *	Write modified pages of a shared file mapping in [start, end) back
+ *
+ *	Pages past the end of the file are not written, mappings never extend
+ *	the file.
+ *
+ *	@return 0 on success, or the negative of an errno of the last failed write
+ */
+static int task_mmap_sync(task_t *proc, task_mmap_t *map, uint32_t start, uint32_t end) {
+	page_table_entry_t *pte;
+	page_flush_t flush;
+	off_t off;
+	int ret, err = 0;
+
+	if (!map->file || !(map->flags & MAP_SHARED) || !(map->prot & PROT_WRITE)) {
+		return 0;
+	}
+	page_flush_init(&flush);
+	for (; start < end; start += (4<<10)) {
+		pte = page_dir_get_pte(proc->pd, start);
+		if (!pte || (*pte & (PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_DIRTY)) !=
+			(PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_DIRTY)) {
+			continue;
+		}
+		*pte &= ~PAGE_TAB_ENT_DIRTY;
+		page_flush_add(&flush, start);
+		off = map->offset + (start - map->start);
+		if (off >= map->file->inode->size) {
+			continue;
+		}
+		ret = (*map->file->f_op->write)(map->file, (uint8_t *) start,
+				(map->file->inode->size - off < (4<<10)) ?
+				map->file->inode->size - off : (4<<10), &off);
+		if (ret < 0) {
+			err = ret;
+		}
+	}
+	if (flush.count) {
+		// Later writes must set the dirty bits again
+		page_flush_finish(&flush);
+		page_cache_invalidate(map->file->inode);
+	}
+	return err;
+}
+
+/**
+ *	Release the frames mapped in [start, end)
+ */
+static void task_mmap_free_frames(task_t *proc, uint32_t start, uint32_t end) {
+	uint32_t next;
+
+	for (; start < end; start = next) {
+		next = (start & ~((4<<20) - 1)) + (4<<20);
+		task_pgtab_free(proc, start, (next < end) ? next : end);
+	}
+}
+
+/**
+ *	Check that no mapping overlaps [start, end)
+ */
+static int task_mmap_range_free(task_t *proc, uint32_t start, uint32_t end) {
+	task_mmap_t *map;
+
+	for (map = proc->mmaps; map && map->start < end; map = map->next) {
+		if (map->end > start) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ *	Find a free range of the mapping area, first fit
+ *
+ *	@return the start of the range, or 0 if the area is full
+ */
+static uint32_t task_mmap_area(task_t *proc, uint32_t len) {
+	task_mmap_t *map;
+	uint32_t addr = TASK_MMAP_BASE;
+
+	for (map = proc->mmaps; map; map = map->next) {
+		if (map->start - addr >= len) {
+			break;
+		}
+		addr = map->end;
+	}
+	if (len > TASK_MMAP_END - addr) {
+		return 0;
+	}
+	return addr;
+}
+
+/**
+ *	Add `pages` entries for the 4MB regions covering [start, end)
+ *
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+static int task_mmap_regions(task_t *proc, uint32_t start, uint32_t end) {
+	uint32_t addr;
+	int i, missing = 0;
+
+	for (addr = start & ~((4<<20) - 1); addr < end; addr += (4<<20)) {
+		i = task_pages_find(proc, addr);
+		if (i < 0) {
+			missing++;
+		} else if (!(proc->pages[i].priv_flags & TASK_PTENT_MMAP)) {
+			// Something else lives there
+			return -ENOMEM;
+		}
+	}
+	i = task_pages_reserve(proc, missing);
+	if (i < 0) {
+		return i;
+	}
+	for (addr = start & ~((4<<20) - 1); addr < end; addr += (4<<20)) {
+		if (task_pages_find(proc, addr) >= 0)
+			continue;
+		proc->pages[i].vaddr = addr;
+		proc->pages[i].paddr = 0;
+		proc->pages[i].pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
+								  PAGE_DIR_ENT_USER | PAGE_DIR_ENT_4MB;
+		proc->pages[i].priv_flags = TASK_PTENT_PGTAB | TASK_PTENT_MMAP;
+		i++;
+	}
+	return 0;
+}
+
+/**
+ *	Drop the `pages` entries of 4MB regions in [start, end) left without mappings
+ */
+static void task_mmap_regions_trim(task_t *proc, uint32_t start, uint32_t end) {
+	uint32_t addr;
+	int i;
+
+	for (addr = start & ~((4<<20) - 1); addr < end; addr += (4<<20)) {
+		i = task_pages_find(proc, addr);
+		if (i < 0 || !(proc->pages[i].priv_flags & TASK_PTENT_MMAP))
+			continue;
+		if (!task_mmap_range_free(proc, addr, addr + (4<<20)))
+			continue;
+		task_pgtab_release(proc, addr);
+		task_pages_remove(proc, i);
+	}
+	page_flush_tlb_range(start, end);
+}
+
+/**
+ *	Remove the mappings in [start, end), splitting those partially covered
+ *
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+static int task_mmap_remove(task_t *proc, uint32_t start, uint32_t end) {
+	task_mmap_t **link, *map, *tail;
+	uint32_t lo, hi;
+
+	for (link = &proc->mmaps; (map = *link) && map->start < end; ) {
+		if (map->end <= start) {
+			link = &map->next;
+			continue;
+		}
+		tail = NULL;
+		if (map->start < start && map->end > end) {
+			// Punching a hole, the part above it becomes a new mapping
+			tail = kmem_cache_alloc(task_mmap_cache);
+			if (!tail) {
+				return -ENOMEM;
+			}
+		}
+		lo = (map->start > start) ? map->start : start;
+		hi = (map->end < end) ? map->end : end;
+		task_mmap_sync(proc, map, lo, hi);
+		task_mmap_free_frames(proc, lo, hi);
+		if (tail) {
+			*tail = *map;
+			tail->start = end;
+			tail->offset += end - map->start;
+			if (tail->file) {
+				tail->file->open_count++;
+			}
+			map->end = start;
+			map->next = tail;
+			break;
+		}
+		if (map->start < start) {
+			map->end = start;
+			link = &map->next;
+		} else if (map->end > end) {
+			map->offset += end - map->start;
+			map->start = end;
+			break;
+		} else {
+			*link = map->next;
+			task_mmap_put(map);
+		}
+	}
+	task_mmap_regions_trim(proc, start, end);
+	return 0;
+}
+
+int task_mmap_fault(task_t *proc, uint32_t addr, int write) {
+	task_mmap_t *map;
+	off_t off;
+	int new = 0, ret = 0, flags;
+
+	map = task_mmap_find(proc, addr);
+	if (!map || !(map->prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) ||
+		(write && !(map->prot & PROT_WRITE))) {
+		return -EFAULT;
+	}
+	flags = PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER;
+	if (!map->file && !(map->flags & MAP_SHARED) && !write) {
+		// Private anonymous memory reads the zero page until written
+		if (map->prot & PROT_WRITE) {
+			flags |= PAGE_TAB_ENT_COW;
+		}
+		return page_dir_map_4KB(proc->pd, addr, page_zero_frame(), flags) ? -ENOMEM : 0;
+	}
+	if (map->prot & PROT_WRITE) {
+		flags |= PAGE_TAB_ENT_RDWR;
+	}
+	if (page_alloc_4KB(&new) != 0) {
+		return -ENOMEM;
+	}
+	// using virtual addr 0x08040000 as temp
+	page_dir_map_4KB(proc->pd, 0x08040000, new, PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR);
+	page_flush_tlb_page(0x08040000);
+	memset((char *) 0x08040000, 0, 4<<10);
+	if (map->file) {
+		// Bytes past the end of the file read as zero
+		off = map->offset + (addr - map->start);
+		ret = (*map->file->f_op->read)(map->file, (uint8_t *) 0x08040000, 4<<10, &off);
+	}
+	page_dir_unmap(proc->pd, 0x08040000);
+	if (ret < 0 || page_dir_map_4KB(proc->pd, addr, new, flags) != 0) {
+		page_alloc_free_4KB(new);
+		return (ret < 0) ? -EFAULT : -ENOMEM;
+	}
+	page_flush_tlb_page(0x08040000);
+	page_flush_tlb_page(addr);
+	return 0;
+}
+
+int task_mmap_fork(task_t *parent, task_t *child) {
+	task_mmap_t *map, *copy, **link;
+
+	link = &child->mmaps;
+	for (map = parent->mmaps; map; map = map->next) {
+		copy = kmem_cache_alloc(task_mmap_cache);
+		if (!copy) {
+			return -ENOMEM;
+		}
+		*copy = *map;
+		copy->next = NULL;
+		if (copy->file) {
+			copy->file->open_count++;
+		}
+		*link = copy;
+		link = &copy->next;
+	}
+	return 0;
+}
+
+void task_mmap_release(task_t *proc) {
+	task_mmap_t *map;
+
+	while ((map = proc->mmaps)) {
+		proc->mmaps = map->next;
+		task_mmap_sync(proc, map, map->start, map->end);
+		task_mmap_put(map);
+	}
+}
+
+void task_mmap_drop(task_t *proc) {
+	task_mmap_t *map;
+
+	while ((map = proc->mmaps)) {
+		proc->mmaps = map->next;
+		task_mmap_put(map);
+	}
+}
+
+int syscall_mmap(int argsp, int b, int c) {
+	struct sys_mmap_args args;
+	task_t *proc;
+	task_mmap_t *map, **link;
+	file_t *file = NULL;
+	uint32_t addr, len;
+	int share, ret;
+
+	proc = task_list + task_current_pid();
+	if (!argsp || task_access_memory(argsp) != 0) {
+		return -EFAULT;
+	}
+	memcpy(&args, (void *) argsp, sizeof(args));
+
+	len = (args.length + 0xFFF) & ~0xFFF;
+	share = args.flags & (MAP_SHARED | MAP_PRIVATE);
+	if (!args.length || len < args.length ||
+		(share != MAP_SHARED && share != MAP_PRIVATE) ||
+		(args.prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))) {
+		return -EINVAL;
+	}
+	if (!(args.flags & MAP_ANONYMOUS)) {
+		if (args.fd < 0 || args.fd >= TASK_MAX_OPEN_FILES || !proc->files[args.fd]) {
+			return -EBADF;
+		}
+		file = proc->files[args.fd];
+		if (args.offset & 0xFFF) {
+			return -EINVAL;
+		}
+		if (file->inode->file_type != FTYPE_REGULAR || !file->f_op->read) {
+			return -ENODEV;
+		}
+		if (!(file->mode & FMODE_RD) || (share == MAP_SHARED && (args.prot & PROT_WRITE) &&
+			(!(file->mode & FMODE_WR) || !file->f_op->write))) {
+			return -EACCES;
+		}
+	}
+
+	if (!task_mmap_cache) {
+		task_mmap_cache = kmem_cache_create("task_mmap", sizeof(task_mmap_t));
+		if (!task_mmap_cache) {
+			return -ENOMEM;
+		}
+	}
+	addr = (uint32_t) args.addr;
+	if (args.flags & MAP_FIXED) {
+		if ((addr & 0xFFF) || addr < TASK_MMAP_BASE || addr > TASK_MMAP_END ||
+			len > TASK_MMAP_END - addr) {
+			return -EINVAL;
+		}
+		ret = task_mmap_remove(proc, addr, addr + len);
+		if (ret != 0) {
+			return ret;
+		}
+	} else if ((addr & 0xFFF) || addr < TASK_MMAP_BASE || addr > TASK_MMAP_END ||
+			   len > TASK_MMAP_END - addr || !task_mmap_range_free(proc, addr, addr + len)) {
+		// The hint is only taken when it is usable as is
+		addr = task_mmap_area(proc, len);
+		if (!addr) {
+			return -ENOMEM;
+		}
+	}
+
+	map = kmem_cache_alloc(task_mmap_cache);
+	if (!map) {
+		return -ENOMEM;
+	}
+	ret = task_mmap_regions(proc, addr, addr + len);
+	if (ret != 0) {
+		kmem_cache_free(task_mmap_cache, map);
+		return ret;
+	}
+	map->start = addr;
+	map->end = addr + len;
+	map->prot = args.prot;
+	map->flags = args.flags;
+	map->file = file;
+	map->offset = args.offset;
+	if (file) {
+		file->open_count++;
+	}
+	for (link = &proc->mmaps; *link && (*link)->start < addr; link = &(*link)->next);
+	map->next = *link;
+	*link = map;
+	return addr;
+}
+
+int syscall_munmap(int addr, int length, int c) {
+	task_t *proc;
+	uint32_t end;
+
+	proc = task_list + task_current_pid();
+	end = ((uint32_t) addr + (uint32_t) length + 0xFFF) & ~0xFFF;
+	if ((addr & 0xFFF) || length <= 0 || end < (uint32_t) addr) {
+		return -EINVAL;
+	}
+	if (!task_mmap_cache) {
+		return 0;
+	}
+	return task_mmap_remove(proc, addr, end);
+}
+
+int syscall_msync(int addr, int length, int flags) {
+	task_t *proc;
+	task_mmap_t *map;
+	uint32_t end, lo, hi, covered = 0;
+	int ret, err = 0;
+
+	proc = task_list + task_current_pid();
+	end = ((uint32_t) addr + (uint32_t) length + 0xFFF) & ~0xFFF;
+	if ((addr & 0xFFF) || length < 0 || end < (uint32_t) addr ||
+		(flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)) ||
+		((flags & MS_ASYNC) && (flags & MS_SYNC))) {
+		return -EINVAL;
+	}
+	for (map = proc->mmaps; map && map->start < end; map = map->next) {
+		if (map->end <= (uint32_t) addr)
+			continue;
+		lo = (map->start > (uint32_t) addr) ? map->start : (uint32_t) addr;
+		hi = (map->end < end) ? map->end : end;
+		covered += hi - lo;
+		ret = task_mmap_sync(proc, map, lo, hi);
+		if (ret < 0) {
+			err = ret;
+		}
+	}
+	if (covered != end - (uint32_t) addr) {
+		// Part of the range is not mapped
+		return -ENOMEM;
+	}
+	return err;
+}
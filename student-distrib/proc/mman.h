@@ -0,0 +1,122 @@
+/**
+ *	@file proc/mman.h
+ *
+ *	Memory mappings of files and anonymous memory (`mmap`)
+ *
+ *	Mappings live in [`TASK_MMAP_BASE`, `TASK_MMAP_END`). Every 4MB region
+ *	holding a mapping has a page table mapped entry in the `pages` array of the
+ *	process flagged with `TASK_PTENT_MMAP`, and its pages are populated by the
+ *	page fault handler: file pages through the `read` operation of the file,
+ *	anonymous pages with zeroed frames. Modified pages of shared file mappings
+ *	are written back through the `write` operation of the file.
+ */
+#ifndef PROC_MMAN_H
+#define PROC_MMAN_H
+
+#include "../types.h"
+#include "../fs/vfs.h"
+
+#define TASK_MMAP_BASE	0x40000000	///< Lowest address of a mapping
+#define TASK_MMAP_END	0x80000000	///< End of the area for mappings
+
+struct s_task;
+
+/**
+ *	A contiguous range of pages mapped by `mmap`
+ */
+typedef struct s_task_mmap {
+	uint32_t start;		///< First address of the mapping, 4KB aligned
+	uint32_t end;		///< End of the mapping, 4KB aligned
+	int prot;			///< Allowed accesses, see `PROT_*`
+	int flags;			///< Mapping flags, see `MAP_*`
+	file_t *file;		///< Mapped file, NULL for anonymous mappings
+	off_t offset;		///< File offset of `start`
+	struct s_task_mmap *next;	///< Next mapping of the process
+} task_mmap_t;
+
+/**
+ *	Find the mapping containing an address
+ *
+ *	@param proc: the process
+ *	@param addr: the address
+ *	@return the mapping, or NULL if the address is not mapped
+ */
+task_mmap_t *task_mmap_find(struct s_task *proc, uint32_t addr);
+
+/**
+ *	Check whether an address belongs to a shared mapping
+ *
+ *	@param proc: the process
+ *	@param addr: the address
+ *	@return nonzero if the page must be shared with forked children as is
+ */
+int task_mmap_shared(struct s_task *proc, uint32_t addr);
+
+/**
+ *	Populate a page of a mapping after a page fault
+ *
+ *	@param proc: the current process
+ *	@param addr: the faulting address, 4KB aligned
+ *	@param write: nonzero if the fault was caused by a write
+ *	@return 0 on success, or the negative of an errno if the access is invalid
+ */
+int task_mmap_fault(struct s_task *proc, uint32_t addr, int write);
+
+/**
+ *	Copy the mappings of a process into a forked child
+ *
+ *	The frames themselves are shared by `syscall_fork`.
+ *
+ *	@param parent: the forking process
+ *	@param child: the new process
+ *	@return 0 on success, or -ENOMEM
+ */
+int task_mmap_fork(struct s_task *parent, struct s_task *child);
+
+/**
+ *	Write back and drop all mappings of a process
+ *
+ *	The frames are released with the rest of the user memory.
+ *
+ *	@param proc: the process, whose address space must be the current one
+ */
+void task_mmap_release(struct s_task *proc);
+
+/**
+ *	Drop all mappings of a process without writing anything back
+ *
+ *	Undoes `task_mmap_fork` when the rest of the fork fails, the child never
+ *	ran and has nothing to write back.
+ *
+ *	@param proc: the process
+ */
+void task_mmap_drop(struct s_task *proc);
+
+/**
+ *	System call handler for `mmap`: map a file or anonymous memory
+ *
+ *	@param argsp: pointer to a `struct sys_mmap_args`
+ *	@return the address of the mapping, or the negative of an errno on failure
+ */
+int syscall_mmap(int argsp, int, int);
+
+/**
+ *	System call handler for `munmap`: remove the mappings in a range
+ *
+ *	@param addr: start of the range, 4KB aligned
+ *	@param length: size of the range in bytes
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int syscall_munmap(int addr, int length, int);
+
+/**
+ *	System call handler for `msync`: write back shared file mappings in a range
+ *
+ *	@param addr: start of the range, 4KB aligned
+ *	@param length: size of the range in bytes
+ *	@param flags: see `MS_*`
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int syscall_msync(int addr, int length, int flags);
+
+#endif
@@ -1,72 +1,404 @@
 #include "scheduler.h"
 
 #include "signal.h"
+#include "fpu.h"
+#include "kthread.h"
+#include "../errno.h"
+#include "../clock.h"
+#include "../../libc/include/sys/resource.h"
 
-static pid_t scheduler_iterator = 0;
+// Per level, the task last picked there, the next one is its successor on
+// the level's queue. When it leaves the queue, its predecessor takes its place.
+static task_t *scheduler_cursor[SCHEDULER_LEVELS];
+static uint32_t scheduler_levels = 0;	// bit n set if level n is not empty
+static uint32_t scheduler_slice_ticks = SCHEDULER_SLICE;
+static uint32_t scheduler_slice_start;	// tick the current task was picked at
+static int scheduler_resched = 0;		// the current task used up its slice
+static ktimer_t scheduler_slice_timer;	// end of the slice of the current task
+static ktimer_t scheduler_boost_timer;	// next boost, pending while tasks moved down
+static uint32_t scheduler_idle_esp = 0;	// top of the idle task's kernel stack
+static int scheduler_idling = 0;		// the idle task owns the processor
+static uint64_t scheduler_idle_since;	// monotonic time the idle task started at
+static uint64_t scheduler_idle_total = 0;	// ns spent idle before that
 
 int scheduler_on_flag = 0;
 
 void scheduling_start() {
+	int esp = task_kstack_alloc(SCHEDULER_IDLE_PID);
+
+	if (esp < 0) {
+		printf("[WARNING] NO KERNEL STACK FOR THE IDLE TASK\n");
+	} else {
+		scheduler_idle_esp = esp;
+	}
 	scheduler_on_flag = 1;
 }
 
-void scheduler_event() {
-	pid_t prev = task_current_pid();
-	int sanity=0;
+/**
+ *	Whether a task can be picked
+ */
+static int scheduler_runnable(task_t *proc) {
+	switch (proc->status) {
+		case TASK_ST_RUNNING:
+			return 1;
+		case TASK_ST_SLEEP:
+			return (proc->signals & ~(proc->signal_mask)) != 0;
+		default:
+			return 0;
+	}
+}
 
-	scheduler_iterator ++;
-	while (1) {
-		switch(task_list[scheduler_iterator].status) {
-			case TASK_ST_RUNNING:
+/**
+ *	Highest level a task runs at, given its nice value
+ */
+static int scheduler_top_level(task_t *proc) {
+	return (proc->nice - SCHEDULER_NICE_MIN) / SCHEDULER_NICE_STEP;
+}
+
+/**
+ *	Timer ticks a task may run at a level before it moves one level down
+ */
+static uint32_t scheduler_slice(int level) {
+	return scheduler_slice_ticks * (level + 1);
+}
+
+/**
+ *	Highest non-empty level, or -1 if no task is runnable
+ */
+static int scheduler_first_level() {
+	int level;
+
+	if (!scheduler_levels) {
+		return -1;
+	}
+	asm ("bsfl %1, %0" : "=r" (level) : "rm" (scheduler_levels));
+	return level;
+}
+
+/**
+ *	Queue a task at a level, just before the cursor, so that it runs after
+ *	all the others of the level
+ */
+static void scheduler_enqueue(task_t *proc, int level) {
+	task_t *cursor = scheduler_cursor[level];
+
+	proc->rq_level = level;
+	proc->rq_ticks = 0;
+	if (!cursor) {
+		proc->rq_next = proc->rq_prev = proc;
+		scheduler_cursor[level] = proc;
+		scheduler_levels |= 1 << level;
+	} else {
+		proc->rq_next = cursor;
+		proc->rq_prev = cursor->rq_prev;
+		proc->rq_prev->rq_next = proc;
+		cursor->rq_prev = proc;
+	}
+}
+
+/**
+ *	Remove a task from the queue of its level
+ */
+static void scheduler_dequeue(task_t *proc) {
+	int level = proc->rq_level;
+
+	if (proc->rq_next == proc) {
+		scheduler_cursor[level] = NULL;
+		scheduler_levels &= ~(1 << level);
+	} else {
+		proc->rq_prev->rq_next = proc->rq_next;
+		proc->rq_next->rq_prev = proc->rq_prev;
+		if (scheduler_cursor[level] == proc) {
+			scheduler_cursor[level] = proc->rq_prev;
+		}
+	}
+	proc->rq_next = proc->rq_prev = NULL;
+}
+
+/**
+ *	Move every queued task back to its highest level, so that tasks which
+ *	used up their slices are not starved
+ */
+static void scheduler_boost() {
+	task_t *proc, *next, *last;
+	int level;
+
+	for (level = 1; level < SCHEDULER_LEVELS; level++) {
+		if (!scheduler_cursor[level]) {
+			continue;
+		}
+		// Detach the ring, tasks staying at this level start a new one
+		proc = scheduler_cursor[level]->rq_next;
+		last = scheduler_cursor[level];
+		scheduler_cursor[level] = NULL;
+		scheduler_levels &= ~(1 << level);
+		while (1) {
+			next = proc->rq_next;
+			scheduler_enqueue(proc, scheduler_top_level(proc));
+			if (proc == last) {
 				break;
-			case TASK_ST_SLEEP:
-				if (task_list[scheduler_iterator].signals &
-					~(task_list[scheduler_iterator].signal_mask) ) {
-					break;
-				}
-				// Fall thru
-			default:
-				++sanity;
-				++scheduler_iterator;
-				if (scheduler_iterator >= TASK_MAX_PROC) {
-					scheduler_iterator = 0;
-				}
-				if (sanity > TASK_MAX_PROC) {
-					printf("[CRITICAL] NO POSSIBLE PROCESS TO EXECUTE!");
-					while (1);
-				}
-				continue;
+			}
+			proc = next;
+		}
+	}
+}
+
+/**
+ *	Arm the slice timer for the rest of the slice of the running task, unless
+ *	no other task is runnable
+ */
+static void scheduler_slice_arm(task_t *proc) {
+	uint32_t used, slice;
+
+	if (!proc->rq_next || (proc->rq_next == proc &&
+		scheduler_levels == (1U << proc->rq_level))) {
+		timer_cancel(&scheduler_slice_timer);
+		return;
+	}
+	used = proc->rq_ticks + (timer_now() - scheduler_slice_start);
+	slice = scheduler_slice(proc->rq_level);
+	timer_add(&scheduler_slice_timer, (used < slice) ? slice - used : 1);
+}
+
+/**
+ *	Boost timer callback
+ */
+static void scheduler_boost_expired(ktimer_t *timer) {
+	scheduler_boost();
+	// The running task starts a new slice too
+	scheduler_slice_start = timer_now();
+}
+
+/**
+ *	Slice timer callback, moves the running task one level down
+ */
+static void scheduler_slice_expired(ktimer_t *timer) {
+	pid_t pid = task_current_pid();
+	task_t *proc;
+
+	scheduler_resched = 1;
+	if (pid == (pid_t)-1 || !task_list[pid].rq_next) {
+		return;
+	}
+	proc = task_list + pid;
+	if (proc->rq_level < SCHEDULER_LEVELS - 1) {
+		scheduler_dequeue(proc);
+		scheduler_enqueue(proc, proc->rq_level + 1);
+		if (!timer_pending(&scheduler_boost_timer)) {
+			scheduler_boost_timer.func = &scheduler_boost_expired;
+			timer_add(&scheduler_boost_timer, SCHEDULER_BOOST);
+		}
+	}
+	proc->rq_ticks = 0;
+	scheduler_slice_start = timer_now();
+}
+
+void scheduler_update(task_t *proc) {
+	int queued = (proc->rq_next != NULL);
+	pid_t pid;
+
+	if (scheduler_runnable(proc) == queued) {
+		return;
+	}
+	if (!queued) {
+		// New or woken up, e.g. by I/O: start again at the highest level
+		scheduler_enqueue(proc, scheduler_top_level(proc));
+		// The running task has to share the CPU now
+		pid = task_current_pid();
+		if (scheduler_on_flag && pid != (pid_t)-1 && task_list + pid != proc &&
+			!timer_pending(&scheduler_slice_timer)) {
+			scheduler_slice_arm(task_list + pid);
+		}
+	} else {
+		scheduler_dequeue(proc);
+	}
+}
+
+void scheduler_preempt() {
+	pid_t pid = task_current_pid();
+
+	if (!scheduler_on_flag || (scheduler_idling && !scheduler_levels)) {
+		return;
+	}
+	if (pid != (pid_t)-1 && kthread_is(task_list + pid)) {
+		// Kernel threads are only switched out where they block or yield
+		return;
+	}
+	if (scheduler_resched || pid == (pid_t)-1 || !task_list[pid].rq_next ||
+		scheduler_first_level() < task_list[pid].rq_level) {
+		scheduler_event();
+	}
+}
+
+/**
+ *	Body of the idle task, halts until an interrupt makes a task runnable
+ */
+static void scheduler_idle_loop() {
+	while (1) {
+		// STI only takes effect after HLT starts, no interrupt is missed
+		asm volatile ("sti; hlt; cli");
+		if (scheduler_levels) {
+			scheduler_event();
 		}
-		break;
 	}
+}
+
+/**
+ *	Run the idle task from the top of its stack, until a task is runnable
+ *
+ *	@param prev: the task giving up the processor
+ */
+static void scheduler_idle(pid_t prev) {
+	uint32_t *frame;
+
+	if (!scheduler_idle_esp) {
+		printf("[CRITICAL] NO POSSIBLE PROCESS TO EXECUTE!");
+		while (1);
+	}
+	timer_cancel(&scheduler_slice_timer);
+	scheduler_resched = 0;
+	if (!scheduler_idling) {
+		scheduler_idling = 1;
+		scheduler_idle_since = clock_monotonic_ns();
+	}
+	if (prev == (pid_t)-1) {
+		// An exited task, its address space may be freed while idle
+		page_dir_switch(task_list[0].pd);
+	}
+	// The frame `scheduler_resume` pops: edi, esi, ebx, ebp, then the entry
+	// point and a return address it never uses
+	frame = (uint32_t *)scheduler_idle_esp - 6;
+	memset(frame, 0, 6 * sizeof(uint32_t));
+	frame[4] = (uint32_t)&scheduler_idle_loop;
+	scheduler_resume((uint32_t)frame);
+}
+
+void scheduler_event() {
+	pid_t prev = task_current_pid();
+	uint32_t now;
+	int level;
+
+	level = scheduler_first_level();
+	if (level < 0) {
+		scheduler_idle(prev);
+	}
+	if (scheduler_idling) {
+		scheduler_idle_total += clock_monotonic_ns() - scheduler_idle_since;
+		scheduler_idling = 0;
+	}
+	scheduler_cursor[level] = scheduler_cursor[level]->rq_next;
+
+	// Charge the previous task for its time, and time the next one
+	now = timer_now();
+	if (prev != (pid_t)-1 && task_list[prev].rq_next) {
+		task_list[prev].rq_ticks += now - scheduler_slice_start;
+	}
+	scheduler_slice_start = now;
+	scheduler_resched = 0;
+	scheduler_slice_timer.func = &scheduler_slice_expired;
+	scheduler_slice_arm(scheduler_cursor[level]);
 
 	// A different running task! switch to it!
 	if (prev == (pid_t)-1) {
 		// Prev is DEAD
-		scheduler_switch(NULL, &task_list[scheduler_iterator]);
+		scheduler_switch(NULL, scheduler_cursor[level]);
 	} else {
-		scheduler_switch(&task_list[prev], &task_list[scheduler_iterator]);
+		scheduler_switch(&task_list[prev], scheduler_cursor[level]);
+	}
+}
+
+int scheduler_set_nice(task_t *proc, int nice) {
+	if (nice < SCHEDULER_NICE_MIN) {
+		nice = SCHEDULER_NICE_MIN;
+	} else if (nice > SCHEDULER_NICE_MAX) {
+		nice = SCHEDULER_NICE_MAX;
+	}
+	if (nice < proc->nice && task_list[task_current_pid()].uid != 0) {
+		return -EACCES;
 	}
+	proc->nice = nice;
+	if (proc->rq_next && proc->rq_level != scheduler_top_level(proc)) {
+		scheduler_dequeue(proc);
+		scheduler_enqueue(proc, scheduler_top_level(proc));
+	}
+	return 0;
+}
+
+int syscall_getpriority(int which, int who, int c) {
+	if (which != PRIO_PROCESS) {
+		return -EINVAL;
+	}
+	if (who == 0) {
+		who = task_current_pid();
+	}
+	if (who < 0 || who >= TASK_MAX_PROC || task_list[who].status == TASK_ST_NA) {
+		return -ESRCH;
+	}
+	// Never negative, so that it is not taken for an error
+	return SCHEDULER_NICE_MAX + 1 - task_list[who].nice;
+}
+
+int syscall_setpriority(int which, int who, int prio) {
+	task_t *cur;
+
+	if (which != PRIO_PROCESS) {
+		return -EINVAL;
+	}
+	cur = task_list + task_current_pid();
+	if (who == 0) {
+		who = cur->pid;
+	}
+	if (who < 0 || who >= TASK_MAX_PROC || task_list[who].status == TASK_ST_NA) {
+		return -ESRCH;
+	}
+	if (cur->uid != 0 && task_list[who].uid != cur->uid) {
+		return -EPERM;
+	}
+	return scheduler_set_nice(task_list + who, prio);
+}
+
+int syscall_sched_slice(int ms, int b, int c) {
+	uint32_t ticks;
+
+	if (ms > SCHEDULER_SLICE_MAX) {
+		return -EINVAL;
+	}
+	if (ms > 0) {
+		if (task_list[task_current_pid()].uid != 0) {
+			return -EPERM;
+		}
+		ticks = TIMER_MS(ms);
+		scheduler_slice_ticks = ticks;
+	} else if (ms < 0) {
+		return -EINVAL;
+	}
+	return (scheduler_slice_ticks * 1000 + TIMER_HZ / 2) / TIMER_HZ;
 }
 
 void scheduler_switch(task_t* from, task_t* to) {
 	task_t *proc;
 	sigset_t signal_masked;
+	uint32_t esp;
 	int i;
 
 	if (to->pid == 2) {
 		tss.ss0 = KERNEL_DS;
 	}
-	// tear down original paging
-	if (from) {
-		scheduler_page_clear(from);
-	}
-	// set up new pagin
-	scheduler_page_setup(to);
+	// switch address space, only a CR3 load
+	page_dir_switch(to->pd);
 
-	page_flush_tlb();
+	if (to->kctx_esp) {
+		// Blocked in the kernel, e.g. on a wait queue: continue from there.
+		// Signals are delivered once it gives up the system call.
+		esp = to->kctx_esp;
+		to->kctx_esp = 0;
+		tss.ss0 = KERNEL_DS;
+		tss.esp0 = to->ks_esp;
+		fpu_switch(to);
+		scheduler_resume(esp);
+	}
 
-	proc = task_list + scheduler_iterator;
+	proc = to;
 	if (proc->signals) {
 		signal_masked = proc->signals & (~proc->signal_mask);
 		for (i = 1; i < SIG_MAX; i++) {
@@ -79,58 +411,45 @@ void scheduler_switch(task_t* from, task_t* to) {
 			}
 		}
 	}
+	scheduler_update(proc);
 
 	// set up tss
 	tss.ss0 = KERNEL_DS;
 	tss.esp0 = to->ks_esp;
+	fpu_switch(to);
 
 	scheduler_iret(&(to->regs));
 }
 
 void scheduler_update_taskregs(regs_t *regs) {
 	task_t *proc;
-	proc = task_list + task_current_pid();
+	pid_t pid = task_current_pid();
+
+	if ((regs->cs & 3) != 3) {
+		// Trapped in the kernel, it returns to the kernel and not to the
+		// user registers saved on entry
+		return;
+	}
+	if (pid == SCHEDULER_IDLE_PID) {
+		// The idle task, it goes back to its loop
+		return;
+	}
+	proc = task_list + pid;
+	if (kthread_is(proc)) {
+		// Kernel threads have no user registers
+		return;
+	}
 	memcpy(&(proc->regs), regs, sizeof(regs_t));
 }
 
-void scheduler_page_clear(task_t *proc){
-	task_ptentry_t* pages;
-	int i, ret;
-	pages = proc->pages;
-	for (i=0; i<proc->page_limit; ++i){
-		// check whether the page is present
-		if (pages[i].pt_flags & PAGE_DIR_ENT_PRESENT) {
-			// then delete this entry
-			if (pages[i].pt_flags & PAGE_DIR_ENT_4MB){
-				ret = page_dir_delete_entry(pages[i].vaddr);
-			}else{
-				ret = page_tab_delete_entry(pages[i].vaddr);
-			}
-			if (ret != 0) {
-				printf("Scheduler page clear failed %d\n", ret);
-			}
-		}
-		// else do nothing
-	}
-}
-
-void scheduler_page_setup(task_t *proc){
-	task_ptentry_t* pages;
-	int i, ret;
-	pages = proc->pages;
-	for (i=0; i<proc->page_limit; ++i){
-		// check whether the page is present
-		if (pages[i].pt_flags & PAGE_DIR_ENT_PRESENT) {
-			// then setup this entry
-			if (pages[i].pt_flags & PAGE_DIR_ENT_4MB){
-				ret = page_dir_add_4MB_entry(pages[i].vaddr, pages[i].paddr, pages[i].pt_flags);
-			}else{
-				ret = page_tab_add_entry(pages[i].vaddr, pages[i].paddr, pages[i].pt_flags);
-			}
-			if (ret != 0) {
-				printf("Scheduler page setup failed %d\n", ret);
-			}
-		}
-		// else do nothing
+uint64_t scheduler_idle_ns() {
+	uint64_t ns = scheduler_idle_total;
+	uint32_t flags;
+
+	cli_and_save(flags);
+	if (scheduler_idling) {
+		ns += clock_monotonic_ns() - scheduler_idle_since;
 	}
+	restore_flags(flags);
+	return ns;
 }
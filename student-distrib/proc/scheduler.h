@@ -2,6 +2,28 @@
  *	@file proc/scheduler.h
  *
  *	Process scheduler
+ *
+ *	Runnable tasks are kept on circular run queues, so that picking the next
+ *	task does not depend on the size of the process table. A task is runnable
+ *	when it is `TASK_ST_RUNNING`, or `TASK_ST_SLEEP` with a signal pending that
+ *	it does not block. Code changing either condition calls
+ *	`scheduler_update` afterwards.
+ *
+ *	The queues form a multilevel feedback queue. The first task of the highest
+ *	non-empty level runs, round robin within the level. A task that uses up
+ *	its time slice moves one level down, where slices are longer. A task that
+ *	wakes up, e.g. from I/O, starts again at its highest level, which depends
+ *	on its nice value. `SCHEDULER_BOOST` ticks after a task moves down, all
+ *	tasks are moved back to their highest level, so that CPU-bound tasks are
+ *	not starved.
+ *
+ *	Slices and boosts are kernel timers (timer.h), armed only while tasks
+ *	compete for the CPU: a task running alone is never interrupted.
+ *
+ *	When no task is runnable, the idle task halts the processor until an
+ *	interrupt wakes one up. It is not a process: it runs in the kernel on a
+ *	stack of its own, where `task_current_pid` returns `SCHEDULER_IDLE_PID`,
+ *	and starts over from the top of the stack every time it is picked.
  */
 #ifndef SCHEDULER_H_
 #define SCHEDULER_H_
@@ -9,12 +31,22 @@
 #include "task.h"
 
 #include "../x86_desc.h"
+#include "../timer.h"
+
+#define SCHEDULER_LEVELS	8	///< Priority levels, 0 is the highest
+#define SCHEDULER_SLICE		4	///< Default time slice at level 0, in timer ticks
+#define SCHEDULER_SLICE_MAX	1000	///< Longest time slice at level 0, in ms
+#define SCHEDULER_BOOST		TIMER_HZ	///< Timer ticks between two boosts of all tasks
+#define SCHEDULER_NICE_MIN	(-20)	///< Nice value of the highest priority
+#define SCHEDULER_NICE_MAX	19		///< Nice value of the lowest priority
+#define SCHEDULER_NICE_STEP	10	///< Nice values sharing the same highest level
+#define SCHEDULER_IDLE_PID	((pid_t)-1)	///< `task_current_pid` of the idle task, as of an exited task
 
 /// Set to 1 when scheduler is enabled. (Used by RTC ISR)
 extern int scheduler_on_flag;
 
 /**
- *	Turn on scheduler
+ *	Turn on scheduler, and set up the idle task
  */
 void scheduling_start();
 
@@ -27,29 +59,77 @@ void scheduling_start();
 void scheduler_event();
 
 /**
- *	this function is called by scheduler event to do the real
- *	task switch
+ *	Switch task after an interrupt, if the current one used up its time
+ *	slice or a task of higher priority became runnable
  *
- *	@param from: the process to be switched out
- *	@param to: the process to be switched to
+ *	@note called at the end of every IRQ handler, the registers of the
+ *		  current task are saved
+ */
+void scheduler_preempt();
+
+/**
+ *	Put a task on the run queue or take it off, after its status or signals
+ *	changed
  *
- *	@note this function will never actually "return"
+ *	@param proc: the task
  */
-void scheduler_switch(task_t* from, task_t* to);
+void scheduler_update(task_t *proc);
+
+/**
+ *	Time the processor spent in the idle task since the scheduler started
+ *
+ *	@return the idle time in ns
+ */
+uint64_t scheduler_idle_ns();
+
+/**
+ *	Change the nice value of a task
+ *
+ *	@param proc: the task
+ *	@param nice: the new nice value, clamped to the valid range
+ *	@return 0 on success, or -EACCES if a user other than root asks for a
+ *			lower value
+ */
+int scheduler_set_nice(task_t *proc, int nice);
+
+/**
+ *	System call handler for `getpriority`
+ *
+ *	@param which: must be `PRIO_PROCESS`
+ *	@param who: the pid, 0 for the calling process
+ *	@return 20 minus the nice value, or the negative of an errno
+ */
+int syscall_getpriority(int which, int who, int c);
 
 /**
- *	this function tear down page table entries accordingly
+ *	System call handler for `setpriority`
  *
- *	@param proc: the process
+ *	@param which: must be `PRIO_PROCESS`
+ *	@param who: the pid, 0 for the calling process
+ *	@param prio: the new nice value
+ *	@return 0 on success, or the negative of an errno
  */
-void scheduler_page_clear(task_t* proc);
+int syscall_setpriority(int which, int who, int prio);
 
 /**
- *	this function set up page table entries accordingly
+ *	System call handler for `sched_slice`: Get or set the time slice
  *
- *	@param proc: the process
+ *	@param ms: the new time slice at the highest level in ms, 0 to keep it.
+ *			   Only root may change it.
+ *	@return the time slice in ms, or the negative of an errno
  */
-void scheduler_page_setup(task_t* proc);
+int syscall_sched_slice(int ms, int b, int c);
+
+/**
+ *	this function is called by scheduler event to do the real
+ *	task switch
+ *
+ *	@param from: the process to be switched out
+ *	@param to: the process to be switched to
+ *
+ *	@note this function will never actually "return"
+ */
+void scheduler_switch(task_t* from, task_t* to);
 
 /**
  *	get magic number and the regs structure behind it
@@ -65,6 +145,9 @@ regs_t*	scheduler_get_magic();
  *		  handler is executed. Thus the `regs` field should already be valid
  *		  when any handler is executing. Handlers do not need to update `regs`
  *		  unless it is intended.
+ *	@note Traps from ring 0, e.g. a system call writing to a copy-on-write
+ *		  or demand-zero user page, keep the registers saved on entry from
+ *		  user mode.
  *
  *	@param regs: pointer to the saved registers and iret structure
  */
@@ -78,6 +161,23 @@ void scheduler_update_taskregs(regs_t *regs);
  */
 void scheduler_iret(regs_t* reg);
 
+/**
+ *	Save the kernel context of the current task and run another one
+ *
+ *	The call returns when `scheduler_switch` picks the task again.
+ *
+ *	@param esp: where to save the kernel stack pointer, `kctx_esp` of the task
+ */
+void scheduler_block(uint32_t *esp);
+
+/**
+ *	assembly function to go back into a kernel context saved by
+ *	`scheduler_block`
+ *
+ *	@param esp: the saved kernel stack pointer
+ */
+void scheduler_resume(uint32_t esp);
+
 /*void scheduler_user_iret(regs_t* reg);
 
 void scheduler_kernel_iret(regs_t* reg, int esp);
@@ -5,6 +5,9 @@
 #include "../lib.h"
 #include "../boot/page_table.h"
 #include "signal_user.h"
+#include "fpu.h"
+#include "wait_queue.h"
+#include "kthread.h"
 #include "../../libc/src/syscalls.h"
 #include "../../libc/include/sys/wait.h"
 
@@ -122,6 +125,7 @@ int syscall_sigsuspend(int sigsetp, int b, int c) {
 	}
 	// proc->regs.eax = -EINTR;
 	proc->status = TASK_ST_SLEEP;
+	scheduler_update(proc);
 
 	scheduler_event();
 	return 0; // Should not hit
@@ -141,8 +145,13 @@ int syscall_kill(int pid, int sig, int c) {
 	if (proc->status != TASK_ST_RUNNING && proc->status != TASK_ST_SLEEP) {
 		return -ESRCH;
 	}
+	if (kthread_is(proc)) {
+		return -EPERM;
+	}
 
 	sigaddset(&(proc->signals), sig);
+	// Wake it up if it was waiting for the signal
+	scheduler_update(proc);
 
 	return 0;
 }
@@ -180,13 +189,14 @@ void signal_init() {
 	page_tab_add_entry(PROC_USR_BASE, paddr, PAGE_TAB_ENT_PRESENT |
 					   PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_USER |
 					   PAGE_TAB_ENT_GLOBAL);
-	page_flush_tlb();
+	page_flush_tlb_page(PROC_USR_BASE);
 	memcpy((uint8_t *) PROC_USR_BASE, &(signal_user_base), signal_user_length);
 
 }
 
 void signal_exec(task_t *proc, int sig) {
 	task_sigact_t *sa;
+	uint32_t area, img;
 	int ret;
 
 	sa = proc->sigacts + sig;
@@ -209,6 +219,16 @@ void signal_exec(task_t *proc, int sig) {
 
 	// Custom handler provided, execute that
 
+	// Save the FPU state of the interrupted code above the return address
+	proc->regs.esp -= SIGNAL_FPU_FRAME;
+	if (proc->regs.esp < 0xbfc00000) {
+		signal_handler_terminate(proc, SIGSEGV);
+		return;
+	}
+	area = proc->regs.esp;
+	img = (area + 4 + 15) & ~15;
+	*(uint32_t *)area = fpu_signal_save(proc, (fpu_state_t *)img) ? img - area : 0;
+
 	// Push stack frame for signal_user_ret
 	if (sa->flags & SA_RESTART) {
 		// Restart INT 0x80
@@ -262,7 +282,10 @@ void signal_exec(task_t *proc, int sig) {
 	proc->regs.eip = (uint32_t) sa->handler;
 }
 
-void signal_exec_default(task_t *proc, int sig) {
+/**
+ *	Check whether the default action of a signal is to discard it
+ */
+static int signal_default_ignored(int sig) {
 	switch(sig) {
 		case SIGCHLD:
 		case SIGURG:
@@ -275,8 +298,50 @@ void signal_exec_default(task_t *proc, int sig) {
 		case SIGALRM:
 		case SIGUSR1:
 		case SIGUSR2:
-			signal_handler_ignore(proc, sig);
-			break;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int signal_ignored(task_t *proc, int sig) {
+	switch((int)(proc->sigacts[sig].handler)) {
+		case ((int)SIG_DFL):
+			return signal_default_ignored(sig);
+		case ((int)SIG_IGN):
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+int signal_pending(task_t *proc) {
+	int sig;
+
+	for (sig = 1; sig < SIG_MAX; sig++) {
+		if (sigismember(&(proc->signals), sig) &&
+			!sigismember(&(proc->signal_mask), sig) &&
+			signal_ignored(proc, sig)) {
+			sigdelset(&(proc->signals), sig);
+		}
+	}
+	return (proc->signals & ~(proc->signal_mask)) != 0;
+}
+
+void signal_syscall_return(int ret) {
+	task_t *proc = task_list + task_current_pid();
+
+	// The scheduler resumes the task from the registers saved on entry
+	proc->regs.eax = ret;
+	scheduler_event();
+}
+
+void signal_exec_default(task_t *proc, int sig) {
+	if (signal_default_ignored(sig)) {
+		signal_handler_ignore(proc, sig);
+		return;
+	}
+	switch(sig) {
 		case SIGSTOP:
 		case SIGTSTP:
 		case SIGTTIN:
@@ -338,4 +403,8 @@ void signal_handler_terminate(task_t *proc, int sig) {
 void signal_handler_stop(task_t *proc, int sig) {
 	proc->status = TASK_ST_SLEEP;
 	proc->exit_status = sig | WIFSTOPPED(-1);
+	// Let a parent in `waitpid` with WUNTRACED see the stop
+	if (proc->parent < TASK_MAX_PROC) {
+		wake_up(&(task_list[proc->parent].child_wait));
+	}
 }
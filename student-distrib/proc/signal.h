@@ -89,6 +89,33 @@ void signal_init();
  */
 void signal_exec_default(task_t *proc, int sig);
 
+/**
+ *	Check whether a signal would be discarded when delivered to a process
+ *
+ *	@param proc: the process
+ *	@param sig: the signal number
+ *	@return 1 if the signal is ignored, 0 otherwise
+ */
+int signal_ignored(task_t *proc, int sig);
+
+/**
+ *	Check whether a process has a signal to handle, discarding the pending
+ *	signals it ignores
+ *
+ *	@param proc: the process
+ *	@return 1 if an unblocked signal that is not ignored is pending
+ */
+int signal_pending(task_t *proc);
+
+/**
+ *	Return from the current system call, delivering its pending signals
+ *	right away rather than at the next task switch
+ *
+ *	@param ret: the return value of the system call, e.g. -EINTR
+ *	@note does not return
+ */
+void signal_syscall_return(int ret);
+
 /**
  *	Default SIGCHLD handler
  *
@@ -14,6 +14,14 @@
 
 #define PROC_USR_BASE	0x8000000 ///< Base address of this page
 
+/**
+ *	Bytes reserved above the return address of a signal frame for the FPU/SSE
+ *	state of the interrupted code: the offset of the image from the start of
+ *	the area (0 if none was saved), alignment slack, and the 16 bytes aligned
+ *	FXSAVE image. `signal_user_ret` pops it with `ret $528`.
+ */
+#define SIGNAL_FPU_FRAME	528
+
 /// A dummy value whose address is the start of the code page
 extern uint32_t signal_user_base;
 /// Size in bytes of the code page
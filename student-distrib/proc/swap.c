@@ -0,0 +1,325 @@
+#include "swap.h"
+
+#include "task.h"
+#include "../lib.h"
+#include "../errno.h"
+#include "../k_mem/kmalloc.h"
+#include "zram.h"
+#include "../fs/vfs.h"
+#include "../fs/pathname.h"
+#include "../fs/file_lookup.h"
+
+static file_t *swap_file = NULL;	// device holding the swap area
+static off_t swap_base;				// offset of the swap area on the device
+static uint8_t swap_count[SWAP_MAX_SLOTS];	// references to each slot, 0 if free
+static uint32_t swap_hint = 0;		// where to start looking for a free slot
+static int swap_busy = 0;			// reclaim is running, do not recurse
+
+static swap_stats_t swap_stats;
+
+/**
+ *	Position of the clock hand: next page table entry to look at
+ */
+static struct {
+	int task;	///< Index in `task_list`
+	int entry;	///< Index in `pages` of the process
+	int pte;	///< Entry in the page table of the region
+} swap_hand;
+
+/**
+ *	Read the time stamp counter, in units of `1 << SWAP_CYCLES_SHIFT` cycles
+ */
+static inline uint32_t swap_time() {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return (hi << (32 - SWAP_CYCLES_SHIFT)) | (lo >> SWAP_CYCLES_SHIFT);
+}
+
+void swap_init() {
+	page_alloc_register_reclaim(&swap_reclaim);
+}
+
+/**
+ *	Take a free slot
+ *
+ *	@return the slot, or -1 if the swap area is full
+ */
+static int swap_slot_get() {
+	uint32_t i, slot;
+
+	for (i = 0; i < swap_stats.slots; i++) {
+		slot = (swap_hint + i) % swap_stats.slots;
+		if (!swap_count[slot]) {
+			swap_count[slot] = 1;
+			swap_hint = slot + 1;
+			swap_stats.used++;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+/**
+ *	Drop a reference to a slot
+ */
+static void swap_slot_put(uint32_t slot) {
+	if (slot >= swap_stats.slots || !swap_count[slot]) {
+		return;
+	}
+	if (--swap_count[slot] == 0) {
+		swap_stats.used--;
+	}
+}
+
+/**
+ *	Read or write a frame from or to a slot
+ *
+ *	@return 0 on success, or -EIO
+ */
+static int swap_io(uint32_t slot, uint32_t paddr, int write) {
+	off_t offset = swap_base + slot * (4<<10);
+	uint8_t *buf;
+	int ret;
+
+	buf = kmem_map_frame(paddr);
+	if (!buf) {
+		return -EIO;
+	}
+	if (write) {
+		ret = (*swap_file->f_op->write)(swap_file, buf, 4<<10, &offset);
+	} else {
+		ret = (*swap_file->f_op->read)(swap_file, buf, 4<<10, &offset);
+	}
+	kmem_unmap_frame(buf);
+	if (ret != (4<<10)) {
+		swap_stats.io_errors++;
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ *	Write a page out and release its frame
+ *
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+static int swap_out(page_table_entry_t *pte) {
+	uint32_t paddr = *pte & ~0xFFF;
+	int slot, flags = PAGE_TAB_ENT_SWAP | PAGE_TAB_ENT_ZRAM;
+
+	slot = zram_store(paddr);
+	if (slot >= 0) {
+		swap_stats.zram_out++;
+	} else {
+		// Incompressible or zram full, fall back to the swap area
+		if (!swap_file || (slot = swap_slot_get()) < 0) {
+			return -ENOSPC;
+		}
+		if (swap_io(slot, paddr, 1) != 0) {
+			swap_slot_put(slot);
+			return -EIO;
+		}
+		flags = PAGE_TAB_ENT_SWAP;
+		swap_stats.pages_out++;
+	}
+	*pte = (slot << SWAP_SLOT_SHIFT) | flags |
+		   (*pte & (PAGE_TAB_ENT_USER | PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_COW));
+	page_alloc_free_4KB(paddr);
+	return 0;
+}
+
+int swap_in(task_t *proc, uint32_t addr, page_table_entry_t *pte) {
+	uint32_t slot = *pte >> SWAP_SLOT_SHIFT, start = swap_time();
+	int flags, ret, new = 0;
+
+	if (!(*pte & PAGE_TAB_ENT_SWAP)) {
+		return -EFAULT;
+	}
+	if (page_alloc_4KB(&new) != 0) {
+		return -ENOMEM;
+	}
+	if (*pte & PAGE_TAB_ENT_ZRAM) {
+		ret = zram_load(slot, new);
+	} else {
+		ret = swap_file ? swap_io(slot, new, 0) : -EFAULT;
+	}
+	if (ret != 0) {
+		page_alloc_free_4KB(new);
+		return ret;
+	}
+	if (*pte & PAGE_TAB_ENT_ZRAM) {
+		zram_release(slot);
+		swap_stats.zram_in++;
+		swap_stats.zram_fault_time += swap_time() - start;
+	} else {
+		swap_slot_put(slot);
+		swap_stats.pages_in++;
+		swap_stats.disk_fault_time += swap_time() - start;
+	}
+	// The copy is private now, a copy-on-write page becomes writable
+	flags = *pte & (PAGE_TAB_ENT_USER | PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_COW);
+	if (flags & PAGE_TAB_ENT_COW) {
+		flags = (flags & ~PAGE_TAB_ENT_COW) | PAGE_TAB_ENT_RDWR;
+	}
+	*pte = new | flags | PAGE_TAB_ENT_PRESENT;
+	if (proc == task_list + task_current_pid()) {
+		page_flush_tlb_page(addr);
+	}
+	return 0;
+}
+
+void swap_dup(page_table_entry_t entry) {
+	uint32_t slot = entry >> SWAP_SLOT_SHIFT;
+
+	if (entry & PAGE_TAB_ENT_ZRAM) {
+		zram_dup(slot);
+	} else if (slot < swap_stats.slots && swap_count[slot] && swap_count[slot] < 0xFF) {
+		swap_count[slot]++;
+	}
+}
+
+void swap_release(page_table_entry_t entry) {
+	if (entry & PAGE_TAB_ENT_ZRAM) {
+		zram_release(entry >> SWAP_SLOT_SHIFT);
+	} else {
+		swap_slot_put(entry >> SWAP_SLOT_SHIFT);
+	}
+}
+
+/**
+ *	Move the clock hand to the first region of the next process
+ */
+static void swap_hand_next_task() {
+	swap_hand.task = (swap_hand.task + 1) % TASK_MAX_PROC;
+	swap_hand.entry = 0;
+	swap_hand.pte = 0;
+}
+
+int swap_reclaim(int frames) {
+	task_t *proc;
+	task_ptentry_t *page;
+	page_table_entry_t *pte;
+	page_flush_t flush;
+	uint32_t paddr, vaddr;
+	int scanned, freed = 0, failed = 0;
+
+	if (swap_busy) {
+		// Storing a compressed page may allocate memory
+		return 0;
+	}
+	swap_busy = 1;
+	page_flush_init(&flush);
+	for (scanned = 0; freed < frames && scanned < SWAP_SCAN_MAX; scanned++) {
+		proc = task_list + swap_hand.task;
+		if (proc->status == TASK_ST_NA || !proc->pages ||
+			swap_hand.entry >= proc->page_limit ||
+			!(proc->pages[swap_hand.entry].pt_flags & PAGE_DIR_ENT_PRESENT)) {
+			swap_hand_next_task();
+			continue;
+		}
+		// Only private pages of page table mapped regions are anonymous
+		page = proc->pages + swap_hand.entry;
+		pte = page_dir_get_pte(proc->pd, page->vaddr);
+		if ((page->priv_flags & (TASK_PTENT_PGTAB | TASK_PTENT_MMAP)) != TASK_PTENT_PGTAB ||
+			!pte) {
+			swap_hand.entry++;
+			swap_hand.pte = 0;
+			continue;
+		}
+		pte += swap_hand.pte;
+		vaddr = page->vaddr + swap_hand.pte * (4<<10);
+		if (++swap_hand.pte == 1024) {
+			swap_hand.entry++;
+			swap_hand.pte = 0;
+		}
+		swap_stats.scanned++;
+
+		if ((*pte & (PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER)) !=
+			(PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER)) {
+			continue;
+		}
+		paddr = *pte & ~0xFFF;
+		if (paddr == page_zero_frame() || get_phys_mem_reference_count(paddr) != 1) {
+			// Shared with another process or the page cache
+			continue;
+		}
+		if (proc == task_list + task_current_pid()) {
+			// Other address spaces are flushed when they are switched to
+			page_flush_add(&flush, vaddr);
+		}
+		if (*pte & PAGE_TAB_ENT_ACCESSED) {
+			// Second chance
+			*pte &= ~PAGE_TAB_ENT_ACCESSED;
+			continue;
+		}
+		if (swap_out(pte) != 0) {
+			// Incompressible without a swap area, or out of space
+			if (++failed >= SWAP_FAIL_MAX) {
+				break;
+			}
+			continue;
+		}
+		freed++;
+	}
+	page_flush_finish(&flush);
+	swap_busy = 0;
+	return freed;
+}
+
+void swap_get_stats(swap_stats_t *stats) {
+	if (stats) {
+		memcpy(stats, &swap_stats, sizeof(swap_stats_t));
+	}
+}
+
+int syscall_swapon(int pathaddr, int offset, int length) {
+	task_t *proc;
+	pathname_t path;
+	inode_t *inode;
+	file_t *file;
+	int ret;
+
+	if (!pathaddr) {
+		return -EFAULT;
+	}
+	proc = task_list + task_current_pid();
+	if (proc->uid != 0 && proc->gid != 0) {
+		return -EPERM;
+	}
+	if (swap_file) {
+		return -EBUSY;
+	}
+	if (offset < 0 || length < (4<<10) || (offset & 0xFFF)) {
+		return -EINVAL;
+	}
+
+	strcpy(path, proc->wd);
+	ret = path_cd(path, (char *)pathaddr);
+	if (ret != 0) {
+		return ret;
+	}
+	if (!(inode = file_lookup(path))) {
+		return -errno;
+	}
+	if (inode->file_type != FTYPE_DEVICE) {
+		(*inode->sb->s_op->free_inode)(inode);
+		return -ENOTBLK;
+	}
+	if (!(file = vfs_open_file(inode, FMODE_RD | FMODE_WR))) {
+		(*inode->sb->s_op->free_inode)(inode);
+		return -errno;
+	}
+	if (!file->f_op->read || !file->f_op->write) {
+		vfs_close_file(file);
+		return -ENOTBLK;
+	}
+	memset(swap_count, 0, sizeof(swap_count));
+	swap_base = offset;
+	swap_stats.slots = length / (4<<10);
+	if (swap_stats.slots > SWAP_MAX_SLOTS) {
+		swap_stats.slots = SWAP_MAX_SLOTS;
+	}
+	swap_stats.used = 0;
+	swap_file = file;
+	return 0;
+}
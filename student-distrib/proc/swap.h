@@ -0,0 +1,103 @@
+/**
+ *	@file proc/swap.h
+ *
+ *	Swapping of anonymous user pages to a block device
+ *
+ *	Once a swap area is enabled with `swapon`, the swap reclaim hook is called
+ *	by the frame allocator when it runs out of memory. It walks the 4KB pages
+ *	of the heap, stack and data regions of every process with a clock hand,
+ *	giving recently accessed pages a second chance, and evicts private pages:
+ *	first to the compressed in-memory store (see zram.h), then to free slots
+ *	of the swap area. An evicted page keeps its zram handle or slot number and
+ *	its access flags in its not present page table entry, flagged with
+ *	`PAGE_TAB_ENT_SWAP` (and `PAGE_TAB_ENT_ZRAM`), and is read back by the
+ *	page fault handler.
+ *
+ *	The compressed store needs no device, so pages are evicted to it as soon
+ *	as the frame allocator runs out of memory, even without `swapon`.
+ */
+#ifndef PROC_SWAP_H
+#define PROC_SWAP_H
+
+#include "../types.h"
+#include "../boot/page_table.h"
+
+#define SWAP_MAX_SLOTS	16384	///< Maximum number of 4KB slots in the swap area = 64MB
+#define SWAP_SCAN_MAX	65536	///< Most page table entries looked at by one reclaim
+#define SWAP_FAIL_MAX	16		///< Most pages that could not be evicted in one reclaim
+#define SWAP_SLOT_SHIFT	12		///< Position of the slot number in a swapped entry
+#define SWAP_CYCLES_SHIFT	10	///< Fault latencies are counted in units of 1024 TSC cycles
+
+struct s_task;
+
+/**
+ *	Swap counters
+ */
+typedef struct s_swap_stats {
+	uint32_t slots;		///< Slots in the swap area, 0 if swap is off
+	uint32_t used;		///< Slots holding a page
+	uint32_t pages_out;	///< Pages written to the swap area
+	uint32_t pages_in;	///< Pages read back from the swap area
+	uint32_t zram_out;	///< Pages compressed into zram
+	uint32_t zram_in;	///< Pages decompressed from zram
+	uint32_t scanned;	///< Page table entries looked at by the clock hand
+	uint32_t io_errors;	///< Failed reads and writes of the swap area
+	uint32_t disk_fault_time;	///< Time spent in faults served by the swap area
+	uint32_t zram_fault_time;	///< Time spent in faults served by zram
+} swap_stats_t;
+
+/**
+ *	Register the swap reclaim hook with the frame allocator
+ */
+void swap_init();
+
+/**
+ *	Read a swapped page back into memory
+ *
+ *	@param proc: the process owning the page
+ *	@param addr: the virtual address of the page, 4KB aligned
+ *	@param pte: the page table entry of the page, flagged `PAGE_TAB_ENT_SWAP`
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int swap_in(struct s_task *proc, uint32_t addr, page_table_entry_t *pte);
+
+/**
+ *	Add a reference to the slot of a swapped page table entry, for fork
+ *
+ *	@param entry: the swapped page table entry
+ */
+void swap_dup(page_table_entry_t entry);
+
+/**
+ *	Drop a reference to the slot of a swapped page table entry
+ *
+ *	@param entry: the swapped page table entry
+ */
+void swap_release(page_table_entry_t entry);
+
+/**
+ *	Evict pages to the swap area, reclaim hook of the frame allocator
+ *
+ *	@param frames: number of frames wanted
+ *	@return the number of frames released
+ */
+int swap_reclaim(int frames);
+
+/**
+ *	Get a snapshot of the swap counters
+ *
+ *	@param stats: buffer to fill
+ */
+void swap_get_stats(swap_stats_t *stats);
+
+/**
+ *	System call handler for `swapon`: enable swapping to a block device
+ *
+ *	@param pathaddr: path of the device
+ *	@param offset: start of the swap area on the device, 4KB aligned
+ *	@param length: size of the swap area in bytes
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int syscall_swapon(int pathaddr, int offset, int length);
+
+#endif
@@ -4,6 +4,9 @@
 #include "../fs/vfs.h"
 #include "../fs/file_lookup.h"
 #include "elf.h"
+#include "mman.h"
+#include "swap.h"
+#include "fpu.h"
 #include "signal.h"
 #include "scheduler.h"
 #include "../terminal_driver/tty.h"
@@ -11,15 +14,382 @@
 
 #define __4MB 0x400000
 
+#define GET_KSTACK_PTE(x) ((((x) - TASK_KSTACK_BASE) >> 12) & 0x3FF)
+
 task_t task_list[TASK_MAX_PROC];
 pid_t task_pid_allocator;
 
+/**
+ *	A kernel stack, headed by the pid `task_current_pid` reads after
+ *	aligning the stack pointer down
+ */
 typedef struct s_task_ks {
 	int32_t pid;
-	uint8_t stack[16380]; // Empty space to fill 16kb
+	uint8_t stack[TASK_KSTACK_SIZE - 4]; // Empty space to fill 16kb
 } __attribute__((__packed__)) task_ks_t;
 
-task_ks_t *kstack = (task_ks_t *)0x800000;
+static page_table_t task_kstack_table;	// maps the kernel stack slots
+static uint32_t task_kstack_map[TASK_MAX_PROC / 32];	// slots in use
+static uint32_t task_kstack_dead[TASK_MAX_PROC / 32];	// released while in use
+
+static kmem_cache_t *task_wd_cache;		// working directories
+static kmem_cache_t *task_pages_cache;	// small `pages` arrays
+
+task_ptentry_t *task_pages_alloc(int *limit) {
+	task_ptentry_t *pages;
+
+	if (*limit <= TASK_PTENT_CACHE_LIMIT) {
+		*limit = TASK_PTENT_CACHE_LIMIT;
+		pages = kmem_cache_alloc(task_pages_cache);
+	} else {
+		pages = kmalloc(*limit * sizeof(task_ptentry_t));
+	}
+	if (pages) {
+		memset(pages, 0, *limit * sizeof(task_ptentry_t));
+	}
+	return pages;
+}
+
+/**
+ *	Get the slot of the kernel stack containing an address
+ */
+static int task_kstack_slot(uint32_t addr) {
+	return (addr - TASK_KSTACK_BASE) / TASK_KSTACK_SLOT;
+}
+
+/**
+ *	Get the kernel stack of a slot
+ */
+static task_ks_t *task_kstack_of(int slot) {
+	return (task_ks_t *)(TASK_KSTACK_BASE + slot * TASK_KSTACK_SLOT +
+						 TASK_KSTACK_SLOT - TASK_KSTACK_SIZE);
+}
+
+/**
+ *	Unmap a kernel stack and give its frames and slot back
+ */
+static void task_kstack_unmap(int slot) {
+	uint32_t addr = (uint32_t)task_kstack_of(slot);
+	page_table_entry_t *pte;
+	int i;
+
+	for (i = 0; i < TASK_KSTACK_SIZE; i += (4<<10)) {
+		pte = task_kstack_table.page_table_entry + GET_KSTACK_PTE(addr + i);
+		if (*pte & PAGE_TAB_ENT_PRESENT) {
+			page_alloc_free_4KB(*pte & ~0xFFF);
+		}
+		*pte = 0;
+	}
+	page_flush_tlb_range(addr, addr + TASK_KSTACK_SIZE);
+	task_kstack_map[slot / 32] &= ~(1 << (slot % 32));
+}
+
+/**
+ *	Release the kernel stacks left by exited processes, except the one in use
+ */
+static void task_kstack_reap() {
+	uint32_t esp, dead;
+	int word, slot, cur;
+
+	asm volatile ("movl %%esp, %0" : "=r" (esp));
+	cur = (esp >= TASK_KSTACK_BASE) ? task_kstack_slot(esp) : -1;
+	for (word = 0; word < TASK_MAX_PROC / 32; word++) {
+		dead = task_kstack_dead[word];
+		while (dead) {
+			asm ("bsfl %1, %0" : "=r" (slot) : "rm" (dead) : "cc");
+			dead &= dead - 1;
+			slot += word * 32;
+			if (slot == cur) {
+				continue;
+			}
+			task_kstack_dead[word] &= ~(1 << (slot % 32));
+			task_kstack_unmap(slot);
+		}
+	}
+}
+
+int task_kstack_alloc(pid_t pid) {
+	uint32_t free, addr;
+	int word, slot, i, frame;
+	task_ks_t *ks;
+
+	task_kstack_reap();
+	for (word = 0; word < TASK_MAX_PROC / 32; word++) {
+		if (~task_kstack_map[word]) {
+			break;
+		}
+	}
+	if (word == TASK_MAX_PROC / 32) {
+		return -ENOMEM;
+	}
+	free = ~task_kstack_map[word];
+	asm ("bsfl %1, %0" : "=r" (slot) : "rm" (free) : "cc");
+	slot += word * 32;
+	task_kstack_map[word] |= 1 << (slot % 32);
+
+	// The page below the stack stays unmapped, an overflow faults there
+	ks = task_kstack_of(slot);
+	for (i = 0; i < TASK_KSTACK_SIZE; i += (4<<10)) {
+		frame = 0;
+		if (page_alloc_4KB(&frame) != 0) {
+			task_kstack_unmap(slot);
+			return -ENOMEM;
+		}
+		addr = (uint32_t)ks + i;
+		task_kstack_table.page_table_entry[GET_KSTACK_PTE(addr)] = frame |
+			PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_SUPERVISOR |
+			PAGE_TAB_ENT_GLOBAL;
+	}
+	ks->pid = pid;
+	return (int)(ks + 1);
+}
+
+/**
+ *	Release the kernel stack of a process
+ *
+ *	The stack the kernel is running on is only marked dead, and released by
+ *	a later allocation once the processor has left it.
+ */
+static void task_kstack_free(uint32_t ks_esp) {
+	int slot = task_kstack_slot(ks_esp - 1);
+	uint32_t esp;
+
+	((task_ks_t *)ks_esp)[-1].pid = -1;
+	asm volatile ("movl %%esp, %0" : "=r" (esp));
+	if (esp >= TASK_KSTACK_BASE && task_kstack_slot(esp) == slot) {
+		task_kstack_dead[slot / 32] |= 1 << (slot % 32);
+		return;
+	}
+	task_kstack_unmap(slot);
+}
+
+int task_pages_reserve(task_t *proc, int n) {
+	task_ptentry_t *pages;
+	int used, limit;
+
+	for (used = 0; used < proc->page_limit; used++) {
+		if (!(proc->pages[used].pt_flags & PAGE_DIR_ENT_PRESENT))
+			break;
+	}
+	if (used + n <= proc->page_limit) {
+		return used;
+	}
+	// Leave some room so that small mappings do not copy the array each time
+	limit = used + n + 8;
+	pages = task_pages_alloc(&limit);
+	if (!pages) {
+		return -ENOMEM;
+	}
+	memcpy(pages, proc->pages, used * sizeof(task_ptentry_t));
+	kfree(proc->pages);
+	proc->pages = pages;
+	proc->page_limit = limit;
+	return used;
+}
+
+/**
+ *	Map a page of a process in its page directory
+ */
+static int task_page_map(task_t *proc, task_ptentry_t *page) {
+	if (page->pt_flags & PAGE_DIR_ENT_4MB) {
+		return page_dir_map_4MB(proc->pd, page->vaddr, page->paddr, page->pt_flags);
+	}
+	return page_dir_map_4KB(proc->pd, page->vaddr, page->paddr, page->pt_flags);
+}
+
+/**
+ *	Map a page of a process again after its flags or address changed
+ */
+static int task_page_remap(task_t *proc, task_ptentry_t *page) {
+	page_dir_unmap(proc->pd, page->vaddr);
+	return task_page_map(proc, page);
+}
+
+/**
+ *	Share the 4KB pages of a page table mapped region with a child process
+ *
+ *	Writable pages become copy-on-write in the parent, and the child gets the
+ *	same entries. Pages of shared mappings stay writable in both.
+ *
+ *	@return number of pages shared, or the negative of an errno
+ */
+static int task_fork_pgtab(task_t *parent, task_t *child, task_ptentry_t *page) {
+	page_table_entry_t *pte, *child_pte;
+	uint32_t vaddr = page->vaddr;
+	int i, addr, shared = 0;
+
+	pte = page_dir_get_pte(parent->pd, vaddr);
+	if (!pte) {
+		// Nothing touched yet
+		return 0;
+	}
+	for (i = 0; i < 1024; i++, vaddr += (4<<10)) {
+		if (pte[i] & PAGE_TAB_ENT_SWAP) {
+			// Both processes read their own copy back from the same slot
+			child_pte = page_dir_make_pte(child->pd, vaddr);
+			if (!child_pte) {
+				return -ENOMEM;
+			}
+			swap_dup(pte[i]);
+			*child_pte = pte[i];
+			continue;
+		}
+		if (!(pte[i] & PAGE_TAB_ENT_PRESENT))
+			continue;
+		if ((pte[i] & PAGE_TAB_ENT_RDWR) && !((page->priv_flags & TASK_PTENT_MMAP) &&
+			task_mmap_shared(parent, vaddr))) {
+			pte[i] = (pte[i] & ~PAGE_TAB_ENT_RDWR) | PAGE_TAB_ENT_COW;
+		}
+		addr = pte[i] & ~0xFFF;
+		page_alloc_4KB(&addr);
+		if (page_dir_map_4KB(child->pd, vaddr, addr, pte[i] & (PAGE_TAB_ENT_PRESENT |
+							 PAGE_TAB_ENT_USER | PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_COW)) != 0) {
+			page_alloc_free_4KB(addr);
+			return -ENOMEM;
+		}
+		shared++;
+	}
+	return shared;
+}
+
+void task_pgtab_free(task_t *proc, uint32_t start, uint32_t end) {
+	page_table_entry_t *pte;
+
+	for (; start < end; start += (4<<10)) {
+		pte = page_dir_get_pte(proc->pd, start);
+		if (!pte) {
+			return;
+		}
+		if (*pte & PAGE_TAB_ENT_PRESENT) {
+			page_alloc_free_4KB(*pte & ~0xFFF);
+			*pte = 0;
+		} else if (*pte & PAGE_TAB_ENT_SWAP) {
+			swap_release(*pte);
+			*pte = 0;
+		}
+	}
+}
+
+void task_pgtab_release(task_t *proc, uint32_t vaddr) {
+	task_pgtab_free(proc, vaddr, vaddr + __4MB);
+	page_dir_unmap_table(proc->pd, vaddr);
+}
+
+uint32_t task_resident_pages(task_t *proc, uint32_t *shared) {
+	page_table_entry_t *pte;
+	uint32_t resident = 0, paddr, vaddr, n;
+	int i;
+
+	*shared = 0;
+	for (i = 0; i < proc->page_limit; i++) {
+		if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT))
+			break;
+		if (!(proc->pages[i].priv_flags & TASK_PTENT_PGTAB)) {
+			n = (proc->pages[i].pt_flags & PAGE_DIR_ENT_4MB) ? 1024 : 1;
+			resident += n;
+			if (get_phys_mem_reference_count(proc->pages[i].paddr) > 1)
+				*shared += n;
+			continue;
+		}
+		for (vaddr = proc->pages[i].vaddr; vaddr < proc->pages[i].vaddr + __4MB;
+			 vaddr += (4<<10)) {
+			pte = page_dir_get_pte(proc->pd, vaddr);
+			if (!pte)
+				break;
+			if (!(*pte & PAGE_TAB_ENT_PRESENT))
+				continue;
+			resident++;
+			paddr = *pte & ~0xFFF;
+			if (paddr == page_zero_frame() || get_phys_mem_reference_count(paddr) > 1)
+				(*shared)++;
+		}
+	}
+	return resident;
+}
+
+/**
+ *	Back the pages in [start, end) of a process with zeroed private frames
+ *
+ *	@return 0 on success, or -ENOMEM
+ */
+static int task_stack_map(task_t *proc, uint32_t start, uint32_t end) {
+	page_table_entry_t *pte;
+	int addr;
+
+	for (start &= ~0xFFF; start < end; start += (4<<10)) {
+		pte = page_dir_get_pte(proc->pd, start);
+		if (pte && (*pte & PAGE_TAB_ENT_PRESENT))
+			continue;
+		addr = 0;
+		if (page_alloc_4KB(&addr) != 0) {
+			return -ENOMEM;
+		}
+		if (page_dir_map_4KB(proc->pd, start, addr, PAGE_TAB_ENT_PRESENT |
+							 PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_USER) != 0) {
+			page_alloc_free_4KB(addr);
+			return -ENOMEM;
+		}
+		memset((char *) start, 0, 4<<10);
+	}
+	return 0;
+}
+
+int task_pages_find(task_t *proc, uint32_t vaddr) {
+	int i;
+
+	for (i = 0; i < proc->page_limit; i++) {
+		if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT))
+			break;
+		if (proc->pages[i].vaddr == vaddr)
+			return i;
+	}
+	return -1;
+}
+
+void task_pages_remove(task_t *proc, int i) {
+	int last;
+
+	for (last = i; last + 1 < proc->page_limit; last++) {
+		if (!(proc->pages[last + 1].pt_flags & PAGE_DIR_ENT_PRESENT))
+			break;
+	}
+	proc->pages[i] = proc->pages[last];
+	memset(proc->pages + last, 0, sizeof(task_ptentry_t));
+	if (proc->vidmap && proc->vidpage_index == (uint32_t)last) {
+		proc->vidpage_index = i;
+	}
+}
+
+/**
+ *	Release the user memory and the `pages` array of a process
+ *
+ *	@note the page directory is kept, but still maps the released frames
+ */
+static void task_release_pages(task_t *proc) {
+	int i;
+
+	for (i = 0; i < proc->page_limit; i++) {
+		if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT)) {
+			// End of page list
+			break;
+		}
+		if (proc->pages[i].priv_flags & TASK_PTENT_PGTAB) {
+			// 4KB frames of a split 4MB page
+			task_pgtab_release(proc, proc->pages[i].vaddr);
+		} else if (proc->pages[i].pt_flags & PAGE_DIR_ENT_4MB) {
+			// 4MB page
+			page_alloc_free_4MB(proc->pages[i].paddr);
+		} else {
+			// 4KB page
+			page_alloc_free_4KB(proc->pages[i].paddr);
+		}
+		proc->pages[i].pt_flags = 0;
+	}
+	if (proc->pages) {
+		kfree(proc->pages);
+		proc->pages = NULL;
+	}
+}
 
 int16_t task_alloc_pid() {
 	pid_t ret;
@@ -36,42 +406,54 @@ int16_t task_alloc_pid() {
 }
 
 void task_create_kernel_pid() {
-	int i;//iterator
 	// initialize the kernel task
 	task_t* init_task = task_list + 0;
 	memset(init_task, 0, sizeof(task_t));
 	// should open fd 0 and 1
 	init_task->parent = -1;
 
+	// Kernel stacks are mapped in every address space
+	page_dir_add_4KB_entry(TASK_KSTACK_BASE, &task_kstack_table, PAGE_DIR_ENT_PRESENT |
+						   PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_SUPERVISOR |
+						   PAGE_DIR_ENT_GLOBAL);
+	init_task->ks_esp = task_kstack_alloc(0);
+	if ((int)init_task->ks_esp < 0) {
+		printf("[CRITICAL] CANNOT ALLOCATE KERNEL STACK!\n");
+		while (1);
+	}
 	tss.ss0 = KERNEL_DS;
-	tss.esp0 = init_task->ks_esp = (uint32_t)(kstack+1);
+	tss.esp0 = init_task->ks_esp;
 	task_pid_allocator = 0;
 
 	init_task->sigacts[SIGCHLD].flags = SA_NOCLDWAIT;
-	
-	init_task->wd = kmalloc(sizeof(pathname_t));
+
+	task_wd_cache = kmem_cache_create("task_wd", sizeof(pathname_t));
+	task_pages_cache = kmem_cache_create("task_pages",
+							TASK_PTENT_CACHE_LIMIT * sizeof(task_ptentry_t));
+
+	init_task->wd = kmem_cache_alloc(task_wd_cache);
 	strcpy(init_task->wd, "/");
-	init_task->pages = kmalloc(4 * sizeof(task_ptentry_t));
 	init_task->page_limit = 4;
+	init_task->pages = task_pages_alloc(&init_task->page_limit);
+	init_task->pd = page_dir_create();
+	if (!init_task->pd) {
+		printf("[CRITICAL] CANNOT CREATE KERNEL PAGE DIRECTORY!\n");
+		while (1);
+	}
 	
 	init_task->uid = 0; // root
 	init_task->gid = 0; // root
 
-	// initialize kernel stack page
-	for (i=0; i<256; ++i){
-		kstack[i].pid = -1;
-	}
-
 	// kick start
 	init_task->pid = 0;
 	init_task->status = TASK_ST_RUNNING;
-
-	kstack[0].pid = 0;
+	scheduler_update(init_task);
 }
 
 void task_start_kernel_pid() {
 	// iret to the kernel process
 	scheduling_start();
+	page_dir_switch(task_list[0].pd);
 	task_kernel_process_iret();
 }
 
@@ -80,24 +462,39 @@ int syscall_getpid(int a, int b, int c) {
 }
 
 int syscall_fork(int a, int b, int c) {
-	int16_t pid, cur_pid;
-	task_t *cur_task, *new_task;
-	int i;
+	return task_fork(task_list + task_current_pid());
+}
+
+int task_fork(task_t *cur_task) {
+	int16_t pid;
+	task_t *new_task;
+	int i, ret;
 
 	pid = task_alloc_pid();
 	if (pid < 0) {
 		return pid;
 	}
-	cur_pid = task_current_pid();
-	cur_task = task_list + cur_pid;
 	new_task = task_list + pid;
 
-	// Initialize task_t structure
+	// Initialize task_t structure, the slot stays unused until it is complete
 	memcpy(new_task, cur_task, sizeof(task_t));
+	new_task->status = TASK_ST_NA;
 	new_task->pid = pid;
-	new_task->parent = cur_pid;
-	new_task->wd = (char *) kmalloc(sizeof(pathname_t));
-	strcpy(new_task->wd, cur_task->wd);
+	new_task->parent = cur_task->pid;
+	new_task->rq_next = new_task->rq_prev = NULL;
+	new_task->wq = NULL;
+	new_task->wq_next = NULL;
+	new_task->kctx_esp = 0;
+	new_task->child_wait.head = NULL;
+	new_task->sleep_timer.pprev = NULL;
+	new_task->sleep_wait.head = NULL;
+	// Nothing below is owned by the child yet
+	new_task->wd = NULL;
+	new_task->fpu = NULL;
+	new_task->mmaps = NULL;
+	new_task->ks_esp = 0;
+	new_task->pd = NULL;
+	new_task->pages = NULL;
 
 	for (i = 0; i < TASK_MAX_OPEN_FILES; ++i) {
 		if (new_task->files[i]) {
@@ -105,36 +502,62 @@ int syscall_fork(int a, int b, int c) {
 		}
 	}
 
-/*	// Create kernel stack (512 8kb entries in 4MB page)
-	for (i = 0; i < 512; i++) {
-		if (kstack[i].pid < 0) {
-			// Slot is empty, use it
-			kstack[i].pid = pid;
-			new_task->ks_esp = (int)(kstack + i + 1);
-			break;
-		}
-	}*/
-	// Create kernel stack (256 16kb entries in 4MB page)
-	for (i = 0; i < 256; i++) {
-		if (kstack[i].pid < 0) {
-			// Slot is empty, use it
-			kstack[i].pid = pid;
-			new_task->ks_esp = (int)(kstack + i + 1);
-			break;
-		}
+	ret = -ENOMEM;
+	new_task->wd = (char *) kmem_cache_alloc(task_wd_cache);
+	if (!new_task->wd) {
+		goto fail;
 	}
-	if (i == 512)
-		return -ENOMEM;
-	
+	strcpy(new_task->wd, cur_task->wd);
+	if (fpu_fork(cur_task, new_task) != 0) {
+		goto fail;
+	}
+
+	ret = task_mmap_fork(cur_task, new_task);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	// Create kernel stack
+	ret = task_kstack_alloc(pid);
+	if (ret < 0)
+		goto fail;
+	new_task->ks_esp = ret;
+
 	// Copy address space
-	new_task->pages = kmalloc(cur_task->page_limit * sizeof(task_ptentry_t));
+	ret = -ENOMEM;
+	new_task->pd = page_dir_create();
+	if (!new_task->pd) {
+		goto fail;
+	}
+	new_task->pages = task_pages_alloc(&new_task->page_limit);
 	if (!new_task->pages) {
-		return -ENOMEM;
+		goto fail;
 	}
 	memcpy(new_task->pages, cur_task->pages, cur_task->page_limit * sizeof(task_ptentry_t));
+	new_task->cow_shared = 0;
+	new_task->cow_copied = 0;
 	for (i = 0; i < new_task->page_limit; i++) {
 		if (!(new_task->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT))
 			break;
+		if ((cur_task->pages[i].pt_flags & (PAGE_DIR_ENT_4MB | PAGE_DIR_ENT_RDWR)) ==
+			(PAGE_DIR_ENT_4MB | PAGE_DIR_ENT_RDWR) &&
+			!(cur_task->pages[i].priv_flags & TASK_PTENT_PGTAB) &&
+			page_dir_split_4MB(cur_task->pd, cur_task->pages[i].vaddr) == 0) {
+			// Writable 4MB page, copy-on-write is tracked per 4KB page from now on
+			cur_task->pages[i].priv_flags |= TASK_PTENT_PGTAB;
+			new_task->pages[i].priv_flags |= TASK_PTENT_PGTAB;
+		}
+		if (cur_task->pages[i].priv_flags & TASK_PTENT_PGTAB) {
+			ret = task_fork_pgtab(cur_task, new_task, cur_task->pages + i);
+			if (ret < 0) {
+				// The entries after this one still hold the parent's frames
+				memset(new_task->pages + i + 1, 0,
+					   (new_task->page_limit - i - 1) * sizeof(task_ptentry_t));
+				goto fail;
+			}
+			new_task->cow_shared += ret;
+			continue;
+		}
 		if (new_task->pages[i].pt_flags & PAGE_DIR_ENT_RDWR) {
 			// Writable page, need copy (mark as copy-on-write)
 			new_task->pages[i].pt_flags &= ~PAGE_DIR_ENT_RDWR;
@@ -142,20 +565,7 @@ int syscall_fork(int a, int b, int c) {
 			// Both have to be protected
 			cur_task->pages[i].pt_flags &= ~PAGE_DIR_ENT_RDWR;
 			cur_task->pages[i].priv_flags |= TASK_PTENT_CPONWR;
-
-			if (cur_task->pages[i].pt_flags & PAGE_DIR_ENT_4MB) {
-				// 4MB
-				page_dir_delete_entry(cur_task->pages[i].vaddr);
-				page_dir_add_4MB_entry(cur_task->pages[i].vaddr,
-									   cur_task->pages[i].paddr,
-									   cur_task->pages[i].pt_flags);
-			} else {
-				// 4KB
-				page_tab_delete_entry(cur_task->pages[i].vaddr);
-				page_tab_add_entry(cur_task->pages[i].vaddr,
-								   cur_task->pages[i].paddr,
-								   cur_task->pages[i].pt_flags);
-			}
+			task_page_remap(cur_task, cur_task->pages + i);
 		}
 		if (new_task->pages[i].pt_flags & PAGE_DIR_ENT_4MB) {
 			// 4MB page
@@ -164,16 +574,49 @@ int syscall_fork(int a, int b, int c) {
 			// 4KB page
 			page_alloc_4KB((int *)&(new_task->pages[i].paddr));
 		}
+		task_page_map(new_task, new_task->pages + i);
+		new_task->cow_shared += (new_task->pages[i].pt_flags & PAGE_DIR_ENT_4MB) ? 1024 : 1;
 	}
 
 	// Return 0 to newly created process
 	new_task->regs.eax = 0;
 
-	// Done. New process will be executed by the scheduler later
+	if (cur_task->pd == page_dir_current()) {
+		page_flush_tlb();
+	}
+
+	// Done. The parent may be blocked in the kernel, the child starts running
+	// and will be executed by the scheduler later
+	new_task->status = TASK_ST_RUNNING;
+	scheduler_update(new_task);
 
-	page_flush_tlb();
+	return pid;
 
-	return pid; // Should not hit
+fail:
+	// Give back everything acquired above, in reverse
+	if (new_task->pages) {
+		task_release_pages(new_task);
+		if (cur_task->pd == page_dir_current()) {
+			page_flush_tlb();
+		}
+	}
+	page_dir_destroy(new_task->pd);
+	new_task->pd = NULL;
+	if (new_task->ks_esp) {
+		task_kstack_free(new_task->ks_esp);
+	}
+	task_mmap_drop(new_task);
+	fpu_release(new_task);
+	if (new_task->wd) {
+		kmem_cache_free(task_wd_cache, new_task->wd);
+	}
+	for (i = 0; i < TASK_MAX_OPEN_FILES; ++i) {
+		if (new_task->files[i]) {
+			new_task->files[i]->open_count--;
+		}
+	}
+	new_task->status = TASK_ST_NA;
+	return ret;
 }
 
 int syscall_execve(int pathp, int argvp, int envpp) {
@@ -181,9 +624,8 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 	char **envp = (char **) envpp;
 	int fd, ret, i;
 	task_t *proc;
-	uint32_t *u_argv, *u_envp, argc, envc;
+	uint32_t *u_argv, *u_envp, argc, envc, size, scratch;
 	task_ptentry_t ptent_stack, tmp_pages[2];
-	char *path_prev;
 
 	// Sanity checks
 	if (!pathp) {
@@ -208,23 +650,35 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 	
 	// Copy execution information to new user stack
 
-	// allocate 4MB page for new stack (temporary at 0xc0000000 - 0xc0400000)
-	ptent_stack.vaddr = 0xc0000000;
-	ptent_stack.paddr = 0;
-	ret = page_alloc_4MB((int *)&(ptent_stack.paddr));
-	if (ret != 0) {
-		// Page allocation failed. Probably ENOMEM
-		return -1;
+	// Size the arguments, only the pages holding them get a frame
+	size = 16; // Reserved dword, pointers and argc
+	argc = envc = 0;
+	if (argv) {
+		for (; argv[argc]; argc++) {
+			size += strlen(argv[argc]) + 4;
+		}
+	}
+	if (envp) {
+		for (; envp[envc]; envc++) {
+			size += strlen(envp[envc]) + 4;
+		}
+	}
+	size += 8 * (argc + envc + 2);
+	scratch = 4 * (argc + envc + 2);
+	if (strlen((char *)pathp) + 1 > scratch) {
+		scratch = strlen((char *)pathp) + 1;
+	}
+	if (size + scratch > (4<<20)) {
+		return -E2BIG;
 	}
 
-	ptent_stack.priv_flags = 0;
-	ptent_stack.pt_flags = PAGE_DIR_ENT_PRESENT;
-	ptent_stack.pt_flags |= PAGE_DIR_ENT_RDWR;
-	ptent_stack.pt_flags |= PAGE_DIR_ENT_USER;
-	ptent_stack.pt_flags |= PAGE_DIR_ENT_4MB;
-	page_dir_add_4MB_entry(ptent_stack.vaddr, ptent_stack.paddr,
-						   ptent_stack.pt_flags);
-	page_flush_tlb();
+	// build new stack at a temporary window at 0xc0000000 - 0xc0400000
+	if (task_stack_map(proc, 0xc0000000, 0xc0000000 + scratch) ||
+		task_stack_map(proc, 0xc0400000 - size, 0xc0400000)) {
+		// Page allocation failed
+		task_pgtab_release(proc, 0xc0000000);
+		return -ENOMEM;
+	}
 
 	// Push argv and envp onto stack, set ESP and EBP
 	proc->regs.esp = 0xc0400000; // Default stack address
@@ -233,26 +687,18 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 
 	// Parse argv
 	u_argv = (uint32_t *) 0xc0000000; // Temporarily use top of stack as heap
-	if (argv) {
-		for (argc = 0; argv[argc]; argc++) {
-			task_user_pushs(&(proc->regs.esp), (uint8_t *) argv[argc],
-							strlen(argv[argc])+1);
-			u_argv[argc] = proc->regs.esp - 0x400000; // Offset 4MB
-		}
-	} else {
-		argc = 0;
+	for (i = 0; i < (int)argc; i++) {
+		task_user_pushs(&(proc->regs.esp), (uint8_t *) argv[i],
+						strlen(argv[i])+1);
+		u_argv[i] = proc->regs.esp - 0x400000; // Offset 4MB
 	}
 	u_argv[argc] = 0; // Terminating zero
 	// Parse envp
 	u_envp = u_argv + argc + 1;
-	if (envp) {
-		for (envc = 0; envp[envc]; envc++) {
-			task_user_pushs(&(proc->regs.esp), (uint8_t *) envp[envc],
-							strlen(envp[envc])+1);
-			u_envp[envc] = proc->regs.esp - 0x400000; // Offset 4MB
-		}
-	} else {
-		envc = 0;
+	for (i = 0; i < (int)envc; i++) {
+		task_user_pushs(&(proc->regs.esp), (uint8_t *) envp[i],
+						strlen(envp[i])+1);
+		u_envp[i] = proc->regs.esp - 0x400000; // Offset 4MB
 	}
 	u_envp[envc] = 0; // Terminating zero
 	// Move temp values back
@@ -269,8 +715,6 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 
 	strcpy((char *)0xc0000000, (char *)pathp); // Copy path to top-of-stack
 
-	ret = task_current_pid();
-
 	// Close all fd (except stdin, stdout, stderr)
 	for (i = 3; i < TASK_MAX_OPEN_FILES; i++) {
 		if (proc->files[i]) {
@@ -278,21 +722,20 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 		}
 	}
 
-	// Release previous process
-	path_prev = proc->wd;
-	proc->wd = NULL;
-	scheduler_page_clear(proc);
-	task_release(proc);
-	proc->wd = path_prev;
-	proc->status = TASK_ST_RUNNING;
-	// Update kernel stack PID
-	((task_ks_t *)(proc->ks_esp))[-1].pid = ret;
+	// Release previous process memory, but keep its page directory
+	task_mmap_release(proc);
+	task_release_pages(proc);
+	page_dir_clear_user(proc->pd, 0xc0000000);
+	// The new program starts with a clean FPU
+	fpu_release(proc);
 
-	// Re-map new stack
-	page_dir_delete_entry(ptent_stack.vaddr);
+	// Re-map new stack, untouched stack pages are demand-zero
+	page_dir_move(proc->pd, 0xc0000000, 0xbfc00000);
 	ptent_stack.vaddr = 0xbfc00000;
-	page_dir_add_4MB_entry(ptent_stack.vaddr, ptent_stack.paddr,
-						   ptent_stack.pt_flags);
+	ptent_stack.paddr = 0;
+	ptent_stack.pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
+						   PAGE_DIR_ENT_USER | PAGE_DIR_ENT_4MB;
+	ptent_stack.priv_flags = TASK_PTENT_PGTAB | TASK_PTENT_DEMAND;
 	memcpy(tmp_pages+0, &ptent_stack, sizeof(task_ptentry_t));
 	memset(tmp_pages+1, 0, sizeof(task_ptentry_t));
 	proc->pages = tmp_pages;
@@ -303,7 +746,6 @@ int syscall_execve(int pathp, int argvp, int envpp) {
 	
 	fd = syscall_open(0xbfc00000, FMODE_EXEC, 0); // Path stored at top of stack
 	if (fd < 0) {
-		page_alloc_free_4MB(ptent_stack.paddr);
 		syscall__exit(WEXITSTATUS(-1),0,0);
 		return fd;
 	}
@@ -351,7 +793,7 @@ int syscall__exit(int status, int b, int c) {
 
 	// Start a new shell if the terminal has nothing to run
 	if (cur_tty && proc->pid == cur_tty->root_proc){
-		new_proc = _tty_start_shell();
+		new_proc = _tty_start_shell(proc->pid);
 		if (new_proc < 0) {
 			printf("Cannot create new shell\n");
 		} else {
@@ -364,6 +806,9 @@ int syscall__exit(int status, int b, int c) {
 
 	proc->regs.eax = status;
 
+	// Write back shared mappings while the address space is still loaded
+	task_mmap_release(proc);
+
 	// Close all fd
 	for (i = 0; i < TASK_MAX_OPEN_FILES; i++) {
 		if (proc->files[i]) {
@@ -375,22 +820,22 @@ int syscall__exit(int status, int b, int c) {
 		// Parent is alive
 		if (parent->sigacts[SIGCHLD].flags & SA_NOCLDWAIT) {
 			// Do not notify parent
-			scheduler_page_clear(proc);
 			task_release(proc);
-			// Restart parent `wait` in case this is the last child
-			syscall_kill(parent->pid, SIGCONT, 0);
+			// Wake up parent `wait` in case this is the last child
+			wake_up(&(parent->child_wait));
 		} else {
 			proc->status = TASK_ST_ZOMBIE;
+			scheduler_update(proc);
 			if (WIFSIGNALED(status)) {
 				proc->exit_status = status;
 			} else {
 				proc->exit_status = WEXITSTATUS(status) | WIFEXITED(-1);
 			}
 			syscall_kill(proc->parent, SIGCHLD, 0);
+			wake_up(&(parent->child_wait));
 		}
 	} else {
 		// Otherwise, just release the process
-		scheduler_page_clear(proc);
 		task_release(proc);
 	}
 
@@ -399,20 +844,15 @@ int syscall__exit(int status, int b, int c) {
 	return 0; // This line should not hit
 }
 
-int syscall_waitpid(int cpid, int statusp, int options) {
-	pid_t pid;
+/**
+ *	Look for a child `waitpid` can report
+ *
+ *	@param pid: the waiting process
+ *	@return the pid of the child, 0 if children exist but none can be
+ *			reported yet, or -ECHILD
+ */
+static int task_wait_scan(pid_t pid, int cpid, int options, int *status) {
 	int i, found_child;
-	task_sigact_t sa;
-	sigset_t ss;
-	int *status;
-
-	if (!statusp) {
-		return -EFAULT;
-	}
-
-	status = (int *) statusp;
-
-	pid = task_current_pid();
 
 	found_child = 0;
 	for (i = 0; i < TASK_MAX_PROC; i++) {
@@ -449,18 +889,27 @@ int syscall_waitpid(int cpid, int statusp, int options) {
 		return -ECHILD;
 	}
 	// Child process found, but non are terminated.
-	if (options & WNOHANG) {
-		return -ECHILD;
+	return 0;
+}
+
+int syscall_waitpid(int cpid, int statusp, int options) {
+	task_t *proc;
+	int ret;
+
+	if (!statusp) {
+		return -EFAULT;
 	}
-	// Put parent to sleep
-	sa.handler = SIG_IGN;
-	sigemptyset(&(sa.mask));
-	sa.flags = SA_RESTART;
-	syscall_sigaction(SIGCHLD, (int)&sa, 0);
-	sigemptyset(&ss);
-	task_list[pid].exit_status = SYSCALL_WAITPID | WIFSYSCALL(-1);
-	syscall_sigsuspend((int) &ss, NULL, 0);
-	return 0; // Should not hit
+
+	proc = task_list + task_current_pid();
+
+	while ((ret = task_wait_scan(proc->pid, cpid, options, (int *) statusp)) == 0) {
+		if (options & WNOHANG) {
+			return -ECHILD;
+		}
+		// Sleep until a child exits or stops
+		wait_queue_sleep(&(proc->child_wait));
+	}
+	return ret;
 }
 
 int syscall_ece391_execute(int cmdlinep, int b, int c) {
@@ -659,37 +1108,26 @@ int syscall_setgid(int gid, int b, int c) {
 }
 
 void task_release(task_t *proc) {
-	int i;
-
 	// Mark program as dead
 	proc->status = TASK_ST_DEAD;
 	// Release all pages
-	for (i = 0; i < proc->page_limit; i++) {
-		if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT)) {
-			// End of page list
-			break;
-		}
-		if (proc->pages[i].pt_flags & PAGE_DIR_ENT_4MB) {
-			// 4MB page
-			page_alloc_free_4MB(proc->pages[i].paddr);
-		} else {
-			// 4KB page
-			page_alloc_free_4KB(proc->pages[i].paddr);
-		}
-		proc->pages[i].pt_flags = 0;
+	task_release_pages(proc);
+	fpu_release(proc);
+	timer_cancel(&(proc->sleep_timer));
+	// Release the address space, leaving it first if it is the current one
+	if (proc->pd) {
+		page_dir_destroy(proc->pd);
+		proc->pd = NULL;
 	}
-	page_flush_tlb();
 	// Release dynamic memory
-	if (proc->pages) {
-		kfree(proc->pages);
-	}
 	if (proc->wd) {
 		kfree(proc->wd);
 	}
 	// Release kernel stack
-	((task_ks_t *)(proc->ks_esp))[-1].pid = -1;
+	task_kstack_free(proc->ks_esp);
 	// Mark program as void
 	proc->status = TASK_ST_NA;
+	scheduler_update(proc);
 }
 
 int task_user_pushs(uint32_t *esp, uint8_t *buf, size_t size) {
@@ -749,7 +1187,95 @@ int task_access_memory(uint32_t addr) {
 	return -EFAULT;
 }
 
-int task_pf_copy_on_write(uint32_t addr) {
+/**
+ *	Back a page of a demand-zero region with a zeroed frame
+ */
+static int task_pf_demand_zero(task_t *proc, task_ptentry_t *page, uint32_t addr,
+							   int write) {
+	int new = 0;
+
+	// only the heap below the program break may be touched
+	if ((page->priv_flags & TASK_PTENT_HEAP) &&
+		(addr < (proc->heap.start & ~0xFFF) ||
+		 addr >= ((proc->heap.prog_break + 0xFFF) & ~0xFFF))) {
+		return -EFAULT;
+	}
+	if (!write) {
+		// Reads see the shared zero frame until the first write
+		return page_dir_map_4KB(proc->pd, addr, page_zero_frame(), PAGE_TAB_ENT_PRESENT |
+								PAGE_TAB_ENT_USER | PAGE_TAB_ENT_COW) ? -ENOMEM : 0;
+	}
+	if (page_alloc_4KB(&new) != 0) {
+		return -ENOMEM;
+	}
+	if (page_dir_map_4KB(proc->pd, addr, new, PAGE_TAB_ENT_PRESENT |
+						 PAGE_TAB_ENT_RDWR | PAGE_TAB_ENT_USER) != 0) {
+		page_alloc_free_4KB(new);
+		return -ENOMEM;
+	}
+	memset((char *) addr, 0, 4<<10);
+	return 0;
+}
+
+/**
+ *	Resolve a fault on a 4KB page of a page table mapped region, either by
+ *	copy-on-write or by demand allocation
+ */
+static int task_pf_pgtab(task_t *proc, task_ptentry_t *page, uint32_t addr, int write) {
+	page_table_entry_t *pte;
+	int old, new = 0;
+
+	addr &= ~0xFFF;
+	pte = page_dir_get_pte(proc->pd, addr);
+	if (!pte || !(*pte & PAGE_TAB_ENT_PRESENT)) {
+		if (pte && (*pte & PAGE_TAB_ENT_SWAP)) {
+			return swap_in(proc, addr, pte);
+		}
+		if (page->priv_flags & TASK_PTENT_MMAP) {
+			return task_mmap_fault(proc, addr, write);
+		}
+		if (!(page->priv_flags & TASK_PTENT_DEMAND)) {
+			return -EFAULT;
+		}
+		return task_pf_demand_zero(proc, page, addr, write);
+	}
+	if (!(*pte & PAGE_TAB_ENT_COW)) {
+		return -EFAULT;
+	}
+	old = *pte & ~0xFFF;
+	if (old == (int)page_zero_frame()) {
+		// First write to a zero page, nothing to copy
+		if (page_alloc_4KB(&new) != 0) {
+			return -ENOMEM;
+		}
+		*pte = new | PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER | PAGE_TAB_ENT_RDWR;
+		page_flush_tlb_page(addr);
+		memset((char *) addr, 0, 4<<10);
+		return 0;
+	}
+	if (get_phys_mem_reference_count(old) == 1) {
+		// Last user of the frame, just take it over
+		*pte = (*pte & ~PAGE_TAB_ENT_COW) | PAGE_TAB_ENT_RDWR;
+		page_flush_tlb_page(addr);
+		return 0;
+	}
+	if (page_alloc_4KB(&new) != 0) {
+		return -ENOMEM;
+	}
+	// using virtual addr 0x08040000 as temp
+	page_dir_map_4KB(proc->pd, 0x08040000, new, PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_RDWR);
+	page_flush_tlb_page(0x08040000);
+	memcpy((char *) 0x08040000, (char *) addr, 4<<10);
+	page_dir_unmap(proc->pd, 0x08040000);
+	*pte = new | (*pte & (PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER)) | PAGE_TAB_ENT_RDWR;
+	page_alloc_free_4KB(old);
+	proc->cow_copied++;
+	page_flush_tlb_page(0x08040000);
+	page_flush_tlb_page(addr);
+	return 0;
+}
+
+int task_pf_copy_on_write(uint32_t addr, int write) {
 	int i;
 	task_t *proc;
 	task_ptentry_t* page;
@@ -768,24 +1294,19 @@ int task_pf_copy_on_write(uint32_t addr) {
 				continue;
 		}
 		// In bounds, check for copy-on-write flag
+		if (proc->pages[i].priv_flags & TASK_PTENT_PGTAB)
+			return task_pf_pgtab(proc, proc->pages + i, addr, write);
 		if (!(proc->pages[i].priv_flags & TASK_PTENT_CPONWR))
 			return -EFAULT;
 
 		// OK. Copy page to be writable
 		page = proc->pages + i;
-		if (get_phys_mem_reference_count(page->paddr) == 1) {
+		if (page->paddr != page_zero_frame() &&
+			get_phys_mem_reference_count(page->paddr) == 1) {
 			page->pt_flags |= PAGE_DIR_ENT_RDWR;
 			page->priv_flags &= ~(TASK_PTENT_CPONWR);
-			if (page->pt_flags & PAGE_DIR_ENT_4MB) {
-				// 4MB page
-				page_dir_delete_entry(page->vaddr);
-				page_dir_add_4MB_entry(page->vaddr, page->paddr, page->pt_flags);
-			} else {
-				// 4KB page
-				page_tab_delete_entry(page->vaddr);
-				page_tab_add_entry(page->vaddr, page->paddr, page->pt_flags);
-			}
-			page_flush_tlb();
+			task_page_remap(proc, page);
+			page_flush_tlb_page(page->vaddr);
 			return 0;
 		}
 		if (page->pt_flags & PAGE_DIR_ENT_4MB) {
@@ -799,16 +1320,18 @@ int task_pf_copy_on_write(uint32_t addr) {
 				// No memory... Delete this page
 				page->pt_flags = 0;
 				page_alloc_free_4MB(i);
-				page_dir_delete_entry(page->vaddr);
+				page_dir_unmap(proc->pd, page->vaddr);
 				return -ENOMEM;
 			}
 			// using virtual addr 0xc0000000 as temp
-			page_dir_add_4MB_entry(0xc0000000, page->paddr, page->pt_flags);
+			page_dir_map_4MB(proc->pd, 0xc0000000, page->paddr, page->pt_flags);
+			page_flush_tlb_page(0xc0000000);
 			memcpy((char *) 0xc0000000, (char *)page->vaddr, 4<<20);
-			page_dir_delete_entry(0xc0000000);
+			page_dir_unmap(proc->pd, 0xc0000000);
+			page_flush_tlb_page(0xc0000000);
 			page_alloc_free_4MB(i);
-			page_dir_delete_entry(page->vaddr);
-			page_dir_add_4MB_entry(page->vaddr, page->paddr, page->pt_flags);
+			task_page_remap(proc, page);
+			proc->cow_copied += 1024;
 		} else {
 			// 4KB page
 			i = page->paddr;
@@ -820,18 +1343,22 @@ int task_pf_copy_on_write(uint32_t addr) {
 				// No memory... Delete this page
 				page->pt_flags = 0;
 				page_alloc_free_4KB(i);
-				page_tab_delete_entry(page->vaddr);
+				page_dir_unmap(proc->pd, page->vaddr);
 				return -ENOMEM;
 			}
 			// using virtual addr 0x08040000 as temp
-			page_tab_add_entry(0x08040000, page->paddr, page->pt_flags);
+			page_dir_map_4KB(proc->pd, 0x08040000, page->paddr, page->pt_flags);
+			page_flush_tlb_page(0x08040000);
 			memcpy((char *) 0x08040000, (char *) page->vaddr, 4<<10);
-			page_tab_delete_entry(0x08040000);
-			page_alloc_free_4KB(i);
-			page_tab_delete_entry(page->vaddr);
-			page_tab_add_entry(page->vaddr, page->paddr, page->pt_flags);
+			page_dir_unmap(proc->pd, 0x08040000);
+			page_flush_tlb_page(0x08040000);
+			if (i != (int)page_zero_frame()) {
+				page_alloc_free_4KB(i);
+			}
+			task_page_remap(proc, page);
+			proc->cow_copied++;
 		}
-		page_flush_tlb();
+		page_flush_tlb_page(page->vaddr);
 		return 0; // Resume program execution
 	}
 	return -EFAULT;
@@ -868,102 +1395,93 @@ int task_make_initd(int a, int b, int c) {
 }
 
 int syscall_brk(int paddr, int b, int c){
-	int i;
-	uint32_t ret_alloc;
-	// extend to this address, note the -1
-	// since it is the address 1 B after the end of uninitialized data segment
-	uint32_t t_addr = (uint32_t)paddr - 1;
-	// align to the start of that 4MB
-	uint32_t aligned_t_addr = ((uint32_t)t_addr / __4MB) * __4MB;
-	uint32_t temp_aligned;
+	int i, missing, avail;
+	uint32_t region, first, old_break;
+	// program break is the address 1 B after the end of the heap
+	uint32_t new_break = (uint32_t)paddr;
 	task_ptentry_t new_ptentry;
 	task_t* proc = task_list + task_current_pid();
 	//task_t* proc = task_list;				// FOR TEST
 
-	// if a deallocate request:
-	if ((uint32_t)paddr < proc->heap.prog_break){
-		// if this is less than start, well
-		if ((uint32_t)paddr < proc->heap.start){
-			// f**k you
-			errno = EINVAL;
+	// if this is less than start, well
+	if (new_break < proc->heap.start){
+		errno = EINVAL;
+		return -1;
+	}
+
+	// if an allocate request: reserve the 4MB regions, frames come on first touch
+	if (new_break > proc->heap.prog_break){
+		if (new_break - proc->heap.start > TASK_MAX_HEAP){
+			errno = ENOMEM;
+			return -1;
+		}
+		// make sure every region fits in pages before touching anything, and
+		// never grow over a region that belongs to mmap, the stack or the image
+		missing = 0;
+		for (region = proc->heap.start & ~(__4MB - 1); region < new_break; region += __4MB){
+			i = task_pages_find(proc, region);
+			if (i < 0){
+				missing++;
+			} else if (!(proc->pages[i].priv_flags & TASK_PTENT_HEAP)){
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		avail = 0;
+		for (i = 0; i < proc->page_limit; ++i){
+			if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT)){
+				avail++;
+			}
+		}
+		if (missing > avail){
+			// guess no space left in pages ha
+			errno = ENOMEM;
 			return -1;
 		}
-		while((proc->heap.prog_break - aligned_t_addr) > __4MB){
-			// deallocate 4MB pages, find that in process pages
-			temp_aligned = ((proc->heap.prog_break - 1)/__4MB)*__4MB;
-			for (i=0;i<proc->page_limit;++i){
-				if (proc->pages[i].vaddr == temp_aligned){
+		new_ptentry.paddr = 0;
+		new_ptentry.pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER | PAGE_DIR_ENT_4MB;
+		new_ptentry.priv_flags = TASK_PTENT_PGTAB | TASK_PTENT_DEMAND | TASK_PTENT_HEAP;
+		for (region = proc->heap.start & ~(__4MB - 1); region < new_break; region += __4MB){
+			if (task_pages_find(proc, region) >= 0){
+				continue;
+			}
+			new_ptentry.vaddr = region;
+			for (i = 0; i < proc->page_limit; ++i){
+				if (!(proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT)){
+					proc->pages[i] = new_ptentry;
 					break;
 				}
 			}
-			if (i > proc->page_limit){
-				// very bad thing happened
-				printf("Page missing!");
-				return -1;
-			}
-			// delete this 4MB page in phys, page dir, proc pages
-			page_dir_delete_entry(proc->pages[i].vaddr);
-			page_alloc_free_4MB(proc->pages[i].paddr);
-			proc->pages[i].pt_flags &= ~(PAGE_DIR_ENT_PRESENT);
-			// edit heap data
-			proc->heap.prog_break = proc->pages[i].vaddr;
 		}
-		proc->heap.prog_break = (uint32_t)paddr;
-		page_flush_tlb();
+		proc->heap.prog_break = new_break;
 		return 0;
 	}
 
-	// if an allocate request:
-	while(aligned_t_addr > (proc->heap.prog_break - 1)){
-		// there is some 4MB pages to be allocated
-		ret_alloc = 0;
-		// allocating new page failed
-		if (page_alloc_4MB((int*)(&ret_alloc))){
-			// well we keep the allocated ones
-			errno = ENOMEM;
-			return -1;
+	// if a deallocate request: give back every frame above the new break
+	first = (new_break + 0xFFF) & ~0xFFF;
+	old_break = proc->heap.prog_break;
+	for (region = proc->heap.start & ~(__4MB - 1); region < proc->heap.prog_break; region += __4MB){
+		i = task_pages_find(proc, region);
+		if (i < 0 || !(proc->pages[i].priv_flags & TASK_PTENT_HEAP)){
+			continue;
 		}
-		// well I guess allocation went well, then add into proc pages and page table
-		new_ptentry.vaddr = ((proc->heap.prog_break -1 + __4MB) / __4MB) * __4MB;
-		new_ptentry.paddr = ret_alloc;
-		new_ptentry.pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER | PAGE_DIR_ENT_4MB;
-		new_ptentry.priv_flags = 0;
-		// add that in pages of process
-		for (i=0; i<proc->page_limit; ++i){
-			if (proc->pages[i].pt_flags & PAGE_DIR_ENT_PRESENT) continue;
-			// else found a empty spot
-			memcpy(&proc->pages[i], &new_ptentry, sizeof(task_ptentry_t));
-			break;
+		if (region + __4MB <= first){
+			// still completely in the heap
+			continue;
+		}
+		if (region >= new_break || new_break == proc->heap.start){
+			// delete this region in phys, page dir, proc pages
+			task_pgtab_release(proc, region);
+			task_pages_remove(proc, i);
+		} else {
+			task_pgtab_free(proc, first, region + __4MB);
 		}
-		// check for loop fail
-	 	if (i>=proc->page_limit){
-	 		// guess no space left in pages ha, remember to deallocate
-	 		page_alloc_free_4MB(ret_alloc);
-	 		errno = ENOMEM;
-	 		return -1;
-	 	}
-	 	// well everything went well
-		page_dir_add_4MB_entry(new_ptentry.vaddr, new_ptentry.paddr, new_ptentry.pt_flags);
-		// update every data
-		// add to the start of new 4MB page
-		proc->heap.prog_break = new_ptentry.vaddr + __4MB;
-		page_flush_tlb();
 	}
-	// now there's something less than 4MB left
-	proc->heap.prog_break = (uint32_t)paddr;
+	proc->heap.prog_break = new_break;
+	page_flush_tlb_range(first, old_break);
 	return 0;
 }
 
-/*void syscall_brk_abort(void* prev_prog_break){
-	task_t* proc = task_list + task_current_pid();
-	// deallocate 4MB pages from previous breakpoint to current pb
-	while ((proc->heap.prog_break - prev_prog_break)/(__4MB)){
-		page_alloc_free_4MB(prev_prog_break + __4MB);
-		page_dir_delete_entry()
-		prev_prog_break += __4MB;
-	}
-}*/
-
 int syscall_sbrk(int increment, int b, int c){
 	task_t* proc = task_list + task_current_pid();
 	//task_t* proc = task_list;				// FOR TEST
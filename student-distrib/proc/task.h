@@ -12,6 +12,8 @@
 #include "../boot/page_table.h"
 #include "../boot/syscall.h"
 #include "../boot/idt_int.h"
+#include "wait_queue.h"
+#include "../timer.h"
 
 #include "../../libc/include/signal.h"
 
@@ -25,9 +27,19 @@
 #define TASK_MAX_OPEN_FILES	16		///< Per-process limit of concurrent open files
 
 #define TASK_PTENT_CPONWR	0x1		///< Current page is copy-on-write
+#define TASK_PTENT_PGTAB	0x2		///< 4MB region mapped by a page table, frames are tracked per 4KB page
+#define TASK_PTENT_DEMAND	0x4		///< Region is backed by zeroed frames on first touch
+#define TASK_PTENT_MMAP		0x8		///< Region holds `mmap` mappings, see proc/mman.h
+#define TASK_PTENT_HEAP		0x10	///< Region was reserved by `brk` for the heap
 
 #define TASK_MAX_HEAP		0x2800000	///< max heap size a process is allowed to allocate
 
+#define TASK_PTENT_CACHE_LIMIT	32	///< `pages` arrays up to this size come from a dedicated cache
+
+#define TASK_KSTACK_BASE	0x800000	///< Virtual address of the kernel stack slots, 8-12MB
+#define TASK_KSTACK_SIZE	0x4000		///< Size of a kernel stack, stacks are aligned to it
+#define TASK_KSTACK_SLOT	0x8000		///< Stride of the slots, the lower half is an unmapped guard
+
 /**
  *	A mapped memory page in a process's mapped page table
  */
@@ -55,17 +67,37 @@ typedef struct s_task {
 	uint8_t tty; 		///< Attached tty number
 	pid_t pid;			///< current process id
 	pid_t parent;		///< parent process id
+	struct s_task *rq_next;	///< Next task in the run queue, NULL if not queued
+	struct s_task *rq_prev;	///< Previous task in the run queue
+	uint8_t rq_level;		///< Run queue level, 0 is the highest priority
+	int8_t nice;			///< Nice value, from -20 to 19
+	uint32_t rq_ticks;		///< Timer ticks used at the current level
+	struct s_wait_queue *wq;	///< Wait queue the task sleeps on, NULL if none
+	struct s_task *wq_next;		///< Next task sleeping on `wq`
+	uint32_t kctx_esp;		///< Kernel stack pointer while blocked in the kernel, or 0
+	wait_queue_t child_wait;	///< Woken up when a child exits or stops
+	ktimer_t sleep_timer;		///< Fires when `usleep` is over
+	wait_queue_t sleep_wait;	///< Woken up by `sleep_timer`
+	void (*kthread_func)(uint32_t data);	///< Function of a kernel thread, NULL for processes
+	uint32_t kthread_data;		///< Argument of `kthread_func`
 
 	regs_t regs;		///< Registers stored for current process
 
 	file_t *files[TASK_MAX_OPEN_FILES]; ///< File descriptor pool
 
+	page_directory_t *pd;	///< Page directory of the address space
 	task_ptentry_t *pages;	///< Mapped pages
 	int	page_limit;			///< Size of `pages`
 	uint32_t vidmap;		///< for the damn video map
 	uint32_t vidpage_index;	///< for the damn video map
 
+	struct s_task_mmap *mmaps;	///< Memory mappings, sorted by address
+
+	uint32_t cow_shared;	///< 4KB pages shared with the parent at fork
+	uint32_t cow_copied;	///< 4KB pages copied on write
+
 	uint32_t 	ks_esp;	///< Kernel Stack pointer
+	struct s_fpu_state *fpu;	///< FPU/SSE registers, NULL until the task uses them
 	struct s_heap_desc heap; 	///< heap descriptor
 
 	struct sigaction sigacts[SIG_MAX]; ///< Signal handlers
@@ -98,6 +130,83 @@ pid_t task_current_pid();
  */
 void task_create_kernel_pid();
 
+/**
+ *	Allocate and map a kernel stack
+ *
+ *	@param pid: what `task_current_pid` returns on the stack
+ *	@return the initial stack pointer, or -ENOMEM
+ */
+int task_kstack_alloc(pid_t pid);
+
+/**
+ *	Allocate a zeroed `pages` array for a process
+ *
+ *	Small arrays are rounded up to `TASK_PTENT_CACHE_LIMIT` entries and taken
+ *	from a dedicated cache. The array can be released with `kfree`.
+ *
+ *	@param limit: pointer to the requested number of entries. Updated to the
+ *				  actual size of the array.
+ *	@return the array, or NULL if out of memory
+ */
+task_ptentry_t *task_pages_alloc(int *limit);
+
+/**
+ *	Make room for new entries in the `pages` array of a process
+ *
+ *	The array is reallocated if it has fewer than `n` unused entries.
+ *
+ *	@param proc: the process
+ *	@param n: number of entries needed
+ *	@return index of the first unused entry, or -ENOMEM
+ */
+int task_pages_reserve(task_t *proc, int n);
+
+/**
+ *	Find the `pages` entry starting at a virtual address
+ *
+ *	@param proc: the process
+ *	@param vaddr: virtual address of the region
+ *	@return index of the entry, or -1 if not found
+ */
+int task_pages_find(task_t *proc, uint32_t vaddr);
+
+/**
+ *	Remove an entry from `pages`, keeping the used entries contiguous
+ *
+ *	@param proc: the process
+ *	@param i: index of the entry
+ */
+void task_pages_remove(task_t *proc, int i);
+
+/**
+ *	Release the frames mapped in [start, end) of a page table mapped region
+ *
+ *	@param proc: the process
+ *	@param start: start of the range
+ *	@param end: end of the range
+ *	@note the range must be inside a single 4MB region
+ */
+void task_pgtab_free(task_t *proc, uint32_t start, uint32_t end);
+
+/**
+ *	Release the frames of a page table mapped region and its page table
+ *
+ *	@param proc: the process
+ *	@param vaddr: virtual address of the 4MB region
+ */
+void task_pgtab_release(task_t *proc, uint32_t vaddr);
+
+/**
+ *	Count the resident user pages of a process
+ *
+ *	@param proc: the process
+ *	@param shared: filled with the number of resident pages whose frame is
+ *				   also referenced elsewhere (copy-on-write, page cache,
+ *				   shared mappings or the zero page)
+ *	@return the number of 4KB pages mapped in `pages`
+ */
+uint32_t task_resident_pages(task_t *proc, uint32_t *shared);
+
 /**
  *	Start process system
  */
@@ -124,6 +233,17 @@ int syscall_getpid(int, int, int);
  */
 int syscall_fork(int, int, int);
 
+/**
+ *	Fork a process, which need not be the current one
+ *
+ *	The child returns to user mode from the registers the parent saved on
+ *	its last entry in the kernel.
+ *
+ *	@param cur_task: the parent, a process and not a kernel thread
+ *	@return The new pid on success, or the negative of an errno on failure
+ */
+int task_fork(task_t *cur_task);
+
 /**
  *	Execute a new file with the current process
  *
@@ -164,7 +284,10 @@ int syscall_waitpid(int pid, int statusp, int options);
  *	@param b: placeholder
  *	@param c: placeholder
  *	@return 0 on success, -1 on error, specific error number stored in errno
- *	@note test passed on non-4MB-aligned start, now 64MB at max, limited by pages number in task_t
+ *	@note the heap is only reserved here, frames are allocated by the page
+ *		  fault handler on first touch and released when the break shrinks
+ *	@note the heap is at most `TASK_MAX_HEAP` bytes, and fails with ENOMEM rather
+ *		  than grow over a region it did not reserve itself
  */
 int syscall_brk(int paddr, int b, int c);
 
@@ -176,7 +299,7 @@ int syscall_brk(int paddr, int b, int c);
  *	@param c: placeholder
  *	@return the address of previous program break, (void*)-1 on error,
  *		specific error number stored in errno
- *	@note test passed on non-4MB-aligned start, now 64MB at max, limited by pages number in task_t
+ *	@note same limits as `syscall_brk`
  */
 int syscall_sbrk(int increment, int b, int c);
 
@@ -304,14 +427,15 @@ int task_user_pushl(uint32_t *esp, uint32_t val);
 int task_access_memory(uint32_t addr);
 
 /**
- *	Perform copy-on-write if applicable on page fault
+ *	Perform copy-on-write or demand allocation if applicable on page fault
  *
  *	@param addr: the faulting address
+ *	@param write: non-zero if the fault was caused by a write
  *	@return 0 if the page fault is resolved and the caller should resume the
  *			  process, or non-zero if the page fault is not on a copy-on-write
- *			  page and the process should indeed be sent a SIGSEGV
+ *			  or demand-zero page and the process should indeed be sent a SIGSEGV
  */
-int task_pf_copy_on_write(uint32_t addr);
+int task_pf_copy_on_write(uint32_t addr, int write);
 
 /**
  *	Initialize the initd process
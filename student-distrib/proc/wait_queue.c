@@ -0,0 +1,69 @@
+#include "wait_queue.h"
+
+#include "task.h"
+#include "scheduler.h"
+#include "signal.h"
+#include "../errno.h"
+
+/**
+ *	Take a task off the wait queue it sleeps on
+ */
+static void wait_queue_remove(task_t *proc) {
+	task_t **link;
+
+	if (!proc->wq) {
+		return;
+	}
+	for (link = &proc->wq->head; *link; link = &(*link)->wq_next) {
+		if (*link == proc) {
+			*link = proc->wq_next;
+			break;
+		}
+	}
+	proc->wq = NULL;
+	proc->wq_next = NULL;
+}
+
+int wait_queue_wait(wait_queue_t *wq) {
+	task_t *proc = task_list + task_current_pid();
+
+	if (!signal_pending(proc)) {
+		proc->wq = wq;
+		proc->wq_next = wq->head;
+		wq->head = proc;
+		proc->status = TASK_ST_SLEEP;
+		scheduler_update(proc);
+		scheduler_block(&proc->kctx_esp);
+
+		// Woken up by `wake_up` or by a signal
+		wait_queue_remove(proc);
+		proc->status = TASK_ST_RUNNING;
+		scheduler_update(proc);
+	}
+	// Ignored signals, such as SIGCHLD by default, do not interrupt the wait
+	return signal_pending(proc) ? -EINTR : 0;
+}
+
+void wait_queue_sleep(wait_queue_t *wq) {
+	if (wait_queue_wait(wq) != 0) {
+		// Give up the system call. The scheduler handles the signal from the
+		// registers saved on entry, and restarts the call if asked to.
+		scheduler_event();
+	}
+}
+
+void wake_up(wait_queue_t *wq) {
+	task_t *proc;
+
+	while ((proc = wq->head)) {
+		wq->head = proc->wq_next;
+		proc->wq = NULL;
+		proc->wq_next = NULL;
+		proc->status = TASK_ST_RUNNING;
+		scheduler_update(proc);
+	}
+}
+
+int wait_queue_active(wait_queue_t *wq) {
+	return wq->head != NULL;
+}
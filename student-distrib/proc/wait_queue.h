@@ -0,0 +1,80 @@
+/**
+ *	@file proc/wait_queue.h
+ *
+ *	Wait queues, to block a task in the kernel until an event happens
+ *
+ *	A task waiting on a queue sleeps with its kernel context saved, and
+ *	continues where it stopped when another task or an interrupt handler
+ *	wakes the queue up. Any number of tasks may wait on the same queue. A
+ *	signal the task neither blocks nor ignores also wakes it up: the system
+ *	call is then abandoned, and restarted after the signal is handled like
+ *	those blocked with `sigsuspend`.
+ *
+ *	A zero-filled `wait_queue_t` is an empty queue.
+ */
+#ifndef PROC_WAIT_QUEUE_H
+#define PROC_WAIT_QUEUE_H
+
+#include "../types.h"
+
+struct s_task;
+
+/**
+ *	Tasks sleeping until an event
+ */
+typedef struct s_wait_queue {
+	struct s_task *head;	///< First sleeping task, linked by `wq_next`
+} wait_queue_t;
+
+/**
+ *	Sleep until `cond` is true
+ *
+ *	@param wq: the wait queue woken up when `cond` may have changed
+ *	@param cond: the condition, evaluated again after each wakeup
+ */
+#define wait_event(wq, cond)			\
+	do {								\
+		while (!(cond)) {				\
+			wait_queue_sleep(wq);		\
+		}								\
+	} while (0)
+
+/**
+ *	Sleep on a wait queue until it is woken up
+ *
+ *	Callers should use `wait_event`, wakeups may be spurious.
+ *
+ *	@param wq: the wait queue
+ *	@note does not return if a signal arrives, see the file description
+ */
+void wait_queue_sleep(wait_queue_t *wq);
+
+/**
+ *	Sleep on a wait queue until it is woken up or a signal arrives
+ *
+ *	For system calls that return -EINTR when interrupted, rather than being
+ *	restarted. Wakeups may be spurious.
+ *
+ *	@param wq: the wait queue
+ *	@return 0 if woken up, -EINTR if a signal is pending
+ */
+int wait_queue_wait(wait_queue_t *wq);
+
+/**
+ *	Wake up all tasks sleeping on a wait queue
+ *
+ *	May be called from interrupt handlers.
+ *
+ *	@param wq: the wait queue
+ */
+void wake_up(wait_queue_t *wq);
+
+/**
+ *	Check whether tasks are sleeping on a wait queue
+ *
+ *	@param wq: the wait queue
+ *	@return 1 if a task sleeps on it, 0 otherwise
+ */
+int wait_queue_active(wait_queue_t *wq);
+
+#endif
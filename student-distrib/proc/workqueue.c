@@ -0,0 +1,93 @@
+#include "workqueue.h"
+
+#include "kthread.h"
+#include "../lib.h"
+
+workqueue_t system_wq;
+
+/**
+ *	Body of the worker thread of a queue
+ *
+ *	@param data: the `workqueue_t`
+ */
+static void workqueue_worker(uint32_t data) {
+	workqueue_t *wq = (workqueue_t *)data;
+	work_t *work;
+
+	while (1) {
+		wait_event(&wq->wait, wq->head != NULL);
+		work = wq->head;
+		wq->head = work->next;
+		if (!wq->head) {
+			wq->tail = NULL;
+		}
+		// Not pending any more, the function may queue it again
+		work->next = NULL;
+		work->wq = NULL;
+		(*work->func)(work);
+	}
+}
+
+void workqueue_init() {
+	if (workqueue_create(&system_wq, WORKQUEUE_SYSTEM_NICE) != 0) {
+		printf("[CRITICAL] CANNOT START THE SYSTEM WORK QUEUE!\n");
+	}
+}
+
+int workqueue_create(workqueue_t *wq, int nice) {
+	int pid;
+
+	wq->head = wq->tail = NULL;
+	wq->wait.head = NULL;
+	pid = kthread_create(&workqueue_worker, (uint32_t)wq, nice);
+	if (pid < 0) {
+		return pid;
+	}
+	wq->worker = pid;
+	return 0;
+}
+
+int queue_work(workqueue_t *wq, work_t *work) {
+	if (work->wq) {
+		return 0;
+	}
+	work->wq = wq;
+	work->next = NULL;
+	if (wq->tail) {
+		wq->tail->next = work;
+	} else {
+		wq->head = work;
+	}
+	wq->tail = work;
+	wake_up(&wq->wait);
+	return 1;
+}
+
+int schedule_work(work_t *work) {
+	return queue_work(&system_wq, work);
+}
+
+int cancel_work(work_t *work) {
+	workqueue_t *wq = work->wq;
+	work_t **link, *prev = NULL;
+
+	if (!wq) {
+		return 0;
+	}
+	for (link = &wq->head; *link; prev = *link, link = &(*link)->next) {
+		if (*link == work) {
+			*link = work->next;
+			if (wq->tail == work) {
+				wq->tail = prev;
+			}
+			break;
+		}
+	}
+	work->next = NULL;
+	work->wq = NULL;
+	return 1;
+}
+
+int work_pending(work_t *work) {
+	return work->wq != NULL;
+}
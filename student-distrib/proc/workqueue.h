@@ -0,0 +1,102 @@
+/**
+ *	@file proc/workqueue.h
+ *
+ *	Work queues, to defer work from interrupt handlers and system calls to a
+ *	kernel thread
+ *
+ *	Each queue has a worker kernel thread (proc/kthread.h), which runs the
+ *	queued work items one at a time, in the order they were queued. Items
+ *	run in a task of their own, so they may sleep, e.g. on a wait queue or in
+ *	`timer_sleep`, which only delays the items queued after them. An item is
+ *	queued at most once: queueing it again while it is pending does nothing,
+ *	but its function may queue it again.
+ *
+ *	Drivers share `system_wq`, whose worker runs at the highest priority, as
+ *	the interrupt handlers it takes work from would.
+ *
+ *	A zero-filled `work_t` is not pending.
+ */
+#ifndef PROC_WORKQUEUE_H
+#define PROC_WORKQUEUE_H
+
+#include "../types.h"
+#include "wait_queue.h"
+
+#define WORKQUEUE_SYSTEM_NICE	(-20)	///< Nice value of the worker of `system_wq`
+
+struct s_workqueue;
+
+/**
+ *	A work item
+ */
+typedef struct s_work {
+	void (*func)(struct s_work *work);	///< Called by the worker
+	uint32_t data;				///< Free for the owner of the item
+	struct s_work *next;		///< Next item in the queue
+	struct s_workqueue *wq;		///< Queue it is pending on, NULL if not pending
+} work_t;
+
+/**
+ *	A queue of work items and its worker
+ */
+typedef struct s_workqueue {
+	work_t *head;		///< Next item to run
+	work_t *tail;		///< Item queued last
+	wait_queue_t wait;	///< The worker sleeps there while the queue is empty
+	pid_t worker;		///< Pid of the worker thread
+} workqueue_t;
+
+/// Queue shared by the drivers
+extern workqueue_t system_wq;
+
+/**
+ *	Start `system_wq`
+ *
+ *	@note the kernel task must exist, see `task_create_kernel_pid`
+ */
+void workqueue_init();
+
+/**
+ *	Start the worker of a queue
+ *
+ *	@param wq: the queue, initialized by the call
+ *	@param nice: nice value of the worker
+ *	@return 0 on success, or the negative of an errno from `kthread_create`
+ */
+int workqueue_create(workqueue_t *wq, int nice);
+
+/**
+ *	Queue a work item, unless it is already pending
+ *
+ *	@param wq: the queue
+ *	@param work: the item, `func` and `data` set
+ *	@return 1 if queued, 0 if it was already pending
+ */
+int queue_work(workqueue_t *wq, work_t *work);
+
+/**
+ *	Queue a work item on `system_wq`, unless it is already pending
+ *
+ *	@param work: the item, `func` and `data` set
+ *	@return 1 if queued, 0 if it was already pending
+ */
+int schedule_work(work_t *work);
+
+/**
+ *	Remove a pending work item from its queue
+ *
+ *	@param work: the item
+ *	@return 1 if it was pending, 0 otherwise
+ *	@note an item already running is not waited for
+ */
+int cancel_work(work_t *work);
+
+/**
+ *	Check whether a work item is queued and has not started yet
+ *
+ *	@param work: the item
+ *	@return 1 if pending, 0 otherwise
+ */
+int work_pending(work_t *work);
+
+#endif
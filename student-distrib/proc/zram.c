@@ -0,0 +1,268 @@
+#include "zram.h"
+
+#include "../lib.h"
+#include "../errno.h"
+#include "../k_mem/kmalloc.h"
+
+#define ZRAM_PAGE	(4<<10)
+#define ZRAM_NO_POS	0xFFFF
+
+static zram_page_t zram_pages[ZRAM_MAX_PAGES];
+static uint32_t zram_hint = 0;		// where to start looking for a free handle
+
+static uint16_t zram_hash[1 << ZRAM_HASH_BITS];	// last position of each hashed word
+static uint8_t zram_buf[ZRAM_MAX_LEN];			// compression output
+
+static zram_stats_t zram_stats;
+
+static inline uint32_t zram_read32(const uint8_t *p) {
+	return *(const uint32_t *)p;
+}
+
+/**
+ *	Append a length extension: 255 for every full 255, then the rest
+ */
+static inline uint8_t *zram_put_len(uint8_t *op, int len) {
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/**
+ *	Append a sequence: token, literals, and the match unless `mlen` is 0
+ *
+ *	@return the new end of the output, or NULL if it would pass `end`
+ */
+static uint8_t *zram_put_seq(uint8_t *op, uint8_t *end, const uint8_t *lit, int nlit,
+							 int offset, int mlen) {
+	uint8_t *token;
+
+	// token, two length extensions, literals and offset
+	if (op + 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1 > end) {
+		return NULL;
+	}
+	token = op++;
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15) {
+		op = zram_put_len(op, nlit - 15);
+	}
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen) {
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+		mlen -= ZRAM_MIN_MATCH;
+		*token |= mlen < 15 ? mlen : 15;
+		if (mlen >= 15) {
+			op = zram_put_len(op, mlen - 15);
+		}
+	}
+	return op;
+}
+
+int zram_compress(const uint8_t *src, uint8_t *dst, int max) {
+	uint8_t *op = dst, *end = dst + max;
+	int ip = 0, anchor = 0, ref, len;
+	uint32_t h;
+
+	memset(zram_hash, 0xFF, sizeof(zram_hash));
+	while (ip + ZRAM_MIN_MATCH <= ZRAM_PAGE) {
+		h = (zram_read32(src + ip) * 2654435761U) >> (32 - ZRAM_HASH_BITS);
+		ref = zram_hash[h];
+		zram_hash[h] = ip;
+		if (ref == ZRAM_NO_POS || zram_read32(src + ref) != zram_read32(src + ip)) {
+			ip++;
+			continue;
+		}
+		for (len = ZRAM_MIN_MATCH; ip + len < ZRAM_PAGE && src[ref + len] == src[ip + len];
+			 len++);
+		op = zram_put_seq(op, end, src + anchor, ip - anchor, ip - ref, len);
+		if (!op) {
+			return 0;
+		}
+		ip += len;
+		anchor = ip;
+	}
+	// The last sequence holds only literals
+	op = zram_put_seq(op, end, src + anchor, ZRAM_PAGE - anchor, 0, 0);
+	return op ? op - dst : 0;
+}
+
+/**
+ *	Read a length extension
+ *
+ *	@return the extension, or -1 if it runs past `end`
+ */
+static int zram_get_len(const uint8_t **ip, const uint8_t *end) {
+	int len = 0;
+
+	do {
+		if (*ip >= end) {
+			return -1;
+		}
+		len += **ip;
+	} while (*(*ip)++ == 255);
+	return len;
+}
+
+int zram_decompress(const uint8_t *src, int len, uint8_t *dst) {
+	const uint8_t *ip = src, *end = src + len;
+	int op = 0, nlit, mlen, offset, ext;
+
+	while (ip < end) {
+		nlit = *ip >> 4;
+		mlen = *ip++ & 0xF;
+		if (nlit == 15) {
+			if ((ext = zram_get_len(&ip, end)) < 0) {
+				return -EINVAL;
+			}
+			nlit += ext;
+		}
+		if (ip + nlit > end || op + nlit > ZRAM_PAGE) {
+			return -EINVAL;
+		}
+		memcpy(dst + op, ip, nlit);
+		ip += nlit;
+		op += nlit;
+		if (ip == end) {
+			break;
+		}
+		if (ip + 2 > end) {
+			return -EINVAL;
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (mlen == 15) {
+			if ((ext = zram_get_len(&ip, end)) < 0) {
+				return -EINVAL;
+			}
+			mlen += ext;
+		}
+		mlen += ZRAM_MIN_MATCH;
+		if (!offset || offset > op || op + mlen > ZRAM_PAGE) {
+			return -EINVAL;
+		}
+		// Byte by byte, matches may overlap their own output
+		for (; mlen > 0; mlen--, op++) {
+			dst[op] = dst[op - offset];
+		}
+	}
+	return op == ZRAM_PAGE ? 0 : -EINVAL;
+}
+
+/**
+ *	Check whether a page holds only zeros
+ */
+static int zram_page_is_zero(const uint8_t *page) {
+	const uint32_t *word = (const uint32_t *)page;
+	int i;
+
+	for (i = 0; i < ZRAM_PAGE / 4; i++) {
+		if (word[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int zram_store(uint32_t paddr) {
+	uint8_t *page;
+	void *data = NULL;
+	uint32_t i, handle;
+	int len = 0;
+
+	for (i = 0; i < ZRAM_MAX_PAGES; i++) {
+		handle = (zram_hint + i) % ZRAM_MAX_PAGES;
+		if (!zram_pages[handle].count) {
+			break;
+		}
+	}
+	if (i == ZRAM_MAX_PAGES) {
+		return -ENOSPC;
+	}
+
+	page = kmem_map_frame(paddr);
+	if (!page) {
+		return -ENOMEM;
+	}
+	if (!zram_page_is_zero(page)) {
+		len = zram_compress(page, zram_buf, ZRAM_MAX_LEN);
+		if (!len) {
+			kmem_unmap_frame(page);
+			zram_stats.rejected++;
+			return -E2BIG;
+		}
+		data = kmalloc(len);
+		if (!data) {
+			kmem_unmap_frame(page);
+			return -ENOMEM;
+		}
+		memcpy(data, zram_buf, len);
+	}
+	kmem_unmap_frame(page);
+
+	zram_pages[handle].data = data;
+	zram_pages[handle].len = len;
+	zram_pages[handle].count = 1;
+	zram_hint = handle + 1;
+	zram_stats.pages++;
+	zram_stats.stores++;
+	zram_stats.compr_bytes += len;
+	if (!data) {
+		zram_stats.zero_pages++;
+	}
+	return handle;
+}
+
+int zram_load(uint32_t handle, uint32_t paddr) {
+	zram_page_t *zpage = zram_pages + handle;
+	uint8_t *page;
+	int ret = 0;
+
+	if (handle >= ZRAM_MAX_PAGES || !zpage->count) {
+		return -EINVAL;
+	}
+	page = kmem_map_frame(paddr);
+	if (!page) {
+		return -ENOMEM;
+	}
+	if (zpage->data) {
+		ret = zram_decompress(zpage->data, zpage->len, page);
+	} else {
+		memset(page, 0, ZRAM_PAGE);
+	}
+	kmem_unmap_frame(page);
+	zram_stats.loads++;
+	return ret;
+}
+
+void zram_dup(uint32_t handle) {
+	if (handle < ZRAM_MAX_PAGES && zram_pages[handle].count) {
+		zram_pages[handle].count++;
+	}
+}
+
+void zram_release(uint32_t handle) {
+	zram_page_t *zpage = zram_pages + handle;
+
+	if (handle >= ZRAM_MAX_PAGES || !zpage->count || --zpage->count) {
+		return;
+	}
+	if (zpage->data) {
+		kfree(zpage->data);
+	} else {
+		zram_stats.zero_pages--;
+	}
+	zram_stats.pages--;
+	zram_stats.compr_bytes -= zpage->len;
+	zpage->data = NULL;
+	zpage->len = 0;
+}
+
+void zram_get_stats(zram_stats_t *stats) {
+	if (stats) {
+		memcpy(stats, &zram_stats, sizeof(zram_stats_t));
+	}
+}
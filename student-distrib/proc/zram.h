@@ -0,0 +1,102 @@
+/**
+ *	@file proc/zram.h
+ *
+ *	Compressed in-memory store for swapped out pages
+ *
+ *	Pages evicted by the swap clock are first compressed with a small LZ77
+ *	codec (LZ4-like byte oriented sequences of literals and matches) and
+ *	kept in kmalloc memory. Pages that compress worse than `ZRAM_MAX_LEN`
+ *	bytes are left to the swap device. Pages of zeros take no memory.
+ */
+#ifndef PROC_ZRAM_H
+#define PROC_ZRAM_H
+
+#include "../types.h"
+
+#define ZRAM_MAX_PAGES	16384	///< Most pages held at once
+#define ZRAM_MAX_LEN	2048	///< Largest compressed page kept
+#define ZRAM_HASH_BITS	12		///< log2 of the size of the match finder table
+#define ZRAM_MIN_MATCH	4		///< Shortest match encoded
+
+/**
+ *	A compressed page
+ */
+typedef struct s_zram_page {
+	void *data;		///< Compressed data, NULL for a page of zeros
+	uint16_t len;	///< Length of the compressed data
+	uint16_t count;	///< References from page table entries, 0 if unused
+} zram_page_t;
+
+/**
+ *	zram counters
+ */
+typedef struct s_zram_stats {
+	uint32_t pages;			///< Pages held
+	uint32_t zero_pages;	///< Pages of zeros held, without data
+	uint32_t compr_bytes;	///< Bytes of compressed data held
+	uint32_t stores;		///< Pages compressed and stored
+	uint32_t loads;			///< Pages decompressed
+	uint32_t rejected;		///< Pages that did not compress well enough
+} zram_stats_t;
+
+/**
+ *	Compress a frame into the store
+ *
+ *	@param paddr: physical address of the frame
+ *	@return the handle of the stored page, or the negative of an errno: -E2BIG
+ *			if the page does not compress well, -ENOSPC or -ENOMEM if the
+ *			store is full
+ */
+int zram_store(uint32_t paddr);
+
+/**
+ *	Decompress a stored page into a frame
+ *
+ *	@param handle: the handle returned by `zram_store`
+ *	@param paddr: physical address of the frame to fill
+ *	@return 0 on success, or -EINVAL if the handle or its data is invalid
+ */
+int zram_load(uint32_t handle, uint32_t paddr);
+
+/**
+ *	Add a reference to a stored page
+ *
+ *	@param handle: the handle of the page
+ */
+void zram_dup(uint32_t handle);
+
+/**
+ *	Drop a reference to a stored page, freeing it on the last one
+ *
+ *	@param handle: the handle of the page
+ */
+void zram_release(uint32_t handle);
+
+/**
+ *	Compress a 4KB page
+ *
+ *	@param src: the page
+ *	@param dst: buffer for the compressed data
+ *	@param max: size of `dst`
+ *	@return the compressed length, or 0 if it does not fit in `max` bytes
+ */
+int zram_compress(const uint8_t *src, uint8_t *dst, int max);
+
+/**
+ *	Decompress a 4KB page
+ *
+ *	@param src: the compressed data
+ *	@param len: length of the compressed data
+ *	@param dst: the page to fill
+ *	@return 0 on success, or -EINVAL if the data is corrupt
+ */
+int zram_decompress(const uint8_t *src, int len, uint8_t *dst);
+
+/**
+ *	Get a snapshot of the zram counters
+ *
+ *	@param stats: buffer to fill
+ */
+void zram_get_stats(zram_stats_t *stats);
+
+#endif
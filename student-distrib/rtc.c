@@ -20,8 +20,19 @@ volatile int previous_enter = -1;
 #define RTC_MAX_OPEN 	256		/* max open file of rtc */
 #define ALRM_MAX_TIMER 	999999
 
+#define CMOS_SECONDS	0x00	/* CMOS clock registers */
+#define CMOS_MINUTES	0x02
+#define CMOS_HOURS		0x04
+#define CMOS_DAY		0x07
+#define CMOS_MONTH		0x08
+#define CMOS_YEAR		0x09
+#define CMOS_FIELDS		6		/* registers read above */
+#define REG_A_UIP		0x80	/* register A, update in progress */
+#define REG_B_24H		0x02	/* register B, hours in 24-hour format */
+#define REG_B_BINARY	0x04	/* register B, values in binary, not BCD */
+#define CMOS_HOURS_PM	0x80	/* PM flag of the 12-hour format */
+
 static rtc_file_t rtc_file_table[RTC_MAX_OPEN];
-pid_t rtc_pid_waiting[RTC_MAX_OPEN];
 static file_operations_t rtc_out_op;
 
 int rtc_out_driver_register() {
@@ -41,8 +52,7 @@ int rtc_out_driver_register() {
         rtc_file_table[i].rtc_sleep = -1;
         rtc_file_table[i].timer.it_value = 0;
         rtc_file_table[i].timer.it_interval = 0;
-        rtc_pid_waiting[i] = -1;
-        // rtc_pid_waiting[RTC_MAX_OPEN] = -1;
+        rtc_file_table[i].rtc_wait.head = NULL;
 	}
 
 	return (devfs_register_driver("rtc", &rtc_out_op));
@@ -66,22 +76,6 @@ void rtc_handler(){
 	/* sends eoi */
 	int iter; // iterator
     rtc_count_prev = rtc_count;
-    // Update count and alrm timer
-    for(iter = 0; iter < rtc_openfile+1; iter++) {
-	    if (rtc_count != rtc_count_prev && rtc_count % RTC_MAX_FREQ == 0) {
-	    	if (rtc_file_table[iter].timer.it_value < 0) {
-	    		rtc_file_table[iter].timer.it_value = 0;
-	    		rtc_file_table[iter].timer.it_interval = 0;
-	    		break;
-	    	}
-
-	    	if(rtc_file_table[iter].timer.it_value-- == 0) {
-	    		rtc_file_table[iter].timer.it_value = rtc_file_table[iter].timer.it_interval;
-	    		rtc_file_table[iter].timer.it_interval = 0;
-	    		syscall_kill(rtc_file_table[iter].rtc_pid, SIGALRM, 0);
-	    	}
-	    }
-	}
 	rtc_count++;
 
     // if ((rtc_count != rtc_count_prev) &&
@@ -98,8 +92,8 @@ void rtc_handler(){
     		if ((rtc_file_table[iter].rtc_freq != 0) &&
     			((rtc_count & (rtc_file_table[iter].rtc_freq-1)) == 0) &&
     			(rtc_file_table[iter].rtc_sleep == 1)) {
-    			syscall_kill(rtc_file_table[iter].rtc_pid, SIGIO, 0);
     			rtc_file_table[iter].rtc_sleep = 0;
+    			wake_up(&rtc_file_table[iter].rtc_wait);
     		}
     	}
     }
@@ -122,6 +116,78 @@ void test_rtc_handler() {
 	inb(CMOS_PORT);
 }
 
+/**
+ *	Read a CMOS register, with NMI disabled
+ */
+static uint8_t rtc_cmos_read(uint8_t reg) {
+	outb(reg | 0x80, RTC_PORT);
+	return inb(CMOS_PORT);
+}
+
+/**
+ *	Read the date and time registers, once no update is in progress
+ */
+static void rtc_cmos_read_fields(uint8_t *fields) {
+	static const uint8_t regs[CMOS_FIELDS] = {
+		CMOS_SECONDS, CMOS_MINUTES, CMOS_HOURS, CMOS_DAY, CMOS_MONTH, CMOS_YEAR
+	};
+	int i;
+
+	while (rtc_cmos_read(REG_A) & REG_A_UIP);
+	for (i = 0; i < CMOS_FIELDS; i++) {
+		fields[i] = rtc_cmos_read(regs[i]);
+	}
+}
+
+static uint32_t rtc_bcd(uint8_t value) {
+	return (value & 0x0F) + (value >> 4) * 10;
+}
+
+uint32_t rtc_cmos_time() {
+	uint8_t now[CMOS_FIELDS], prev[CMOS_FIELDS];
+	uint8_t status;
+	uint32_t sec, min, hour, day, month, year, pm, days, era, yoe, doy;
+	int i;
+
+	// Read until two reads agree, an update may start in between
+	rtc_cmos_read_fields(now);
+	do {
+		memcpy(prev, now, CMOS_FIELDS);
+		rtc_cmos_read_fields(now);
+	} while (memcmp(prev, now, CMOS_FIELDS));
+
+	status = rtc_cmos_read(REG_B);
+	pm = now[2] & CMOS_HOURS_PM;
+	now[2] &= ~CMOS_HOURS_PM;
+	if (!(status & REG_B_BINARY)) {
+		for (i = 0; i < CMOS_FIELDS; i++) {
+			now[i] = rtc_bcd(now[i]);
+		}
+	}
+	sec = now[0];
+	min = now[1];
+	hour = now[2];
+	day = now[3];
+	month = now[4];
+	year = now[5];
+	if (!(status & REG_B_24H)) {
+		hour = hour % 12 + (pm ? 12 : 0);
+	}
+	year += (year < 70) ? 2000 : 1900;
+
+	// Days since 1970-01-01, counting years from March so that the leap
+	// day comes last
+	if (month <= 2) {
+		year--;
+	}
+	era = year / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+
+	return ((days * 24 + hour) * 60 + min) * 60 + sec;
+}
+
 void rtc_setrate(int rate) {
 	char prev;
 
@@ -179,6 +245,7 @@ int rtc_close(inode_t* inode, file_t* file) {
 	rtc_file_table[i].rtc_sleep = -1;
 	rtc_file_table[i].timer.it_interval = 0;
 	rtc_file_table[i].timer.it_value = 0;
+	timer_cancel(&(rtc_file_table[i].alarm));
 	rtc_count = 1;
 	// rtc_openfile--;
 	return 0;
@@ -195,10 +262,6 @@ ssize_t rtc_read(file_t* file, uint8_t* buf, size_t count, off_t* offset) {
         return -EINVAL;
     }
     
-    task_sigact_t sa;
-    sigset_t ss;
-    pid_t cur_pid = task_current_pid();
-    
 /*
     int v_rtc_status;
     int v_rtc_freq;
@@ -207,33 +270,11 @@ ssize_t rtc_read(file_t* file, uint8_t* buf, size_t count, off_t* offset) {
 */
     // Code in Keyboard, needs to be change, TODO
     
-    if (rtc_file_table[i].rtc_sleep < 0) {
-        
-        // set process to sleep until SIGIO
-        
-        rtc_pid_waiting[i] = cur_pid;
-        
-        sa.handler = SIG_IGN;
-        sigemptyset(&(sa.mask)); // unmask
-        
-        sa.flags = SA_RESTART;
-
-        syscall_sigaction(SIGIO, (int)&sa, 0);
-        rtc_file_table[i].rtc_sleep = 1;
-        sigemptyset(&ss);
-        syscall_sigsuspend((int)&ss, NULL, 0);
-        return 0;
-        
-    }
-    
-    if (rtc_file_table[i].rtc_sleep == 0) {
-        rtc_file_table[i].rtc_sleep = -1;
-        return 0;
-    } 
-
-    else {
-        return 0;
-    }
+    // sleep until the next tick at this file's frequency
+    rtc_file_table[i].rtc_sleep = 1;
+    wait_event(&rtc_file_table[i].rtc_wait, rtc_file_table[i].rtc_sleep != 1);
+    rtc_file_table[i].rtc_sleep = -1;
+    return 0;
 
 }
 
@@ -273,19 +314,33 @@ int is_power_of_two(int freq) {
 	return 0;
 }
 
+/**
+ *	Alarm timer callback, signals the process and starts the next period
+ */
+static void rtc_alarm_expired(ktimer_t *timer) {
+	rtc_file_t *rtc = rtc_file_table + timer->data;
+
+	syscall_kill(rtc->rtc_pid, SIGALRM, 0);
+	rtc->timer.it_value = rtc->timer.it_interval;
+	if (rtc->timer.it_interval) {
+		timer_add(&(rtc->alarm), rtc->timer.it_interval * TIMER_HZ);
+	}
+}
+
 int getitimer(struct itimerval *value) {
 	/* sanity check */
 	if (value == NULL) {
 		return -EINVAL;
 	}
 
-	if (rtc_file_table[rtc_openfile].timer.it_value == 0) {
+	if (!timer_pending(&(rtc_file_table[rtc_openfile].alarm))) {
 		value->it_value = 0;
 		value->it_interval = 0;
 		printf("TIMER NOT SET!");
 		return 0;
 	} else {
-		value->it_value = rtc_file_table[rtc_openfile].timer.it_value;
+		value->it_value = (timer_remaining(&(rtc_file_table[rtc_openfile].alarm)) +
+						   TIMER_HZ - 1) / TIMER_HZ;
 		value->it_interval = rtc_file_table[rtc_openfile].timer.it_interval;
 		return 0;
 	}
@@ -303,15 +358,23 @@ int setitimer(struct itimerval *value, struct itimerval *old_value) {
 	}
 
 	old_value->it_interval = rtc_file_table[rtc_openfile].timer.it_interval;
-	old_value->it_interval = rtc_file_table[rtc_openfile].timer.it_value;
+	old_value->it_value = (timer_remaining(&(rtc_file_table[rtc_openfile].alarm)) +
+						   TIMER_HZ - 1) / TIMER_HZ;
 	rtc_file_table[rtc_openfile].timer.it_interval = value->it_interval;
 	rtc_file_table[rtc_openfile].timer.it_value = value->it_value;
+	if (value->it_value > 0) {
+		rtc_file_table[rtc_openfile].alarm.func = &rtc_alarm_expired;
+		rtc_file_table[rtc_openfile].alarm.data = rtc_openfile;
+		timer_add(&(rtc_file_table[rtc_openfile].alarm), value->it_value * TIMER_HZ);
+	} else {
+		timer_cancel(&(rtc_file_table[rtc_openfile].alarm));
+	}
 
 	return 0;
 
 }
 
-int nanosleep(struct itimerval *requested, struct itimerval *remain) {
+int rtc_nanosleep(struct itimerval *requested, struct itimerval *remain) {
 
 	if (requested == NULL || remain == NULL) {
 		return -EINVAL;
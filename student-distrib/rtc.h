@@ -15,6 +15,8 @@
 #include "fs/vfs.h"
 #include "fs/fs_devfs.h"
 #include "proc/scheduler.h"
+#include "proc/wait_queue.h"
+#include "timer.h"
 
 /**
  * 	Time interval datatype used to invoke alarm.
@@ -32,7 +34,9 @@ typedef struct rtc_file {
 	int rtc_freq;			///< Indicate the rtc_frequency
 	pid_t rtc_pid;			///< Indicate the rtc current pid
 	itimerval_t timer;		///< Timer struct for alarm
+	ktimer_t alarm;			///< Fires SIGALRM when `timer` expires
 	volatile int rtc_sleep;	///< Indicate if RTC is sleeping
+	wait_queue_t rtc_wait;	///< Processes sleeping until the next tick
 } rtc_file_t;
 
 /**
@@ -160,6 +164,15 @@ void test_rtc_handler();
  */
 void rtc_setrate(int rate);
 
+/**
+ *	Read the date and time kept by the CMOS clock
+ *
+ *	The CMOS clock is assumed to run in UTC, in the years 1970 to 2069.
+ *
+ *	@return the seconds since the Epoch
+ */
+uint32_t rtc_cmos_time();
+
 /**
  *	Initialize frequency to 2 Hz and enable RTC by changing rtc_status. 
  *
@@ -253,6 +266,6 @@ int syscall_setitimer(struct itimerval *value, struct itimerval *old_value);
  *			it_interval's value. it_value indicates the current count.
  *
  */
-int nanosleep(struct itimerval *requested, struct itimerval *remain);
+int rtc_nanosleep(struct itimerval *requested, struct itimerval *remain);
 
 #endif /* _RTC_H */
@@ -72,10 +72,19 @@ void _vidmap_switch(uint32_t from, uint32_t to){
 			if (proc->vidmap != 0){
 				if (proc->vidmap == from){
 					proc->vidmap = to;
-					proc->pages[proc->vidpage_index].paddr = proc->vidmap;
 				}else if (proc->vidmap == to){
 					proc->vidmap = from;
-					proc->pages[proc->vidpage_index].paddr = proc->vidmap;
+				}else{
+					continue;
+				}
+				proc->pages[proc->vidpage_index].paddr = proc->vidmap;
+				// every process maps the video memory in its own directory
+				page_dir_unmap(proc->pd, proc->pages[proc->vidpage_index].vaddr);
+				page_dir_map_4KB(proc->pd, proc->pages[proc->vidpage_index].vaddr,
+						proc->pages[proc->vidpage_index].paddr,
+						proc->pages[proc->vidpage_index].pt_flags);
+				if (proc->pd == page_dir_current()){
+					page_flush_tlb_page(proc->pages[proc->vidpage_index].vaddr);
 				}
 			}
 		}
@@ -110,7 +119,7 @@ int syscall_ece391_vidmap(int start_addr_in, int b, int c){
 		*start_addr = NULL;
 		return -1;
 	}
-	page_flush_tlb();
+	page_flush_tlb_page(VIDMAP_START);
 	*start_addr = (uint8_t*)VIDMAP_START;
 	proc->vidmap = VIDMEM_START;
 	proc->vidpage_index = i;
@@ -142,7 +151,7 @@ void* terminal_out_tty_init(){
 		errno = EFAULT;
 		return NULL;
 	}
-	page_flush_tlb();
+	page_flush_tlb_page(stdout[stdout_index].vidmem.vaddr);
 
 	video_mem = (uint8_t*)stdout[stdout_index].vidmem.vaddr;
 	terminal_out_clear();
@@ -176,7 +185,9 @@ int terminal_out_tty_switch(void* fromp, void* top){
 	if (ret) return ret;
 	ret = _page_tab_add_entry(to->vidmem.vaddr,to->vidmem.paddr,to->vidmem.pt_flags);
 	if (ret) return ret;
-	page_flush_tlb();
+	// the terminal pages are global, reloading CR3 would not drop them
+	page_flush_tlb_page(from->vidmem.vaddr);
+	page_flush_tlb_page(to->vidmem.vaddr);
 
 	terminal_set_cursor(top);
 	return 0;
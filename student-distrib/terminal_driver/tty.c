@@ -9,8 +9,17 @@ static char* argv_placeholder = NULL;
 
 tty_t* cur_tty = NULL;
 static uint8_t temp_buf[TTY_BUF_LENGTH];
+static work_t tty_switch_work[TTY_NUMBER];	// pending `tty_request_switch`, one per tty
 
-//static uint32_t keyboard_pid_waiting = 0;
+
+/**
+ *	Read the time stamp counter, low 32 bits
+ */
+static inline uint32_t tty_tsc(){
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return lo;
+}
 
 int tty_init(){
 	int i; //iterator
@@ -25,7 +34,7 @@ int tty_init(){
 		tty_list[i].indev_flag = 0;
 		tty_list[i].outdev_flag = 0;
 		tty_list[i].flags = 0;
-		tty_list[i].input_pid_waiting = 0;
+		tty_list[i].input_wait.head = NULL;
 
 		// initialize buffer
 		tty_list[i].buf.index = 0;
@@ -48,6 +57,7 @@ int tty_driver_register(){
 	tty_f_op.write = &tty_write;
 	tty_f_op.llseek = NULL;
 	tty_f_op.readdir = NULL;
+	tty_f_op.ioctl = &tty_ioctl;
 	// register tty driver
 	return devfs_register_driver("tty", &tty_f_op);
 }
@@ -56,7 +66,8 @@ int tty_switch(int to_index){
 	int from_index = get_current_tty();
 	if (tty_list[to_index].tty_status == TTY_SLEEP){
 		_single_tty_init(to_index);
-		int child_pid = _tty_start_shell();
+		// Not the current task, which may be any process or a kernel thread
+		int child_pid = _tty_start_shell(0);
 		if (child_pid < 0)	return child_pid;
 
 		tty_list[to_index].fg_proc = child_pid;
@@ -66,9 +77,27 @@ int tty_switch(int to_index){
 	return  _tty_switch(&tty_list[from_index],&tty_list[to_index]);
 }
 
-int _tty_start_shell(){
+/**
+ *	Work function of `tty_request_switch`
+ */
+static void tty_switch_work_func(work_t *work){
+	tty_switch(work->data);
+}
+
+void tty_request_switch(int to_index){
+	work_t *work = tty_switch_work + to_index;
+
+	// a pending request for the same tty already does the job
+	if (work_pending(work))
+		return;
+	work->func = &tty_switch_work_func;
+	work->data = to_index;
+	schedule_work(work);
+}
+
+int _tty_start_shell(pid_t parent){
 	// create new process of fork
-	int child_pid = syscall_fork(0,0,0);
+	int child_pid = task_fork(task_list + parent);
 	if (child_pid < 0){
 		//error condition
 		return child_pid;
@@ -158,7 +187,6 @@ void tty_send_input(uint8_t* data, uint32_t size){
 	uint32_t i;
 	uint32_t print_size = 0;
 	tty_buf_t* op_buf = &(cur_tty->buf);
-	uint32_t keyboard_pid_waiting = cur_tty->input_pid_waiting;
 	// buffer handle
 	for (i=0; i<size; ++i){
 		// accept Ctrl C even if overflowed
@@ -189,10 +217,9 @@ void tty_send_input(uint8_t* data, uint32_t size){
 			print_size ++;
 			op_buf->buf[op_buf->index] = data[i];
 			op_buf->index = (op_buf->index + 1) % TTY_BUF_LENGTH;
-			if (keyboard_pid_waiting){
-				syscall_kill(keyboard_pid_waiting, SIGIO, 0);
-				cur_tty->input_pid_waiting = 0;
-				keyboard_pid_waiting = 0;
+			if (wait_queue_active(&cur_tty->input_wait)){
+				cur_tty->input_wake_tsc = tty_tsc() | 1;
+				wake_up(&cur_tty->input_wait);
 			}
 		}else if (data[i] == 12){
 			// for clear screen, go to stdout, but don't go to buffer
@@ -218,9 +245,10 @@ void tty_send_input(uint8_t* data, uint32_t size){
 		// we don't increment index this case to block further input, but we add i
 		temp_buf[i] = '\n'; 	// temp buffer used for stdout
 		print_size++;
-		syscall_kill(keyboard_pid_waiting, SIGIO, 0);
-		cur_tty->input_pid_waiting = 0;
-		keyboard_pid_waiting = 0;
+		if (wait_queue_active(&cur_tty->input_wait)){
+			cur_tty->input_wake_tsc = tty_tsc() | 1;
+			wake_up(&cur_tty->input_wait);
+		}
 	}
 	// if echo flag is on then call write
 	if (!(cur_tty->flags & TTY_FG_ECHO)){
@@ -229,6 +257,20 @@ void tty_send_input(uint8_t* data, uint32_t size){
 	}
 }
 
+int tty_ioctl(struct s_file *file, int cmd, int arg){
+	tty_t* tty = &(tty_list[file->private_data]);
+
+	if (cmd != TTY_IOCTL_LATENCY){
+		return -ENOTTY;
+	}
+	if (task_access_memory(arg) || task_access_memory(arg + sizeof(struct tty_latency) - 1)){
+		return -EFAULT;
+	}
+	memcpy((void*)arg, &(tty->input_latency), sizeof(struct tty_latency));
+	memset(&(tty->input_latency), 0, sizeof(struct tty_latency));
+	return 0;
+}
+
 int tty_open(struct s_inode *inode, struct s_file *file){
 	// set the private data to the process's tty
 	task_t* proc = task_list + task_current_pid();
@@ -241,32 +283,44 @@ int tty_close(struct s_inode *inode, struct s_file *file){
 	return 0;
 }
 
-ssize_t tty_read(struct s_file *file, uint8_t *buf, size_t count, off_t *offset){
-	// blocking read from tty buffer
-	task_sigact_t sa;
-	sigset_t ss;
-	tty_buf_t* op_buf = &(tty_list[(task_list + task_current_pid())->tty].buf);
+/**
+ *	Check for an enter in a tty buffer, and flag it
+ *
+ *	@return 1 if a line can be read, 0 otherwise
+ */
+static int tty_buf_has_line(tty_buf_t* op_buf){
 	uint32_t i;
-	uint32_t copy_start = (op_buf->end + 1) % TTY_BUF_LENGTH;
 
-	// check for enter in the buffer
 	for (i = (op_buf->end + 1)%TTY_BUF_LENGTH; i != op_buf->index; i=(i+1)%TTY_BUF_LENGTH){
 		if (op_buf->buf[i]=='\n'){
 			op_buf->flags |= TTY_BUF_ENTER;
 			break;
 		}
 	}
+	return (op_buf->flags & TTY_BUF_ENTER) != 0;
+}
 
-	if (!(op_buf->flags &  TTY_BUF_ENTER)){
-		// No enter in buffer, set process to sleep until SIGIO
-		tty_list[(task_list + task_current_pid())->tty].input_pid_waiting = task_current_pid();
-		sa.handler = SIG_IGN;
-		sigemptyset(&(sa.mask));
-		sa.flags = SA_RESTART;
-		syscall_sigaction(SIGIO, (int)&sa, 0);
-		sigemptyset(&ss);
-		syscall_sigsuspend((int) &ss, NULL, 0);
-		return 0; // Should not hit
+ssize_t tty_read(struct s_file *file, uint8_t *buf, size_t count, off_t *offset){
+	// blocking read from tty buffer
+	tty_t* tty = &(tty_list[(task_list + task_current_pid())->tty]);
+	tty_buf_t* op_buf = &(tty->buf);
+	uint32_t i;
+	uint32_t copy_start;
+
+	// sleep until there is an enter in the buffer
+	wait_event(&tty->input_wait, tty_buf_has_line(op_buf));
+	copy_start = (op_buf->end + 1) % TTY_BUF_LENGTH;
+
+	if (tty->input_wake_tsc){
+		// Woken up by the line, account for the time it took to get here
+		i = tty_tsc() - tty->input_wake_tsc;
+		tty->input_wake_tsc = 0;
+		tty->input_latency.last = i;
+		if (i > tty->input_latency.max){
+			tty->input_latency.max = i;
+		}
+		tty->input_latency.count++;
+		tty->input_latency.total += i;
 	}
 
 	// copy until hit enter, with enter
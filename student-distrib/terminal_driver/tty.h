@@ -6,6 +6,9 @@
 #include "../proc/task.h"
 #include "../errno.h"
 #include "../proc/signal.h"
+#include "../proc/wait_queue.h"
+#include "../proc/workqueue.h"
+#include "../../libc/include/sys/ioctl.h"
 
 #define	TTY_SLEEP 			0x0 		///< tty flag, means tty is not in use
 #define TTY_ACTIVE 			0x1			///< tty flag, means tty is in use
@@ -46,7 +49,9 @@ typedef struct s_tty{
 	uint32_t 		root_proc;		///< first process born with this tty
 	struct s_tty_buffer	buf; 			///< tty buffer
 
-	uint32_t 		input_pid_waiting; 		///< pid of the process waiting for input, 0 for none
+	wait_queue_t	input_wait;				///< processes waiting for a line of input
+	uint32_t		input_wake_tsc;			///< TSC when waiting processes were woken, 0 for none
+	struct tty_latency	input_latency;		///< wakeup to read latency of waiting processes
 	void* 			input_private_data; 	///< input private data, memory allocated by input driver
 	void* 			output_private_data;	///< output private data, memory allocated by output driver
 
@@ -80,9 +85,10 @@ int tty_init();
 /**
  *	private function to fork out a process, and set it to run ece391 shell
  *
+ *	@param parent: the process to fork
  *	return the pid of forked process on success, negative error codes on error
  */
-int _tty_start_shell();
+int _tty_start_shell(pid_t parent);
 
 /**
  *	function to register tty driver to devfs, initialize file operation table
@@ -146,6 +152,19 @@ ssize_t tty_read(struct s_file *file, uint8_t *buf, size_t count, off_t *offset)
  */
 ssize_t tty_write(struct s_file *file, uint8_t *buf, size_t count, off_t *offset);
 
+/**
+ *	Ioctl function for tty
+ *
+ *	`TTY_IOCTL_LATENCY` copies the input latency statistics of the tty to the
+ *	`struct tty_latency` pointed to by `arg`, and resets them.
+ *
+ *	@param file: the tty file
+ *	@param cmd: the command
+ *	@param arg: the argument of the command
+ *	@return 0 on success, or the negative of an errno on failure
+ */
+int tty_ioctl(struct s_file *file, int cmd, int arg);
+
 /**
  *	Open function for tty
  *
@@ -179,6 +198,17 @@ uint8_t get_current_tty();
  */
 int tty_switch(int to_index);
 
+/**
+ *	Switch to another tty later, from the system work queue
+ *
+ *	For interrupt handlers: starting the shell of a new tty forks a process,
+ *	and switching copies the screen. Requests for different ttys run in the
+ *	order they were made, a repeated one is dropped while still pending.
+ *
+ *	@param to_index: the index of the tty to switch to
+ */
+void tty_request_switch(int to_index);
+
 /**
  *	private helper function to switch tty
  *
@@ -11,11 +11,21 @@
 #include "boot/page_table.h"
 
 #include "proc/task.h"
+#include "proc/scheduler.h"
+#include "proc/signal.h"
+#include "proc/wait_queue.h"
+#include "proc/workqueue.h"
+#include "timer.h"
+#include "clock.h"
 #include "boot/syscall.h"
 #include "fs/vfs.h"
 #include "fs/test.h"
+#include "fs/page_cache.h"
+#include "k_mem/kmalloc.h"
+#include "proc/zram.h"
 #include "types.h"
 #include "../libc/include/dirent.h"
+#include "../libc/include/time.h"
 
 
 static inline void assertion_failure(){
@@ -68,7 +78,10 @@ int idt_test(){
 int paging_test(){
 	TEST_HEADER;
 
-	int temp;
+	int temp, first, count, i;
+	int held[PAGE_MAX_4MB_BLOCKS];
+	uint32_t free_frames;
+	page_alloc_stats_t stats;
 	// kernel space paging test
 	temp = *(int*)(0x600000);
 	// video memory paging test
@@ -95,30 +108,37 @@ int paging_test(){
 	// if page fault, error
 	*((int*)0x08400000) = 3;
 
-	temp = 0;
+	first = temp;
 	// crazy allocation test
-	while (page_alloc_4MB(&temp) != -ENOMEM){
-		temp = 0;
+	for (count = 0; count < PAGE_MAX_4MB_BLOCKS; count++){
+		held[count] = 0;
+		if (page_alloc_4MB(held + count) == -ENOMEM){
+			break;
+		}
 	}
 
-	page_alloc_free_4MB(0x1000000);
+	page_alloc_free_4MB(first);
 
+	temp = 0;
 	if(page_alloc_4MB(&temp)){
 		printf("physical page leak\n");
 		return FAIL;
 	}
 
-	if (temp != 0x1000000){
+	if (temp != first){
 		printf("physical page leak\n");
 		return FAIL;
 	}
 
 	// well well well all test done and clean up
-	while (page_alloc_free_4MB(temp)){
-		temp += 0x400000;
+	page_alloc_get_stats(&stats);
+	free_frames = stats.free_frames;
+	for (i = 0; i < count; i++){
+		page_alloc_free_4MB(held[i]);
 	}
+	page_alloc_get_stats(&stats);
 
-	if (temp < 10000000){
+	if (stats.free_frames != free_frames + count * 1024){
 		printf("page allocation freeing failed\n");
 		return FAIL;
 	}
@@ -127,6 +147,7 @@ int paging_test(){
 		printf("page table delete entry failed\n");
 		return FAIL;
 	}
+	page_alloc_free_4MB(first);
 /*	flush test ignored
 	page_dir_add_4MB_entry(0x08800000, 0x1000000, PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_RDWR |
 							PAGE_DIR_ENT_SUPERVISOR);
@@ -143,6 +164,766 @@ int paging_test(){
 	return PASS;
 }
 
+/*
+ *	buddy_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Buddy allocator split, merge and reference counts
+ */
+int buddy_test(){
+	TEST_HEADER;
+
+	int addr[PAGE_BUDDY_ORDERS];
+	int i, ref;
+	page_alloc_stats_t before, after;
+
+	page_alloc_get_stats(&before);
+	for (i = 0; i < PAGE_BUDDY_ORDERS; i++){
+		addr[i] = page_alloc_order(i);
+		if (addr[i] < 0){
+			printf("order %d allocation failed\n", i);
+			return FAIL;
+		}
+		if (addr[i] & ((0x1000 << i) - 1)){
+			printf("order %d block misaligned\n", i);
+			return FAIL;
+		}
+	}
+	// copy-on-write style sharing
+	ref = addr[0];
+	if (page_alloc_4KB(&ref) || get_phys_mem_reference_count(addr[0]) != 2){
+		printf("reference count error\n");
+		return FAIL;
+	}
+	page_alloc_free_4KB(addr[0]);
+	if (get_phys_mem_reference_count(addr[0]) != 1){
+		printf("reference count error\n");
+		return FAIL;
+	}
+	for (i = 0; i < PAGE_BUDDY_ORDERS; i++){
+		page_alloc_free_4KB(addr[i]);
+	}
+	if (page_alloc_free_4KB(addr[0]) != -EINVAL){
+		printf("double free not detected\n");
+		return FAIL;
+	}
+	page_alloc_get_stats(&after);
+	if (after.free_frames != before.free_frames){
+		printf("frames leaked\n");
+		return FAIL;
+	}
+	for (i = 0; i < PAGE_BUDDY_ORDERS; i++){
+		if (after.nr_free[i] != before.nr_free[i]){
+			printf("order %d not merged back\n", i);
+			return FAIL;
+		}
+	}
+	return PASS;
+}
+
+/**
+ *	page_dir_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Per-process page directories sharing a physical frame
+ */
+int page_dir_test(){
+	TEST_HEADER;
+
+	page_directory_t *pd1, *pd2, *cur = page_dir_current();
+	int addr = 0;
+	int result = PASS;
+
+	pd1 = page_dir_create();
+	pd2 = page_dir_create();
+	if (!pd1 || !pd2 || page_alloc_4KB(&addr)){
+		printf("page directory creation failed\n");
+		return FAIL;
+	}
+	if (page_dir_map_4KB(pd1, 0x08400000, addr, PAGE_TAB_ENT_RDWR) ||
+		page_dir_map_4KB(pd2, 0x08800000, addr, PAGE_TAB_ENT_RDWR)){
+		printf("mapping failed\n");
+		result = FAIL;
+	}
+	if (page_dir_map_4KB(pd1, 0x08400000, addr, PAGE_TAB_ENT_RDWR) != -EEXIST){
+		printf("double mapping not detected\n");
+		result = FAIL;
+	}
+	if (result == PASS){
+		page_dir_switch(pd1);
+		*(volatile int *)0x08400000 = 391;
+		page_dir_switch(pd2);
+		if (*(volatile int *)0x08800000 != 391){
+			printf("frame not shared between directories\n");
+			result = FAIL;
+		}
+		page_dir_switch(cur);
+	}
+	if (page_dir_unmap(pd1, 0x08400000) || page_dir_unmap(pd1, 0x08400000) != -EINVAL){
+		printf("unmap error\n");
+		result = FAIL;
+	}
+	page_dir_destroy(pd1);
+	page_dir_destroy(pd2);
+	page_alloc_free_4KB(addr);
+	return result;
+}
+
+/**
+ *	page_split_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Splitting a 4MB mapping into independently counted 4KB frames
+ */
+int page_split_test(){
+	TEST_HEADER;
+
+	page_directory_t *pd;
+	page_table_entry_t *pte;
+	int addr = 0, ref, i;
+	int result = PASS;
+	page_alloc_stats_t before, after;
+
+	pd = page_dir_create();
+	page_alloc_get_stats(&before);
+	if (!pd || page_alloc_4MB(&addr)){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	page_dir_map_4MB(pd, 0x08400000, addr, PAGE_DIR_ENT_RDWR | PAGE_DIR_ENT_USER |
+					 PAGE_DIR_ENT_4MB);
+	ref = addr;
+	page_alloc_4MB(&ref);
+	if (page_dir_split_4MB(pd, 0x08400000) != -EBUSY){
+		printf("shared block split\n");
+		result = FAIL;
+	}
+	page_alloc_free_4MB(addr);
+	if (page_dir_split_4MB(pd, 0x08400000)){
+		printf("split failed\n");
+		result = FAIL;
+	}
+	pte = page_dir_get_pte(pd, 0x08400000);
+	if (!pte || (pte[5] & ~0xFFF) != addr + 5 * 0x1000 || !(pte[5] & PAGE_TAB_ENT_RDWR)){
+		printf("bad page table entry\n");
+		result = FAIL;
+	}
+	if (get_phys_mem_reference_count(addr + 5 * 0x1000) != 1){
+		printf("frame not counted\n");
+		result = FAIL;
+	}
+	for (i = 0; i < 1024; i++){
+		page_alloc_free_4KB(addr + i * 0x1000);
+	}
+	page_dir_unmap_table(pd, 0x08400000);
+	page_dir_destroy(pd);
+	page_alloc_get_stats(&after);
+	if (after.free_frames != before.free_frames){
+		printf("frames leaked\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	page_cache_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Sharing, invalidating and reclaiming cached file pages
+ */
+int page_cache_test(){
+	TEST_HEADER;
+
+	inode_t inode;
+	int addr = 0;
+	int result = PASS;
+
+	memset(&inode, 0, sizeof(inode));
+	inode.ino = -1;
+	inode.size = 0x2000;
+	if (page_alloc_4KB(&addr) || page_cache_add(&inode, 0x1000, 0, 0x800, addr)){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	if (page_cache_find(&inode, 0x1000, 0x10, 0x800) != 0){
+		printf("bounds ignored\n");
+		result = FAIL;
+	}
+	if (page_cache_find(&inode, 0x1000, 0, 0x800) != (uint32_t)addr ||
+		get_phys_mem_reference_count(addr) != 3){
+		printf("page not shared\n");
+		result = FAIL;
+	}
+	page_alloc_free_4KB(addr);
+	// only the cache holds the frame now
+	page_alloc_free_4KB(addr);
+	if (page_cache_reclaim(0x7FFFFFFF) < 1 || get_phys_mem_reference_count(addr) != 0){
+		printf("page not reclaimed\n");
+		result = FAIL;
+	}
+	if (page_cache_find(&inode, 0x1000, 0, 0x800) != 0){
+		printf("reclaimed page found\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	kmalloc_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Splitting and merging heap blocks, page runs
+ */
+int kmalloc_test(){
+	TEST_HEADER;
+
+	void *a, *b, *c, *run;
+	int result = PASS;
+	kmalloc_stats_t before, after;
+
+	kmalloc_stats(&before);
+	a = kmalloc(3000);
+	b = kmalloc(3000);
+	c = kmalloc(3000);
+	run = kmalloc(3 * 4096 + 1);
+	if (!a || !b || !c || !run){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	if (((uint32_t)a | (uint32_t)b | (uint32_t)c) % KMEM_ALIGN){
+		printf("misaligned block\n");
+		result = FAIL;
+	}
+	memset(run, 0xAB, 3 * 4096 + 1);
+	kmalloc_stats(&after);
+	if (after.run_pages != before.run_pages + 4){
+		printf("page run not mapped\n");
+		result = FAIL;
+	}
+	// free the middle block last so that it merges with both neighbours
+	if (kfree(a) || kfree(c) || kfree(b) || kfree(run)){
+		printf("free failed\n");
+		result = FAIL;
+	}
+	if (kfree(b) != -EINVAL){
+		printf("double free accepted\n");
+		result = FAIL;
+	}
+	kmalloc_stats(&after);
+	if (after.used_bytes != before.used_bytes || after.free_blocks != before.free_blocks ||
+		after.largest_free != before.largest_free || after.run_pages != before.run_pages){
+		printf("blocks not merged\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	Read the time stamp counter, low 32 bits
+ */
+static uint32_t tlb_test_tsc(){
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return lo;
+}
+
+/**
+ *	tlb_flush_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: Prints the cost of full and single page TLB flushes
+ *		Coverage: Global kernel mappings are remapped with invlpg
+ */
+int tlb_flush_test(){
+	TEST_HEADER;
+
+	int frame[2] = {0, 0};
+	volatile int *page;
+	uint32_t start, full, single;
+	int i, result = PASS;
+
+	if (page_alloc_4KB(frame) || page_alloc_4KB(frame + 1)){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	// the slot of the first frame is reused for the second one
+	for (i = 0; i < 2 && result == PASS; i++){
+		page = kmem_map_frame(frame[i]);
+		if (!page){
+			result = FAIL;
+			break;
+		}
+		*page = i + 391;
+		if (*page != i + 391){
+			printf("stale translation of a remapped page\n");
+			result = FAIL;
+		}
+		kmem_unmap_frame((void *)page);
+	}
+	page_alloc_free_4KB(frame[0]);
+	page_alloc_free_4KB(frame[1]);
+
+	// each flush is followed by a walk to reload the kernel page
+	start = tlb_test_tsc();
+	for (i = 0; i < 64; i++){
+		page_flush_tlb_global();
+		*(volatile int *)&tlb_test_tsc;
+	}
+	full = (tlb_test_tsc() - start) / 64;
+	start = tlb_test_tsc();
+	for (i = 0; i < 64; i++){
+		page_flush_tlb_page((uint32_t)&tlb_test_tsc);
+		*(volatile int *)&tlb_test_tsc;
+	}
+	single = (tlb_test_tsc() - start) / 64;
+	printf("tlb flush: full %u cycles, invlpg %u cycles\n", full, single);
+	return result;
+}
+
+/**
+ *	zram_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Compressing a page into zram and reading it back
+ */
+int zram_test(){
+	TEST_HEADER;
+
+	int src = 0, dst = 0, handle, i;
+	uint8_t *page;
+	int result = PASS;
+
+	if (page_alloc_4KB(&src) || page_alloc_4KB(&dst) || !(page = kmem_map_frame(src))){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	for (i = 0; i < (4<<10); i++){
+		page[i] = (i % 100 < 10) ? i : 'z';
+	}
+	kmem_unmap_frame(page);
+	handle = zram_store(src);
+	if (handle < 0 || zram_load(handle, dst) != 0){
+		printf("page not stored\n");
+		result = FAIL;
+	} else if ((page = kmem_map_frame(dst))){
+		for (i = 0; i < (4<<10); i++){
+			if (page[i] != ((i % 100 < 10) ? i : 'z')){
+				printf("page corrupted at %d\n", i);
+				result = FAIL;
+				break;
+			}
+		}
+		kmem_unmap_frame(page);
+	}
+	if (handle >= 0){
+		zram_release(handle);
+	}
+	page_alloc_free_4KB(src);
+	page_alloc_free_4KB(dst);
+	return result;
+}
+
+/**
+ *	mem_bandwidth_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: Prints the cost of the memcpy and memset variants
+ *		Coverage: Non-temporal copies match rep movsl ones
+ */
+int mem_bandwidth_test(){
+	TEST_HEADER;
+
+	const uint32_t size = 1 << 20;
+	uint8_t *src, *dst;
+	uint32_t start, movs, nt, stos, ntset, i;
+	int result = PASS;
+
+	src = kmalloc(size);
+	dst = kmalloc(size + 4);
+	if (!src || !dst){
+		printf("allocation failed\n");
+		kfree(src);
+		kfree(dst);
+		return FAIL;
+	}
+	for (i = 0; i < size; i++){
+		src[i] = i * 7 + 3;
+	}
+	if (!mem_nt_enabled()){
+		printf("no SSE2, non-temporal variants not used\n");
+	} else {
+		// unaligned destination and odd length exercise the edges
+		memset(dst, 0, size + 4);
+		memcpy_nt(dst + 1, src, size - 3);
+		if (dst[0] != 0 || memcmp(dst + 1, src, size - 3) != 0 || dst[size - 2] != 0){
+			printf("non-temporal copy corrupted\n");
+			result = FAIL;
+		}
+	}
+
+	start = tlb_test_tsc();
+	memcpy_movs(dst, src, size);
+	movs = tlb_test_tsc() - start;
+	start = tlb_test_tsc();
+	memset_stos(dst, 0, size);
+	stos = tlb_test_tsc() - start;
+	nt = ntset = 0;
+	if (mem_nt_enabled()){
+		start = tlb_test_tsc();
+		memcpy_nt(dst, src, size);
+		nt = tlb_test_tsc() - start;
+		start = tlb_test_tsc();
+		memset_nt(dst, 0, size);
+		ntset = tlb_test_tsc() - start;
+	}
+	printf("cycles/KB: memcpy movs %u nt %u, memset stos %u nt %u\n",
+		   movs >> 10, nt >> 10, stos >> 10, ntset >> 10);
+	kfree(src);
+	kfree(dst);
+	return result;
+}
+
+/**
+ *	run_queue_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: Tasks join and leave the run queue as their status and
+ *				  signals change, and change level with their nice value
+ */
+int run_queue_test(){
+	TEST_HEADER;
+
+	task_t *a = NULL, *b = NULL, *init = task_list;
+	int i, result = PASS;
+
+	for (i = 1; i < TASK_MAX_PROC && !b; i++){
+		if (task_list[i].status != TASK_ST_NA){
+			continue;
+		}
+		if (!a){
+			a = task_list + i;
+		} else {
+			b = task_list + i;
+		}
+	}
+	if (!b || init->rq_next != init){
+		printf("no free slots, or the queue is not only the init task\n");
+		return FAIL;
+	}
+	a->nice = b->nice = init->nice;
+	a->status = TASK_ST_RUNNING;
+	scheduler_update(a);
+	b->status = TASK_ST_SLEEP;
+	b->signals = 0;
+	b->signal_mask = 0;
+	scheduler_update(b);
+	if (init->rq_next != a || a->rq_next != init || b->rq_next){
+		printf("sleeping task queued\n");
+		result = FAIL;
+	}
+	sigaddset(&(b->signals), SIGCHLD);
+	scheduler_update(b);
+	if (a->rq_next != b || b->rq_next != init || init->rq_prev != b){
+		printf("signaled task not queued last\n");
+		result = FAIL;
+	}
+	scheduler_set_nice(a, SCHEDULER_NICE_MAX);
+	if (a->rq_level <= init->rq_level || init->rq_next != b || a->rq_next != a){
+		printf("niced task not moved to a lower level\n");
+		result = FAIL;
+	}
+	a->status = b->status = TASK_ST_NA;
+	b->signals = 0;
+	scheduler_update(a);
+	scheduler_update(b);
+	if (init->rq_next != init || init->rq_prev != init || a->rq_next || b->rq_next){
+		printf("released tasks left queued\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	wait_queue_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: wake_up puts sleeping tasks back on the run queue, and
+ *				  ignored signals do not interrupt a wait
+ */
+int wait_queue_test(){
+	TEST_HEADER;
+
+	task_t *a = NULL, *init = task_list;
+	wait_queue_t wq;
+	int i, result = PASS;
+
+	for (i = 1; i < TASK_MAX_PROC && !a; i++){
+		if (task_list[i].status == TASK_ST_NA){
+			a = task_list + i;
+		}
+	}
+	if (!a || init->rq_next != init){
+		printf("no free slots, or the queue is not only the init task\n");
+		return FAIL;
+	}
+	a->nice = init->nice;
+	a->signals = 0;
+	a->signal_mask = 0;
+	a->status = TASK_ST_SLEEP;
+	a->wq = &wq;
+	a->wq_next = NULL;
+	wq.head = a;
+	scheduler_update(a);
+	if (!wait_queue_active(&wq) || a->rq_next){
+		printf("waiting task queued\n");
+		result = FAIL;
+	}
+	wake_up(&wq);
+	if (wait_queue_active(&wq) || a->wq || a->status != TASK_ST_RUNNING ||
+		init->rq_next != a){
+		printf("woken task not queued\n");
+		result = FAIL;
+	}
+	a->sigacts[SIGCHLD].handler = SIG_DFL;
+	a->sigacts[SIGTERM].handler = SIG_DFL;
+	sigaddset(&(a->signals), SIGCHLD);
+	if (signal_pending(a) || a->signals){
+		printf("ignored signal kept pending\n");
+		result = FAIL;
+	}
+	sigaddset(&(a->signals), SIGTERM);
+	if (!signal_pending(a)){
+		printf("signal not pending\n");
+		result = FAIL;
+	}
+	a->signals = 0;
+	a->status = TASK_ST_NA;
+	scheduler_update(a);
+	return result;
+}
+
+/**
+ *	timer_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: timers on different levels of the wheel are armed, report
+ *				  their remaining time, and are cancelled independently
+ */
+static void timer_test_func(ktimer_t *timer){
+}
+
+int timer_test(){
+	TEST_HEADER;
+
+	ktimer_t timers[3];
+	uint32_t delays[3] = {100, 1000, 100000};
+	uint32_t left, flags;
+	int i, result = PASS;
+
+	// Keep the timers from firing during the test
+	cli_and_save(flags);
+	memset(timers, 0, sizeof(timers));
+	for (i = 0; i < 3; i++){
+		timers[i].func = &timer_test_func;
+		timer_add(timers + i, delays[i]);
+	}
+	for (i = 0; i < 3; i++){
+		left = timer_remaining(timers + i);
+		if (!timer_pending(timers + i) || left > delays[i] || left + 5 < delays[i]){
+			printf("timer %d: %u ticks left, expected %u\n", i, left, delays[i]);
+			result = FAIL;
+		}
+	}
+	if (!timer_cancel(timers + 1) || timer_cancel(timers + 1) ||
+		timer_pending(timers + 1) || !timer_pending(timers + 2)){
+		printf("cancel failed\n");
+		result = FAIL;
+	}
+	timer_add(timers + 2, 5);
+	if (timer_remaining(timers + 2) > 5){
+		printf("timer not moved\n");
+		result = FAIL;
+	}
+	timer_cancel(timers);
+	timer_cancel(timers + 2);
+	restore_flags(flags);
+	return result;
+}
+
+/**
+ *	clock_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: the monotonic clock moves forward and agrees with the timer
+ *				  ticks, the realtime clock is past 2020
+ */
+int clock_test(){
+	TEST_HEADER;
+
+	struct timespec mono, real;
+	uint64_t start, ns;
+	uint32_t ticks;
+	int result = PASS;
+
+	start = clock_monotonic_ns();
+	ticks = timer_now();
+	while (timer_now() - ticks < 2 * TIMER_HZ / 100);
+	ns = clock_monotonic_ns() - start;
+	// 20 ms of ticks, within a tick of PIT reads either way
+	if (ns < 18000000 || ns > 22000000){
+		printf("%u ns elapsed in 20 ms of ticks\n", (uint32_t)ns);
+		result = FAIL;
+	}
+	if (syscall_clock_gettime(CLOCK_MONOTONIC, (int)&mono, 0) ||
+		syscall_clock_gettime(CLOCK_REALTIME, (int)&real, 0) ||
+		syscall_clock_gettime(-1, (int)&real, 0) != -EINVAL){
+		printf("clock_gettime failed\n");
+		result = FAIL;
+	}
+	if (mono.tv_nsec >= 1000000000 || real.tv_sec < 1577836800){
+		// printf has no field width, print the nanoseconds on their own
+		printf("bad time %d s %d ns, epoch %d\n", mono.tv_sec, mono.tv_nsec, real.tv_sec);
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	workqueue_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: work items are queued once, in order, and cancelled from
+ *				  any position. The queue has no worker, nothing runs.
+ */
+int workqueue_test(){
+	TEST_HEADER;
+
+	workqueue_t wq;
+	work_t works[3];
+	int i, result = PASS;
+
+	memset(&wq, 0, sizeof(wq));
+	memset(works, 0, sizeof(works));
+	for (i = 0; i < 3; i++){
+		if (queue_work(&wq, works + i) != 1 || !work_pending(works + i)){
+			result = FAIL;
+		}
+	}
+	if (queue_work(&wq, works + 1) != 0 || wq.head != works ||
+		works[0].next != works + 1 || wq.tail != works + 2){
+		printf("bad queue order\n");
+		result = FAIL;
+	}
+	if (cancel_work(works + 2) != 1 || cancel_work(works + 2) != 0 ||
+		wq.tail != works + 1 || works[1].next != NULL){
+		printf("cancel of the last item failed\n");
+		result = FAIL;
+	}
+	if (cancel_work(works) != 1 || wq.head != works + 1 ||
+		cancel_work(works + 1) != 1 || wq.head || wq.tail){
+		printf("cancel failed\n");
+		result = FAIL;
+	}
+	return result;
+}
+
+/**
+ *	cow_kernel_write_test
+ *		Inputs: None
+ *		Outputs: Pass/Fail
+ *		Side Effects: None
+ *		Coverage: a kernel write to a copy-on-write user page faults, gets a
+ *				  private copy of the page, and leaves the user registers of
+ *				  the task alone
+ */
+int cow_kernel_write_test(){
+	TEST_HEADER;
+
+	task_t *proc = task_list + task_current_pid();
+	page_directory_t *prev_pd = page_dir_current();
+	uint32_t vaddr = 0xB0000000, flags;
+	volatile uint32_t *page;
+	int frame = 0, ref, i, result = PASS;
+	regs_t saved;
+
+	if (page_alloc_4KB(&frame)){
+		printf("allocation failed\n");
+		return FAIL;
+	}
+	page = kmem_map_frame(frame);
+	if (!page){
+		page_alloc_free_4KB(frame);
+		return FAIL;
+	}
+	*page = 391;
+	kmem_unmap_frame((void *)page);
+	// Shared with a second owner, the write has to copy it
+	ref = frame;
+	page_alloc_4KB(&ref);
+
+	cli_and_save(flags);
+	page_dir_switch(proc->pd);
+	i = task_pages_reserve(proc, 1);
+	if (i < 0){
+		page_dir_switch(prev_pd);
+		restore_flags(flags);
+		page_alloc_free_4KB(frame);
+		page_alloc_free_4KB(frame);
+		return FAIL;
+	}
+	proc->pages[i].vaddr = vaddr;
+	proc->pages[i].paddr = frame;
+	proc->pages[i].pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_USER;
+	proc->pages[i].priv_flags = TASK_PTENT_CPONWR;
+	page_dir_map_4KB(proc->pd, vaddr, frame, PAGE_TAB_ENT_PRESENT | PAGE_TAB_ENT_USER);
+	page_flush_tlb_page(vaddr);
+	memset(&proc->regs, 0, sizeof(regs_t));
+	proc->regs.cs = USER_CS;
+	proc->regs.esp = 0x83FFFFC;
+	memcpy(&saved, &proc->regs, sizeof(regs_t));
+
+	*(volatile uint32_t *)vaddr += 1;
+
+	if (*(volatile uint32_t *)vaddr != 392 || proc->pages[i].paddr == (uint32_t)frame ||
+		!(proc->pages[i].pt_flags & PAGE_DIR_ENT_RDWR)){
+		printf("page not copied on write\n");
+		result = FAIL;
+	}
+	if (memcmp(&saved, &proc->regs, sizeof(regs_t))){
+		printf("user registers replaced by the kernel fault\n");
+		result = FAIL;
+	}
+	page_alloc_free_4KB(proc->pages[i].paddr);
+	page_dir_unmap(proc->pd, vaddr);
+	page_dir_unmap_table(proc->pd, vaddr);
+	page_flush_tlb_page(vaddr);
+	task_pages_remove(proc, i);
+	page_dir_switch(prev_pd);
+	restore_flags(flags);
+	// The other owner's frame is untouched
+	page = kmem_map_frame(frame);
+	if (page && *page != 391){
+		printf("shared frame modified\n");
+		result = FAIL;
+	}
+	if (page){
+		kmem_unmap_frame((void *)page);
+	}
+	page_alloc_free_4KB(frame);
+	return result;
+}
+
 /**
  *	Test IDT by triggering a division error
  *
@@ -488,6 +1269,61 @@ cleanup:
 	return ret;
 }
 
+int fork_fail_test(){
+	TEST_HEADER;
+
+	task_t *proc = task_list + task_current_pid();
+	page_directory_t *pds[PAGE_DIR_MAX];
+	kmem_cache_t *wd_cache = kmem_cache_of(proc->wd);
+	int open_count[TASK_MAX_OPEN_FILES];
+	uint32_t wds;
+	int i, n, unused = 0, ret, result = PASS;
+
+	for (i = 0; i < TASK_MAX_PROC; ++i){
+		if (task_list[i].status == TASK_ST_NA)
+			unused++;
+	}
+	for (i = 0; i < TASK_MAX_OPEN_FILES; ++i){
+		open_count[i] = proc->files[i] ? proc->files[i]->open_count : 0;
+	}
+	wds = wd_cache ? wd_cache->nr_active : 0;
+
+	// take every page directory, the fork fails after its kernel stack
+	for (n = 0; n < PAGE_DIR_MAX; ++n){
+		pds[n] = page_dir_create();
+		if (!pds[n])
+			break;
+	}
+	ret = task_fork(proc);
+	while (n--){
+		page_dir_destroy(pds[n]);
+	}
+
+	if (ret != -ENOMEM){
+		printf("fork without a page directory returned %d\n", ret);
+		return FAIL;
+	}
+	for (i = 0; i < TASK_MAX_PROC; ++i){
+		if (task_list[i].status == TASK_ST_NA)
+			unused--;
+	}
+	if (unused){
+		printf("failed fork kept its pid\n");
+		result = FAIL;
+	}
+	for (i = 0; i < TASK_MAX_OPEN_FILES; ++i){
+		if (proc->files[i] && proc->files[i]->open_count != open_count[i]){
+			printf("failed fork kept a reference to fd %d\n", i);
+			result = FAIL;
+		}
+	}
+	if (wd_cache && wd_cache->nr_active != wds){
+		printf("failed fork kept its working directory\n");
+		result = FAIL;
+	}
+	return result;
+}
+
 int brk_test(){
 	// mock up a virtual task to run
 	task_t* proc = task_list;
@@ -560,24 +1396,45 @@ int brk_test(){
 		return FAIL;
 	}
 
-	// this should increase program break by 40MB
-	syscall_sbrk(0x2800000, 0, 0);
-	if ( task_list->heap.prog_break != (0xA0000000 + 0x2800000)){
+	// a region brk did not reserve, say an mmap, stops the heap
+	proc->pages[0].vaddr = 0xA0800000;
+	proc->pages[0].paddr = 0;
+	proc->pages[0].pt_flags = PAGE_DIR_ENT_PRESENT | PAGE_DIR_ENT_4MB;
+	proc->pages[0].priv_flags = TASK_PTENT_PGTAB | TASK_PTENT_MMAP;
+	if (syscall_sbrk(0xC00000, 0, 0) != (-1) || task_list->heap.prog_break != 0xA0000000){
+		printf("sbrk over other region fail\n");
+		return FAIL;
+	}
+	if (proc->pages[0].vaddr != 0xA0800000 || proc->pages[0].priv_flags != (TASK_PTENT_PGTAB | TASK_PTENT_MMAP)){
+		printf("sbrk over other region modified it\n");
+		return FAIL;
+	}
+	proc->pages[0].pt_flags = 0;
+	proc->pages[0].priv_flags = 0;
+
+	// this should increase program break by 40MB, all the heap there is
+	syscall_sbrk(TASK_MAX_HEAP, 0, 0);
+	if ( task_list->heap.prog_break != (0xA0000000 + TASK_MAX_HEAP)){
 		printf("sbrk increase to 40MB program break fail\n");
 		return FAIL;
 	}
+	// one more byte is over the limit
+	if (syscall_sbrk(1, 0, 0) != (-1)){
+		printf("sbrk over TASK_MAX_HEAP fail\n");
+		return FAIL;
+	}
 	// error intended to trigger ENOMEN, by increasing 1GB
 	if (syscall_sbrk(0x40000000, 0, 0) != (-1)){
 		printf("sbrk trigger ENOMEM fail\n");
 		return FAIL;
 	}
-	if ( task_list->heap.prog_break != (0xA0000000 + 0x4000000)){
+	if ( task_list->heap.prog_break != (0xA0000000 + TASK_MAX_HEAP)){
 		printf("sbrk trigger ENOMEM and retain fail\n");
 		return FAIL;
 	}
 
 	// all right all right clear all
-	syscall_sbrk(-0x4000000, 0, 0);
+	syscall_sbrk(-TASK_MAX_HEAP, 0, 0);
 	if ( task_list->heap.prog_break != (0xA0000000)){
 		printf("sbrk clear all fail\n");
 		return FAIL;
@@ -680,8 +1537,23 @@ void launch_tests() {
 	//TEST_OUTPUT("syscall_devfs_stdout_test", test_stdio_with_fd());
 
 	TEST_OUTPUT("paging test",paging_test());
+	TEST_OUTPUT("buddy test", buddy_test());
+	TEST_OUTPUT("page directory test", page_dir_test());
+	TEST_OUTPUT("page split test", page_split_test());
+	TEST_OUTPUT("page cache test", page_cache_test());
+	TEST_OUTPUT("kmalloc test", kmalloc_test());
+	TEST_OUTPUT("zram test", zram_test());
+	TEST_OUTPUT("tlb flush test", tlb_flush_test());
+	TEST_OUTPUT("mem bandwidth test", mem_bandwidth_test());
+	TEST_OUTPUT("run queue test", run_queue_test());
+	TEST_OUTPUT("wait queue test", wait_queue_test());
+	TEST_OUTPUT("timer test", timer_test());
+	TEST_OUTPUT("clock test", clock_test());
+	TEST_OUTPUT("workqueue test", workqueue_test());
 	TEST_OUTPUT("rtc_test_2", rtc_test_2());
 	//TEST_OUTPUT("paging test",paging_test()); 	DO NOT RUN THIS TEST!
+	TEST_OUTPUT("cow kernel write test", cow_kernel_write_test());
+	TEST_OUTPUT("fork fail test", fork_fail_test());
 	TEST_OUTPUT("brk test", brk_test());
 
 	// IDT tests
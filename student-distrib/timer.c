@@ -0,0 +1,236 @@
+#include "timer.h"
+
+#include "pit.h"
+#include "lib.h"
+#include "errno.h"
+#include "proc/task.h"
+#include "proc/wait_queue.h"
+#include "proc/signal.h"
+
+#define TIMER_MASK		(TIMER_SLOTS - 1)
+
+static ktimer_t *timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint32_t timer_jiffies = 0;	// next tick the wheel runs the timers of
+static uint32_t timer_clock = 0;	// ticks elapsed when the PIT was last read
+static uint32_t timer_residue = 0;	// PIT cycles times TIMER_HZ short of a tick
+static uint32_t timer_next = 0;		// tick the PIT is programmed to fire at
+static int timer_started = 0;		// the PIT is running in one-shot mode
+static int timer_in_interrupt = 0;	// expired timers are being run
+
+/**
+ *	Link a timer in the slot of its expiry, relative to the wheel position
+ */
+static void timer_link(ktimer_t *timer) {
+	uint32_t delta;
+	ktimer_t **slot;
+	int level;
+
+	if ((int32_t)(timer->expires - timer_jiffies) < 0) {
+		// Overdue, runs with the next tick of the wheel
+		timer->expires = timer_jiffies;
+	}
+	delta = timer->expires - timer_jiffies;
+	for (level = 0; level < TIMER_LEVELS - 1; level++) {
+		if (delta < (1U << (TIMER_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = &timer_wheel[level][(timer->expires >> (TIMER_BITS * level)) & TIMER_MASK];
+	timer->next = *slot;
+	if (*slot) {
+		(*slot)->pprev = &timer->next;
+	}
+	*slot = timer;
+	timer->pprev = slot;
+}
+
+/**
+ *	Move the timers of the current slot of a level down the wheel
+ *
+ *	@return the index of the slot
+ */
+static uint32_t timer_cascade(int level) {
+	uint32_t index = (timer_jiffies >> (TIMER_BITS * level)) & TIMER_MASK;
+	ktimer_t *timer, *next;
+
+	timer = timer_wheel[level][index];
+	timer_wheel[level][index] = NULL;
+	for (; timer; timer = next) {
+		next = timer->next;
+		timer_link(timer);
+	}
+	return index;
+}
+
+/**
+ *	Run the timers of every tick up to the clock
+ *
+ *	Cascades as soon as the wheel reaches a new round of level 0, so that
+ *	level 0 always holds every timer due before the next cascade.
+ */
+static void timer_run() {
+	uint32_t index;
+	ktimer_t *timer;
+	int level;
+
+	while ((int32_t)(timer_clock - timer_jiffies) >= 0) {
+		index = timer_jiffies & TIMER_MASK;
+		while ((timer = timer_wheel[0][index])) {
+			timer_wheel[0][index] = timer->next;
+			if (timer->next) {
+				timer->next->pprev = &timer_wheel[0][index];
+			}
+			timer->next = NULL;
+			timer->pprev = NULL;
+			(*timer->func)(timer);
+		}
+		timer_jiffies++;
+		if (!(timer_jiffies & TIMER_MASK)) {
+			for (level = 1; level < TIMER_LEVELS && !timer_cascade(level); level++);
+		}
+	}
+}
+
+/**
+ *	Add the PIT cycles elapsed since it was programmed to the clock
+ *
+ *	@note the PIT must be programmed again afterwards
+ */
+static void timer_sync() {
+	timer_residue += pit_elapsed() * TIMER_HZ;
+	timer_clock += timer_residue / PIT_FREQ;
+	timer_residue %= PIT_FREQ;
+}
+
+/**
+ *	Program the PIT for the first tick with timers to run, or for the next
+ *	cascade, whichever comes first
+ */
+static void timer_program() {
+	uint32_t index, i, counts;
+	int32_t ticks;
+
+	index = timer_jiffies & TIMER_MASK;
+	for (i = index; i < TIMER_SLOTS && !timer_wheel[0][i]; i++);
+	ticks = (int32_t)(timer_jiffies - index + i - timer_clock);
+	if (ticks > (int32_t)(PIT_COUNT_MAX * TIMER_HZ / PIT_FREQ)) {
+		ticks = PIT_COUNT_MAX * TIMER_HZ / PIT_FREQ + 1;
+	}
+	if (ticks <= 0) {
+		// Overdue, fire as soon as possible
+		counts = 0;
+	} else {
+		counts = (ticks * PIT_FREQ - timer_residue + TIMER_HZ - 1) / TIMER_HZ;
+	}
+	counts = pit_oneshot(counts);
+	timer_next = timer_clock + (timer_residue + counts * TIMER_HZ) / PIT_FREQ;
+}
+
+void timer_init() {
+	pit_init();
+	timer_started = 1;
+	timer_program();
+}
+
+void timer_add(ktimer_t *timer, uint32_t ticks) {
+	timer_cancel(timer);
+	if (ticks == 0) {
+		ticks = 1;
+	} else if (ticks > TIMER_MAX_DELAY) {
+		ticks = TIMER_MAX_DELAY;
+	}
+	timer->expires = timer_now() + ticks;
+	timer_link(timer);
+	if (timer_started && !timer_in_interrupt &&
+		(int32_t)(timer->expires - timer_next) < 0) {
+		// Fires before the programmed interrupt
+		timer_sync();
+		timer_program();
+	}
+}
+
+int timer_cancel(ktimer_t *timer) {
+	if (!timer->pprev) {
+		return 0;
+	}
+	*(timer->pprev) = timer->next;
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+	return 1;
+}
+
+int timer_pending(ktimer_t *timer) {
+	return timer->pprev != NULL;
+}
+
+uint32_t timer_remaining(ktimer_t *timer) {
+	int32_t ticks;
+
+	if (!timer->pprev) {
+		return 0;
+	}
+	ticks = (int32_t)(timer->expires - timer_now());
+	return (ticks > 0) ? ticks : 0;
+}
+
+uint32_t timer_now() {
+	if (!timer_started || timer_in_interrupt) {
+		return timer_clock;
+	}
+	return timer_clock + (timer_residue + pit_elapsed() * TIMER_HZ) / PIT_FREQ;
+}
+
+void timer_interrupt() {
+	if (!timer_started) {
+		return;
+	}
+	timer_sync();
+	timer_in_interrupt = 1;
+	timer_run();
+	timer_in_interrupt = 0;
+	timer_program();
+}
+
+/**
+ *	Wake up the task sleeping in `timer_sleep`
+ */
+static void timer_sleep_expired(ktimer_t *timer) {
+	wake_up(&(task_list[timer->data].sleep_wait));
+}
+
+uint32_t timer_sleep(uint32_t ticks) {
+	task_t *proc = task_list + task_current_pid();
+	uint32_t left;
+
+	proc->sleep_timer.func = &timer_sleep_expired;
+	proc->sleep_timer.data = proc->pid;
+	timer_add(&(proc->sleep_timer), ticks);
+	while (timer_pending(&(proc->sleep_timer))) {
+		if (wait_queue_wait(&(proc->sleep_wait)) != 0) {
+			left = timer_remaining(&(proc->sleep_timer));
+			timer_cancel(&(proc->sleep_timer));
+			return left ? left : 1;
+		}
+	}
+	return 0;
+}
+
+int syscall_usleep(int usec, int b, int c) {
+	uint32_t ms;
+
+	if (usec < 0) {
+		return -EINVAL;
+	}
+	if (usec == 0) {
+		return 0;
+	}
+	ms = ((uint32_t)usec + 999) / 1000;
+	// One more tick, the current one is partly over
+	if (timer_sleep(TIMER_MS(ms) + 1)) {
+		signal_syscall_return(-EINTR);
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ *	@file timer.h
+ *
+ *	Kernel timers
+ *
+ *	Timers are kept on a hierarchical timer wheel. Level 0 has one slot per
+ *	tick for the next `TIMER_SLOTS` ticks, each next level has slots
+ *	`TIMER_SLOTS` times as long, and its timers are moved down a level
+ *	(cascaded) when the wheel reaches their slot. Adding and cancelling a
+ *	timer are O(1).
+ *
+ *	There is no periodic tick: the PIT is programmed in one-shot mode for the
+ *	next expiring timer, or for its longest period (about 55 ms) if none is
+ *	due before, to keep the clock running. The clock counts the PIT cycles
+ *	actually elapsed, so it does not drift when the PIT is reprogrammed.
+ *
+ *	Callbacks run in interrupt context, and must not block or call
+ *	`scheduler_event`.
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+#define TIMER_HZ		1024	///< Ticks per second
+#define TIMER_BITS		6		///< log2 of the slots per level
+#define TIMER_SLOTS		(1 << TIMER_BITS)	///< Slots per level
+#define TIMER_LEVELS	5		///< Levels of the wheel
+#define TIMER_MAX_DELAY	((1 << (TIMER_BITS * TIMER_LEVELS)) - 1)	///< Longest delay, in ticks
+
+/// Convert milliseconds to ticks, rounding up
+#define TIMER_MS(ms)	(((ms) * TIMER_HZ + 999) / 1000)
+
+/**
+ *	A kernel timer
+ *
+ *	A zero-filled `ktimer_t` is not pending.
+ */
+typedef struct s_timer {
+	uint32_t expires;			///< Tick at which it fires
+	void (*func)(struct s_timer *timer);	///< Called when it fires
+	uint32_t data;				///< Free for the owner of the timer
+	struct s_timer *next;		///< Next timer in the slot
+	struct s_timer **pprev;		///< Link pointing to it, NULL if not pending
+} ktimer_t;
+
+/**
+ *	Initialize the timer wheel, and start the PIT
+ */
+void timer_init();
+
+/**
+ *	Arm a timer, or move it if already pending
+ *
+ *	@param timer: the timer, `func` and `data` set
+ *	@param ticks: delay from now, at most `TIMER_MAX_DELAY`
+ */
+void timer_add(ktimer_t *timer, uint32_t ticks);
+
+/**
+ *	Disarm a timer
+ *
+ *	@param timer: the timer
+ *	@return 1 if it was pending, 0 otherwise
+ */
+int timer_cancel(ktimer_t *timer);
+
+/**
+ *	Check whether a timer is armed and has not fired yet
+ *
+ *	@param timer: the timer
+ *	@return 1 if pending, 0 otherwise
+ */
+int timer_pending(ktimer_t *timer);
+
+/**
+ *	Ticks left before a timer fires
+ *
+ *	@param timer: the timer
+ *	@return the ticks, or 0 if it is not pending
+ */
+uint32_t timer_remaining(ktimer_t *timer);
+
+/**
+ *	Current time
+ *
+ *	@return the ticks since `timer_init`, wraps around after about 48 days
+ */
+uint32_t timer_now();
+
+/**
+ *	Run expired timers and program the next interrupt, called by the PIT
+ *	interrupt handler
+ */
+void timer_interrupt();
+
+/**
+ *	Put the current task to sleep
+ *
+ *	@param ticks: ticks to sleep
+ *	@return 0, or the ticks left if a signal interrupted the sleep
+ */
+uint32_t timer_sleep(uint32_t ticks);
+
+/**
+ *	Sleep system call
+ *
+ *	@param usec: microseconds to sleep
+ *	@return 0, -EINVAL, or -EINTR if interrupted by a signal
+ */
+int syscall_usleep(int usec, int b, int c);
+
+#endif